@@ -0,0 +1,108 @@
+#!/bin/bash
+
+# Exit immediately if a command exits with a non-zero status
+set -e
+
+# Directory for huffpress.h and huffpress.cpp
+OUT_DIR="${1:-./build/amalgamation}"
+
+# Directories searched for quoted includes after the including file's own directory
+INCLUDE_DIRS=("./huffpress" "./huffpress/huffman" "./huffpress/checksum")
+
+# Public headers, in the order they go into huffpress.h
+HEADERS=(
+  "huffpress/huffman/huffman.h"
+  "huffpress/huffman/static_codec.h"
+  "huffpress/checksum/checksum.h"
+  "huffpress/transform.h"
+  "huffpress/lz77.h"
+  "huffpress/context.h"
+  "huffpress/huffpress.h"
+  "huffpress/mapped_file.h"
+  "huffpress/async.h"
+  "huffpress/cache.h"
+  "huffpress/archive.h"
+  "huffpress/blockfile.h"
+  "huffpress/cli/cli.h"
+)
+
+# Sources of libhuffman, libhuffchecksum, libhuffpress and libhuffpresscli
+SOURCES=(
+  "huffpress/checksum/checksum.c"
+  "huffpress/huffman/allocator.cpp"
+  "huffpress/huffman/huffman.cpp"
+  "huffpress/huffpress.cpp"
+  "huffpress/transform.cpp"
+  "huffpress/lz77.cpp"
+  "huffpress/context.cpp"
+  "huffpress/mapped_file.cpp"
+  "huffpress/async.cpp"
+  "huffpress/cache.cpp"
+  "huffpress/archive.cpp"
+  "huffpress/blockfile.cpp"
+  "huffpress/cli/cli.cpp"
+)
+
+# Files already inlined, by real path
+declare -A SEEN
+
+# Function to find a quoted include the way the compiler does
+resolve_include() {
+  local dir="$1" name="$2" candidate
+  for candidate in "$dir/$name" "${INCLUDE_DIRS[@]/%//$name}"; do
+    if [ -f "$candidate" ]; then
+      realpath "$candidate"
+      return
+    fi
+  done
+}
+
+# Function to copy a file, replacing each quoted include with the file itself the first time it is seen
+inline_file() {
+  local file="$1" dir line name path
+  dir=$(dirname "$file")
+  SEEN[$(realpath "$file")]=1
+  echo "// ---- $(realpath --relative-to=. "$file") ----"
+  while IFS= read -r line || [ -n "$line" ]; do
+    if [[ $line =~ ^[[:space:]]*#[[:space:]]*include[[:space:]]*\"([^\"]+)\" ]]; then
+      name="${BASH_REMATCH[1]}"
+      path=$(resolve_include "$dir" "$name")
+      if [ -z "$path" ]; then
+        echo "Cannot find $name included from $file" >&2
+        exit 1
+      fi
+      if [ -z "${SEEN[$path]}" ]; then
+        inline_file "$path"
+      fi
+    else
+      printf '%s\n' "$line"
+    fi
+  done < "$file"
+}
+
+mkdir -p "$OUT_DIR"
+
+# The amalgamated library is always static
+{
+  echo "// Amalgamated Huffpress header, generated by amalgamate.sh; do not edit"
+  echo "#ifndef HUFFPRESS_AMALGAMATED_H"
+  echo "#define HUFFPRESS_AMALGAMATED_H"
+  echo "#ifndef HUFFPRESS_STATIC"
+  echo "#define HUFFPRESS_STATIC"
+  echo "#endif"
+  for FILE in "${HEADERS[@]}"; do
+    inline_file "$FILE"
+  done
+  echo "#endif // HUFFPRESS_AMALGAMATED_H"
+} > "$OUT_DIR/huffpress.h"
+
+# Headers inlined above are not repeated in the source
+{
+  echo "// Amalgamated Huffpress source, generated by amalgamate.sh; do not edit"
+  echo "#include \"huffpress.h\""
+  for FILE in "${SOURCES[@]}"; do
+    inline_file "$FILE"
+  done
+} > "$OUT_DIR/huffpress.cpp"
+
+echo "Amalgamation written to $OUT_DIR"
@@ -1,8 +1,12 @@
 #include <huffpress/cli/cli.h>
 #include <unistd.h>
+#include <cstring>
 
 int main(int argc, char* argv[]) {
     Huffpress::HuffpressCLI cli;
+    if (argc > 1 && (std::strcmp(argv[1], "compress") == 0 || std::strcmp(argv[1], "decompress") == 0 || std::strcmp(argv[1], "append") == 0)) {
+        return cli.runStream(argc, argv);
+    }
     cli.runCombine(argc, argv);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <huffpress/daemon/daemon.h>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+    Huffpress::DaemonServer* server = nullptr;
+
+    void HandleSignal(int) {
+        if (server) server->Stop();
+    }
+
+    void Usage() {
+        std::cerr << "Usage: hpfd [-T workers] [-R request threads] [-C cached tables] <socket path>" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Huffpress::DaemonOptions options;
+    std::string socketPath;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 < argc && std::strcmp(argv[i], "-T") == 0) {
+            options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && std::strcmp(argv[i], "-R") == 0) {
+            options.requestThreads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && std::strcmp(argv[i], "-C") == 0) {
+            options.cachedTables = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (argv[i][0] != '-' && socketPath.empty()) {
+            socketPath = argv[i];
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+    if (socketPath.empty()) {
+        Usage();
+        return 1;
+    }
+
+    try {
+        Huffpress::DaemonServer daemon(socketPath, options);
+        server = &daemon;
+        std::signal(SIGINT, HandleSignal);
+        std::signal(SIGTERM, HandleSignal);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        std::cout << "hpfd listening on " << socketPath << std::endl;
+        daemon.Serve();
+        server = nullptr;
+
+        Huffpress::DaemonStats stats = daemon.Stats();
+        std::cout << "hpfd stopped after " << stats.requests << " requests on " << stats.connections << " connections ("
+                  << stats.errors << " errors, " << stats.tableHits << " table hits, " << stats.tableMisses << " table misses)" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,307 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "archive.h"
+#include "mapped_file.h"
+#include "bytes.h"
+
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+
+namespace Huffpress {
+
+    namespace {
+        // "HPA" and the library version open an archive, the trailer ends with "HPA" again
+        const char ArchiveMagic[3] = {'H', 'P', 'A'};
+        const size_t ArchiveHeaderSize = sizeof(ArchiveMagic) + sizeof(Version);
+        // Directory offset, directory size, directory checksum and the magic
+        const size_t ArchiveTrailerSize = 2 * sizeof(std::uint64_t) + sizeof(checksum_t) + sizeof(ArchiveMagic);
+
+        using Detail::Put;
+        using Detail::Take;
+
+        Huffman::ByteVector ArchiveHeader() {
+            Huffman::ByteVector header;
+            Put(header, ArchiveMagic);
+            Put(header, Version);
+            return header;
+        }
+
+        // Read the trailer and the central directory of an archive; returns the size of the archive
+        std::uint64_t ReadDirectory(std::istream& in, const std::string& filePath, std::vector<ArchiveEntry>& entries, std::map<std::string, size_t>& index) {
+            in.seekg(0, std::ios::end);
+            std::uint64_t fileSize = static_cast<std::uint64_t>(in.tellg());
+            if (!in || fileSize < ArchiveHeaderSize + ArchiveTrailerSize) {
+                throw Exceptions::DeserializationException(filePath + " is not an archive");
+            }
+
+            Huffman::ByteVector head(ArchiveHeaderSize), trailer(ArchiveTrailerSize);
+            in.seekg(0);
+            in.read(reinterpret_cast<char*>(head.data()), head.size());
+            in.seekg(static_cast<std::streamoff>(fileSize - ArchiveTrailerSize));
+            in.read(reinterpret_cast<char*>(trailer.data()), trailer.size());
+            if (!in || std::memcmp(head.data(), ArchiveMagic, sizeof(ArchiveMagic)) != 0
+                || std::memcmp(trailer.data() + trailer.size() - sizeof(ArchiveMagic), ArchiveMagic, sizeof(ArchiveMagic)) != 0) {
+                throw Exceptions::DeserializationException(filePath + " is not an archive");
+            }
+            if (head[sizeof(ArchiveMagic)] != Version[0]) {
+                throw Exceptions::DeserializationException("unsupported archive version");
+            }
+
+            size_t offset = 0;
+            std::uint64_t directoryOffset = 0, directorySize = 0;
+            checksum_t directoryChecksum = 0;
+            Take(trailer, offset, directoryOffset);
+            Take(trailer, offset, directorySize);
+            Take(trailer, offset, directoryChecksum);
+            if (directoryOffset < ArchiveHeaderSize || directorySize != fileSize - ArchiveTrailerSize - directoryOffset) {
+                throw Exceptions::DeserializationException("archive directory out of bounds");
+            }
+
+            Huffman::ByteVector directory(static_cast<size_t>(directorySize));
+            in.seekg(static_cast<std::streamoff>(directoryOffset));
+            in.read(reinterpret_cast<char*>(directory.data()), directory.size());
+            if (!in) {
+                throw Exceptions::DeserializationException("truncated archive directory");
+            }
+            if (checksum(reinterpret_cast<const char*>(directory.data()), directory.size()) != directoryChecksum) {
+                throw Exceptions::ChecksumMismatchException("archive directory");
+            }
+
+            offset = 0;
+            std::uint64_t count = 0;
+            if (!Take(directory, offset, count)) {
+                throw Exceptions::DeserializationException("truncated archive directory");
+            }
+            entries.clear();
+            index.clear();
+            for (std::uint64_t i = 0; i < count; ++i) {
+                ArchiveEntry entry;
+                std::uint32_t nameSize = 0;
+                if (!Take(directory, offset, nameSize) || directory.size() - offset < nameSize) {
+                    throw Exceptions::DeserializationException("truncated archive directory");
+                }
+                entry.name.assign(reinterpret_cast<const char*>(directory.data() + offset), nameSize);
+                offset += nameSize;
+                if (!Take(directory, offset, entry.offset) || !Take(directory, offset, entry.compressedSize)
+                    || !Take(directory, offset, entry.size) || !Take(directory, offset, entry.sourceChecksum)) {
+                    throw Exceptions::DeserializationException("truncated archive directory");
+                }
+                if (entry.offset < ArchiveHeaderSize || entry.compressedSize > directoryOffset - entry.offset || entry.offset > directoryOffset) {
+                    throw Exceptions::DeserializationException("archive entry " + entry.name + " out of bounds");
+                }
+                index[entry.name] = entries.size();
+                entries.push_back(std::move(entry));
+            }
+            return fileSize;
+        }
+    }
+
+    HUFFPRESS_API ArchiveWriter::ArchiveWriter(const std::string& filePath, bool append) : filePath_(filePath) {
+        if (append) {
+            std::ifstream existing(filePath, std::ios::binary);
+            if (existing) {
+                this->end_ = ReadDirectory(existing, filePath, this->entries_, this->index_);
+                existing.close();
+
+                this->out_.open(filePath, std::ios::binary | std::ios::in | std::ios::out);
+                if (!this->out_) {
+                    throw Exceptions::FileOpenException(filePath);
+                }
+                this->out_.seekp(static_cast<std::streamoff>(this->end_));
+                return;
+            }
+        }
+
+        this->out_.open(filePath, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!this->out_) {
+            throw Exceptions::FileOpenException(filePath);
+        }
+        Huffman::ByteVector header = ArchiveHeader();
+        this->out_.write(reinterpret_cast<const char*>(header.data()), header.size());
+        this->end_ = header.size();
+    }
+
+    HUFFPRESS_API ArchiveWriter::~ArchiveWriter() {
+        if (!this->finished_) {
+            try {
+                this->Finish();
+            } catch (...) {
+            }
+        }
+    }
+
+    HUFFPRESS_API void ArchiveWriter::Add(const std::string& name, const std::string& data, unsigned threads) {
+        if (this->index_.count(name)) {
+            throw std::invalid_argument("duplicate archive entry: " + name);
+        }
+        HuffpressFile file;
+        file.Init(data, threads);
+        this->Append(name, file, data.size());
+    }
+
+    HUFFPRESS_API void ArchiveWriter::AddFile(const std::string& name, const std::string& sourcePath, unsigned threads) {
+        if (this->index_.count(name)) {
+            throw std::invalid_argument("duplicate archive entry: " + name);
+        }
+        HuffpressFile file;
+        std::uint64_t size = file.Load(sourcePath, threads);
+        this->Append(name, file, size);
+    }
+
+    void ArchiveWriter::Append(const std::string& name, HuffpressFile& file, std::uint64_t size) {
+        if (this->finished_) {
+            throw Exceptions::SerializationException("archive " + this->filePath_ + " is already finished");
+        }
+
+        Huffman::ByteVector record;
+        file.SerializeToBuffer(record);
+        this->out_.write(reinterpret_cast<const char*>(record.data()), record.size());
+        if (!this->out_) {
+            throw Exceptions::SerializationException("failed to write " + this->filePath_);
+        }
+
+        ArchiveEntry entry;
+        entry.name = name;
+        entry.offset = this->end_;
+        entry.compressedSize = record.size();
+        entry.size = size;
+        entry.sourceChecksum = file.header.sourceChecksum;
+
+        this->end_ += record.size();
+        this->index_[name] = this->entries_.size();
+        this->entries_.push_back(std::move(entry));
+    }
+
+    HUFFPRESS_API void ArchiveWriter::Finish() {
+        if (this->finished_) return;
+        this->finished_ = true;
+
+        Huffman::ByteVector directory;
+        Put(directory, static_cast<std::uint64_t>(this->entries_.size()));
+        for (const ArchiveEntry& entry : this->entries_) {
+            Put(directory, static_cast<std::uint32_t>(entry.name.size()));
+            directory.insert(directory.end(), entry.name.begin(), entry.name.end());
+            Put(directory, entry.offset);
+            Put(directory, entry.compressedSize);
+            Put(directory, entry.size);
+            Put(directory, entry.sourceChecksum);
+        }
+
+        Huffman::ByteVector trailer;
+        Put(trailer, this->end_);
+        Put(trailer, static_cast<std::uint64_t>(directory.size()));
+        Put(trailer, checksum(reinterpret_cast<const char*>(directory.data()), directory.size()));
+        Put(trailer, ArchiveMagic);
+
+        this->out_.write(reinterpret_cast<const char*>(directory.data()), directory.size());
+        this->out_.write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+        this->out_.close();
+        if (!this->out_) {
+            throw Exceptions::SerializationException("failed to write " + this->filePath_);
+        }
+    }
+
+    HUFFPRESS_API ArchiveReader::ArchiveReader(const std::string& filePath, BlockCache* cache)
+        : filePath_(filePath), cache_(cache), fileId_(BlockCache::FileId(filePath)), in_(filePath, std::ios::binary) {
+        if (!this->in_) {
+            throw Exceptions::FileOpenException(filePath);
+        }
+        ReadDirectory(this->in_, filePath, this->entries_, this->index_);
+    }
+
+    HUFFPRESS_API const ArchiveEntry* ArchiveReader::Find(const std::string& name) const {
+        auto found = this->index_.find(name);
+        return found == this->index_.end() ? nullptr : &this->entries_[found->second];
+    }
+
+    HUFFPRESS_API std::string ArchiveReader::Extract(const std::string& name) const {
+        const ArchiveEntry* entry = this->Find(name);
+        if (!entry) {
+            throw Exceptions::EntryNotFoundException(name);
+        }
+        size_t index = static_cast<size_t>(entry - this->entries_.data());
+        if (this->cache_) {
+            std::shared_ptr<const std::string> cached = this->cache_->Find(this->fileId_, index, entry->sourceChecksum);
+            if (cached) return *cached;
+        }
+
+        Huffman::ByteVector record(static_cast<size_t>(entry->compressedSize));
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->in_.clear();
+            this->in_.seekg(static_cast<std::streamoff>(entry->offset));
+            this->in_.read(reinterpret_cast<char*>(record.data()), record.size());
+            if (!this->in_) {
+                throw Exceptions::DeserializationException("truncated archive entry " + name);
+            }
+        }
+        return this->Decode(index, record);
+    }
+
+    HUFFPRESS_API std::vector<std::string> ArchiveReader::ExtractAll(unsigned threads) const {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+        MappedFile mapped(this->filePath_);
+        std::vector<std::string> results(this->entries_.size());
+        std::atomic<size_t> next(0);
+        std::mutex mutex;
+        std::exception_ptr error;
+
+        Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+        auto worker = [this, &mapped, &results, &next, &mutex, &error, &allocator]() {
+            Huffman::AllocatorScope scope(allocator, false);
+            for (size_t i = next++; i < this->entries_.size(); i = next++) {
+                try {
+                    const ArchiveEntry& entry = this->entries_[i];
+                    if (this->cache_) {
+                        std::shared_ptr<const std::string> cached = this->cache_->Find(this->fileId_, i, entry.sourceChecksum);
+                        if (cached) {
+                            results[i] = *cached;
+                            continue;
+                        }
+                    }
+                    if (entry.offset + entry.compressedSize > mapped.Size()) {
+                        throw Exceptions::DeserializationException("truncated archive entry " + entry.name);
+                    }
+                    const Huffman::Byte* begin = mapped.Data() + entry.offset;
+                    results[i] = this->Decode(i, Huffman::ByteVector(begin, begin + entry.compressedSize));
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) error = std::current_exception();
+                    next = this->entries_.size();
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < std::min<size_t>(threads, this->entries_.size()); ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+
+        if (error) std::rethrow_exception(error);
+        return results;
+    }
+
+    std::string ArchiveReader::Decode(size_t index, const Huffman::ByteVector& record) const {
+        const ArchiveEntry& entry = this->entries_[index];
+        HuffpressFile file;
+        file.ParseFromBuffer(record);
+        if (file.header.sourceChecksum != entry.sourceChecksum) {
+            throw Exceptions::ChecksumMismatchException("directory record of " + entry.name);
+        }
+
+        std::string data = file.DecompressAndVerify();
+        if (data.size() != entry.size) {
+            throw Exceptions::DeserializationException("archive entry " + entry.name + " does not match its directory record");
+        }
+        if (this->cache_) this->cache_->Insert(this->fileId_, index, entry.sourceChecksum, data);
+        return data;
+    }
+} // Huffpress
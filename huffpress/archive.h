@@ -0,0 +1,95 @@
+#ifndef HUFFPRESS_ARCHIVE_H
+#define HUFFPRESS_ARCHIVE_H
+
+#include "export.h"
+
+#include "huffpress.h"
+#include "cache.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+namespace Huffpress {
+
+    // Central directory record of one archive entry
+    struct ArchiveEntry {
+        std::string name;
+        // Position of the entry's Huffpress file in the archive
+        std::uint64_t offset = 0;
+        // Size of the entry's Huffpress file (header and payload)
+        std::uint64_t compressedSize = 0;
+        // Size of the entry's data
+        std::uint64_t size = 0;
+        // Checksum of the entry's data, repeated from the entry's header
+        checksum_t sourceChecksum = 0;
+    };
+
+    // Writes a multi-entry archive: one complete Huffpress file per entry, then a central directory and a trailer
+    // Entries are written as they are added; the directory is written by Finish (or the destructor)
+    class HUFFPRESS_API ArchiveWriter
+    {
+    public:
+        // Create the archive, or with append keep the entries of an existing one and add more
+        // Appended entries go after the old directory, so the old archive stays readable until Finish
+        HUFFPRESS_API explicit ArchiveWriter(const std::string& filePath, bool append = false);
+        // Finish the archive if Finish was not called, ignoring errors
+        HUFFPRESS_API ~ArchiveWriter();
+
+        ArchiveWriter(const ArchiveWriter&) = delete;
+        ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+        // Compress data into a new entry (on up to `threads` threads); names must be unique
+        HUFFPRESS_API void Add(const std::string& name, const std::string& data, unsigned threads = 1);
+        // Compress a file on disk into a new entry through HuffpressFile::Load
+        HUFFPRESS_API void AddFile(const std::string& name, const std::string& sourcePath, unsigned threads = 0);
+        // Write the central directory and the trailer and close the archive
+        HUFFPRESS_API void Finish();
+
+        const std::vector<ArchiveEntry>& Entries() const { return entries_; }
+
+    private:
+        // Write the file as the next entry; size is the size of its source data
+        void Append(const std::string& name, HuffpressFile& file, std::uint64_t size);
+
+        std::string filePath_;
+        std::fstream out_;
+        std::uint64_t end_ = 0;
+        std::vector<ArchiveEntry> entries_;
+        std::map<std::string, size_t> index_;
+        bool finished_ = false;
+    };
+
+    // Reads a multi-entry archive; only the trailer and the central directory are read when it is opened
+    // Thread safety: all members may be called from any number of threads at once
+    class HUFFPRESS_API ArchiveReader
+    {
+    public:
+        // Open an archive (throws FileOpenException, DeserializationException or ChecksumMismatchException)
+        // With a cache, extracted entries are looked up there first and stored there after decoding
+        HUFFPRESS_API explicit ArchiveReader(const std::string& filePath, BlockCache* cache = nullptr);
+
+        const std::vector<ArchiveEntry>& Entries() const { return entries_; }
+        // Directory record of an entry, nullptr if there is none of that name
+        HUFFPRESS_API const ArchiveEntry* Find(const std::string& name) const;
+        // Decompress one entry with a single seek and read, checking its checksums (throws EntryNotFoundException)
+        HUFFPRESS_API std::string Extract(const std::string& name) const;
+        // Decompress every entry on up to `threads` threads (all hardware threads for 0), in the order of Entries()
+        HUFFPRESS_API std::vector<std::string> ExtractAll(unsigned threads = 0) const;
+
+    private:
+        std::string Decode(size_t index, const Huffman::ByteVector& record) const;
+
+        std::string filePath_;
+        BlockCache* cache_;
+        std::uint64_t fileId_;
+        mutable std::ifstream in_;
+        mutable std::mutex mutex_;
+        std::vector<ArchiveEntry> entries_;
+        std::map<std::string, size_t> index_;
+    };
+} // Huffpress
+#endif // HUFFPRESS_ARCHIVE_H
@@ -0,0 +1,128 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "async.h"
+
+#include <algorithm>
+
+namespace Huffpress {
+
+    namespace {
+        // Queue `job` on the executor, completing the task with its result, its exception or CancelledException
+        template <typename T, typename Job>
+        AsyncTask<T> Launch(AsyncExecutor& executor, const char* operation, Job job) {
+            std::shared_ptr<Detail::AsyncState<T>> state = std::make_shared<Detail::AsyncState<T>>();
+            executor.Post([state, operation, job]() mutable {
+                std::exception_ptr error;
+                try {
+                    if (state->cancelled) throw Exceptions::CancelledException(operation);
+                    job(*state);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                state->Finish(error);
+            });
+            return AsyncTask<T>(state);
+        }
+    }
+
+    HUFFPRESS_API AsyncExecutor::AsyncExecutor(unsigned workers, size_t capacity, Overflow overflow)
+        : capacity_(std::max<size_t>(1, capacity)), overflow_(overflow) {
+        if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < workers; ++i) {
+            this->workers_.emplace_back(&AsyncExecutor::Work, this);
+        }
+    }
+
+    HUFFPRESS_API AsyncExecutor::~AsyncExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->stopping_ = true;
+        }
+        this->hasJob_.notify_all();
+        for (std::thread& worker : this->workers_) {
+            worker.join();
+        }
+    }
+
+    HUFFPRESS_API void AsyncExecutor::Post(std::function<void()> job) {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        if (this->queue_.size() >= this->capacity_) {
+            if (this->overflow_ == Overflow::Throw) throw Exceptions::QueueFullException(this->capacity_);
+            this->hasRoom_.wait(lock, [this]() { return this->queue_.size() < this->capacity_; });
+        }
+        this->queue_.push_back(std::move(job));
+        lock.unlock();
+        this->hasJob_.notify_one();
+    }
+
+    HUFFPRESS_API bool AsyncExecutor::TryPost(std::function<void()> job) {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        if (this->queue_.size() >= this->capacity_) return false;
+        this->queue_.push_back(std::move(job));
+        lock.unlock();
+        this->hasJob_.notify_one();
+        return true;
+    }
+
+    HUFFPRESS_API size_t AsyncExecutor::Pending() const {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return this->queue_.size();
+    }
+
+    HUFFPRESS_API AsyncExecutor& AsyncExecutor::Default() {
+        static AsyncExecutor executor;
+        return executor;
+    }
+
+    void AsyncExecutor::Work() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->hasJob_.wait(lock, [this]() { return this->stopping_ || !this->queue_.empty(); });
+                if (this->queue_.empty()) return;
+                job = std::move(this->queue_.front());
+                this->queue_.pop_front();
+            }
+            this->hasRoom_.notify_one();
+
+            // Jobs report their own errors, anything that escapes must not take the worker down
+            try {
+                job();
+            } catch (...) {
+            }
+        }
+    }
+
+    HUFFPRESS_API AsyncTask<HuffpressFile> CompressAsync(std::string data, unsigned threads, AsyncExecutor& executor) {
+        std::shared_ptr<const std::string> source = std::make_shared<std::string>(std::move(data));
+        return Launch<HuffpressFile>(executor, "compression", [source, threads](Detail::AsyncState<HuffpressFile>& state) {
+            auto checkCancelled = [&state](const char*, size_t) {
+                if (state.cancelled) throw Exceptions::CancelledException("compression");
+            };
+            Detail::CompressInto(state.value, *source, threads, Huffman::TableMode::Exact, checkCancelled, checkCancelled);
+        });
+    }
+
+    HUFFPRESS_API AsyncTask<std::string> DecompressAsync(HuffpressFile file, unsigned threads, AsyncExecutor& executor) {
+        std::shared_ptr<HuffpressFile> shared = std::make_shared<HuffpressFile>(std::move(file));
+        return Launch<std::string>(executor, "decompression", [shared, threads](Detail::AsyncState<std::string>& state) {
+            if (threads > 1) {
+                state.value = shared->Decompress(threads);
+                return;
+            }
+
+            shared->Decode([&state](const char* chunk, size_t size) {
+                if (state.cancelled) throw Exceptions::CancelledException("decompression");
+                state.value.append(chunk, size);
+            });
+        });
+    }
+
+    HUFFPRESS_API AsyncTask<void> SerializeAsync(HuffpressFile file, std::string filePath, AsyncExecutor& executor) {
+        std::shared_ptr<HuffpressFile> shared = std::make_shared<HuffpressFile>(std::move(file));
+        return Launch<void>(executor, "serialization", [shared, filePath](Detail::AsyncState<void>&) {
+            shared->Serialize(filePath);
+        });
+    }
+} // Huffpress
@@ -0,0 +1,183 @@
+#ifndef HUFFPRESS_ASYNC_H
+#define HUFFPRESS_ASYNC_H
+
+#include "export.h"
+
+#include "huffpress.h"
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define HUFFPRESS_COROUTINES 1
+#endif
+#endif
+
+namespace Huffpress {
+
+    // Fixed pool of worker threads with a bounded job queue
+    // Submitting to a full queue blocks the caller or throws QueueFullException, depending on the overflow policy
+    class HUFFPRESS_API AsyncExecutor
+    {
+    public:
+        enum class Overflow { Block, Throw };
+
+        // Start `workers` threads (all hardware threads for 0) that take jobs from a queue of at most `capacity` jobs
+        HUFFPRESS_API explicit AsyncExecutor(unsigned workers = 0, size_t capacity = 64, Overflow overflow = Overflow::Block);
+        // Run the jobs still queued, then stop the workers
+        HUFFPRESS_API ~AsyncExecutor();
+
+        AsyncExecutor(const AsyncExecutor&) = delete;
+        AsyncExecutor& operator=(const AsyncExecutor&) = delete;
+
+        // Queue a job
+        HUFFPRESS_API void Post(std::function<void()> job);
+        // Queue a job unless the queue is full
+        HUFFPRESS_API bool TryPost(std::function<void()> job);
+        // Jobs waiting for a worker
+        HUFFPRESS_API size_t Pending() const;
+
+        // Executor shared by the async functions when none is given, created on first use
+        HUFFPRESS_API static AsyncExecutor& Default();
+
+    private:
+        void Work();
+
+        mutable std::mutex mutex_;
+        std::condition_variable hasJob_;
+        std::condition_variable hasRoom_;
+        std::deque<std::function<void()>> queue_;
+        std::vector<std::thread> workers_;
+        size_t capacity_;
+        Overflow overflow_;
+        bool stopping_ = false;
+    };
+
+    namespace Detail {
+        // Completion state shared by an asynchronous job and the tasks that observe it
+        class AsyncStateBase
+        {
+        public:
+            void Wait() const {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->done_.wait(lock, [this]() { return this->finished_; });
+            }
+
+            bool Ready() const {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                return this->finished_;
+            }
+
+            // Store the continuation to run once the job finishes; false if it has already finished
+            bool Attach(std::function<void()> continuation) {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->finished_) return false;
+                this->continuation_ = std::move(continuation);
+                return true;
+            }
+
+            void Finish(std::exception_ptr error) {
+                std::function<void()> continuation;
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    this->error_ = error;
+                    this->finished_ = true;
+                    continuation.swap(this->continuation_);
+                }
+                this->done_.notify_all();
+                if (continuation) continuation();
+            }
+
+            void Rethrow() const {
+                if (this->error_) std::rethrow_exception(this->error_);
+            }
+
+            std::atomic<bool> cancelled{false};
+
+        private:
+            mutable std::mutex mutex_;
+            mutable std::condition_variable done_;
+            bool finished_ = false;
+            std::exception_ptr error_;
+            std::function<void()> continuation_;
+        };
+
+        template <typename T>
+        class AsyncState : public AsyncStateBase
+        {
+        public:
+            T Take() { return std::move(this->value); }
+            T value;
+        };
+
+        template <>
+        class AsyncState<void> : public AsyncStateBase
+        {
+        public:
+            void Take() {}
+        };
+    }
+
+    // Handle to the result of a job running on an AsyncExecutor
+    // Copies refer to the same job; the result is taken out by the first Get()
+    template <typename T>
+    class AsyncTask
+    {
+    public:
+        explicit AsyncTask(std::shared_ptr<Detail::AsyncState<T>> state) : state_(std::move(state)) {}
+
+        // Wait for the job and take its result, rethrowing its exception (CancelledException if it was cancelled)
+        T Get() {
+            this->state_->Wait();
+            this->state_->Rethrow();
+            return this->state_->Take();
+        }
+
+        void Wait() const { this->state_->Wait(); }
+        bool Ready() const { return this->state_->Ready(); }
+
+        // Ask the job to stop; a queued job never starts and a running one stops at its next chunk
+        void Cancel() { this->state_->cancelled = true; }
+        bool Cancelled() const { return this->state_->cancelled; }
+
+        // Run onComplete once the job has finished, on the worker thread (or right away if it already has)
+        void OnComplete(std::function<void(AsyncTask<T>&)> onComplete) {
+            AsyncTask<T> task(*this);
+            if (!this->state_->Attach([task, onComplete]() mutable { onComplete(task); })) {
+                onComplete(task);
+            }
+        }
+
+#ifdef HUFFPRESS_COROUTINES
+        // co_await a task: the coroutine resumes on the worker thread that finished the job
+        struct Awaiter {
+            std::shared_ptr<Detail::AsyncState<T>> state;
+
+            bool await_ready() const { return state->Ready(); }
+            bool await_suspend(std::coroutine_handle<> handle) { return state->Attach([handle]() { handle.resume(); }); }
+            T await_resume() { return AsyncTask<T>(state).Get(); }
+        };
+
+        Awaiter operator co_await() const { return Awaiter{this->state_}; }
+#endif
+
+    private:
+        std::shared_ptr<Detail::AsyncState<T>> state_;
+    };
+
+    // Compress data off the calling thread (on up to `threads` threads of the job's own)
+    HUFFPRESS_API AsyncTask<HuffpressFile> CompressAsync(std::string data, unsigned threads = 1, AsyncExecutor& executor = AsyncExecutor::Default());
+    // Decompress a file off the calling thread; with threads > 1 cancellation only takes effect before decoding starts
+    HUFFPRESS_API AsyncTask<std::string> DecompressAsync(HuffpressFile file, unsigned threads = 1, AsyncExecutor& executor = AsyncExecutor::Default());
+    // Serialize a file off the calling thread; a file is either written completely or, when cancelled in time, not at all
+    HUFFPRESS_API AsyncTask<void> SerializeAsync(HuffpressFile file, std::string filePath, AsyncExecutor& executor = AsyncExecutor::Default());
+} // Huffpress
+#endif // HUFFPRESS_ASYNC_H
@@ -0,0 +1,432 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "blockfile.h"
+#include "bytes.h"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+
+namespace Huffpress {
+
+    namespace {
+        // "HPB", the library version, the block size and the extent and checksum of the index
+        const char BlockFileMagic[3] = {'H', 'P', 'B'};
+        const size_t BlockFileHeaderSize = sizeof(BlockFileMagic) + sizeof(Version) + 3 * sizeof(std::uint64_t) + sizeof(checksum_t);
+        // Offset, compressed size, size and source checksum of every block
+        const size_t BlockIndexEntrySize = 3 * sizeof(std::uint64_t) + sizeof(checksum_t);
+
+        using Detail::Put;
+        using Detail::Take;
+
+        Huffman::ByteVector BlockFileHeader(std::uint64_t blockSize, std::uint64_t indexOffset, const Huffman::ByteVector& index) {
+            Huffman::ByteVector header;
+            Put(header, BlockFileMagic);
+            Put(header, Version);
+            Put(header, blockSize);
+            Put(header, indexOffset);
+            Put(header, static_cast<std::uint64_t>(index.size()));
+            Put(header, checksum(reinterpret_cast<const char*>(index.data()), index.size()));
+            return header;
+        }
+
+        // Compress one block into a complete Huffpress file
+        Huffman::ByteVector EncodeBlock(const std::string& data, checksum_t& sourceChecksum) {
+            HuffpressFile file(data);
+            Huffman::ByteVector record;
+            file.SerializeToBuffer(record);
+            sourceChecksum = file.header.sourceChecksum;
+            return record;
+        }
+    }
+
+    HUFFPRESS_API void BlockFile::Create(const std::string& filePath, const std::string& data, size_t blockSize, unsigned threads) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        blockSize = std::max<size_t>(blockSize, 1);
+
+        size_t count = (data.size() + blockSize - 1) / blockSize;
+        std::vector<Huffman::ByteVector> records(count);
+        std::vector<Block> blocks(count);
+        std::atomic<size_t> next(0);
+        std::mutex mutex;
+        std::exception_ptr error;
+
+        Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+        auto worker = [&]() {
+            Huffman::AllocatorScope scope(allocator, false);
+            for (size_t i = next++; i < count; i = next++) {
+                try {
+                    std::string block = data.substr(i * blockSize, blockSize);
+                    records[i] = EncodeBlock(block, blocks[i].sourceChecksum);
+                    blocks[i].size = block.size();
+                    blocks[i].compressedSize = records[i].size();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) error = std::current_exception();
+                    next = count;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < std::min<size_t>(threads, count); ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+        if (error) std::rethrow_exception(error);
+
+        std::uint64_t offset = BlockFileHeaderSize;
+        Huffman::ByteVector index;
+        Put(index, static_cast<std::uint64_t>(count));
+        for (Block& block : blocks) {
+            block.offset = offset;
+            offset += block.compressedSize;
+            Put(index, block.offset);
+            Put(index, block.compressedSize);
+            Put(index, block.size);
+            Put(index, block.sourceChecksum);
+        }
+
+        std::ofstream out(filePath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw Exceptions::FileOpenException(filePath);
+        }
+        Huffman::ByteVector header = BlockFileHeader(blockSize, offset, index);
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        for (const Huffman::ByteVector& record : records) {
+            out.write(reinterpret_cast<const char*>(record.data()), record.size());
+        }
+        out.write(reinterpret_cast<const char*>(index.data()), index.size());
+        out.close();
+        if (!out) {
+            throw Exceptions::SerializationException("failed to write " + filePath);
+        }
+    }
+
+    HUFFPRESS_API BlockFile::BlockFile(const std::string& filePath, BlockCache* cache)
+        : filePath_(filePath), cache_(cache), fileId_(BlockCache::FileId(filePath)) {
+        this->Open();
+    }
+
+    HUFFPRESS_API BlockFile::~BlockFile() {
+        try {
+            this->Flush();
+        } catch (...) {
+        }
+    }
+
+    void BlockFile::Open() {
+        this->file_.open(this->filePath_, std::ios::binary | std::ios::in | std::ios::out);
+        if (!this->file_) {
+            throw Exceptions::FileOpenException(this->filePath_);
+        }
+        this->file_.seekg(0, std::ios::end);
+        this->end_ = static_cast<std::uint64_t>(this->file_.tellg());
+        if (this->end_ < BlockFileHeaderSize) {
+            throw Exceptions::DeserializationException(this->filePath_ + " is not a block file");
+        }
+
+        Huffman::ByteVector header = this->ReadAt(0, BlockFileHeaderSize);
+        if (std::memcmp(header.data(), BlockFileMagic, sizeof(BlockFileMagic)) != 0) {
+            throw Exceptions::DeserializationException(this->filePath_ + " is not a block file");
+        }
+        if (header[sizeof(BlockFileMagic)] != Version[0]) {
+            throw Exceptions::DeserializationException("unsupported version");
+        }
+
+        size_t offset = sizeof(BlockFileMagic) + sizeof(Version);
+        std::uint64_t blockSize = 0;
+        checksum_t indexChecksum = 0;
+        Take(header, offset, blockSize);
+        Take(header, offset, this->indexOffset_);
+        Take(header, offset, this->indexSize_);
+        Take(header, offset, indexChecksum);
+        if (blockSize == 0 || this->indexOffset_ < BlockFileHeaderSize || this->indexSize_ > this->end_ - this->indexOffset_
+            || this->indexOffset_ > this->end_ || this->indexSize_ < sizeof(std::uint64_t)) {
+            throw Exceptions::DeserializationException("block file index out of bounds");
+        }
+        this->blockSize_ = static_cast<size_t>(blockSize);
+
+        Huffman::ByteVector index = this->ReadAt(this->indexOffset_, this->indexSize_);
+        if (checksum(reinterpret_cast<const char*>(index.data()), index.size()) != indexChecksum) {
+            throw Exceptions::ChecksumMismatchException("block file index");
+        }
+
+        offset = 0;
+        std::uint64_t count = 0;
+        Take(index, offset, count);
+        if (count != (index.size() - sizeof(count)) / BlockIndexEntrySize || (index.size() - sizeof(count)) % BlockIndexEntrySize != 0) {
+            throw Exceptions::DeserializationException("malformed block file index");
+        }
+
+        // Everything not covered by the header, a block or the index is free
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> used(1, std::make_pair(this->indexOffset_, this->indexSize_));
+        this->blocks_.assign(static_cast<size_t>(count), Block());
+        for (size_t i = 0; i < this->blocks_.size(); ++i) {
+            Block& block = this->blocks_[i];
+            Take(index, offset, block.offset);
+            Take(index, offset, block.compressedSize);
+            Take(index, offset, block.size);
+            Take(index, offset, block.sourceChecksum);
+            bool lastBlock = i + 1 == this->blocks_.size();
+            if (block.offset < BlockFileHeaderSize || block.offset > this->end_ || block.compressedSize > this->end_ - block.offset
+                || block.size > blockSize || (!lastBlock && block.size != blockSize) || block.size == 0) {
+                throw Exceptions::DeserializationException("block " + std::to_string(i) + " out of bounds");
+            }
+            used.push_back(std::make_pair(block.offset, block.compressedSize));
+        }
+
+        std::sort(used.begin(), used.end());
+        this->free_.clear();
+        std::uint64_t position = BlockFileHeaderSize;
+        for (const auto& extent : used) {
+            if (extent.first < position) {
+                throw Exceptions::DeserializationException("overlapping blocks in the block file index");
+            }
+            if (extent.first > position) this->free_[position] = extent.first - position;
+            position = extent.first + extent.second;
+        }
+        if (position < this->end_) this->free_[position] = this->end_ - position;
+        this->dirty_.clear();
+    }
+
+    HUFFPRESS_API std::uint64_t BlockFile::Size() const {
+        if (this->blocks_.empty()) return 0;
+        size_t last = this->blocks_.size() - 1;
+        auto dirty = this->dirty_.find(last);
+        return std::uint64_t(last) * this->blockSize_ + (dirty != this->dirty_.end() ? dirty->second.size() : this->blocks_[last].size);
+    }
+
+    HUFFPRESS_API std::string BlockFile::Read(std::uint64_t offset, size_t size) {
+        std::uint64_t total = this->Size();
+        if (offset >= total) return std::string();
+        size = static_cast<size_t>(std::min<std::uint64_t>(size, total - offset));
+
+        std::string result;
+        result.reserve(size);
+        while (result.size() < size) {
+            std::uint64_t position = offset + result.size();
+            size_t index = static_cast<size_t>(position / this->blockSize_);
+            size_t within = static_cast<size_t>(position % this->blockSize_);
+
+            auto dirty = this->dirty_.find(index);
+            std::shared_ptr<const std::string> clean = dirty == this->dirty_.end() ? this->CleanBlock(index) : nullptr;
+            const std::string& block = clean ? *clean : dirty->second;
+            result.append(block, within, size - result.size());
+        }
+        return result;
+    }
+
+    HUFFPRESS_API void BlockFile::Write(std::uint64_t offset, const std::string& data) {
+        if (offset > this->Size()) {
+            throw std::out_of_range("write past the end of " + this->filePath_);
+        }
+
+        size_t done = 0;
+        while (done < data.size()) {
+            std::uint64_t position = offset + done;
+            size_t index = static_cast<size_t>(position / this->blockSize_);
+            size_t within = static_cast<size_t>(position % this->blockSize_);
+            if (index == this->blocks_.size()) {
+                // A new block at the end, written to the file by the next flush
+                this->blocks_.push_back(Block());
+                this->dirty_[index];
+            }
+
+            std::string& block = this->DirtyBlock(index);
+            size_t count = std::min(this->blockSize_ - within, data.size() - done);
+            if (block.size() < within + count) block.resize(within + count);
+            block.replace(within, count, data, done, count);
+            done += count;
+        }
+    }
+
+    HUFFPRESS_API void BlockFile::Flush() {
+        if (this->dirty_.empty()) return;
+
+        // New blocks only go to free space, the blocks they replace are released once the header points to the new index
+        std::vector<Block> updated = this->blocks_;
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> released(1, std::make_pair(this->indexOffset_, this->indexSize_));
+        for (const auto& dirty : this->dirty_) {
+            Block& block = updated[dirty.first];
+            if (block.compressedSize > 0) released.push_back(std::make_pair(block.offset, block.compressedSize));
+
+            Huffman::ByteVector record = EncodeBlock(dirty.second, block.sourceChecksum);
+            block.size = dirty.second.size();
+            block.compressedSize = record.size();
+            block.offset = this->Allocate(record.size());
+            this->WriteAt(block.offset, record);
+        }
+
+        Huffman::ByteVector index;
+        Put(index, static_cast<std::uint64_t>(updated.size()));
+        for (const Block& block : updated) {
+            Put(index, block.offset);
+            Put(index, block.compressedSize);
+            Put(index, block.size);
+            Put(index, block.sourceChecksum);
+        }
+        std::uint64_t indexOffset = this->Allocate(index.size());
+        this->WriteAt(indexOffset, index);
+        this->file_.flush();
+        this->WriteAt(0, BlockFileHeader(this->blockSize_, indexOffset, index));
+        if (!this->file_.flush()) {
+            throw Exceptions::SerializationException("failed to write " + this->filePath_);
+        }
+
+        this->blocks_.swap(updated);
+        this->indexOffset_ = indexOffset;
+        this->indexSize_ = index.size();
+        if (this->cache_) {
+            // The new blocks are already decoded, readers after the flush find them under their new checksums
+            for (auto& dirty : this->dirty_) {
+                this->cache_->Insert(this->fileId_, dirty.first, this->blocks_[dirty.first].sourceChecksum, std::move(dirty.second));
+            }
+        }
+        this->dirty_.clear();
+        for (const auto& extent : released) {
+            this->Release(extent.first, extent.second);
+        }
+    }
+
+    HUFFPRESS_API void BlockFile::Compact() {
+        this->Flush();
+
+        const std::string compactPath = this->filePath_ + ".compact";
+        {
+            std::ofstream out(compactPath, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw Exceptions::FileOpenException(compactPath);
+            }
+
+            std::uint64_t offset = BlockFileHeaderSize;
+            Huffman::ByteVector index;
+            Put(index, static_cast<std::uint64_t>(this->blocks_.size()));
+            out.seekp(static_cast<std::streamoff>(offset));
+            for (const Block& block : this->blocks_) {
+                Huffman::ByteVector record = this->ReadAt(block.offset, block.compressedSize);
+                out.write(reinterpret_cast<const char*>(record.data()), record.size());
+                Put(index, offset);
+                Put(index, block.compressedSize);
+                Put(index, block.size);
+                Put(index, block.sourceChecksum);
+                offset += block.compressedSize;
+            }
+            out.write(reinterpret_cast<const char*>(index.data()), index.size());
+
+            Huffman::ByteVector header = BlockFileHeader(this->blockSize_, offset, index);
+            out.seekp(0);
+            out.write(reinterpret_cast<const char*>(header.data()), header.size());
+            out.close();
+            if (!out) {
+                std::remove(compactPath.c_str());
+                throw Exceptions::SerializationException("failed to write " + compactPath);
+            }
+        }
+
+        this->file_.close();
+#if defined(_WIN32) || defined(_WIN64)
+        std::remove(this->filePath_.c_str());
+#endif
+        if (std::rename(compactPath.c_str(), this->filePath_.c_str()) != 0) {
+            throw Exceptions::SerializationException("failed to replace " + this->filePath_);
+        }
+        this->Open();
+    }
+
+    HUFFPRESS_API std::uint64_t BlockFile::FreeBytes() const {
+        std::uint64_t total = 0;
+        for (const auto& extent : this->free_) total += extent.second;
+        return total;
+    }
+
+    std::string& BlockFile::DirtyBlock(size_t index) {
+        auto dirty = this->dirty_.find(index);
+        if (dirty != this->dirty_.end()) return dirty->second;
+        return this->dirty_[index] = *this->CleanBlock(index);
+    }
+
+    std::shared_ptr<const std::string> BlockFile::CleanBlock(size_t index) {
+        if (!this->cache_) return std::make_shared<const std::string>(this->DecodeBlock(index));
+
+        // Keyed by the block's checksum too, so blocks replaced by a flush or another writer miss
+        checksum_t sourceChecksum = this->blocks_[index].sourceChecksum;
+        std::shared_ptr<const std::string> cached = this->cache_->Find(this->fileId_, index, sourceChecksum);
+        return cached ? cached : this->cache_->Insert(this->fileId_, index, sourceChecksum, this->DecodeBlock(index));
+    }
+
+    std::string BlockFile::DecodeBlock(size_t index) {
+        const Block& block = this->blocks_[index];
+        HuffpressFile file;
+        file.ParseFromBuffer(this->ReadAt(block.offset, block.compressedSize));
+        if (file.header.sourceChecksum != block.sourceChecksum) {
+            throw Exceptions::ChecksumMismatchException("index entry of block " + std::to_string(index));
+        }
+
+        std::string data = file.DecompressAndVerify();
+        if (data.size() != block.size) {
+            throw Exceptions::DeserializationException("block " + std::to_string(index) + " does not match its index entry");
+        }
+        return data;
+    }
+
+    std::uint64_t BlockFile::Allocate(std::uint64_t size) {
+        // First fit, falling back to the end of the file
+        for (auto extent = this->free_.begin(); extent != this->free_.end(); ++extent) {
+            if (extent->second < size) continue;
+            std::uint64_t offset = extent->first;
+            std::uint64_t rest = extent->second - size;
+            this->free_.erase(extent);
+            if (rest > 0) this->free_[offset + size] = rest;
+            return offset;
+        }
+
+        std::uint64_t offset = this->end_;
+        this->end_ += size;
+        return offset;
+    }
+
+    void BlockFile::Release(std::uint64_t offset, std::uint64_t size) {
+        if (size == 0) return;
+        auto next = this->free_.lower_bound(offset);
+        if (next != this->free_.end() && offset + size == next->first) {
+            size += next->second;
+            next = this->free_.erase(next);
+        }
+        if (next != this->free_.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                previous->second += size;
+                return;
+            }
+        }
+        this->free_[offset] = size;
+    }
+
+    Huffman::ByteVector BlockFile::ReadAt(std::uint64_t offset, std::uint64_t size) {
+        Huffman::ByteVector bytes(static_cast<size_t>(size));
+        this->file_.clear();
+        this->file_.seekg(static_cast<std::streamoff>(offset));
+        this->file_.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        if (!this->file_) {
+            throw Exceptions::DeserializationException("truncated block file " + this->filePath_);
+        }
+        return bytes;
+    }
+
+    void BlockFile::WriteAt(std::uint64_t offset, const Huffman::ByteVector& bytes) {
+        this->file_.clear();
+        this->file_.seekp(static_cast<std::streamoff>(offset));
+        this->file_.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        if (!this->file_) {
+            throw Exceptions::SerializationException("failed to write " + this->filePath_);
+        }
+    }
+} // Huffpress
@@ -0,0 +1,88 @@
+#ifndef HUFFPRESS_BLOCKFILE_H
+#define HUFFPRESS_BLOCKFILE_H
+
+#include "export.h"
+
+#include "huffpress.h"
+#include "cache.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+namespace Huffpress {
+
+    // Compressed file made of independently coded fixed-size blocks with an index, editable in place
+    // Writes decode only the blocks they touch and keep them as dirty blocks; Flush re-encodes just those blocks
+    // into free space, writes a new index and then switches the header over to it, so a file interrupted in the
+    // middle of a flush still opens in its previous state. The space of replaced blocks is reused by later flushes
+    class HUFFPRESS_API BlockFile
+    {
+    public:
+        // Create a block file holding data, split into blockSize blocks compressed on up to `threads` threads
+        HUFFPRESS_API static void Create(const std::string& filePath, const std::string& data, size_t blockSize = 64 << 10, unsigned threads = 0);
+
+        // Open a block file, reading the header and the index (throws FileOpenException, DeserializationException)
+        // With a cache, decoded blocks are looked up there first and flushed blocks are stored there
+        HUFFPRESS_API explicit BlockFile(const std::string& filePath, BlockCache* cache = nullptr);
+        // Flush dirty blocks, ignoring errors
+        HUFFPRESS_API ~BlockFile();
+
+        BlockFile(const BlockFile&) = delete;
+        BlockFile& operator=(const BlockFile&) = delete;
+
+        // Uncompressed size, including unflushed writes
+        HUFFPRESS_API std::uint64_t Size() const;
+        // Read up to `size` bytes at offset, decoding only the blocks in range
+        HUFFPRESS_API std::string Read(std::uint64_t offset, size_t size);
+        // Overwrite data at offset (at most Size(), writing past the end grows the file)
+        HUFFPRESS_API void Write(std::uint64_t offset, const std::string& data);
+        // Re-encode and write the dirty blocks, then the index
+        HUFFPRESS_API void Flush();
+        // Flush, then rewrite the file without free space (the blocks are copied, not re-encoded)
+        HUFFPRESS_API void Compact();
+
+        size_t BlockSize() const { return blockSize_; }
+        size_t BlockCount() const { return blocks_.size(); }
+        size_t DirtyBlocks() const { return dirty_.size(); }
+        // Bytes inside the file not used by a block or the index
+        HUFFPRESS_API std::uint64_t FreeBytes() const;
+
+    private:
+        struct Block {
+            std::uint64_t offset = 0;
+            std::uint64_t compressedSize = 0;
+            std::uint64_t size = 0;
+            checksum_t sourceChecksum = 0;
+        };
+
+        void Open();
+        std::string& DirtyBlock(size_t index);
+        std::shared_ptr<const std::string> CleanBlock(size_t index);
+        std::string DecodeBlock(size_t index);
+        std::uint64_t Allocate(std::uint64_t size);
+        void Release(std::uint64_t offset, std::uint64_t size);
+        Huffman::ByteVector ReadAt(std::uint64_t offset, std::uint64_t size);
+        void WriteAt(std::uint64_t offset, const Huffman::ByteVector& bytes);
+
+        std::string filePath_;
+        std::fstream file_;
+        BlockCache* cache_;
+        std::uint64_t fileId_;
+        size_t blockSize_ = 0;
+        std::vector<Block> blocks_;
+        // Decoded blocks changed since the last flush
+        std::map<size_t, std::string> dirty_;
+        // Free extents inside the file, by offset
+        std::map<std::uint64_t, std::uint64_t> free_;
+        // Extent of the current index
+        std::uint64_t indexOffset_ = 0;
+        std::uint64_t indexSize_ = 0;
+        // End of the file
+        std::uint64_t end_ = 0;
+    };
+} // Huffpress
+#endif // HUFFPRESS_BLOCKFILE_H
@@ -0,0 +1,28 @@
+#ifndef HUFFPRESS_BYTES_H
+#define HUFFPRESS_BYTES_H
+
+#include "huffman/huffman.h"
+
+#include <cstring>
+
+namespace Huffpress {
+
+    // Fixed-size fields of the archive and block file formats, in host byte order
+    namespace Detail {
+        template <typename T>
+        void Put(Huffman::ByteVector& buffer, const T& value) {
+            const Huffman::Byte* bytes = reinterpret_cast<const Huffman::Byte*>(&value);
+            buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+        }
+
+        // Read the next field; false if the buffer ends first
+        template <typename T>
+        bool Take(const Huffman::ByteVector& buffer, size_t& offset, T& value) {
+            if (buffer.size() - offset < sizeof(value)) return false;
+            std::memcpy(&value, buffer.data() + offset, sizeof(value));
+            offset += sizeof(value);
+            return true;
+        }
+    }
+} // Huffpress
+#endif // HUFFPRESS_BYTES_H
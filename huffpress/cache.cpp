@@ -0,0 +1,92 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "cache.h"
+
+#include <algorithm>
+
+namespace Huffpress {
+
+    HUFFPRESS_API BlockCache::BlockCache(size_t capacity, unsigned shards) {
+        shards = std::max(1u, shards);
+        this->shardCapacity_ = capacity / shards;
+        for (unsigned i = 0; i < shards; ++i) {
+            this->shards_.emplace_back(new Shard());
+        }
+    }
+
+    HUFFPRESS_API std::shared_ptr<const std::string> BlockCache::Find(std::uint64_t file, std::uint64_t block, checksum_t sourceChecksum) {
+        Key key = {file, block};
+        Shard& shard = this->ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.index.find(key);
+        if (found == shard.index.end() || found->second->sourceChecksum != sourceChecksum) {
+            shard.stats.misses++;
+            return nullptr;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        shard.stats.hits++;
+        return found->second->data;
+    }
+
+    HUFFPRESS_API std::shared_ptr<const std::string> BlockCache::Insert(std::uint64_t file, std::uint64_t block, checksum_t sourceChecksum, std::string data) {
+        std::shared_ptr<const std::string> shared = std::make_shared<const std::string>(std::move(data));
+        if (shared->size() > this->shardCapacity_) return shared;
+
+        Key key = {file, block};
+        Shard& shard = this->ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.index.find(key);
+        if (found != shard.index.end()) {
+            shard.bytes -= found->second->data->size();
+            shard.entries.erase(found->second);
+            shard.index.erase(found);
+        }
+
+        shard.entries.push_front(Entry{key, sourceChecksum, shared});
+        shard.index[key] = shard.entries.begin();
+        shard.bytes += shared->size();
+        shard.stats.insertions++;
+
+        while (shard.bytes > this->shardCapacity_) {
+            const Entry& oldest = shard.entries.back();
+            shard.bytes -= oldest.data->size();
+            shard.index.erase(oldest.key);
+            shard.entries.pop_back();
+            shard.stats.evictions++;
+        }
+        return shared;
+    }
+
+    HUFFPRESS_API void BlockCache::Clear() {
+        for (std::unique_ptr<Shard>& shard : this->shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->entries.clear();
+            shard->index.clear();
+            shard->bytes = 0;
+        }
+    }
+
+    HUFFPRESS_API BlockCacheStats BlockCache::Stats() const {
+        BlockCacheStats total;
+        for (const std::unique_ptr<Shard>& shard : this->shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total.hits += shard->stats.hits;
+            total.misses += shard->stats.misses;
+            total.insertions += shard->stats.insertions;
+            total.evictions += shard->stats.evictions;
+            total.bytes += shard->bytes;
+            total.entries += shard->entries.size();
+        }
+        return total;
+    }
+
+    HUFFPRESS_API std::uint64_t BlockCache::FileId(const std::string& filePath) {
+        return checksum(filePath.data(), filePath.size());
+    }
+
+    BlockCache::Shard& BlockCache::ShardOf(const Key& key) {
+        return *this->shards_[KeyHash()(key) % this->shards_.size()];
+    }
+} // Huffpress
@@ -0,0 +1,85 @@
+#ifndef HUFFPRESS_CACHE_H
+#define HUFFPRESS_CACHE_H
+
+#include "export.h"
+
+#include "huffpress.h"
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace Huffpress {
+
+    // Counters of a BlockCache, summed over its shards
+    struct BlockCacheStats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t insertions = 0;
+        std::uint64_t evictions = 0;
+        // Decoded bytes and blocks currently held
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    // Size-bounded LRU cache of decoded blocks keyed by (file, block), shared by readers on any number of threads
+    // The cache is split into shards with a lock each, so readers of different blocks rarely wait for each other.
+    // Every block is stored with the checksum of its data and only found again under the same checksum, so a block
+    // that was rewritten in the meantime is a miss rather than stale data
+    class HUFFPRESS_API BlockCache
+    {
+    public:
+        // Hold up to `capacity` decoded bytes in `shards` shards
+        HUFFPRESS_API explicit BlockCache(size_t capacity = 64 << 20, unsigned shards = 16);
+
+        BlockCache(const BlockCache&) = delete;
+        BlockCache& operator=(const BlockCache&) = delete;
+
+        // Decoded block, or nullptr if it is not cached under this checksum
+        HUFFPRESS_API std::shared_ptr<const std::string> Find(std::uint64_t file, std::uint64_t block, checksum_t sourceChecksum);
+        // Store a decoded block, evicting the least recently used ones of its shard; blocks larger than a shard are not kept
+        HUFFPRESS_API std::shared_ptr<const std::string> Insert(std::uint64_t file, std::uint64_t block, checksum_t sourceChecksum, std::string data);
+        HUFFPRESS_API void Clear();
+        HUFFPRESS_API BlockCacheStats Stats() const;
+
+        // Identity of a file for the cache keys
+        HUFFPRESS_API static std::uint64_t FileId(const std::string& filePath);
+
+    private:
+        struct Key {
+            std::uint64_t file;
+            std::uint64_t block;
+
+            bool operator==(const Key& other) const { return file == other.file && block == other.block; }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const { return std::hash<std::uint64_t>()(key.file * 0x9e3779b97f4a7c15ULL ^ key.block); }
+        };
+
+        struct Entry {
+            Key key;
+            checksum_t sourceChecksum;
+            std::shared_ptr<const std::string> data;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            // Most recently used first
+            std::list<Entry> entries;
+            std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+            size_t bytes = 0;
+            BlockCacheStats stats;
+        };
+
+        Shard& ShardOf(const Key& key);
+
+        size_t shardCapacity_;
+        std::vector<std::unique_ptr<Shard>> shards_;
+    };
+} // Huffpress
+#endif // HUFFPRESS_CACHE_H
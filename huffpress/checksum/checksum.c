@@ -1,13 +1,62 @@
-
 #define CHECKSUM_LIBRARY_BUILD
 
 #include "checksum.h"
 
+#define BLOCK_CHECKSUM_MOD   0x1fffffffffffffffULL
+#define BLOCK_CHECKSUM_BASE  0x0000000100000001b3ULL
+
 CHECKSUM_API checksum_t checksum(const char *buf, size_t len) {
-    uint64_t hash = 0xcbf29ce484222325;
+    return checksum_update(CHECKSUM_INIT, buf, len);
+}
+
+CHECKSUM_API checksum_t checksum_update(checksum_t hash, const char *buf, size_t len) {
     for (size_t i = 0; i < len; i++) {
         hash ^= (uint8_t)buf[i];
         hash *= 0x00000100000001b3;
     }
     return hash;
+}
+
+// a * b mod 2^61 - 1, both operands already reduced
+static uint64_t mulmod61(uint64_t a, uint64_t b) {
+    uint64_t aLo = a & 0xffffffffULL, aHi = a >> 32;
+    uint64_t bLo = b & 0xffffffffULL, bHi = b >> 32;
+
+    uint64_t lo = aLo * bLo;
+    uint64_t mid = aLo * bHi + aHi * bLo;
+    uint64_t hi = aHi * bHi;
+
+    // 2^64 == 8 and 2^61 == 1 (mod 2^61 - 1)
+    uint64_t r = (lo & BLOCK_CHECKSUM_MOD) + (lo >> 61)
+               + (hi << 3)
+               + ((mid & 0x1fffffffULL) << 32) + (mid >> 29);
+
+    r = (r & BLOCK_CHECKSUM_MOD) + (r >> 61);
+    r = (r & BLOCK_CHECKSUM_MOD) + (r >> 61);
+    return r >= BLOCK_CHECKSUM_MOD ? r - BLOCK_CHECKSUM_MOD : r;
+}
+
+static uint64_t addmod61(uint64_t a, uint64_t b) {
+    uint64_t r = a + b;
+    return r >= BLOCK_CHECKSUM_MOD ? r - BLOCK_CHECKSUM_MOD : r;
+}
+
+CHECKSUM_API checksum_t block_checksum(const char *buf, size_t len) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < len; i++) {
+        // Offset by one so that runs of zero bytes still change the hash
+        hash = addmod61(mulmod61(hash, BLOCK_CHECKSUM_BASE), (uint64_t)(uint8_t)buf[i] + 1);
+    }
+    return hash;
+}
+
+CHECKSUM_API checksum_t block_checksum_combine(checksum_t left, checksum_t right, size_t rightLen) {
+    // left * base^rightLen + right
+    uint64_t power = 1, base = BLOCK_CHECKSUM_BASE;
+    while (rightLen) {
+        if (rightLen & 1) power = mulmod61(power, base);
+        base = mulmod61(base, base);
+        rightLen >>= 1;
+    }
+    return addmod61(mulmod61(left, power), right);
 }
\ No newline at end of file
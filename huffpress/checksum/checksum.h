@@ -10,6 +10,21 @@
 
 typedef uint64_t checksum_t;
 
+// Initial state of a running checksum (FNV-1a offset basis)
+#define CHECKSUM_INIT ((checksum_t)0xcbf29ce484222325ULL)
+
 CHECKSUM_API checksum_t checksum(const char *buf, size_t len);
 
+// Continue a running checksum over the next chunk of data
+// checksum(buf, len) == checksum_update(CHECKSUM_INIT, buf, len)
+CHECKSUM_API checksum_t checksum_update(checksum_t hash, const char *buf, size_t len);
+
+// Combinable checksum of a block (polynomial hash modulo 2^61 - 1)
+// Blocks can be hashed independently and joined in any grouping afterwards
+CHECKSUM_API checksum_t block_checksum(const char *buf, size_t len);
+
+// Checksum of the concatenation of two blocks from their checksums
+// block_checksum(A || B) == block_checksum_combine(block_checksum(A), block_checksum(B), len(B))
+CHECKSUM_API checksum_t block_checksum_combine(checksum_t left, checksum_t right, size_t rightLen);
+
 #endif // CHECKSHUM_H
\ No newline at end of file
@@ -1,7 +1,10 @@
 #ifndef CHECKSUM_EXPORT_H
 #define CHECKSUM_EXPORT_H
 
-#if defined(_WIN32) || defined(_WIN64)
+// Static builds (the amalgamated library) export nothing
+#if defined(HUFFPRESS_STATIC)
+#define CHECKSUM_API
+#elif defined(_WIN32) || defined(_WIN64)
 #ifdef CHECKSUM_LIBRARY_BUILD
 #define CHECKSUM_API __declspec(dllexport)
 #else
@@ -12,6 +12,18 @@
 #include <stdexcept>
 #include <cstring>
 #include <cstdlib>
+#include <memory>
+#include <chrono>
+#include <cerrno>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
 namespace Huffpress {
     const std::string RED = "\033[31m";
@@ -83,6 +95,128 @@ namespace Huffpress {
         run(); // stdin
     }
 
+    HUFFPRESS_CLI_API int HuffpressCLI::runStream(int argc, char* argv[]) {
+        const char* usage = "Usage: hpfcli compress [-T threads] [-B block-size] [-P pipeline] [-L level|-C tables] [-v] [<input>|- [<output>|-]]\n"
+                            "       hpfcli compress -a [-l] [-v] [<input>|- [<output>|-]]\n"
+                            "       hpfcli decompress [-T threads] [-v] [<input>|- [<output>|-]]\n"
+                            "       hpfcli append [-T threads] [-B block-size] [-P pipeline] [-L level|-C tables] [-v] <stream> [<input>|-]\n"
+                            "Pipelines are comma-separated transforms applied to every block: delta8, delta16, delta32, mtf, bwt\n"
+                            "Levels 1 (fastest) to 9 (smallest) code every block as LZ77 matches and literals\n"
+                            "Tables 1 to 16 code every block with that many tables at most, chosen by the previous byte\n";
+        if (argc < 2) {
+            std::cerr << usage;
+            return EXIT_FAILURE;
+        }
+
+        std::string command = argv[1];
+        unsigned threads = 0;
+        size_t blockSize = 4 << 20;
+        bool verbose = false;
+        // One-pass adaptive coding, with -l a frame per line
+        bool adaptive = false, lineFrames = false;
+        Huffpress::Pipeline pipeline;
+        // LZ77 level of the blocks, 0 for Huffman coding alone
+        int lzLevel = 0;
+        // Per-context tables of the blocks at most, 0 for one table
+        size_t contextTables = 0;
+        std::vector<std::string> paths;
+        try {
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                if ((arg == "-T" || arg == "-B") && i + 1 < argc) {
+                    size_t value = parseSize(argv[++i]);
+                    if (arg == "-T") threads = static_cast<unsigned>(value);
+                    else blockSize = value;
+                } else if (arg == "-P" && i + 1 < argc) {
+                    pipeline = Huffpress::ParsePipeline(argv[++i]);
+                } else if (arg == "-L" && i + 1 < argc) {
+                    lzLevel = static_cast<int>(parseSize(argv[++i]));
+                    Huffpress::LzLevel(lzLevel);
+                } else if (arg == "-C" && i + 1 < argc) {
+                    contextTables = parseSize(argv[++i]);
+                    if (contextTables == 0 || contextTables > Huffpress::MaxContextTables) throw std::invalid_argument("bad number of tables " + std::string(argv[i]));
+                } else if (arg == "-v") {
+                    verbose = true;
+                } else if (arg == "-a") {
+                    adaptive = true;
+                } else if (arg == "-l") {
+                    lineFrames = true;
+                } else if (arg.size() > 1 && arg[0] == '-') {
+                    throw std::invalid_argument("unknown option " + arg);
+                } else {
+                    paths.push_back(arg);
+                }
+            }
+            if ((command != "compress" && command != "decompress" && command != "append") || paths.size() > 2 || blockSize == 0
+                || (command == "append" && paths.empty()) || (lineFrames && !adaptive) || (adaptive && command != "compress")
+                || ((!pipeline.empty() || lzLevel || contextTables) && (adaptive || command == "decompress")) || (lzLevel && contextTables)) {
+                throw std::invalid_argument("bad arguments");
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "An error has occurred: " << e.what() << "\n" << usage;
+            return EXIT_FAILURE;
+        }
+
+        // append writes to the stream named first and reads from the optional second path
+        bool append = command == "append";
+        std::string inputPath = paths.size() > (append ? 1 : 0) ? paths[append ? 1 : 0] : "-";
+        std::string outputPath = append ? paths[0] : paths.size() > 1 ? paths[1] : "-";
+
+        // Large stream buffers keep the number of system calls low; the standard streams are switched to binary
+        const size_t bufferSize = 1 << 20;
+        std::unique_ptr<char[]> inputBuffer(new char[bufferSize]), outputBuffer(new char[bufferSize]);
+        std::ifstream inputFile;
+        std::ofstream outputFile;
+        std::istream* in = &std::cin;
+        std::ostream* out = &std::cout;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+        try {
+            if (inputPath != "-") {
+                inputFile.rdbuf()->pubsetbuf(inputBuffer.get(), bufferSize);
+                inputFile.open(inputPath, std::ios::binary);
+                if (!inputFile) throw Huffpress::Exceptions::FileOpenException(inputPath);
+                in = &inputFile;
+            }
+            if (append) {
+                Huffpress::StreamStats stats = Huffpress::AppendStream(outputPath, *in, threads, blockSize, pipeline, lzLevel, contextTables);
+                if (verbose) {
+                    std::cerr << stats.blocks << " block(s) appended, " << stats.sourceBytes << " bytes <-> " << stats.compressedBytes << " bytes compressed\n";
+                }
+                return EXIT_SUCCESS;
+            }
+            if (outputPath != "-") {
+                outputFile.rdbuf()->pubsetbuf(outputBuffer.get(), bufferSize);
+                outputFile.open(outputPath, std::ios::binary | std::ios::trunc);
+                if (!outputFile) throw Huffpress::Exceptions::FileOpenException(outputPath);
+                out = &outputFile;
+            }
+
+            Huffpress::StreamStats stats = adaptive ? Huffpress::CompressAdaptive(*in, *out, lineFrames)
+                : command == "compress" ? Huffpress::CompressStream(*in, *out, threads, blockSize, pipeline, lzLevel, contextTables)
+                : Huffpress::DecompressStream(*in, *out, threads);
+
+            if (outputFile.is_open()) {
+                outputFile.close();
+                if (!outputFile) throw Huffpress::Exceptions::SerializationException("failed to write " + outputPath);
+            }
+            if (verbose) {
+                std::cerr << stats.blocks << " block(s), " << stats.sourceBytes << " bytes <-> " << stats.compressedBytes << " bytes compressed\n";
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "An error has occurred: " << e.what() << "\n";
+            if (outputFile.is_open()) {
+                outputFile.close();
+                std::remove(outputPath.c_str());
+            }
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
     HUFFPRESS_CLI_API std::string HuffpressCLI::getSelectedFilePath() {
         if (filePath_.empty()) return RED+"None" + RESET;
         return GREEN + filePath_ + RESET;
@@ -182,6 +316,18 @@ namespace Huffpress {
         else if (command == "version") {
             handleVersion();
         }
+        else if (command == "verify") {
+            handleVerify(tokens);
+        }
+        else if (command == "append") {
+            handleAppend(tokens);
+        }
+        else if (command == "compress-dir") {
+            handleDirectory(tokens, true);
+        }
+        else if (command == "decompress-dir") {
+            handleDirectory(tokens, false);
+        }
         // else if (command == "run") {
         //     handleRun();
         // }
@@ -309,7 +455,7 @@ namespace Huffpress {
             std::cout << "You do not have an open file, skip\n";
         } else {
             try {
-                file_.Modify(bufferedRead(remainingTokens, 0x20000));
+                file_.Load(remainingTokens);
                 std::cout << "Successful, commit the changes with commit\n";
             } catch (const std::exception& e) {
                 std::cout << "An error has occurred: " << e.what() << "\n";
@@ -368,6 +514,119 @@ namespace Huffpress {
         printf("Library version: %d.%d.%d\n", Huffpress::Version[0], Huffpress::Version[1], Huffpress::Version[2]);
     }
 
+    HUFFPRESS_CLI_API void HuffpressCLI::handleVerify(const std::vector<std::string>& tokens) {
+        bool checkSource = true;
+        std::vector<std::string> paths;
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            if (tokens[i] == "--fast") {
+                checkSource = false;
+            } else {
+                paths.push_back(tokens[i]);
+            }
+        }
+
+        if (paths.empty()) {
+            if (filePath_.empty()) {
+                std::cout << "You do not have an open file, skip\n";
+                return;
+            }
+            paths.push_back(filePath_);
+        }
+
+        try {
+            std::vector<Huffpress::VerifyResult> results = Huffpress::VerifyFiles(paths, checkSource);
+            size_t failed = 0;
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (results[i].Ok()) {
+                    std::cout << GREEN << "OK" << RESET << "      " << paths[i] << "\n";
+                } else {
+                    std::cout << RED << "FAILED" << RESET << "  " << paths[i] << ": " << results[i].error << "\n";
+                    ++failed;
+                }
+            }
+            std::cout << "Verified " << results.size() << " file(s), " << failed << " failed\n";
+        } catch (const std::exception& e) {
+            std::cout << "An error has occurred: " << e.what() << "\n";
+        }
+    }
+
+    HUFFPRESS_CLI_API void HuffpressCLI::handleAppend(const std::vector<std::string>& tokens) {
+        if (tokens.size() != 3) {
+            std::cout << "Usage: append <stream-path> <source-path>\n";
+            return;
+        }
+
+        try {
+            std::ifstream source(tokens[2], std::ios::binary);
+            if (!source) {
+                throw Huffpress::Exceptions::FileOpenException(tokens[2]);
+            }
+            Huffpress::StreamStats stats = Huffpress::AppendStream(tokens[1], source);
+            std::cout << "Appended " << stats.sourceBytes << " bytes as " << stats.blocks << " block(s) of " << stats.compressedBytes << " bytes\n";
+        } catch (const std::exception& e) {
+            std::cout << "An error has occurred: " << e.what() << "\n";
+        }
+    }
+
+    HUFFPRESS_CLI_API void HuffpressCLI::handleDirectory(const std::vector<std::string>& tokens, bool compress) {
+        unsigned threads = 0;
+        std::vector<std::string> paths;
+        try {
+            for (size_t i = 1; i < tokens.size(); ++i) {
+                if (tokens[i] == "-T" && i + 1 < tokens.size()) {
+                    threads = static_cast<unsigned>(parseSize(tokens[++i]));
+                } else {
+                    paths.push_back(tokens[i]);
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cout << "An error has occurred: " << e.what() << "\n";
+            return;
+        }
+        if (paths.size() != 2) {
+            std::cout << "Usage: " << tokens[0] << " [-T threads] <source-dir> <target-dir>\n";
+            return;
+        }
+
+        const std::string extension = ".hpf";
+        std::string sourceRoot = paths[0], targetRoot = paths[1];
+        try {
+            std::vector<std::string> sources, targets;
+            for (const std::string& relative : listFiles(sourceRoot)) {
+                bool compressed = relative.size() > extension.size() && relative.compare(relative.size() - extension.size(), extension.size(), extension) == 0;
+                if (compressed == compress) continue;
+
+                sources.push_back(sourceRoot + "/" + relative);
+                targets.push_back(targetRoot + "/" + (compress ? relative + extension : relative.substr(0, relative.size() - extension.size())));
+                makeDirectories(targets.back().substr(0, targets.back().find_last_of('/')));
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            std::vector<Huffpress::FileResult> results = compress
+                ? Huffpress::CompressFiles(sources, targets, threads)
+                : Huffpress::DecompressFiles(sources, targets, threads);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            size_t failed = 0, sourceBytes = 0, compressedBytes = 0;
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (results[i].Ok()) {
+                    sourceBytes += results[i].sourceBytes;
+                    compressedBytes += results[i].compressedBytes;
+                } else {
+                    std::cout << RED << "FAILED" << RESET << "  " << sources[i] << ": " << results[i].error << "\n";
+                    ++failed;
+                }
+            }
+
+            std::cout << (compress ? "Compressed " : "Decompressed ") << results.size() - failed << " file(s), " << failed << " failed\n";
+            std::cout << "  " << sourceBytes << " bytes <-> " << compressedBytes << " bytes compressed";
+            if (sourceBytes > 0) std::cout << " (" << calculateCompressionEfficiency(sourceBytes, compressedBytes) << "% saved)";
+            std::cout << "\n  " << seconds << " s, " << (seconds > 0 ? sourceBytes / seconds / (1 << 20) : 0.0) << " MB/s\n";
+        } catch (const std::exception& e) {
+            std::cout << "An error has occurred: " << e.what() << "\n";
+        }
+    }
+
     // HUFFPRESS_CLI_API void HuffpressCLI::handleRun() {
     //     if (doCliLoop_) {
     //         std::cout << "The loop has already running" << std::endl;
@@ -411,9 +670,16 @@ namespace Huffpress {
         std::cout << "  refresh             - Refresh file buffer\n";
         std::cout << "  version             - Write a huffpress library version\n";
         std::cout << "  file                - Write a file info\n";
+        std::cout << "  verify [--fast] [<path>...] - Check the integrity of the given files (or the selected one); --fast skips decoding\n";
         // std::cout << "  run                 - Run console loop\n";
         // std::cout << "  stop                - Stop console loop\n";
         std::cout << "  exit                - Exit the program\n";
+        std::cout << "  append <stream> <path> - Compress a file as new blocks at the end of a block stream, created if missing\n";
+        std::cout << "  compress-dir [-T threads] <source-dir> <target-dir>   - Compress every file of a tree into <file>.hpf files on a worker pool\n";
+        std::cout << "  decompress-dir [-T threads] <source-dir> <target-dir> - Decompress every .hpf file of a tree on a worker pool\n";
+        std::cout << "Streaming mode (instead of the console):\n";
+        std::cout << "  hpfcli compress|decompress [-T threads] [-B block-size] [-P pipeline] [-L level|-C tables] [-v] [<input>|- [<output>|-]]\n";
+        std::cout << "  hpfcli append [-T threads] [-B block-size] [-P pipeline] [-L level|-C tables] [-v] <stream> [<input>|-]\n";
         std::cout << "Available prefixes:\n";
         std::cout << "  !...                - Execute everything after '!' in the console\n";
     }
@@ -422,6 +688,15 @@ namespace Huffpress {
         std::cout << "Target: " << filePath << std::endl;
         std::cout << "  Magic: " << file.header.magic << "\n";
         printf(      "  Version: %d.%d.%d\n", file.header.version[0], file.header.version[1], file.header.version[2]);
+        std::cout << "  Transforms: " << Huffpress::PipelineName(file.header.transforms) << "\n";
+        std::cout << "  Coding: ";
+        if (file.header.coding == Huffpress::Coding::Lz77) {
+            std::cout << "LZ77\n";
+        } else if (file.header.coding == Huffpress::Coding::ContextSplit) {
+            std::cout << "Huffman, " << file.header.tables.size() + 1 << " context tables\n";
+        } else {
+            std::cout << "Huffman\n";
+        }
         std::cout << "  FreqMapSize: " << file.header.freqMap.size() << "\n";
         std::cout << "  BitLength: " << file.header.bitLength << "\n";
         size_t sourceSize = file.Decompress().size();
@@ -490,4 +765,78 @@ namespace Huffpress {
 
         return data;
     }
-}
\ No newline at end of file
+
+    HUFFPRESS_CLI_API size_t HuffpressCLI::parseSize(const std::string& text) {
+        size_t end = 0;
+        unsigned long long value = std::stoull(text, &end);
+        std::string suffix = text.substr(end);
+        if (suffix == "K" || suffix == "k") value <<= 10;
+        else if (suffix == "M" || suffix == "m") value <<= 20;
+        else if (suffix == "G" || suffix == "g") value <<= 30;
+        else if (!suffix.empty()) throw std::invalid_argument("bad size " + text);
+        return static_cast<size_t>(value);
+    }
+
+    HUFFPRESS_CLI_API std::vector<std::string> HuffpressCLI::listFiles(const std::string& root) {
+        // Paths relative to root, in '/' notation; directory links are not followed
+        std::vector<std::string> files;
+        std::vector<std::string> pending(1, "");
+        while (!pending.empty()) {
+            std::string directory = pending.back();
+            pending.pop_back();
+            std::string base = directory.empty() ? root : root + "/" + directory;
+            std::string prefix = directory.empty() ? "" : directory + "/";
+#ifdef _WIN32
+            WIN32_FIND_DATAA entry;
+            HANDLE find = FindFirstFileA((base + "/*").c_str(), &entry);
+            if (find == INVALID_HANDLE_VALUE) {
+                throw std::ios_base::failure("Failed to open directory: " + base);
+            }
+            do {
+                std::string name = entry.cFileName;
+                if (name == "." || name == "..") continue;
+                if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                    if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) pending.push_back(prefix + name);
+                } else {
+                    files.push_back(prefix + name);
+                }
+            } while (FindNextFileA(find, &entry));
+            FindClose(find);
+#else
+            DIR* dir = opendir(base.c_str());
+            if (!dir) {
+                throw std::ios_base::failure("Failed to open directory: " + base);
+            }
+            while (dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name == "." || name == "..") continue;
+                struct stat info;
+                if (lstat((base + "/" + name).c_str(), &info) != 0) continue;
+                if (S_ISDIR(info.st_mode)) {
+                    pending.push_back(prefix + name);
+                } else if (S_ISREG(info.st_mode) || (S_ISLNK(info.st_mode) && stat((base + "/" + name).c_str(), &info) == 0 && S_ISREG(info.st_mode))) {
+                    files.push_back(prefix + name);
+                }
+            }
+            closedir(dir);
+#endif
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    HUFFPRESS_CLI_API void HuffpressCLI::makeDirectories(const std::string& path) {
+        for (size_t end = path.find('/', 1); ; end = path.find('/', end + 1)) {
+            std::string directory = path.substr(0, end);
+#ifdef _WIN32
+            int made = _mkdir(directory.c_str());
+#else
+            int made = mkdir(directory.c_str(), 0755);
+#endif
+            if (made != 0 && errno != EEXIST) {
+                throw std::ios_base::failure("Failed to create directory: " + directory);
+            }
+            if (end == std::string::npos) break;
+        }
+    }
+}
@@ -20,6 +20,10 @@ namespace Huffpress {
 
         HUFFPRESS_CLI_API void runCombine(int argc, char* argv[]);
 
+        // Non-interactive `compress`/`decompress`/`append` subcommands streaming between files or stdin/stdout
+        // Returns the process exit code
+        HUFFPRESS_CLI_API int runStream(int argc, char* argv[]);
+
     private:
         std::string filePath_;
         Huffpress::HuffpressFile file_;
@@ -48,6 +52,9 @@ namespace Huffpress {
         HUFFPRESS_CLI_API void handleRevert();
         HUFFPRESS_CLI_API void handleFile();
         HUFFPRESS_CLI_API void handleVersion();
+        HUFFPRESS_CLI_API void handleVerify(const std::vector<std::string>& tokens);
+        HUFFPRESS_CLI_API void handleAppend(const std::vector<std::string>& tokens);
+        HUFFPRESS_CLI_API void handleDirectory(const std::vector<std::string>& tokens, bool compress);
         // HUFFPRESS_CLI_API void handleRun();
         // HUFFPRESS_CLI_API void handleStop();
         
@@ -62,6 +69,9 @@ namespace Huffpress {
         HUFFPRESS_CLI_API void createOrClearFile(const std::string& filePath);
         HUFFPRESS_CLI_API void bufferedWrite(const std::string& filePath, const std::string& data, size_t bufferSize);
         HUFFPRESS_CLI_API std::string bufferedRead(const std::string& filePath, size_t bufferSize);
+        HUFFPRESS_CLI_API size_t parseSize(const std::string& text);
+        HUFFPRESS_CLI_API std::vector<std::string> listFiles(const std::string& root);
+        HUFFPRESS_CLI_API void makeDirectories(const std::string& path);
     };
 } // Huffpress
 #endif // HUFFPRESS_CLI_H
@@ -0,0 +1,336 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "context.h"
+#include "exceptions.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Huffpress {
+
+    namespace {
+        using Huffman::Byte;
+        using Histogram = std::array<std::uint64_t, 256>;
+
+        // Header bits of a table: its entry count, and the symbol and count of every entry
+        const double ContextTableBits = 8 * sizeof(size_t);
+        const double ContextEntryBits = 8 * (sizeof(Huffman::Char) + sizeof(Huffman::Int));
+        // Rounds of moving every context to the table that codes its bytes in the fewest bits
+        const int RefineRounds = 2;
+        // Decoded bytes are handed on in chunks of this many
+        const size_t ContextChunkSize = 64 * 1024;
+
+        // Counts below this take count * log2(count) from a table; merging contexts evaluates it millions of times
+        const size_t XLog2TableSize = 1 << 14;
+
+        double XLog2(std::uint64_t count) {
+            static const std::vector<double> table = []() {
+                std::vector<double> values(XLog2TableSize);
+                for (size_t value = 1; value < XLog2TableSize; ++value) values[value] = value * std::log2(static_cast<double>(value));
+                return values;
+            }();
+            return count < XLog2TableSize ? table[count] : static_cast<double>(count) * std::log2(static_cast<double>(count));
+        }
+
+        // Bits an order-0 code takes for the counts of a or of a and b together, estimated by their entropy, plus the
+        // header entry of its table
+        double ClusterCost(const Histogram& a, const Histogram* b = nullptr) {
+            std::uint64_t total = 0;
+            double sum = 0;
+            size_t symbols = 0;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                std::uint64_t count = a[symbol] + (b ? (*b)[symbol] : 0);
+                if (!count) continue;
+                total += count;
+                sum += XLog2(count);
+                ++symbols;
+            }
+            return total ? XLog2(total) - sum + ContextTableBits + symbols * ContextEntryBits : 0;
+        }
+
+        // Frequency map of counts; a lone symbol gets a partner so that it has a one-bit code, since every byte of the
+        // payload is decoded from its code
+        Huffman::FreqMap ContextTable(const Histogram& counts) {
+            Huffman::FreqMap freqMap;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                if (counts[symbol]) freqMap[static_cast<Huffman::Char>(symbol)] = static_cast<Huffman::Int>(std::min<std::uint64_t>(counts[symbol], std::numeric_limits<Huffman::Int>::max()));
+            }
+            if (freqMap.size() == 1) freqMap[static_cast<Huffman::Char>(static_cast<Byte>(freqMap.begin()->first) ^ 1)] = 1;
+            return freqMap;
+        }
+
+        // Cluster the contexts with any counts into at most maxTables tables and point map at them
+        // Every context starts as its own cluster; the pair whose merge costs the fewest bits is merged while there
+        // are too many clusters or a merge saves bits. Contexts are then moved to the cluster whose codes take the
+        // fewest bits for them, which the entropy estimate of the merges does not see
+        std::vector<Histogram> ClusterContexts(const std::vector<Histogram>& contexts, size_t maxTables, ContextMap& map) {
+            std::vector<Histogram> clusters(contexts);
+            std::vector<double> costs(256);
+            std::vector<bool> alive(256);
+            size_t count = 0;
+            for (int context = 0; context < 256; ++context) {
+                costs[context] = ClusterCost(clusters[context]);
+                alive[context] = costs[context] > 0;
+                map[context] = static_cast<std::uint8_t>(context);
+                if (alive[context]) ++count;
+            }
+
+            // Cost of merging every pair, kept up to date for the clusters a merge changes
+            std::vector<double> deltas(256 * 256);
+            for (int a = 0; a < 256; ++a) {
+                for (int b = a + 1; alive[a] && b < 256; ++b) {
+                    if (alive[b]) deltas[a * 256 + b] = ClusterCost(clusters[a], &clusters[b]) - costs[a] - costs[b];
+                }
+            }
+            while (count > 1) {
+                int bestA = -1, bestB = -1;
+                for (int a = 0; a < 256; ++a) {
+                    for (int b = a + 1; alive[a] && b < 256; ++b) {
+                        if (alive[b] && (bestA < 0 || deltas[a * 256 + b] < deltas[bestA * 256 + bestB])) {
+                            bestA = a;
+                            bestB = b;
+                        }
+                    }
+                }
+                if (count <= maxTables && deltas[bestA * 256 + bestB] >= 0) break;
+
+                for (int symbol = 0; symbol < 256; ++symbol) clusters[bestA][symbol] += clusters[bestB][symbol];
+                costs[bestA] = ClusterCost(clusters[bestA]);
+                alive[bestB] = false;
+                --count;
+                for (int context = 0; context < 256; ++context) {
+                    if (map[context] == bestB) map[context] = static_cast<std::uint8_t>(bestA);
+                }
+                for (int other = 0; other < 256; ++other) {
+                    if (!alive[other] || other == bestA) continue;
+                    int a = std::min(bestA, other), b = std::max(bestA, other);
+                    deltas[a * 256 + b] = ClusterCost(clusters[a], &clusters[b]) - costs[a] - costs[b];
+                }
+            }
+
+            std::vector<Histogram> result;
+            std::array<std::uint8_t, 256> number{};
+            for (int cluster = 0; cluster < 256; ++cluster) {
+                if (!alive[cluster]) continue;
+                number[cluster] = static_cast<std::uint8_t>(result.size());
+                result.push_back(clusters[cluster]);
+            }
+            for (int context = 0; context < 256; ++context) map[context] = number[map[context]];
+
+            for (int round = 0; round < RefineRounds && result.size() > 1; ++round) {
+                std::vector<Huffman::Encoder> encoders;
+                encoders.reserve(result.size());
+                for (const Histogram& cluster : result) encoders.emplace_back(ContextTable(cluster));
+
+                bool moved = false;
+                for (int context = 0; context < 256; ++context) {
+                    const Histogram& counts = contexts[context];
+                    size_t best = map[context];
+                    std::uint64_t bestBits = std::numeric_limits<std::uint64_t>::max();
+                    for (size_t cluster = 0; cluster < encoders.size(); ++cluster) {
+                        std::uint64_t bits = 0;
+                        for (int symbol = 0; symbol < 256 && bits <= bestBits; ++symbol) {
+                            if (!counts[symbol]) continue;
+                            if (!encoders[cluster].Knows(static_cast<Byte>(symbol))) {
+                                bits = std::numeric_limits<std::uint64_t>::max();
+                                break;
+                            }
+                            bits += counts[symbol] * encoders[cluster].Code(static_cast<Byte>(symbol)).length;
+                        }
+                        // Ties stay where they are
+                        if (bits < bestBits || (bits == bestBits && cluster == map[context])) {
+                            best = cluster;
+                            bestBits = bits;
+                        }
+                    }
+                    if (best != map[context]) {
+                        map[context] = static_cast<std::uint8_t>(best);
+                        moved = true;
+                    }
+                }
+                if (!moved) break;
+
+                // Recount the clusters from their contexts, dropping the ones left empty
+                std::vector<Histogram> recounted(result.size(), Histogram{});
+                for (int context = 0; context < 256; ++context) {
+                    for (int symbol = 0; symbol < 256; ++symbol) recounted[map[context]][symbol] += contexts[context][symbol];
+                }
+                result.clear();
+                number.fill(0);
+                for (size_t cluster = 0; cluster < recounted.size(); ++cluster) {
+                    if (ClusterCost(recounted[cluster]) == 0) continue;
+                    number[cluster] = static_cast<std::uint8_t>(result.size());
+                    result.push_back(recounted[cluster]);
+                }
+                for (int context = 0; context < 256; ++context) map[context] = number[map[context]];
+            }
+            return result;
+        }
+
+        // Read `count` raw bits, throwing if the payload ends first
+        std::uint64_t ReadContextBits(Huffman::BitReader& reader, unsigned count) {
+            reader.Refill();
+            if (reader.Position() + count > reader.BitLength()) {
+                throw Exceptions::DeserializationException("context-split payload ends inside its source size");
+            }
+            std::uint64_t value = reader.Peek() >> (64 - count);
+            reader.Skip(count);
+            return value;
+        }
+
+        // Decode a payload in chunks handed to onOutput, after onSize received its source size
+        // The size is only trusted once it is no larger than the bits left, as every byte takes at least one bit
+        template <typename OnSize, typename OnOutput>
+        void DecodeContexts(const Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& first, const std::vector<Huffman::FreqMap>& tables,
+                            const ContextMap& map, OnSize onSize, OnOutput onOutput) {
+            if (tables.size() >= MaxContextTables) {
+                throw Exceptions::DeserializationException("context-split payload has more than " + std::to_string(MaxContextTables) + " tables");
+            }
+            if (std::any_of(map.begin(), map.end(), [&tables](std::uint8_t table) { return table > tables.size(); })) {
+                throw Exceptions::DeserializationException("context map refers to a missing table");
+            }
+            if (bitLength == 0) return;
+
+            Huffman::BitReader reader(payload, size, bitLength);
+            std::uint64_t total = ReadContextBits(reader, 32) << 32;
+            total |= ReadContextBits(reader, 32);
+            if (total > reader.BitLength() - reader.Position()) {
+                throw Exceptions::DeserializationException("context-split source size does not match the payload");
+            }
+            onSize(static_cast<size_t>(total));
+
+            // The decode tables are built once per payload, then every byte costs one lookup of its context's table
+            std::vector<Huffman::Decoder> decoders;
+            decoders.reserve(tables.size());
+            for (const Huffman::FreqMap& table : tables) decoders.emplace_back(table);
+            const Huffman::Decoder* byContext[256];
+            for (int context = 0; context < 256; ++context) {
+                const Huffman::Decoder& decoder = map[context] ? decoders[map[context] - 1] : first;
+                if (total && (decoder.Empty() || decoder.Lone())) {
+                    throw Exceptions::DeserializationException("context-split payload uses a table without codes");
+                }
+                byContext[context] = &decoder;
+            }
+
+            Huffman::ScratchVector<char> chunk(static_cast<size_t>(std::min<std::uint64_t>(total, ContextChunkSize)));
+            Byte previous = 0;
+            for (std::uint64_t left = total; left > 0;) {
+                size_t count = static_cast<size_t>(std::min<std::uint64_t>(left, chunk.size()));
+                for (size_t pos = 0; pos < count; ++pos) {
+                    char symbol;
+                    if (!byContext[previous]->DecodeSymbol(reader, symbol)) {
+                        throw Exceptions::DeserializationException("context-split payload ends inside a code");
+                    }
+                    chunk[pos] = symbol;
+                    previous = static_cast<Byte>(symbol);
+                }
+                onOutput(chunk.data(), count);
+                left -= count;
+            }
+            if (reader.Position() != reader.BitLength()) {
+                throw Exceptions::DeserializationException("context-split payload has bits past its last code");
+            }
+        }
+
+        unsigned ContextMapBits(size_t tableCount) {
+            unsigned bits = 0;
+            while ((size_t(1) << bits) < tableCount) ++bits;
+            return bits;
+        }
+    }
+
+    HUFFPRESS_API size_t ContextMapSize(size_t tableCount) {
+        return 256 * ContextMapBits(tableCount) / 8;
+    }
+
+    HUFFPRESS_API void PackContextMap(const ContextMap& map, size_t tableCount, Huffman::Byte* out) {
+        const unsigned bits = ContextMapBits(tableCount);
+        std::fill(out, out + ContextMapSize(tableCount), 0);
+        for (size_t context = 0, pos = 0; context < map.size(); ++context) {
+            for (unsigned bit = 0; bit < bits; ++bit, ++pos) {
+                out[pos / 8] |= static_cast<Byte>(((map[context] >> bit) & 1) << (pos % 8));
+            }
+        }
+    }
+
+    HUFFPRESS_API bool UnpackContextMap(const Huffman::Byte* data, size_t tableCount, ContextMap& map) {
+        const unsigned bits = ContextMapBits(tableCount);
+        for (size_t context = 0, pos = 0; context < map.size(); ++context) {
+            unsigned value = 0;
+            for (unsigned bit = 0; bit < bits; ++bit, ++pos) value |= ((data[pos / 8] >> (pos % 8)) & 1u) << bit;
+            if (value >= tableCount) return false;
+            map[context] = static_cast<std::uint8_t>(value);
+        }
+        return true;
+    }
+
+    HUFFPRESS_API Huffman::ByteVector ContextCompress(const char* data, size_t size, const ContextOptions& options, Huffman::FreqMap& first,
+                                                      std::vector<Huffman::FreqMap>& tables, ContextMap& map, size_t& bitLength) {
+        if (options.maxTables == 0 || options.maxTables > MaxContextTables) {
+            throw std::invalid_argument("context-split tables must be between 1 and " + std::to_string(MaxContextTables));
+        }
+        const Byte* bytes = reinterpret_cast<const Byte*>(data);
+
+        std::vector<Histogram> contexts(256, Histogram{});
+        Byte previous = 0;
+        for (size_t pos = 0; pos < size; ++pos) {
+            contexts[previous][bytes[pos]]++;
+            previous = bytes[pos];
+        }
+
+        std::vector<Histogram> clusters = ClusterContexts(contexts, options.maxTables, map);
+        first.clear();
+        tables.clear();
+        if (clusters.empty()) {
+            map.fill(0);
+            bitLength = 0;
+            return Huffman::ByteVector();
+        }
+        first = ContextTable(clusters[0]);
+        for (size_t cluster = 1; cluster < clusters.size(); ++cluster) tables.push_back(ContextTable(clusters[cluster]));
+
+        std::vector<Huffman::Encoder> encoders;
+        encoders.reserve(clusters.size());
+        encoders.emplace_back(first);
+        for (const Huffman::FreqMap& table : tables) encoders.emplace_back(table);
+
+        // The stream starts with the 64-bit source size; the exact bit length sizes the output
+        bitLength = 64;
+        for (int context = 0; context < 256; ++context) {
+            const Huffman::Encoder& encoder = encoders[map[context]];
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                if (contexts[context][symbol]) bitLength += contexts[context][symbol] * encoder.Code(static_cast<Byte>(symbol)).length;
+            }
+        }
+
+        const Huffman::Encoder* byContext[256];
+        for (int context = 0; context < 256; ++context) byContext[context] = &encoders[map[context]];
+
+        Huffman::ByteVector payload((bitLength + 7) / 8);
+        Huffman::BitWriter writer(payload.data());
+        writer.Put(static_cast<std::uint64_t>(size), 64);
+        previous = 0;
+        for (size_t pos = 0; pos < size; ++pos) {
+            const Huffman::HuffmanCodeword& code = byContext[previous]->Code(bytes[pos]);
+            writer.Put(code.bits, code.length);
+            previous = bytes[pos];
+        }
+        writer.Flush();
+        return payload;
+    }
+
+    HUFFPRESS_API std::string ContextDecompress(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& first,
+                                                const std::vector<Huffman::FreqMap>& tables, const ContextMap& map) {
+        std::string out;
+        DecodeContexts(payload, size, bitLength, first, tables, map, [&out](size_t total) { out.reserve(total); },
+                       [&out](const char* data, size_t chunk) { out.append(data, chunk); });
+        return out;
+    }
+
+    HUFFPRESS_API void ContextDecode(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& first,
+                                     const std::vector<Huffman::FreqMap>& tables, const ContextMap& map, const Huffman::ChunkVisitor& onOutput) {
+        DecodeContexts(payload, size, bitLength, first, tables, map, [](size_t) {}, onOutput);
+    }
+} // Huffpress
@@ -0,0 +1,52 @@
+#ifndef HUFFPRESS_CONTEXT_H
+#define HUFFPRESS_CONTEXT_H
+
+#include "export.h"
+#include "huffman/huffman.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Huffpress {
+
+    // Tables a context-split payload codes with at most, so that a table number fits 4 bits
+    const size_t MaxContextTables = 16;
+
+    // Settings of the context-split coding
+    struct ContextOptions {
+        // Tables the previous-byte contexts are clustered into at most (1 to MaxContextTables); fewer are used when
+        // the saving of another table does not pay for its header entry
+        size_t maxTables = MaxContextTables;
+    };
+
+    // Table that codes the bytes following each byte value: 0 stands for freqMap, i for tables[i - 1]
+    // The first byte of the data follows byte value 0
+    using ContextMap = std::array<std::uint8_t, 256>;
+
+    // Bytes a context map takes in a header for `tableCount` tables in all: every entry takes as many bits as the
+    // largest table number needs, so a single table takes none
+    HUFFPRESS_API size_t ContextMapSize(size_t tableCount);
+    // Bytes a context map takes at most, with MaxContextTables tables
+    const size_t MaxContextMapSize = 256 * 4 / 8;
+    // Pack a context map into ContextMapSize(tableCount) bytes at out
+    HUFFPRESS_API void PackContextMap(const ContextMap& map, size_t tableCount, Huffman::Byte* out);
+    // Unpack ContextMapSize(tableCount) bytes; false if an entry is not below tableCount
+    HUFFPRESS_API bool UnpackContextMap(const Huffman::Byte* data, size_t tableCount, ContextMap& map);
+
+    // Code every byte with a table chosen by the byte before it (an order-1 model): the 256 contexts are clustered
+    // into up to options.maxTables tables by how alike their symbol counts are
+    // first receives table 0, tables the others and map the table of every context
+    HUFFPRESS_API Huffman::ByteVector ContextCompress(const char* data, size_t size, const ContextOptions& options, Huffman::FreqMap& first,
+                                                      std::vector<Huffman::FreqMap>& tables, ContextMap& map, size_t& bitLength);
+    // Decode a ContextCompress payload with a decoder of its first table, its other tables and its context map
+    // Throws DeserializationException on a payload ContextCompress cannot have produced
+    HUFFPRESS_API std::string ContextDecompress(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& first,
+                                                const std::vector<Huffman::FreqMap>& tables, const ContextMap& map);
+    // Decode a ContextCompress payload the same way, handing the source to onOutput in chunks as it is decoded
+    HUFFPRESS_API void ContextDecode(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& first,
+                                     const std::vector<Huffman::FreqMap>& tables, const ContextMap& map, const Huffman::ChunkVisitor& onOutput);
+} // Huffpress
+
+#endif // HUFFPRESS_CONTEXT_H
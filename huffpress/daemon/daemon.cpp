@@ -0,0 +1,406 @@
+#define HUFFPRESS_DAEMON_LIBRARY_BUILD
+
+#include "daemon.h"
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace Huffpress {
+
+    namespace {
+        // Operation or status, then the payload size
+        const size_t FrameHeaderSize = 1 + sizeof(std::uint64_t);
+
+#ifdef MSG_NOSIGNAL
+        const int SendFlags = MSG_NOSIGNAL;
+#else
+        const int SendFlags = 0;
+#endif
+
+        std::string SystemError(const std::string& what) {
+            return what + ": " + std::strerror(errno);
+        }
+
+        sockaddr_un SocketAddress(const std::string& socketPath) {
+            sockaddr_un address;
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+                throw Exceptions::DaemonException("socket path must be 1 to " + std::to_string(sizeof(address.sun_path) - 1) + " characters: " + socketPath);
+            }
+            std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+            return address;
+        }
+
+        // Read exactly size bytes; false if the peer closed the connection before the first byte
+        bool ReadFully(int fd, void* data, size_t size) {
+            char* out = static_cast<char*>(data);
+            size_t done = 0;
+            while (done < size) {
+                ssize_t got = ::recv(fd, out + done, size - done, 0);
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0) throw Exceptions::DaemonException(SystemError("receive failed"));
+                if (got == 0) {
+                    if (done == 0) return false;
+                    throw Exceptions::DaemonException("connection closed in the middle of a message");
+                }
+                done += static_cast<size_t>(got);
+            }
+            return true;
+        }
+
+        void WriteFully(int fd, const void* data, size_t size) {
+            const char* in = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t sent = ::send(fd, in, size, SendFlags);
+                if (sent < 0 && errno == EINTR) continue;
+                if (sent < 0) throw Exceptions::DaemonException(SystemError("send failed"));
+                in += sent;
+                size -= static_cast<size_t>(sent);
+            }
+        }
+
+        void WriteFrame(int fd, std::uint8_t kind, const void* payload, size_t size) {
+            char header[FrameHeaderSize];
+            std::uint64_t size64 = size;
+            header[0] = static_cast<char>(kind);
+            std::memcpy(header + 1, &size64, sizeof(size64));
+            WriteFully(fd, header, sizeof(header));
+            if (size > 0) WriteFully(fd, payload, size);
+        }
+
+        // Read the kind and size of the next frame; false at the end of the connection
+        bool ReadFrameHeader(int fd, std::uint8_t& kind, std::uint64_t& size) {
+            char header[FrameHeaderSize];
+            if (!ReadFully(fd, header, sizeof(header))) return false;
+            kind = static_cast<std::uint8_t>(header[0]);
+            std::memcpy(&size, header + 1, sizeof(size));
+            return true;
+        }
+
+        // Frequency map as a string key for the decoder cache
+        std::string TableKey(const Huffman::FreqMap& freqMap) {
+            std::string key;
+            key.reserve(freqMap.size() * (sizeof(Huffman::Char) + sizeof(Huffman::Int)));
+            for (const auto& pair : freqMap) {
+                key.append(reinterpret_cast<const char*>(&pair.first), sizeof(pair.first));
+                key.append(reinterpret_cast<const char*>(&pair.second), sizeof(pair.second));
+            }
+            return key;
+        }
+
+        // Header and compressed checksum checks of HuffpressFile::Verify, which builds no decoder without the source check
+        void CheckRecord(HuffpressFile& file, const Huffman::ByteVector& record) {
+            file.ParseFromBuffer(record);
+            VerifyResult result = file.Verify(false);
+            if (!result.headerValid) throw Exceptions::DeserializationException(result.error);
+            if (!result.compressedChecksumValid) throw Exceptions::ChecksumMismatchException("compressed data");
+        }
+    }
+
+    HUFFPRESS_DAEMON_API DaemonServer::DaemonServer(const std::string& socketPath, DaemonOptions options)
+        : socketPath_(socketPath), options_(options) {
+        sockaddr_un address = SocketAddress(socketPath);
+
+        // A socket file left behind by a daemon that is gone is replaced, anything else at the path is not touched
+        struct stat info;
+        if (::lstat(socketPath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            bool alive = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+            if (probe >= 0) ::close(probe);
+            if (alive) throw Exceptions::DaemonException("a daemon is already listening on " + socketPath);
+            ::unlink(socketPath.c_str());
+        }
+
+        this->listen_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (this->listen_ < 0) throw Exceptions::DaemonException(SystemError("cannot create a socket"));
+        if (::bind(this->listen_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(this->listen_, SOMAXCONN) != 0) {
+            std::string error = SystemError("cannot listen on " + socketPath);
+            ::close(this->listen_);
+            throw Exceptions::DaemonException(error);
+        }
+        if (::pipe(this->wake_) != 0) {
+            std::string error = SystemError("cannot create a pipe");
+            ::close(this->listen_);
+            ::unlink(socketPath.c_str());
+            throw Exceptions::DaemonException(error);
+        }
+        ::fcntl(this->wake_[1], F_SETFL, O_NONBLOCK);
+
+        unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        this->executor_.reset(new AsyncExecutor(threads, SOMAXCONN));
+    }
+
+    HUFFPRESS_DAEMON_API DaemonServer::~DaemonServer() {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->stopping_ = true;
+            for (int connection : this->connections_) ::shutdown(connection, SHUT_RDWR);
+        }
+        // Queued connections still start, see the shutdown socket and close it
+        this->executor_.reset();
+
+        ::close(this->listen_);
+        ::close(this->wake_[0]);
+        ::close(this->wake_[1]);
+        ::unlink(this->socketPath_.c_str());
+    }
+
+    HUFFPRESS_DAEMON_API void DaemonServer::Serve() {
+        for (;;) {
+            pollfd fds[2] = {{this->listen_, POLLIN, 0}, {this->wake_[0], POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                throw Exceptions::DaemonException(SystemError("poll failed"));
+            }
+            if (fds[1].revents) break;
+
+            int connection = ::accept(this->listen_, nullptr, nullptr);
+            if (connection < 0) continue;
+
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->stopping_) {
+                    ::close(connection);
+                    break;
+                }
+                this->connections_.insert(connection);
+                this->connectionCount_++;
+            }
+            // Posted without the lock: a full queue blocks until a worker is done with a connection, and workers
+            // take the lock to remove their connection
+            this->executor_->Post([this, connection]() { this->ServeConnection(connection); });
+        }
+
+        // Wake up the workers blocked on their connections and wait until all connections are closed
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->stopping_ = true;
+        for (int connection : this->connections_) ::shutdown(connection, SHUT_RDWR);
+        this->closed_.wait(lock, [this]() { return this->connections_.empty(); });
+    }
+
+    HUFFPRESS_DAEMON_API void DaemonServer::Stop() {
+        // Only a write, so that a signal handler may call it
+        char byte = 0;
+        ssize_t written = ::write(this->wake_[1], &byte, 1);
+        (void)written;
+    }
+
+    HUFFPRESS_DAEMON_API DaemonStats DaemonServer::Stats() const {
+        DaemonStats stats;
+        stats.connections = this->connectionCount_;
+        stats.requests = this->requests_;
+        stats.errors = this->errors_;
+        stats.tableHits = this->tableHits_;
+        stats.tableMisses = this->tableMisses_;
+        return stats;
+    }
+
+    void DaemonServer::ServeConnection(int connection) {
+        // Every worker keeps its arena between requests, so warm workers do not go back to the heap for scratch memory
+        static thread_local Huffman::ArenaAllocator arena;
+
+        try {
+            std::uint8_t op = 0;
+            std::uint64_t size = 0;
+            Huffman::ByteVector payload;
+            while (ReadFrameHeader(connection, op, size)) {
+                this->requests_++;
+                if (size > this->options_.maxRequestSize) {
+                    this->errors_++;
+                    std::string error = "request of " + std::to_string(size) + " bytes exceeds the limit of " + std::to_string(this->options_.maxRequestSize);
+                    WriteFrame(connection, 1, error.data(), error.size());
+                    break;
+                }
+                payload.resize(static_cast<size_t>(size));
+                if (size > 0 && !ReadFully(connection, payload.data(), payload.size())) break;
+
+                Huffman::ByteVector response;
+                std::string error;
+                try {
+                    Huffman::AllocatorScope scope(arena);
+                    response = this->Handle(static_cast<DaemonOp>(op), payload);
+                } catch (const std::exception& e) {
+                    error = e.what();
+                }
+
+                if (error.empty()) {
+                    WriteFrame(connection, 0, response.data(), response.size());
+                } else {
+                    this->errors_++;
+                    WriteFrame(connection, 1, error.data(), error.size());
+                }
+            }
+        } catch (const std::exception&) {
+            // A broken connection only ends itself
+        }
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        ::close(connection);
+        this->connections_.erase(connection);
+        this->closed_.notify_all();
+    }
+
+    Huffman::ByteVector DaemonServer::Handle(DaemonOp op, const Huffman::ByteVector& payload) {
+        Huffman::ByteVector response;
+        switch (op) {
+        case DaemonOp::Ping:
+            return response;
+
+        case DaemonOp::Compress: {
+            HuffpressFile file;
+            file.Init(std::string(payload.begin(), payload.end()), this->options_.requestThreads);
+            file.SerializeToBuffer(response);
+            return response;
+        }
+
+        case DaemonOp::Decompress: {
+            HuffpressFile file;
+            CheckRecord(file, payload);
+            std::string data;
+            if (file.header.Plain()) {
+                std::shared_ptr<const Huffman::Decoder> decoder = this->DecoderFor(file.header.freqMap);
+                data = decoder->Decompress(file.byteVec.data(), file.byteVec.size(), file.header.bitLength, this->options_.requestThreads);
+            } else {
+                data = file.Decompress(this->options_.requestThreads);
+            }
+            if (checksum(data.data(), data.size()) != file.header.sourceChecksum) {
+                throw Exceptions::ChecksumMismatchException("source data");
+            }
+            response.assign(data.begin(), data.end());
+            return response;
+        }
+
+        case DaemonOp::Verify:
+        case DaemonOp::VerifyHeader: {
+            VerifyResult result;
+            HuffpressFile file;
+            try {
+                file.ParseFromBuffer(payload);
+                result = file.Verify(false);
+            } catch (const std::exception& e) {
+                result.error = e.what();
+            }
+
+            if (result.Ok() && op == DaemonOp::Verify && !file.header.Plain()) {
+                // The cached decoders only serve plain payloads, the others take the full check
+                result = file.Verify(true);
+            } else if (result.Ok() && op == DaemonOp::Verify) {
+                checksum_t sourceChecksum = CHECKSUM_INIT;
+                this->DecoderFor(file.header.freqMap)->Decode(file.byteVec.data(), file.byteVec.size(), file.header.bitLength,
+                    [&sourceChecksum](const char* chunk, size_t size) { sourceChecksum = checksum_update(sourceChecksum, chunk, size); });
+                result.sourceChecked = true;
+                result.sourceChecksumValid = sourceChecksum == file.header.sourceChecksum;
+                if (!result.sourceChecksumValid) result.error = "source checksum mismatch";
+            }
+
+            response.push_back(result.headerValid);
+            response.push_back(result.compressedChecksumValid);
+            response.push_back(result.sourceChecked);
+            response.push_back(result.sourceChecksumValid);
+            response.insert(response.end(), result.error.begin(), result.error.end());
+            return response;
+        }
+        }
+        throw Exceptions::DaemonException("unknown operation " + std::to_string(static_cast<unsigned>(op)));
+    }
+
+    std::shared_ptr<const Huffman::Decoder> DaemonServer::DecoderFor(const Huffman::FreqMap& freqMap) {
+        std::string key = TableKey(freqMap);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            auto found = this->decoderIndex_.find(key);
+            if (found != this->decoderIndex_.end()) {
+                this->decoders_.splice(this->decoders_.begin(), this->decoders_, found->second);
+                this->tableHits_++;
+                return found->second->second;
+            }
+        }
+
+        // Built outside the lock; two workers missing the same table at once both build it
+        this->tableMisses_++;
+        std::shared_ptr<const Huffman::Decoder> decoder = std::make_shared<const Huffman::Decoder>(freqMap);
+        if (this->options_.cachedTables == 0) return decoder;
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->decoderIndex_.count(key) == 0) {
+            this->decoders_.emplace_front(key, decoder);
+            this->decoderIndex_[key] = this->decoders_.begin();
+            if (this->decoders_.size() > this->options_.cachedTables) {
+                this->decoderIndex_.erase(this->decoders_.back().first);
+                this->decoders_.pop_back();
+            }
+        }
+        return decoder;
+    }
+
+    HUFFPRESS_DAEMON_API DaemonClient::DaemonClient(const std::string& socketPath) : socketPath_(socketPath) {
+        sockaddr_un address = SocketAddress(socketPath);
+        this->socket_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (this->socket_ < 0) throw Exceptions::DaemonException(SystemError("cannot create a socket"));
+        if (::connect(this->socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            std::string error = SystemError("cannot connect to " + socketPath);
+            ::close(this->socket_);
+            throw Exceptions::DaemonException(error);
+        }
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        ::setsockopt(this->socket_, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    }
+
+    HUFFPRESS_DAEMON_API DaemonClient::~DaemonClient() {
+        if (this->socket_ >= 0) ::close(this->socket_);
+    }
+
+    HUFFPRESS_DAEMON_API void DaemonClient::Ping() {
+        this->Call(DaemonOp::Ping, nullptr, 0);
+    }
+
+    HUFFPRESS_DAEMON_API Huffman::ByteVector DaemonClient::Compress(const std::string& data) {
+        return this->Call(DaemonOp::Compress, data.data(), data.size());
+    }
+
+    HUFFPRESS_DAEMON_API std::string DaemonClient::Decompress(const Huffman::ByteVector& record) {
+        Huffman::ByteVector data = this->Call(DaemonOp::Decompress, record.data(), record.size());
+        return std::string(data.begin(), data.end());
+    }
+
+    HUFFPRESS_DAEMON_API VerifyResult DaemonClient::Verify(const Huffman::ByteVector& record, bool checkSource) {
+        Huffman::ByteVector response = this->Call(checkSource ? DaemonOp::Verify : DaemonOp::VerifyHeader, record.data(), record.size());
+        if (response.size() < 4) throw Exceptions::DaemonException("malformed verify response");
+
+        VerifyResult result;
+        result.headerValid = response[0] != 0;
+        result.compressedChecksumValid = response[1] != 0;
+        result.sourceChecked = response[2] != 0;
+        result.sourceChecksumValid = response[3] != 0;
+        result.error.assign(response.begin() + 4, response.end());
+        return result;
+    }
+
+    Huffman::ByteVector DaemonClient::Call(DaemonOp op, const void* payload, size_t size) {
+        WriteFrame(this->socket_, static_cast<std::uint8_t>(op), payload, size);
+
+        std::uint8_t status = 0;
+        std::uint64_t responseSize = 0;
+        if (!ReadFrameHeader(this->socket_, status, responseSize)) {
+            throw Exceptions::DaemonException("the daemon at " + this->socketPath_ + " closed the connection");
+        }
+        Huffman::ByteVector response(static_cast<size_t>(responseSize));
+        if (responseSize > 0 && !ReadFully(this->socket_, response.data(), response.size())) {
+            throw Exceptions::DaemonException("the daemon at " + this->socketPath_ + " closed the connection");
+        }
+        if (status != 0) throw Exceptions::DaemonException(std::string(response.begin(), response.end()));
+        return response;
+    }
+} // Huffpress
@@ -0,0 +1,133 @@
+#ifndef HUFFPRESS_DAEMON_H
+#define HUFFPRESS_DAEMON_H
+
+#include "export.h"
+#include "../huffpress.h"
+#include "../async.h"
+
+#include <map>
+#include <list>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+
+namespace Huffpress {
+
+    // Requests understood by the daemon
+    // Every request is the operation (1 byte), the payload size (8 bytes) and the payload; every response is a status
+    // (1 byte, 0 for success), the payload size (8 bytes) and the payload, or the error message when the status is not 0
+    enum class DaemonOp : std::uint8_t {
+        // Empty payload and response
+        Ping = 0,
+        // Data in, the complete Huffpress record (as SerializeToBuffer writes it) out
+        Compress = 1,
+        // Huffpress record in, data out; both checksums are checked
+        Decompress = 2,
+        // Huffpress record in, the flags of a VerifyResult (4 bytes) and its error message out
+        Verify = 3,
+        // Same as Verify, without decoding the payload
+        VerifyHeader = 4,
+    };
+
+    struct DaemonOptions {
+        // Connections served at once (all hardware threads for 0), later ones wait for a free worker
+        unsigned threads = 0;
+        // Threads a single compression or decompression may use
+        unsigned requestThreads = 1;
+        // Decoders kept for reuse, keyed by their frequency map
+        size_t cachedTables = 64;
+        // Requests with a larger payload are refused and their connection closed
+        std::uint64_t maxRequestSize = std::uint64_t(1) << 30;
+    };
+
+    struct DaemonStats {
+        std::uint64_t connections = 0;
+        std::uint64_t requests = 0;
+        std::uint64_t errors = 0;
+        // Decompress and verify requests that found their decoder built already
+        std::uint64_t tableHits = 0;
+        std::uint64_t tableMisses = 0;
+    };
+
+    // Serves compression requests on a Unix domain socket
+    // Each connection is served by a worker of a fixed pool, which keeps its arena allocator between requests, and
+    // decoders are shared by all workers, so repeated requests skip the setup a fresh process pays for every job
+    class HUFFPRESS_DAEMON_API DaemonServer
+    {
+    public:
+        // Listen on socketPath, replacing a stale socket file (throws DaemonException)
+        HUFFPRESS_DAEMON_API explicit DaemonServer(const std::string& socketPath, DaemonOptions options = DaemonOptions());
+        // Stop serving and remove the socket file
+        HUFFPRESS_DAEMON_API ~DaemonServer();
+
+        DaemonServer(const DaemonServer&) = delete;
+        DaemonServer& operator=(const DaemonServer&) = delete;
+
+        // Accept connections until Stop, then close the open connections and wait for their workers
+        HUFFPRESS_DAEMON_API void Serve();
+        // Make Serve return; may be called from any thread and from a signal handler
+        HUFFPRESS_DAEMON_API void Stop();
+
+        HUFFPRESS_DAEMON_API DaemonStats Stats() const;
+
+    private:
+        void ServeConnection(int connection);
+        Huffman::ByteVector Handle(DaemonOp op, const Huffman::ByteVector& payload);
+        std::shared_ptr<const Huffman::Decoder> DecoderFor(const Huffman::FreqMap& freqMap);
+
+        std::string socketPath_;
+        DaemonOptions options_;
+        int listen_ = -1;
+        // Self-pipe that wakes Serve up when Stop is called
+        int wake_[2] = {-1, -1};
+
+        mutable std::mutex mutex_;
+        std::condition_variable closed_;
+        std::set<int> connections_;
+        bool stopping_ = false;
+
+        // Decoders by frequency map, most recently used first
+        std::list<std::pair<std::string, std::shared_ptr<const Huffman::Decoder>>> decoders_;
+        std::map<std::string, decltype(decoders_)::iterator> decoderIndex_;
+
+        std::atomic<std::uint64_t> connectionCount_{0};
+        std::atomic<std::uint64_t> requests_{0};
+        std::atomic<std::uint64_t> errors_{0};
+        std::atomic<std::uint64_t> tableHits_{0};
+        std::atomic<std::uint64_t> tableMisses_{0};
+
+        // Last, so that its workers are joined before anything they use goes away
+        std::unique_ptr<AsyncExecutor> executor_;
+    };
+
+    // Connection to a DaemonServer; requests on one client are sent one at a time (use a client per thread)
+    class HUFFPRESS_DAEMON_API DaemonClient
+    {
+    public:
+        // Connect to the daemon at socketPath (throws DaemonException)
+        HUFFPRESS_DAEMON_API explicit DaemonClient(const std::string& socketPath);
+        HUFFPRESS_DAEMON_API ~DaemonClient();
+
+        DaemonClient(const DaemonClient&) = delete;
+        DaemonClient& operator=(const DaemonClient&) = delete;
+
+        HUFFPRESS_DAEMON_API void Ping();
+        // Compress data into a complete Huffpress record
+        HUFFPRESS_DAEMON_API Huffman::ByteVector Compress(const std::string& data);
+        // Decompress a Huffpress record, throws DaemonException with the daemon's error (a bad checksum, a malformed record)
+        HUFFPRESS_DAEMON_API std::string Decompress(const Huffman::ByteVector& record);
+        // Same checks as HuffpressFile::Verify
+        HUFFPRESS_DAEMON_API VerifyResult Verify(const Huffman::ByteVector& record, bool checkSource = true);
+
+    private:
+        Huffman::ByteVector Call(DaemonOp op, const void* payload, size_t size);
+
+        std::string socketPath_;
+        int socket_ = -1;
+    };
+} // Huffpress
+#endif // HUFFPRESS_DAEMON_H
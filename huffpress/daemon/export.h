@@ -0,0 +1,21 @@
+#ifndef HUFFPRESS_DAEMON_EXPORT_H
+#define HUFFPRESS_DAEMON_EXPORT_H
+
+// Static builds (the amalgamated library) export nothing
+#if defined(HUFFPRESS_STATIC)
+#define HUFFPRESS_DAEMON_API
+#elif defined(_WIN32) || defined(_WIN64)
+#ifdef HUFFPRESS_DAEMON_LIBRARY_BUILD
+#define HUFFPRESS_DAEMON_API __declspec(dllexport)
+#else
+#define HUFFPRESS_DAEMON_API __declspec(dllimport)
+#endif
+#else
+#ifdef HUFFPRESS_DAEMON_LIBRARY_BUILD
+#define HUFFPRESS_DAEMON_API  __attribute__((visibility("default")))
+#else
+#define HUFFPRESS_DAEMON_API
+#endif
+#endif
+
+#endif // HUFFPRESS_DAEMON_EXPORT_H
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define HUFFPRESS_EXCEPTIONS
 
 #include <stdexcept>
+#include <string>
 
 namespace Huffpress
 {
@@ -34,6 +35,36 @@ namespace Huffpress
             explicit DeserializationException(const std::string& message) 
                 : HuffpressException("Deserialization error: " + message) {}
         };
+
+        class ChecksumMismatchException : public HuffpressException {
+        public:
+            explicit ChecksumMismatchException(const std::string& message) 
+                : HuffpressException("Checksum mismatch: " + message) {}
+        };
+
+        class CancelledException : public HuffpressException {
+        public:
+            explicit CancelledException(const std::string& operation)
+                : HuffpressException("Cancelled: " + operation) {}
+        };
+
+        class QueueFullException : public HuffpressException {
+        public:
+            explicit QueueFullException(size_t capacity)
+                : HuffpressException("Executor queue is full: " + std::to_string(capacity) + " jobs pending") {}
+        };
+
+        class EntryNotFoundException : public HuffpressException {
+        public:
+            explicit EntryNotFoundException(const std::string& name)
+                : HuffpressException("Archive entry not found: " + name) {}
+        };
+
+        class DaemonException : public HuffpressException {
+        public:
+            explicit DaemonException(const std::string& message)
+                : HuffpressException("Daemon error: " + message) {}
+        };
     } // namespace Exceptions
 } // namespace Huffpress
 
@@ -1,7 +1,10 @@
 #ifndef HUFFPRESS_EXPORT_H
 #define HUFFPRESS_EXPORT_H
 
-#if defined(_WIN32) || defined(_WIN64)
+// Static builds (the amalgamated library) export nothing
+#if defined(HUFFPRESS_STATIC)
+#define HUFFPRESS_API
+#elif defined(_WIN32) || defined(_WIN64)
 #ifdef HUFFPRESS_LIBRARY_BUILD
 #define HUFFPRESS_API __declspec(dllexport)
 #else
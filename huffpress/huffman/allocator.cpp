@@ -0,0 +1,140 @@
+#define HUFFMAN_LIBRARY_BUILD
+
+#include "allocator.h"
+#include <new>
+#include <algorithm>
+
+namespace Huffman {
+
+    namespace {
+        HeapAllocator& DefaultAllocator() {
+            static HeapAllocator heap;
+            return heap;
+        }
+
+        thread_local Allocator* currentAllocator = nullptr;
+
+        void RaisePeak(std::atomic<size_t>& peak, size_t usage) {
+            size_t seen = peak.load(std::memory_order_relaxed);
+            while (seen < usage && !peak.compare_exchange_weak(seen, usage, std::memory_order_relaxed)) {}
+        }
+    }
+
+    HUFFMAN_API void* HeapAllocator::Allocate(size_t size, size_t alignment) {
+        // Global operator new is suitably aligned for every fundamental type the library allocates
+        (void)alignment;
+        void* ptr = ::operator new(size);
+        RaisePeak(this->peak_, this->usage_.fetch_add(size, std::memory_order_relaxed) + size);
+        return ptr;
+    }
+
+    HUFFMAN_API void HeapAllocator::Deallocate(void* ptr, size_t size) {
+        if (!ptr) return;
+        ::operator delete(ptr);
+        this->usage_.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    HUFFMAN_API size_t HeapAllocator::Usage() const {
+        return this->usage_.load(std::memory_order_relaxed);
+    }
+
+    HUFFMAN_API size_t HeapAllocator::PeakUsage() const {
+        return this->peak_.load(std::memory_order_relaxed);
+    }
+
+    HUFFMAN_API ArenaAllocator::ArenaAllocator(size_t blockSize, size_t limit)
+        : blockSize_(std::max<size_t>(blockSize, 4096)), limit_(limit) {}
+
+    HUFFMAN_API ArenaAllocator::~ArenaAllocator() {
+        this->Release();
+    }
+
+    HUFFMAN_API void* ArenaAllocator::Allocate(size_t size, size_t alignment) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+
+        if (this->limit_ && this->usage_ + size > this->limit_) {
+            throw std::bad_alloc();
+        }
+
+        while (true) {
+            if (this->current_ < this->blocks_.size()) {
+                Block& block = this->blocks_[this->current_];
+                size_t aligned = (this->offset_ + alignment - 1) / alignment * alignment;
+                if (aligned + size <= block.size) {
+                    this->offset_ = aligned + size;
+                    this->usage_ += size;
+                    this->peak_ = std::max(this->peak_, this->usage_);
+                    return block.data + aligned;
+                }
+                // Blocks kept from before a reset may be too small, move on to the next one
+                if (this->current_ + 1 < this->blocks_.size()) {
+                    ++this->current_;
+                    this->offset_ = 0;
+                    continue;
+                }
+            }
+
+            Block block;
+            block.size = std::max(this->blockSize_, size + alignment);
+            block.data = static_cast<unsigned char*>(::operator new(block.size));
+            this->blocks_.push_back(block);
+            this->current_ = this->blocks_.size() - 1;
+            this->offset_ = 0;
+        }
+    }
+
+    HUFFMAN_API void ArenaAllocator::Deallocate(void*, size_t) {}
+
+    HUFFMAN_API size_t ArenaAllocator::Usage() const {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return this->usage_;
+    }
+
+    HUFFMAN_API size_t ArenaAllocator::PeakUsage() const {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return this->peak_;
+    }
+
+    HUFFMAN_API void ArenaAllocator::Reset() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->current_ = 0;
+        this->offset_ = 0;
+        this->usage_ = 0;
+    }
+
+    HUFFMAN_API void ArenaAllocator::Release() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (Block& block : this->blocks_) {
+            ::operator delete(block.data);
+        }
+        this->blocks_.clear();
+        this->current_ = 0;
+        this->offset_ = 0;
+        this->usage_ = 0;
+    }
+
+    HUFFMAN_API size_t ArenaAllocator::Reserved() const {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        size_t reserved = 0;
+        for (const Block& block : this->blocks_) {
+            reserved += block.size;
+        }
+        return reserved;
+    }
+
+    HUFFMAN_API Allocator& CurrentAllocator() {
+        return currentAllocator ? *currentAllocator : DefaultAllocator();
+    }
+
+    HUFFMAN_API AllocatorScope::AllocatorScope(Allocator& allocator, bool resetOnExit)
+        : previous_(currentAllocator), allocator_(&allocator), resetOnExit_(resetOnExit) {
+        currentAllocator = &allocator;
+    }
+
+    HUFFMAN_API AllocatorScope::~AllocatorScope() {
+        currentAllocator = this->previous_;
+        if (this->resetOnExit_) {
+            this->allocator_->Reset();
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef HUFFMAN_ALLOCATOR_H
+#define HUFFMAN_ALLOCATOR_H
+
+#include "export.h"
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+namespace Huffman {
+
+    // Source of the memory the library uses internally (trees, tables and scratch buffers)
+    // Results handed back to the caller (ByteVector, std::string) keep using the standard allocator
+    class HUFFMAN_API Allocator {
+    public:
+        virtual ~Allocator() = default;
+
+        // Allocate size bytes aligned to alignment (throws std::bad_alloc)
+        virtual void* Allocate(size_t size, size_t alignment) = 0;
+        // Return memory obtained from Allocate with the same size
+        virtual void Deallocate(void* ptr, size_t size) = 0;
+        // Bytes currently handed out
+        virtual size_t Usage() const = 0;
+        // Largest Usage() seen so far
+        virtual size_t PeakUsage() const = 0;
+        // Forget everything allocated so far where the allocator supports it
+        virtual void Reset() {}
+    };
+
+    // Global operator new/delete with usage accounting, the default for every thread
+    class HUFFMAN_API HeapAllocator : public Allocator {
+    public:
+        HUFFMAN_API void* Allocate(size_t size, size_t alignment) override;
+        HUFFMAN_API void Deallocate(void* ptr, size_t size) override;
+        HUFFMAN_API size_t Usage() const override;
+        HUFFMAN_API size_t PeakUsage() const override;
+
+    private:
+        std::atomic<size_t> usage_{0};
+        std::atomic<size_t> peak_{0};
+    };
+
+    // Bump allocator carving memory out of large blocks
+    // Deallocate is a no-op; Reset makes all blocks available again without returning them to the heap
+    class HUFFMAN_API ArenaAllocator : public Allocator {
+    public:
+        // limit caps Usage() between resets (0 for no limit), exceeding it throws std::bad_alloc
+        HUFFMAN_API explicit ArenaAllocator(size_t blockSize = 1 << 20, size_t limit = 0);
+        HUFFMAN_API ~ArenaAllocator() override;
+
+        ArenaAllocator(const ArenaAllocator&) = delete;
+        ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+        HUFFMAN_API void* Allocate(size_t size, size_t alignment) override;
+        HUFFMAN_API void Deallocate(void* ptr, size_t size) override;
+        HUFFMAN_API size_t Usage() const override;
+        HUFFMAN_API size_t PeakUsage() const override;
+
+        // Forget every allocation, keeping the blocks for reuse
+        HUFFMAN_API void Reset() override;
+        // Forget every allocation and free the blocks
+        HUFFMAN_API void Release();
+        // Bytes held in blocks
+        HUFFMAN_API size_t Reserved() const;
+
+    private:
+        struct Block {
+            unsigned char* data;
+            size_t size;
+        };
+
+        mutable std::mutex mutex_;
+        std::vector<Block> blocks_;
+        size_t current_ = 0;
+        size_t offset_ = 0;
+        size_t blockSize_;
+        size_t limit_;
+        size_t usage_ = 0;
+        size_t peak_ = 0;
+    };
+
+    // The allocator of the calling thread
+    HUFFMAN_API Allocator& CurrentAllocator();
+
+    // Makes an allocator current for the calling thread while the scope lives
+    // The allocator is reset when the scope ends unless told otherwise, giving reset-per-operation semantics
+    class HUFFMAN_API AllocatorScope {
+    public:
+        HUFFMAN_API explicit AllocatorScope(Allocator& allocator, bool resetOnExit = true);
+        HUFFMAN_API ~AllocatorScope();
+
+        AllocatorScope(const AllocatorScope&) = delete;
+        AllocatorScope& operator=(const AllocatorScope&) = delete;
+
+    private:
+        Allocator* previous_;
+        Allocator* allocator_;
+        bool resetOnExit_;
+    };
+
+    // Standard library adaptor over the allocator that was current when the container was created
+    template <typename T>
+    struct StlAllocator {
+        using value_type = T;
+
+        Allocator* allocator;
+
+        StlAllocator() : allocator(&CurrentAllocator()) {}
+        explicit StlAllocator(Allocator& allocator) : allocator(&allocator) {}
+        template <typename U>
+        StlAllocator(const StlAllocator<U>& other) : allocator(other.allocator) {}
+
+        T* allocate(size_t n) { return static_cast<T*>(allocator->Allocate(n * sizeof(T), alignof(T))); }
+        void deallocate(T* ptr, size_t n) { allocator->Deallocate(ptr, n * sizeof(T)); }
+
+        template <typename U>
+        bool operator==(const StlAllocator<U>& other) const { return allocator == other.allocator; }
+        template <typename U>
+        bool operator!=(const StlAllocator<U>& other) const { return allocator != other.allocator; }
+    };
+
+    template <typename T>
+    using ScratchVector = std::vector<T, StlAllocator<T>>;
+    using ScratchString = std::basic_string<char, std::char_traits<char>, StlAllocator<char>>;
+}
+
+#endif // HUFFMAN_ALLOCATOR_H
@@ -0,0 +1,175 @@
+#ifndef HUFFMAN_BITIO_H
+#define HUFFMAN_BITIO_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+namespace Huffman {
+
+    namespace Bits {
+        inline std::uint64_t ByteSwap(std::uint64_t value) {
+#if defined(_MSC_VER)
+            return _byteswap_uint64(value);
+#else
+            return __builtin_bswap64(value);
+#endif
+        }
+
+        inline std::uint32_t ByteSwap(std::uint32_t value) {
+#if defined(_MSC_VER)
+            return _byteswap_ulong(value);
+#else
+            return __builtin_bswap32(value);
+#endif
+        }
+
+        inline bool LittleEndian() {
+#if defined(__BYTE_ORDER__)
+            return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+#else
+            return true;
+#endif
+        }
+
+        // Unaligned big-endian 64-bit load, the first byte ends up in the most significant bits
+        inline std::uint64_t LoadBigEndian64(const std::uint8_t* data) {
+            std::uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return LittleEndian() ? ByteSwap(value) : value;
+        }
+
+        // Unaligned big-endian 32-bit store
+        inline void StoreBigEndian32(std::uint8_t* data, std::uint32_t value) {
+            if (LittleEndian()) value = ByteSwap(value);
+            std::memcpy(data, &value, sizeof(value));
+        }
+    }
+
+    // Reads a bit stream most significant bit first through a 64-bit window
+    // Away from the end of the buffer the window is refilled with one unaligned 64-bit load and no branches;
+    // bits past the end of the buffer read as zeros
+    class BitReader {
+    public:
+        // Start reading at bit pos of a buffer holding bitLength bits
+        BitReader(const std::uint8_t* data, size_t size, size_t bitLength, size_t pos = 0)
+            : data_(data), size_(size), bitLength_(bitLength < size * 8 ? bitLength : size * 8) {
+            this->Seek(pos);
+        }
+
+        // Make at least 56 unread bits visible in the window
+        void Refill() {
+            if (this->byte_ + 8 <= this->size_) {
+                this->window_ |= Bits::LoadBigEndian64(this->data_ + this->byte_) >> this->available_;
+                this->byte_ += (63 - this->available_) >> 3;
+                this->available_ |= 56;
+                return;
+            }
+            for (; this->available_ < 56; this->available_ += 8, ++this->byte_) {
+                this->window_ |= std::uint64_t(this->byte_ < this->size_ ? this->data_[this->byte_] : 0) << (56 - this->available_);
+            }
+        }
+
+        // Unread bits, left-aligned; only the first Available() of them are meaningful
+        std::uint64_t Peek() const { return this->window_; }
+        unsigned Available() const { return this->available_; }
+
+        // Consume bits, at most Available() of them
+        void Skip(unsigned bits) {
+            this->window_ <<= bits;
+            this->available_ -= bits;
+            this->pos_ += bits;
+        }
+
+        // Continue reading at any bit position
+        void Seek(size_t pos) {
+            this->byte_ = pos >> 3;
+            this->pos_ = pos & ~size_t(7);
+            this->window_ = 0;
+            this->available_ = 0;
+            this->Refill();
+            this->Skip(static_cast<unsigned>(pos & 7));
+        }
+
+        // A single bit anywhere in the stream, without moving the window
+        bool BitAt(size_t pos) const {
+            size_t byte = pos >> 3;
+            return byte < this->size_ && (this->data_[byte] & (0x80 >> (pos & 7)));
+        }
+
+        size_t Position() const { return this->pos_; }
+        size_t BitLength() const { return this->bitLength_; }
+        bool Done() const { return this->pos_ >= this->bitLength_; }
+
+    private:
+        const std::uint8_t* data_;
+        size_t size_;
+        size_t bitLength_;
+        // Next byte to load into the window
+        size_t byte_ = 0;
+        size_t pos_ = 0;
+        std::uint64_t window_ = 0;
+        unsigned available_ = 0;
+    };
+
+    // Packs codes most significant bit first into a preallocated buffer, storing 32-bit words
+    // Only complete bytes are ever written, so writers of adjacent parts of one buffer do not overlap
+    // except in the byte they share, which the caller merges with PartialByte()
+    class BitWriter {
+    public:
+        // Start writing at out, after leadingBits (up to 7) zero bits
+        explicit BitWriter(std::uint8_t* out, unsigned leadingBits = 0) : out_(out), pending_(leadingBits) {}
+
+        // Append the low `length` bits of bits (up to 64, no bits above them may be set)
+        void Put(std::uint64_t bits, unsigned length) {
+            if (length > 32) {
+                this->Put(bits >> 32, length - 32);
+                bits &= 0xffffffffu;
+                length = 32;
+            }
+            // Fewer than 32 bits are pending, so the accumulator holds them and the new bits
+            this->acc_ = (this->acc_ << length) | bits;
+            this->pending_ += length;
+            if (this->pending_ >= 32) {
+                this->pending_ -= 32;
+                Bits::StoreBigEndian32(this->out_, static_cast<std::uint32_t>(this->acc_ >> this->pending_));
+                this->out_ += 4;
+            }
+        }
+
+        // Write the complete bytes, keeping fewer than 8 bits pending
+        void Drain() {
+            for (; this->pending_ >= 8; this->pending_ -= 8) {
+                *this->out_++ = static_cast<std::uint8_t>(this->acc_ >> (this->pending_ - 8));
+            }
+        }
+
+        // Drain, then write the last partial byte padded with zeros
+        void Flush() {
+            this->Drain();
+            if (this->pending_ > 0) {
+                *this->out_++ = this->PartialByte();
+                this->pending_ = 0;
+            }
+        }
+
+        // Next byte to be written
+        std::uint8_t* Position() const { return this->out_; }
+        // Continue at out, the new place of Position() after the written bytes were moved to another buffer
+        void Rebase(std::uint8_t* out) { this->out_ = out; }
+        // After Drain: the bits of the unfinished byte, left-aligned and padded with zeros, and how many there are
+        std::uint8_t PartialByte() const { return static_cast<std::uint8_t>(this->acc_ << (8 - this->pending_)); }
+        unsigned PartialBits() const { return this->pending_; }
+
+    private:
+        std::uint8_t* out_;
+        std::uint64_t acc_ = 0;
+        unsigned pending_;
+    };
+}
+
+#endif // HUFFMAN_BITIO_H
@@ -1,7 +1,10 @@
 #ifndef HUFFMAN_EXPORT_H
 #define HUFFMAN_EXPORT_H
 
-#if defined(_WIN32) || defined(_WIN64)
+// Static builds (the amalgamated library) export nothing
+#if defined(HUFFPRESS_STATIC)
+#define HUFFMAN_API
+#elif defined(_WIN32) || defined(_WIN64)
 #ifdef HUFFMAN_LIBRARY_BUILD
 #define HUFFMAN_API __declspec(dllexport)
 #else
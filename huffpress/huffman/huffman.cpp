@@ -5,28 +5,391 @@
 #include <queue>
 #include <vector>
 #include <sstream>
+#include <algorithm>
+#include <thread>
+#include <numeric>
+#include <utility>
+#include <cstddef>
+#include <stdexcept>
+#include <limits>
 
 namespace Huffman {
 
+    namespace {
+        // Granularity in which the source and output are handed to chunk visitors
+        const size_t ChunkSize = 64 * 1024;
+        // Slices below this size are not worth a thread of their own
+        const size_t MinSliceSize = 256 * 1024;
+
+        using Histogram = std::array<std::uint64_t, 256>;
+
+        // Four interleaved histograms, so that runs of one symbol do not wait on their own increments
+        void CountSymbols(const char* data, size_t size, Histogram& counts) {
+            std::uint32_t lanes[4][256] = {};
+            const Byte* bytes = reinterpret_cast<const Byte*>(data);
+            while (size > 0) {
+                // Lanes are flushed before a 32-bit count can overflow
+                size_t block = std::min<size_t>(size, size_t(1) << 30);
+                size_t i = 0;
+                for (; i + 4 <= block; i += 4) {
+                    lanes[0][bytes[i]]++;
+                    lanes[1][bytes[i + 1]]++;
+                    lanes[2][bytes[i + 2]]++;
+                    lanes[3][bytes[i + 3]]++;
+                }
+                for (; i < block; ++i) lanes[0][bytes[i]]++;
+                for (int symbol = 0; symbol < 256; ++symbol) {
+                    counts[symbol] += std::uint64_t(lanes[0][symbol]) + lanes[1][symbol] + lanes[2][symbol] + lanes[3][symbol];
+                    lanes[0][symbol] = lanes[1][symbol] = lanes[2][symbol] = lanes[3][symbol] = 0;
+                }
+                bytes += block;
+                size -= block;
+            }
+        }
+
+        // Bits a speculative decoder records code starts for, the window in which it has to resynchronize
+        const size_t SyncWindowBits = 8 * 1024;
+        // Slices below this many bits are decoded by a single thread
+        const size_t MinSliceBits = 8 * 1024 * 1024;
+
+        // Tree built into one contiguous node array from the current allocator
+        // Nodes are created in the same order as in Methods::BuildHuffmanTree, which gives the same tree
+        struct Tree {
+            ScratchVector<HuffmanNode> nodes;
+            HuffmanNode* root = nullptr;
+
+            explicit Tree(const FreqMap& freqMap) {
+                if (freqMap.empty()) return;
+                nodes.reserve(freqMap.size() * 2 - 1);
+
+                std::priority_queue<HuffmanNode*, ScratchVector<HuffmanNode*>, HuffmanCompare> pq;
+                for (const auto& pair : freqMap) {
+                    nodes.emplace_back(pair.first, pair.second);
+                    pq.push(&nodes.back());
+                }
+
+                while (pq.size() > 1) {
+                    HuffmanNode *left = pq.top(); pq.pop();
+                    HuffmanNode *right = pq.top(); pq.pop();
+
+                    nodes.emplace_back('\0', left->freq + right->freq);
+                    nodes.back().left = left;
+                    nodes.back().right = right;
+                    pq.push(&nodes.back());
+                }
+
+                root = pq.top();
+            }
+
+            bool IsLeaf() const { return root && !root->left && !root->right; }
+        };
+
+        void VisitChunks(const char* data, size_t size, const ChunkVisitor& visitor) {
+            for (size_t offset = 0; offset < size; offset += ChunkSize) {
+                visitor(data + offset, std::min(ChunkSize, size - offset));
+            }
+        }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__BMI2__)
+#define HUFFMAN_BMI2_DISPATCH 1
+        bool HasBmi2() {
+            static const bool supported = []() {
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("bmi2") != 0;
+            }();
+            return supported;
+        }
+#endif
+
+        // Runs a bit I/O kernel, on CPUs with BMI2 through a build of it where the variable shifts of BitReader and
+        // BitWriter compile to shlx/shrx (everything the kernel calls is inlined into that build)
+        template <typename Kernel>
+        struct Dispatch {
+            template <typename... Args>
+            static typename Kernel::Result Run(Args&&... args) {
+#ifdef HUFFMAN_BMI2_DISPATCH
+                if (HasBmi2()) return RunBmi2(std::forward<Args>(args)...);
+#endif
+                return Kernel::Run(std::forward<Args>(args)...);
+            }
+
+#ifdef HUFFMAN_BMI2_DISPATCH
+            template <typename... Args>
+            __attribute__((target("bmi,bmi2"), flatten)) static typename Kernel::Result RunBmi2(Args&&... args) {
+                return Kernel::Run(std::forward<Args>(args)...);
+            }
+#endif
+        };
+
+        // Encode every byte of data with the code table
+        struct EncodeKernel {
+            using Result = void;
+
+            static void Run(const CodeTable& codeTable, const char* data, size_t size, BitWriter& writer) {
+                for (size_t i = 0; i < size; ++i) {
+                    const HuffmanCodeword& code = codeTable[static_cast<Byte>(data[i])];
+                    writer.Put(code.bits, code.length);
+                }
+            }
+        };
+
+        // Decode up to `count` symbols into out, stopping early only at the end of the stream; returns how many were decoded
+        struct DecodeKernel {
+            using Result = size_t;
+
+            static size_t Run(const Decoder& decoder, BitReader& reader, char* out, size_t count) {
+                size_t used = 0;
+                while (used < count && !reader.Done() && decoder.DecodeSymbol(reader, out[used])) ++used;
+                return used;
+            }
+        };
+
+        // Decode codes until one ends at or past `stop` (or the stream ends), returning where decoding stopped
+        // The start of every code below `recordUntil` is appended to starts
+        struct DecodeSpanKernel {
+            using Result = size_t;
+
+            static size_t Run(const Decoder& decoder, BitReader& reader, size_t stop, ScratchString& out,
+                              ScratchVector<size_t>* starts, size_t recordUntil) {
+                char symbol;
+                while (reader.Position() < stop && !reader.Done()) {
+                    size_t start = reader.Position();
+                    if (!decoder.DecodeSymbol(reader, symbol)) return start; // Truncated code at the end of the stream
+
+                    if (starts && start < recordUntil) starts->push_back(start);
+                    out += symbol;
+                }
+                return reader.Position();
+            }
+        };
+
+        // Decode codes from bit `pos` until one ends at or past `stop` (or the stream ends), returning where decoding stopped
+        size_t DecodeSpan(const Decoder& decoder, const Byte* data, size_t size, size_t bitLength, size_t pos, size_t stop,
+                          ScratchString& out, ScratchVector<size_t>* starts = nullptr, size_t recordUntil = 0) {
+            BitReader reader(data, size, bitLength, pos);
+            return Dispatch<DecodeSpanKernel>::Run(decoder, reader, stop, out, starts, recordUntil);
+        }
+
+        void AssignCodes(HuffmanNode* node, std::uint64_t bits, std::uint8_t length, CodeTable& codeTable) {
+            if (!node) return;
+
+            if (!node->left && !node->right) {
+                codeTable[static_cast<Byte>(node->data)].bits = bits;
+                codeTable[static_cast<Byte>(node->data)].length = length;
+            }
+
+            AssignCodes(node->left, bits << 1, length + 1, codeTable);
+            AssignCodes(node->right, (bits << 1) | 1, length + 1, codeTable);
+        }
+
+        // Rebuild points and count limit of AdaptiveModel
+        const std::uint64_t AdaptiveFirstRebuild = 1024;
+        const std::uint64_t AdaptiveMaxInterval = 16 * 1024;
+        const std::uint64_t AdaptiveCountLimit = 1 << 16;
+
+        // Sampled tables count one run of SampleRunSize bytes in every SampleStride bytes
+        const size_t SampleRunSize = 4 * 1024;
+        const size_t SampleStride = 64 * 1024;
+
+        // Count the sampled runs of data; returns how many bytes were counted
+        size_t CountSample(const char* data, size_t size, Histogram& counts) {
+            size_t sampled = 0;
+            for (size_t offset = 0; offset < size; offset += SampleStride) {
+                size_t run = std::min(SampleRunSize, size - offset);
+                CountSymbols(data + offset, run, counts);
+                sampled += run;
+            }
+            return sampled;
+        }
+
+        // Frequencies of `size` bytes estimated from the counts of `sampled` of them
+        // Byte values missing from the sample count as half a sampled occurrence, so that every byte value has a code
+        FreqMap SampledFreqMap(const Histogram& counts, size_t sampled, size_t size) {
+            double scale = static_cast<double>(size) / sampled;
+            double estimates[256];
+            double total = 0;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                estimates[symbol] = std::max(1.0, counts[symbol] ? counts[symbol] * scale : scale / 2);
+                total += estimates[symbol];
+            }
+
+            // Tree nodes add frequencies up as int, so the total has to stay within Int
+            const double limit = static_cast<double>(std::numeric_limits<Int>::max() / 2);
+            double shrink = total > limit ? limit / total : 1.0;
+            FreqMap freqMap;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                freqMap[static_cast<Char>(symbol)] = static_cast<Int>(std::max(1.0, estimates[symbol] * shrink));
+            }
+            return freqMap;
+        }
+
+        // Encode data into out without knowing the output size up front, growing out as needed; returns the bit length
+        // The source goes to onSource chunk by chunk right after it was encoded, while it is still in cache
+        size_t EncodeGrowing(const CodeTable& codeTable, const char* data, size_t size, size_t expectedBytes, ByteVector& out,
+                             const ChunkVisitor& onSource, const ChunkVisitor& onPacked) {
+            unsigned longest = 0;
+            for (const HuffmanCodeword& code : codeTable) longest = std::max<unsigned>(longest, code.length);
+
+            out.resize(expectedBytes);
+            BitWriter writer(out.data());
+            size_t visited = 0;
+            for (size_t offset = 0; offset < size; offset += ChunkSize) {
+                size_t chunk = std::min(ChunkSize, size - offset);
+
+                // Room for the whole chunk in the longest code, and for the bits still pending in the writer
+                size_t used = writer.Position() - out.data();
+                size_t needed = used + chunk * longest / 8 + 8;
+                if (needed > out.size()) {
+                    out.resize(std::max(needed, out.size() + out.size() / 2));
+                    writer.Rebase(out.data() + used);
+                }
+
+                Dispatch<EncodeKernel>::Run(codeTable, data + offset, chunk, writer);
+                if (onSource) onSource(data + offset, chunk);
+                if (onPacked) {
+                    writer.Drain();
+                    size_t written = writer.Position() - out.data();
+                    if (written != visited) {
+                        onPacked(reinterpret_cast<const char*>(out.data()) + visited, written - visited);
+                        visited = written;
+                    }
+                }
+            }
+
+            writer.Drain();
+            size_t bitLength = (writer.Position() - out.data()) * 8 + writer.PartialBits();
+            writer.Flush();
+            out.resize(writer.Position() - out.data());
+            if (onPacked && out.size() != visited) {
+                onPacked(reinterpret_cast<const char*>(out.data()) + visited, out.size() - visited);
+            }
+            return bitLength;
+        }
+
+        // Compress with a table estimated from a sample, reading the input once (TableMode::Sampled)
+        // Slices are encoded into buffers of their own, since their bit lengths are only known afterwards, and then
+        // shifted into place
+        ByteVector CompressSampled(const std::string& text, FreqMap& freqMap, size_t& bitLength, const ChunkVisitor& onSource,
+                                   const ChunkVisitor& onPacked, unsigned threads) {
+            Histogram counts{};
+            size_t sampled = CountSample(text.data(), text.size(), counts);
+            freqMap = SampledFreqMap(counts, sampled, text.size());
+
+            CodeTable codeTable;
+            Methods::BuildCodeTable(Tree(freqMap).root, codeTable);
+
+            // The sample's bit length predicts the output size, with some slack for the rest of the input
+            size_t sampleBits = 0;
+            for (int symbol = 0; symbol < 256; ++symbol) sampleBits += counts[symbol] * codeTable[symbol].length;
+            double bytesPerSymbol = static_cast<double>(sampleBits) / 8 / sampled * 1.0625;
+
+            size_t slices = std::max<size_t>(1, std::min<size_t>(threads, text.size() / MinSliceSize));
+            ByteVector compressed;
+            if (slices == 1) {
+                bitLength = EncodeGrowing(codeTable, text.data(), text.size(), static_cast<size_t>(text.size() * bytesPerSymbol) + 8,
+                                          compressed, onSource, onPacked);
+                return compressed;
+            }
+
+            ScratchVector<size_t> bounds(slices + 1);
+            for (size_t i = 0; i <= slices; ++i) {
+                bounds[i] = text.size() / slices * i + std::min(i, text.size() % slices);
+            }
+            std::vector<ByteVector> parts(slices);
+            ScratchVector<size_t> bitOffsets(slices + 1, 0);
+            ScratchVector<std::thread> workers;
+            for (size_t i = 0; i < slices; ++i) {
+                workers.emplace_back([&, i]() {
+                    size_t sliceSize = bounds[i + 1] - bounds[i];
+                    bitOffsets[i + 1] = EncodeGrowing(codeTable, text.data() + bounds[i], sliceSize,
+                                                      static_cast<size_t>(sliceSize * bytesPerSymbol) + 8, parts[i], nullptr, nullptr);
+                });
+            }
+            try {
+                if (onSource) VisitChunks(text.data(), text.size(), onSource);
+            } catch (...) {
+                // A visitor may abort the compression, the encoding threads still have to be joined
+                for (std::thread& worker : workers) worker.join();
+                throw;
+            }
+            for (std::thread& worker : workers) worker.join();
+            workers.clear();
+
+            for (size_t i = 0; i < slices; ++i) bitOffsets[i + 1] += bitOffsets[i];
+            bitLength = bitOffsets[slices];
+            compressed.resize((bitLength + 7) / 8);
+
+            // Same stitching as the exact path: complete bytes go straight into place, shared bytes are merged afterwards
+            ScratchVector<BitWriter> writers;
+            writers.reserve(slices);
+            for (size_t i = 0; i < slices; ++i) {
+                writers.emplace_back(compressed.data() + bitOffsets[i] / 8, static_cast<unsigned>(bitOffsets[i] % 8));
+            }
+            for (size_t i = 0; i < slices; ++i) {
+                workers.emplace_back([&, i]() {
+                    size_t left = bitOffsets[i + 1] - bitOffsets[i];
+                    BitReader reader(parts[i].data(), parts[i].size(), left);
+                    for (; left >= 32; left -= 32) {
+                        reader.Refill();
+                        writers[i].Put(reader.Peek() >> 32, 32);
+                        reader.Skip(32);
+                    }
+                    if (left > 0) {
+                        reader.Refill();
+                        writers[i].Put(reader.Peek() >> (64 - left), static_cast<unsigned>(left));
+                    }
+                    writers[i].Drain();
+                    ByteVector().swap(parts[i]);
+                });
+            }
+            for (std::thread& worker : workers) worker.join();
+
+            for (size_t i = 0; i < slices; ++i) {
+                if (writers[i].PartialBits() > 0) {
+                    compressed[bitOffsets[i + 1] / 8] |= writers[i].PartialByte();
+                }
+            }
+
+            if (onPacked) VisitChunks(reinterpret_cast<const char*>(compressed.data()), compressed.size(), onPacked);
+            return compressed;
+        }
+    }
+
     HUFFMAN_API HuffmanNode::HuffmanNode(char data, int freq) {
         this->data = data;
         this->freq = freq;
         left = right = nullptr;
     }
 
+    HUFFMAN_API void* HuffmanNode::operator new(size_t size) {
+        // Remember the allocator in front of the node, delete may run under another one
+        const size_t prefix = alignof(std::max_align_t) > sizeof(Allocator*) ? alignof(std::max_align_t) : sizeof(Allocator*);
+        Allocator& allocator = CurrentAllocator();
+        unsigned char* block = static_cast<unsigned char*>(allocator.Allocate(prefix + size, alignof(std::max_align_t)));
+        *reinterpret_cast<Allocator**>(block) = &allocator;
+        return block + prefix;
+    }
+
+    HUFFMAN_API void HuffmanNode::operator delete(void* ptr) noexcept {
+        if (!ptr) return;
+        const size_t prefix = alignof(std::max_align_t) > sizeof(Allocator*) ? alignof(std::max_align_t) : sizeof(Allocator*);
+        unsigned char* block = static_cast<unsigned char*>(ptr) - prefix;
+        (*reinterpret_cast<Allocator**>(block))->Deallocate(block, prefix + sizeof(HuffmanNode));
+    }
+
     HUFFMAN_API bool HuffmanCompare::operator()(HuffmanNode* left, HuffmanNode* right) {
         return left->freq > right->freq;
     }
 
     namespace Methods {
         HUFFMAN_API HuffmanNode* BuildHuffmanTree(const Huffman::FreqMap& freqMap) {
-            std::priority_queue<HuffmanNode*, std::vector<HuffmanNode*>, HuffmanCompare> pq;
+            std::priority_queue<HuffmanNode*, ScratchVector<HuffmanNode*>, HuffmanCompare> pq;
 
             for (const auto& pair : freqMap) {
                 pq.push(new HuffmanNode(pair.first, pair.second));
             }
 
-            while (pq.size() != 1) {
+            while (pq.size() > 1) {
                 HuffmanNode *left = pq.top(); pq.pop();
                 HuffmanNode *right = pq.top(); pq.pop();
 
@@ -37,7 +400,7 @@ namespace Huffman {
                 pq.push(node);
             }
 
-            return pq.top();
+            return pq.empty() ? nullptr : pq.top();
         }
 
         HUFFMAN_API void GenerateCodes(HuffmanNode* node, const std::string& code, std::map<char, std::string>& huffmanCode) {
@@ -51,6 +414,11 @@ namespace Huffman {
             GenerateCodes(node->right, code + '1', huffmanCode);
         }
 
+        HUFFMAN_API void BuildCodeTable(HuffmanNode* root, CodeTable& codeTable) {
+            codeTable.fill(HuffmanCodeword());
+            AssignCodes(root, 0, 0, codeTable);
+        }
+
         HUFFMAN_API void FreeTree(HuffmanNode* node) {
             if (node == nullptr) return;
             FreeTree(node->left);
@@ -59,87 +427,453 @@ namespace Huffman {
         }
 
         HUFFMAN_API Huffman::ByteVector PackBitsToBytes(const std::string& bitString, size_t& bitLength) {
-            Huffman::ByteVector compressedData;
-            Huffman::Byte currentByte = 0;
-            int bitCount = 0;
-
             bitLength = bitString.size();
+            Huffman::ByteVector compressedData((bitLength + 7) / 8);
+
+            // Eight characters make a byte; everything but '1' is a zero bit
+            BitWriter writer(compressedData.data());
+            size_t pos = 0;
+            for (; pos + 8 <= bitLength; pos += 8) {
+                unsigned byte = 0;
+                for (size_t i = 0; i < 8; ++i) byte = (byte << 1) | (bitString[pos + i] == '1');
+                writer.Put(byte, 8);
+            }
+            for (; pos < bitLength; ++pos) writer.Put(bitString[pos] == '1', 1);
+            writer.Flush();
 
-            for (char bit : bitString) {
-                currentByte <<= 1;
-                if (bit == '1') {
-                    currentByte |= 1;
-                }
-                bitCount++;
+            return compressedData;
+        }
 
-                if (bitCount == 8) {
-                    compressedData.push_back(currentByte);
-                    currentByte = 0;
-                    bitCount = 0;
-                }
+        HUFFMAN_API std::string UnpackBytesToBits(const Huffman::ByteVector& compressedData, size_t bitLength) {
+            bitLength = std::min(bitLength, compressedData.size() * 8);
+            std::string bitString(bitLength, '0');
+
+            for (size_t pos = 0; pos < bitLength; ++pos) {
+                if (compressedData[pos >> 3] & (0x80 >> (pos & 7))) bitString[pos] = '1';
             }
 
-            if (bitCount > 0) {
-                currentByte <<= (8 - bitCount);
-                compressedData.push_back(currentByte);
+            return bitString;
+        }
+
+    }
+
+    HUFFMAN_API Huffman::ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength) {
+        return Compress(text, freqMap, bitLength, nullptr, nullptr, 1);
+    }
+
+    HUFFMAN_API Huffman::ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength, unsigned threads) {
+        return Compress(text, freqMap, bitLength, nullptr, nullptr, threads);
+    }
+
+    HUFFMAN_API Huffman::ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength, const ChunkVisitor& onSource, const ChunkVisitor& onPacked, unsigned threads, TableMode mode) {
+        if (mode == TableMode::Sampled && text.size() >= SampledTableMinSize) {
+            return CompressSampled(text, freqMap, bitLength, onSource, onPacked, threads);
+        }
+
+        size_t slices = std::max<size_t>(1, std::min<size_t>(threads, text.size() / MinSliceSize));
+        ScratchVector<size_t> bounds(slices + 1);
+        for (size_t i = 0; i <= slices; ++i) {
+            bounds[i] = text.size() / slices * i + std::min(i, text.size() % slices);
+        }
+
+        ScratchVector<Histogram> counts(slices, Histogram{});
+        ScratchVector<std::thread> workers;
+
+        if (slices == 1) {
+            // Count chunk by chunk so that the visitor sees each chunk while it is still in cache
+            for (size_t offset = 0; offset < text.size(); offset += ChunkSize) {
+                size_t chunk = std::min(ChunkSize, text.size() - offset);
+                CountSymbols(text.data() + offset, chunk, counts[0]);
+                if (onSource) onSource(text.data() + offset, chunk);
+            }
+        } else {
+            for (size_t i = 0; i < slices; ++i) {
+                workers.emplace_back(CountSymbols, text.data() + bounds[i], bounds[i + 1] - bounds[i], std::ref(counts[i]));
             }
+            try {
+                if (onSource) VisitChunks(text.data(), text.size(), onSource);
+            } catch (...) {
+                // A visitor may abort the compression, the counting threads still have to be joined
+                for (std::thread& worker : workers) worker.join();
+                throw;
+            }
+            for (std::thread& worker : workers) worker.join();
+            workers.clear();
+        }
 
-            return compressedData;
+        Histogram total{};
+        for (const Histogram& sliceCounts : counts) {
+            for (int symbol = 0; symbol < 256; ++symbol) total[symbol] += sliceCounts[symbol];
+        }
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            if (total[symbol]) freqMap[static_cast<Char>(symbol)] += static_cast<Int>(total[symbol]);
         }
 
-        HUFFMAN_API std::string UnpackBytesToBits(const Huffman::ByteVector& compressedData, size_t bitLength) {
-            std::string bitString;
+        bitLength = 0;
+        if (freqMap.empty()) return Huffman::ByteVector();
+
+        CodeTable codeTable;
+        Methods::BuildCodeTable(Tree(freqMap).root, codeTable);
 
-            for (Huffman::Byte byte : compressedData) {
-                for (int i = 7; i >= 0; --i) {
-                    bitString += (byte & (1 << i)) ? '1' : '0';
+        // The histograms give every slice's bit length up front, so its place in the stream is known before encoding
+        ScratchVector<size_t> bitOffsets(slices + 1, 0);
+        for (size_t i = 0; i < slices; ++i) {
+            size_t sliceBits = 0;
+            for (int symbol = 0; symbol < 256; ++symbol) sliceBits += counts[i][symbol] * codeTable[symbol].length;
+            bitOffsets[i + 1] = bitOffsets[i] + sliceBits;
+        }
+        bitLength = bitOffsets[slices];
+
+        Huffman::ByteVector compressed((bitLength + 7) / 8);
+
+        if (slices == 1) {
+            BitWriter writer(compressed.data());
+            const Byte* visited = compressed.data();
+
+            for (size_t offset = 0; offset < text.size(); offset += ChunkSize) {
+                size_t chunk = std::min(ChunkSize, text.size() - offset);
+                Dispatch<EncodeKernel>::Run(codeTable, text.data() + offset, chunk, writer);
+                if (onPacked) {
+                    writer.Drain();
+                    if (writer.Position() != visited) {
+                        onPacked(reinterpret_cast<const char*>(visited), writer.Position() - visited);
+                        visited = writer.Position();
+                    }
                 }
             }
 
-            return bitString.substr(0, bitLength);
+            writer.Flush();
+            if (onPacked && writer.Position() != visited) {
+                onPacked(reinterpret_cast<const char*>(visited), writer.Position() - visited);
+            }
+            return compressed;
+        }
+
+        // Every slice writes the bytes it completes straight into place; a byte shared with the next
+        // slice is only ever completed by that slice, so the unfinished tail of each slice is kept
+        // in its writer and merged in once all slices are done
+        ScratchVector<BitWriter> writers;
+        writers.reserve(slices);
+        for (size_t i = 0; i < slices; ++i) {
+            writers.emplace_back(compressed.data() + bitOffsets[i] / 8, static_cast<unsigned>(bitOffsets[i] % 8));
+        }
+        for (size_t i = 0; i < slices; ++i) {
+            workers.emplace_back([&text, &codeTable, &bounds, &writers, i]() {
+                Dispatch<EncodeKernel>::Run(codeTable, text.data() + bounds[i], bounds[i + 1] - bounds[i], writers[i]);
+                writers[i].Drain();
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+
+        for (size_t i = 0; i < slices; ++i) {
+            if (writers[i].PartialBits() > 0) {
+                compressed[bitOffsets[i + 1] / 8] |= writers[i].PartialByte();
+            }
         }
 
+        if (onPacked) VisitChunks(reinterpret_cast<const char*>(compressed.data()), compressed.size(), onPacked);
+        return compressed;
     }
 
-    HUFFMAN_API Huffman::ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength) {
-        for (char ch : text) {
-            freqMap[ch]++;
+    HUFFMAN_API size_t EncodedBitLength(const char* data, size_t size, FreqMap& freqMap, bool fromSample) {
+        Histogram counts{};
+        size_t counted = size;
+        if (fromSample && size >= SampledTableMinSize) {
+            counted = CountSample(data, size, counts);
+        } else {
+            CountSymbols(data, size, counts);
+        }
+
+        freqMap.clear();
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            if (counts[symbol]) freqMap[static_cast<Char>(symbol)] = static_cast<Int>(counts[symbol]);
         }
+        if (freqMap.empty()) return 0;
 
-        HuffmanNode* root = Methods::BuildHuffmanTree(freqMap);
-        
-        std::map<char, std::string> huffmanCode;
-        Methods::GenerateCodes(root, std::string(), huffmanCode);
+        CodeTable codeTable;
+        Methods::BuildCodeTable(Tree(freqMap).root, codeTable);
+        std::uint64_t bits = 0;
+        for (int symbol = 0; symbol < 256; ++symbol) bits += counts[symbol] * codeTable[symbol].length;
+        return counted == size ? static_cast<size_t>(bits) : static_cast<size_t>(static_cast<double>(bits) * size / counted);
+    }
 
-        std::string bitString;
-        for (char ch : text) {
-            bitString += huffmanCode[ch];
+    HUFFMAN_API Encoder::Encoder(const FreqMap& freqMap) {
+        this->known_.fill(false);
+        for (const auto& pair : freqMap) this->known_[static_cast<Byte>(pair.first)] = true;
+        Methods::BuildCodeTable(Tree(freqMap).root, this->codes_);
+    }
+
+    HUFFMAN_API Huffman::ByteVector Encoder::Encode(const char* data, size_t size, size_t& bitLength, unsigned leadingBits) const {
+        bitLength = 0;
+        for (size_t i = 0; i < size; ++i) {
+            Byte symbol = static_cast<Byte>(data[i]);
+            if (!this->known_[symbol]) throw std::invalid_argument("symbol is missing from the frequency map");
+            bitLength += this->codes_[symbol].length;
         }
 
-        Huffman::ByteVector compressed = Methods::PackBitsToBytes(bitString, bitLength);
-        Methods::FreeTree(root);
-        return compressed;
+        leadingBits %= 8;
+        Huffman::ByteVector encoded((leadingBits + bitLength + 7) / 8);
+        BitWriter writer(encoded.data(), leadingBits);
+        Dispatch<EncodeKernel>::Run(this->codes_, data, size, writer);
+        writer.Flush();
+        return encoded;
     }
 
-    HUFFMAN_API std::string Decompress(const ByteVector& compressed, const FreqMap& freqMap, size_t bitLength) {
-        HuffmanNode* root = Methods::BuildHuffmanTree(freqMap);
+    HUFFMAN_API Decoder::Decoder(const FreqMap& freqMap) {
+        Tree tree(freqMap);
+        if (!tree.root) return;
+
+        // Flatten the tree with the root at index 0, then fill the lookup table from every node at depth <= TableBits
+        struct Pending {
+            const HuffmanNode* node;
+            std::int16_t index;
+            std::uint32_t bits;
+            unsigned length;
+        };
+        ScratchVector<Pending> stack;
+        this->nodes_[0].freq = tree.root->freq;
+        this->nodeCount_ = 1;
+        stack.push_back({tree.root, 0, 0, 0});
+
+        while (!stack.empty()) {
+            Pending item = stack.back();
+            stack.pop_back();
+            Node& node = this->nodes_[item.index];
+
+            if (!item.node->left && !item.node->right) {
+                node.symbol = item.node->data;
+                if (item.length > 0 && item.length <= TableBits) {
+                    unsigned spread = TableBits - item.length;
+                    for (std::uint32_t suffix = 0; suffix < (1u << spread); ++suffix) {
+                        Entry& entry = this->table_[(item.bits << spread) | suffix];
+                        entry.node = static_cast<std::uint16_t>(item.index);
+                        entry.length = static_cast<std::uint8_t>(item.length);
+                    }
+                }
+                continue;
+            }
+
+            if (item.length == TableBits) {
+                this->table_[item.bits].node = static_cast<std::uint16_t>(item.index);
+            }
+
+            node.left = static_cast<std::int16_t>(this->nodeCount_++);
+            node.right = static_cast<std::int16_t>(this->nodeCount_++);
+            this->nodes_[node.left].freq = item.node->left->freq;
+            this->nodes_[node.right].freq = item.node->right->freq;
+            stack.push_back({item.node->left, node.left, item.bits << 1, item.length + 1});
+            stack.push_back({item.node->right, node.right, (item.bits << 1) | 1, item.length + 1});
+        }
+    }
+
+    HUFFMAN_API void Decoder::Decode(const Byte* compressed, size_t size, size_t bitLength, const ChunkVisitor& onOutput) const {
+        if (this->Empty()) return;
+
+        // Every code takes at least one bit, small payloads only need a small buffer
+        ScratchVector<char> buffer(std::min<size_t>(ChunkSize, this->Lone() ? this->nodes_[0].freq : std::min(bitLength, size * 8)));
+        size_t used = 0;
+
+        if (this->Lone()) {
+            // A lone symbol gets an empty code, the count is all there is to restore
+            for (Int left = this->nodes_[0].freq; left > 0; left -= static_cast<Int>(used)) {
+                used = std::min<size_t>(ChunkSize, left);
+                std::fill(buffer.begin(), buffer.begin() + used, this->nodes_[0].symbol);
+                onOutput(buffer.data(), used);
+            }
+            return;
+        }
+
+        BitReader reader(compressed, size, bitLength);
+        while (!reader.Done()) {
+            used = Dispatch<DecodeKernel>::Run(*this, reader, buffer.data(), buffer.size());
+            if (used) onOutput(buffer.data(), used);
+            if (used < buffer.size()) break; // End of the stream, possibly inside a truncated code
+        }
+    }
+
+    HUFFMAN_API std::string Decoder::Decompress(const Byte* compressed, size_t size, size_t bitLength, unsigned threads) const {
+        if (this->Empty()) return std::string();
+
+        bitLength = std::min(bitLength, size * 8);
+        size_t slices = std::max<size_t>(1, std::min<size_t>(threads, bitLength / MinSliceBits));
+
         std::string result;
+        if (slices == 1 || this->Lone()) {
+            result.reserve(this->Lone() ? this->nodes_[0].freq : bitLength / 2);
+            this->Decode(compressed, size, bitLength, [&result](const char* data, size_t chunk) {
+                result.append(data, chunk);
+            });
+            return result;
+        }
 
-        std::string bitString = Methods::UnpackBytesToBits(compressed, bitLength);
-        HuffmanNode* current = root;
-        for (char bit : bitString) {
-            current = (bit == '0') ? current->left : current->right;
+        ScratchVector<size_t> bounds(slices + 1);
+        for (size_t i = 0; i <= slices; ++i) {
+            bounds[i] = bitLength / slices * i + std::min(i, bitLength % slices);
+        }
 
-            if (!current->left && !current->right) {
-                result += current->data;
-                current = root;
+        // Every slice is decoded as if a code started at its first bit. That guess is usually wrong, but
+        // the decoder falls into step with the true code boundaries within a few dozen bits; the code
+        // starts it sees early on are recorded so the stitching below can find where that happened
+        Allocator& allocator = CurrentAllocator();
+        ScratchVector<ScratchString> outputs(slices);
+        ScratchVector<ScratchVector<size_t>> starts(slices);
+        ScratchVector<size_t> ends(slices);
+        ScratchVector<std::thread> workers;
+        for (size_t i = 0; i < slices; ++i) {
+            workers.emplace_back([&, i]() {
+                AllocatorScope scope(allocator, false);
+                outputs[i].reserve((bounds[i + 1] - bounds[i]) / 2);
+                ends[i] = DecodeSpan(*this, compressed, size, bitLength, bounds[i], bounds[i + 1],
+                                     outputs[i], &starts[i], bounds[i] + SyncWindowBits);
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+
+        result.reserve(std::accumulate(outputs.begin(), outputs.end(), size_t(0),
+            [](size_t total, const ScratchString& output) { return total + output.size(); }));
+        result.append(outputs[0].data(), outputs[0].size());
+        size_t pos = ends[0];
+
+        ScratchString serial;
+        for (size_t i = 1; i < slices; ++i) {
+            // `pos` is a true code boundary; decode from it serially until it meets one of the slice's recorded starts
+            size_t next = 0;
+            serial.clear();
+            while (pos < bounds[i + 1] && pos < bitLength) {
+                while (next < starts[i].size() && starts[i][next] < pos) ++next;
+                if (next < starts[i].size() && starts[i][next] == pos) {
+                    result.append(serial.data(), serial.size());
+                    serial.clear();
+                    result.append(outputs[i].data() + next, outputs[i].size() - next);
+                    pos = ends[i];
+                    break;
+                }
+
+                if (pos >= bounds[i] + SyncWindowBits) {
+                    // No synchronization inside the window, the slice is decoded over again
+                    pos = DecodeSpan(*this, compressed, size, bitLength, pos, bounds[i + 1], serial);
+                    break;
+                }
+                size_t decoded = DecodeSpan(*this, compressed, size, bitLength, pos, pos + 1, serial);
+                if (decoded == pos) break; // Truncated code at the end of the stream
+                pos = decoded;
             }
+            result.append(serial.data(), serial.size());
+            ScratchString().swap(outputs[i]);
         }
 
-        Methods::FreeTree(root);
         return result;
     }
 
+    HUFFMAN_API std::string Decompress(const ByteVector& compressed, const FreqMap& freqMap, size_t bitLength) {
+        return Decoder(freqMap).Decompress(compressed.data(), compressed.size(), bitLength);
+    }
+
+    HUFFMAN_API std::string Decompress(const ByteVector& compressed, const FreqMap& freqMap, size_t bitLength, unsigned threads) {
+        return Decoder(freqMap).Decompress(compressed.data(), compressed.size(), bitLength, threads);
+    }
+
+    HUFFMAN_API void Decode(const Byte* compressed, size_t size, const FreqMap& freqMap, size_t bitLength, const ChunkVisitor& onOutput) {
+        Decoder(freqMap).Decode(compressed, size, bitLength, onOutput);
+    }
+
+    HUFFMAN_API AdaptiveModel::AdaptiveModel() : next_(AdaptiveFirstRebuild), interval_(AdaptiveFirstRebuild) {
+        this->counts_.fill(1);
+    }
+
+    HUFFMAN_API void AdaptiveModel::Count(const char* data, size_t size) {
+        if (size >= AdaptiveFirstRebuild) {
+            Histogram counts{};
+            CountSymbols(data, size, counts);
+            for (int symbol = 0; symbol < 256; ++symbol) this->counts_[symbol] += counts[symbol];
+        } else {
+            // Short writes are common in streams, the lanes of CountSymbols cost more than they save there
+            for (size_t i = 0; i < size; ++i) this->counts_[static_cast<Byte>(data[i])]++;
+        }
+        this->total_ += size;
+        this->seen_ += size;
+    }
+
+    HUFFMAN_API FreqMap AdaptiveModel::Rebuild() {
+        this->interval_ = std::min(this->interval_ * 2, AdaptiveMaxInterval);
+        this->next_ = this->seen_ + this->interval_;
+        if (this->total_ > AdaptiveCountLimit) {
+            this->total_ = 0;
+            for (std::uint64_t& count : this->counts_) {
+                count = std::max<std::uint64_t>(1, count / 2);
+                this->total_ += count;
+            }
+        }
+        return this->Current();
+    }
+
+    HUFFMAN_API FreqMap AdaptiveModel::Current() const {
+        FreqMap freqMap;
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            freqMap[static_cast<Char>(symbol)] = static_cast<Int>(this->counts_[symbol]);
+        }
+        return freqMap;
+    }
+
+    HUFFMAN_API AdaptiveEncoder::AdaptiveEncoder() {
+        this->Rebuild(this->model_.Current());
+    }
+
+    void AdaptiveEncoder::Rebuild(const FreqMap& freqMap) {
+        Methods::BuildCodeTable(Tree(freqMap).root, this->codes_);
+        this->longest_ = 0;
+        for (const HuffmanCodeword& code : this->codes_) this->longest_ = std::max<unsigned>(this->longest_, code.length);
+    }
+
+    HUFFMAN_API void AdaptiveEncoder::Encode(const char* data, size_t size, ByteVector& out) {
+        size_t used = out.size();
+        while (size > 0) {
+            // Encode up to the next rebuild with one table, with room for every symbol in the longest code
+            size_t run = static_cast<size_t>(std::min<std::uint64_t>(size, this->model_.UntilRebuild()));
+            run = std::min(run, ChunkSize);
+            out.resize(used + run * this->longest_ / 8 + 8);
+            this->writer_.Rebase(out.data() + used);
+            Dispatch<EncodeKernel>::Run(this->codes_, data, run, this->writer_);
+            this->writer_.Drain();
+            used = this->writer_.Position() - out.data();
+
+            this->model_.Count(data, run);
+            if (this->model_.UntilRebuild() == 0) this->Rebuild(this->model_.Rebuild());
+            data += run;
+            size -= run;
+        }
+        out.resize(used);
+    }
+
+    HUFFMAN_API void AdaptiveEncoder::Flush(ByteVector& out) {
+        if (this->writer_.PartialBits() == 0) return;
+        size_t used = out.size();
+        out.resize(used + 1);
+        this->writer_.Rebase(out.data() + used);
+        this->writer_.Flush();
+    }
+
+    HUFFMAN_API AdaptiveDecoder::AdaptiveDecoder() : decoder_(model_.Current()) {}
+
+    HUFFMAN_API void AdaptiveDecoder::Decode(const Byte* data, size_t size, size_t count, std::string& out) {
+        const size_t start = out.size();
+        size_t used = start;
+        out.resize(start + count);
+        BitReader reader(data, size, size * 8);
+        while (count > 0) {
+            size_t run = static_cast<size_t>(std::min<std::uint64_t>(count, this->model_.UntilRebuild()));
+            if (Dispatch<DecodeKernel>::Run(this->decoder_, reader, &out[used], run) != run) {
+                out.resize(start);
+                throw std::invalid_argument("adaptive frame ends before its last symbol");
+            }
+
+            this->model_.Count(&out[used], run);
+            if (this->model_.UntilRebuild() == 0) this->decoder_ = Decoder(this->model_.Rebuild());
+            used += run;
+            count -= run;
+        }
+    }
+
     namespace Stringize {
         HUFFMAN_API std::string StringizeFreqMap(const Huffman::FreqMap& freqMap) {
             std::stringstream ss;
@@ -2,11 +2,15 @@
 #define HUFFMAN_H
 
 #include "export.h"
+#include "allocator.h"
+#include "bitio.h"
 
 #include <map>
+#include <array>
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <functional>
 
 namespace Huffman {
     using Char = char;
@@ -21,18 +25,215 @@ namespace Huffman {
         HuffmanNode *left, *right;
 
         HUFFMAN_API HuffmanNode(char data, int freq);
+
+        // Nodes created with new come from the calling thread's Allocator
+        HUFFMAN_API static void* operator new(size_t size);
+        HUFFMAN_API static void operator delete(void* ptr) noexcept;
     };
 
     struct HuffmanCompare {
         HUFFMAN_API bool operator()(HuffmanNode* left, HuffmanNode* right);
     };
 
+    // Code of a single symbol, right-aligned in bits (the first bit of the code is the most significant one)
+    struct HuffmanCodeword {
+        std::uint64_t bits = 0;
+        std::uint8_t length = 0;
+    };
+
+    // Codes of all byte values, indexed by the unsigned value of the symbol
+    using CodeTable = std::array<HuffmanCodeword, 256>;
+
+    // How Compress builds the code table
+    enum class TableMode {
+        // Count every symbol: optimal codes, the input is read once for counting and once for encoding
+        Exact,
+        // Count a strided sample (1/16) of inputs of SampledTableMinSize bytes and more, so the input is read only by
+        // the encoder; every byte value gets a code, and the frequency map holds scaled estimates instead of counts
+        Sampled,
+    };
+
+    // Smaller inputs are always counted exactly
+    const size_t SampledTableMinSize = 1 << 20;
+
+    // Receives consecutive chunks of a buffer while it is being walked by the coder
+    using ChunkVisitor = std::function<void(const char* data, size_t size)>;
+
+    // Code table built once from a frequency map, for encoding many buffers with the same codes
+    // Nothing changes after construction, so a single encoder can be used by any number of threads at once
+    class HUFFMAN_API Encoder {
+    public:
+        HUFFMAN_API explicit Encoder(const FreqMap& freqMap);
+
+        // Encode data with these codes; throws std::invalid_argument on a symbol that is not in the frequency map
+        // With leadingBits (up to 7) the codes start after that many zero bits, so that a block can be OR-ed onto
+        // the unfinished last byte of the block before it; bitLength does not count the leading bits
+        HUFFMAN_API ByteVector Encode(const char* data, size_t size, size_t& bitLength, unsigned leadingBits = 0) const;
+
+        // Whether the frequency map contains the symbol
+        bool Knows(Byte symbol) const { return known_[symbol]; }
+        const HuffmanCodeword& Code(Byte symbol) const { return codes_[symbol]; }
+
+    private:
+        CodeTable codes_;
+        std::array<bool, 256> known_;
+    };
+
+    // Table-driven decoder built once from a frequency map
+    // Nothing changes after construction, so a single decoder can be used by any number of threads at once
+    class HUFFMAN_API Decoder {
+    public:
+        // Codes up to this many bits are resolved with a single table lookup
+        static const unsigned TableBits = 10;
+
+        HUFFMAN_API explicit Decoder(const FreqMap& freqMap);
+
+        // Decode to a string on up to `threads` threads (see the threaded Huffman::Decompress)
+        HUFFMAN_API std::string Decompress(const Byte* compressed, size_t size, size_t bitLength, unsigned threads = 1) const;
+        // Decode without materializing the result, handing decoded chunks to onOutput
+        HUFFMAN_API void Decode(const Byte* compressed, size_t size, size_t bitLength, const ChunkVisitor& onOutput) const;
+
+        // Decode the code starting at bit pos and move pos past it; false if the stream ends inside the code
+        bool DecodeSymbol(const Byte* data, size_t size, size_t bitLength, size_t& pos, char& symbol) const {
+            BitReader reader(data, size, bitLength, pos);
+            if (!this->DecodeSymbol(reader, symbol)) return false;
+            pos = reader.Position();
+            return true;
+        }
+
+        // Decode the next code from the reader and move past it; false if the stream ends inside the code
+        bool DecodeSymbol(BitReader& reader, char& symbol) const {
+            reader.Refill();
+            const Entry& entry = table_[reader.Peek() >> (64 - TableBits)];
+            if (entry.length) {
+                if (reader.Position() + entry.length > reader.BitLength()) return false;
+                reader.Skip(entry.length);
+                symbol = nodes_[entry.node].symbol;
+                return true;
+            }
+
+            // Codes longer than the table continue down the tree bit by bit
+            size_t next = reader.Position() + TableBits;
+            const Node* node = &nodes_[entry.node];
+            while (node->left >= 0) {
+                if (next >= reader.BitLength()) return false;
+                node = &nodes_[reader.BitAt(next) ? node->right : node->left];
+                ++next;
+            }
+            if (next - reader.Position() <= reader.Available()) {
+                reader.Skip(static_cast<unsigned>(next - reader.Position()));
+            } else {
+                reader.Seek(next);
+            }
+            symbol = node->symbol;
+            return true;
+        }
+
+        // No symbols at all
+        bool Empty() const { return nodeCount_ == 0; }
+        // A single symbol, which has an empty code and is restored from its count alone
+        bool Lone() const { return nodeCount_ == 1; }
+
+    private:
+        struct Node {
+            std::int16_t left = -1, right = -1;
+            char symbol = 0;
+            Int freq = 0;
+        };
+
+        // A code of `length` bits for the leaf `node`, or with length 0 the node to continue from after TableBits bits
+        struct Entry {
+            std::uint16_t node = 0;
+            std::uint8_t length = 0;
+        };
+
+        std::array<Node, 511> nodes_;
+        std::array<Entry, 1 << TableBits> table_;
+        size_t nodeCount_ = 0;
+    };
+
+    // Running symbol counts of an adaptive stream, which the encoder and the decoder keep in step
+    // Every byte value starts with a count of one; the table is rebuilt from the counts after the first 1024 symbols,
+    // then at intervals that double up to 16K symbols, and the counts are halved once they add up to more than 64K
+    // so that the table follows changes in the data. Rebuilds happen at the same symbols on both sides, nothing about
+    // them is transmitted
+    class HUFFMAN_API AdaptiveModel {
+    public:
+        HUFFMAN_API AdaptiveModel();
+
+        // Symbols left until the table has to be rebuilt
+        size_t UntilRebuild() const { return this->next_ - this->seen_; }
+        // Count symbols, at most UntilRebuild() of them
+        HUFFMAN_API void Count(const char* data, size_t size);
+        // Frequency map of the next table, once UntilRebuild() reached zero
+        HUFFMAN_API FreqMap Rebuild();
+        // Frequency map of the current table
+        HUFFMAN_API FreqMap Current() const;
+
+    private:
+        std::array<std::uint64_t, 256> counts_;
+        std::uint64_t total_ = 256;
+        std::uint64_t seen_ = 0;
+        std::uint64_t next_;
+        std::uint64_t interval_;
+    };
+
+    // One-pass encoder for data of unknown length: codes come from the AdaptiveModel instead of a frequency map
+    // counted up front, so every symbol is encoded as soon as it is seen
+    class HUFFMAN_API AdaptiveEncoder {
+    public:
+        HUFFMAN_API AdaptiveEncoder();
+
+        // Encode data, appending the complete bytes to out; up to 7 bits stay in the encoder until more data or Flush
+        HUFFMAN_API void Encode(const char* data, size_t size, ByteVector& out);
+        // Append the unfinished byte padded with zeros, ending a frame; the model carries over to the next frame
+        HUFFMAN_API void Flush(ByteVector& out);
+
+    private:
+        AdaptiveModel model_;
+        CodeTable codes_;
+        unsigned longest_ = 0;
+        BitWriter writer_{nullptr};
+
+        void Rebuild(const FreqMap& freqMap);
+    };
+
+    // Decoder for the frames of an AdaptiveEncoder, in the order they were written
+    class HUFFMAN_API AdaptiveDecoder {
+    public:
+        HUFFMAN_API AdaptiveDecoder();
+
+        // Decode the `count` symbols of a frame and append them to out; the padding after them is skipped
+        // Throws std::invalid_argument if the frame ends first, after which the decoder is out of step with the stream
+        HUFFMAN_API void Decode(const Byte* data, size_t size, size_t count, std::string& out);
+
+    private:
+        AdaptiveModel model_;
+        Decoder decoder_;
+    };
+
     HUFFMAN_API ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength);
+    // Compress, handing the source to onSource while counting and the packed bytes to onPacked while encoding
+    // With TableMode::Sampled freqMap is replaced by the estimated one, and the source is handed to onSource while encoding
+    HUFFMAN_API ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength, const ChunkVisitor& onSource, const ChunkVisitor& onPacked, unsigned threads = 1, TableMode mode = TableMode::Exact);
+    // Compress on up to `threads` threads (counting and encoding slices in parallel), the output is identical to the serial one
+    HUFFMAN_API ByteVector Compress(const std::string& text, FreqMap& freqMap, size_t& bitLength, unsigned threads);
+    // Bit length Compress gives data, from the symbol counts and code lengths alone: nothing is encoded and no output is
+    // allocated; freqMap receives the counts. With fromSample only the runs sampled tables use are counted, freqMap holds
+    // the sample's counts and the result is an estimate (inputs below SampledTableMinSize are always counted in full)
+    HUFFMAN_API size_t EncodedBitLength(const char* data, size_t size, FreqMap& freqMap, bool fromSample = false);
     HUFFMAN_API std::string Decompress(const ByteVector& compressed, const FreqMap& freqMap, size_t bitLength);
+    // Decompress on up to `threads` threads: slices are decoded speculatively from arbitrary bit offsets and
+    // stitched where they resynchronize with the preceding slice, the result is identical to the serial one
+    HUFFMAN_API std::string Decompress(const ByteVector& compressed, const FreqMap& freqMap, size_t bitLength, unsigned threads);
+    // Decode without materializing the result, handing decoded chunks to onOutput
+    HUFFMAN_API void Decode(const Byte* compressed, size_t size, const FreqMap& freqMap, size_t bitLength, const ChunkVisitor& onOutput);
 
     namespace Methods {
         HUFFMAN_API HuffmanNode* BuildHuffmanTree(const FreqMap& freqMap);
         HUFFMAN_API void GenerateCodes(HuffmanNode* node, const std::string& code, std::map<Char, std::string>& huffmanCode);
+        // Same codes as GenerateCodes, laid out for table-driven encoding
+        HUFFMAN_API void BuildCodeTable(HuffmanNode* root, CodeTable& codeTable);
         HUFFMAN_API ByteVector PackBitsToBytes(const std::string& bitString, size_t& bitLength);
         HUFFMAN_API std::string UnpackBytesToBits(const ByteVector& compressedData, size_t bitLength);
         HUFFMAN_API void FreeTree(HuffmanNode* node);
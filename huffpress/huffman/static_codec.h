@@ -0,0 +1,275 @@
+#ifndef HUFFMAN_STATIC_CODEC_H
+#define HUFFMAN_STATIC_CODEC_H
+
+#include "huffman.h"
+
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+namespace Huffman {
+
+    namespace Detail {
+        // Longest code a static codec accepts, so that a code always fits a 64-bit window next to unread bits
+        constexpr unsigned StaticMaxLength = 32;
+
+        // Code length of every byte value, 0 for symbols that do not occur
+        struct StaticLengths {
+            std::uint8_t length[256];
+        };
+
+        // One lookup table slot: the symbol whose code is a prefix of the slot index, or length 0 for longer codes
+        struct StaticEntry {
+            Byte symbol;
+            std::uint8_t length;
+        };
+
+        template <unsigned MaxLength, unsigned TableBits>
+        struct StaticTables {
+            HuffmanCodeword codes[256];
+            StaticEntry lookup[1u << TableBits];
+            // Canonical decoding past the lookup table: the end of the codes of every length (left-aligned to
+            // MaxLength bits), the first code of every length and the position of its first symbol in `symbols`
+            std::uint64_t limit[MaxLength + 1];
+            std::uint32_t firstCode[MaxLength + 1];
+            std::uint16_t offset[MaxLength + 1];
+            Byte symbols[256];
+        };
+
+        // Huffman code lengths: symbols are sorted by frequency (stable, so ties keep symbol order) and merged with
+        // the two-queue method, since the merged nodes come out in ascending order as well
+        template <typename Frequencies>
+        constexpr StaticLengths LengthsFromFrequencies(const Frequencies& frequencies) {
+            unsigned order[256] = {};
+            unsigned count = 0;
+            for (unsigned symbol = 0; symbol < 256; ++symbol) {
+                if (frequencies[symbol] == 0) continue;
+                unsigned i = count++;
+                while (i > 0 && frequencies[order[i - 1]] > frequencies[symbol]) {
+                    order[i] = order[i - 1];
+                    --i;
+                }
+                order[i] = symbol;
+            }
+
+            StaticLengths result{};
+            if (count == 1) {
+                // A lone symbol still gets a one-bit code, the stream carries no symbol count
+                result.length[order[0]] = 1;
+                return result;
+            }
+
+            std::uint64_t weight[511] = {};
+            unsigned parent[511] = {};
+            for (unsigned i = 0; i < count; ++i) weight[i] = frequencies[order[i]];
+            unsigned leaf = 0, merged = count, next = count;
+            while (next + 1 < 2 * count) {
+                unsigned pick[2] = {};
+                for (unsigned k = 0; k < 2; ++k) {
+                    pick[k] = leaf < count && (merged == next || weight[leaf] <= weight[merged]) ? leaf++ : merged++;
+                }
+                weight[next] = weight[pick[0]] + weight[pick[1]];
+                parent[pick[0]] = parent[pick[1]] = next++;
+            }
+
+            // Parents come after their children and the root is the last node
+            unsigned depth[511] = {};
+            for (unsigned i = 2 * count - 2; i-- > 0;) depth[i] = depth[parent[i]] + 1;
+            for (unsigned i = 0; i < count; ++i) result.length[order[i]] = static_cast<std::uint8_t>(depth[i]);
+            return result;
+        }
+
+        // Table::Lengths when the table gives code lengths, otherwise lengths built from Table::Frequencies
+        template <typename Table>
+        constexpr auto CodeLengths(int) -> decltype(Table::Lengths[0], StaticLengths()) {
+            StaticLengths result{};
+            for (unsigned symbol = 0; symbol < 256; ++symbol) result.length[symbol] = static_cast<std::uint8_t>(Table::Lengths[symbol]);
+            return result;
+        }
+
+        template <typename Table>
+        constexpr StaticLengths CodeLengths(long) {
+            return LengthsFromFrequencies(Table::Frequencies);
+        }
+
+        constexpr unsigned LongestCode(const StaticLengths& lengths) {
+            unsigned longest = 0;
+            for (unsigned symbol = 0; symbol < 256; ++symbol) longest = lengths.length[symbol] > longest ? lengths.length[symbol] : longest;
+            return longest;
+        }
+
+        constexpr unsigned ShortestCode(const StaticLengths& lengths) {
+            unsigned shortest = 0;
+            for (unsigned symbol = 0; symbol < 256; ++symbol) {
+                if (lengths.length[symbol] && (!shortest || lengths.length[symbol] < shortest)) shortest = lengths.length[symbol];
+            }
+            return shortest;
+        }
+
+        // Whether codes of these lengths can be prefix-free (Kraft's inequality)
+        constexpr bool PrefixFree(const StaticLengths& lengths) {
+            std::uint64_t used = 0;
+            for (unsigned symbol = 0; symbol < 256; ++symbol) {
+                if (lengths.length[symbol] > StaticMaxLength) return false;
+                if (lengths.length[symbol]) used += std::uint64_t(1) << (StaticMaxLength - lengths.length[symbol]);
+            }
+            return used <= (std::uint64_t(1) << StaticMaxLength);
+        }
+
+        // Canonical codes: shorter codes first, codes of the same length in symbol order
+        template <unsigned MaxLength, unsigned TableBits>
+        constexpr StaticTables<MaxLength, TableBits> BuildStaticTables(const StaticLengths& lengths) {
+            StaticTables<MaxLength, TableBits> tables{};
+            unsigned count[MaxLength + 1] = {};
+            for (unsigned symbol = 0; symbol < 256; ++symbol) count[lengths.length[symbol]]++;
+            count[0] = 0;
+
+            std::uint64_t code = 0;
+            unsigned index = 0;
+            std::uint32_t next[MaxLength + 1] = {};
+            for (unsigned length = 1; length <= MaxLength; ++length) {
+                code = (code + count[length - 1]) << 1;
+                tables.firstCode[length] = next[length] = static_cast<std::uint32_t>(code);
+                tables.offset[length] = static_cast<std::uint16_t>(index);
+                tables.limit[length] = (code + count[length]) << (MaxLength - length);
+                index += count[length];
+            }
+
+            for (unsigned symbol = 0; symbol < 256; ++symbol) {
+                unsigned length = lengths.length[symbol];
+                if (!length) continue;
+                std::uint32_t bits = next[length]++;
+                tables.codes[symbol].bits = bits;
+                tables.codes[symbol].length = static_cast<std::uint8_t>(length);
+                tables.symbols[tables.offset[length] + (bits - tables.firstCode[length])] = static_cast<Byte>(symbol);
+
+                if (length <= TableBits) {
+                    unsigned spread = TableBits - length;
+                    for (std::uint32_t suffix = 0; suffix < (1u << spread); ++suffix) {
+                        tables.lookup[(bits << spread) | suffix].symbol = static_cast<Byte>(symbol);
+                        tables.lookup[(bits << spread) | suffix].length = static_cast<std::uint8_t>(length);
+                    }
+                }
+            }
+            return tables;
+        }
+    }
+
+    // Codec for a fixed symbol distribution with all of its tables computed at compile time
+    // Table is a type with either `static constexpr ... Frequencies` or `static constexpr ... Lengths`, anything that
+    // can be indexed with a byte value in a constant expression (0 for symbols that never occur). The codes are canonical
+    // Huffman codes of at most 32 bits, so streams are not interchangeable with Encoder/Decoder ones; both ends have to
+    // use the same table. Codes up to LookupBits long decode with one table lookup; when every code is that short the
+    // canonical fallback is compiled out
+    template <typename Table, unsigned LookupBits = 11>
+    class StaticCodec {
+    public:
+        static constexpr unsigned MaxLength = Detail::LongestCode(Detail::CodeLengths<Table>(0));
+        static constexpr unsigned MinLength = Detail::ShortestCode(Detail::CodeLengths<Table>(0));
+        static constexpr unsigned TableBits = LookupBits < MaxLength ? LookupBits : MaxLength;
+
+        static_assert(MaxLength > 0, "the table has no symbols");
+        static_assert(Detail::PrefixFree(Detail::CodeLengths<Table>(0)), "the code lengths do not fit a prefix code of at most 32 bits");
+        static_assert(LookupBits > 0 && LookupBits <= 16, "the lookup table takes 1 to 16 bits");
+
+        using Tables = Detail::StaticTables<MaxLength, TableBits>;
+
+        static constexpr bool Knows(Byte symbol) { return tables_.codes[symbol].length != 0; }
+        static constexpr HuffmanCodeword Code(Byte symbol) { return tables_.codes[symbol]; }
+
+        // Encode data; throws std::invalid_argument on a symbol the table does not have
+        static ByteVector Encode(const char* data, size_t size, size_t& bitLength) {
+            bitLength = 0;
+            for (size_t i = 0; i < size; ++i) {
+                unsigned length = tables_.codes[static_cast<Byte>(data[i])].length;
+                if (!length) throw std::invalid_argument("symbol is missing from the static table");
+                bitLength += length;
+            }
+
+            // Codes are at most 32 bits, so up to 31 pending bits and the next code always fit the accumulator
+            ByteVector encoded((bitLength + 7) / 8);
+            Byte* out = encoded.data();
+            std::uint64_t acc = 0;
+            unsigned pending = 0;
+            for (size_t i = 0; i < size; ++i) {
+                const HuffmanCodeword& code = tables_.codes[static_cast<Byte>(data[i])];
+                acc = (acc << code.length) | code.bits;
+                pending += code.length;
+                if (pending >= 32) {
+                    pending -= 32;
+                    std::uint32_t word = static_cast<std::uint32_t>(acc >> pending);
+                    out[0] = static_cast<Byte>(word >> 24);
+                    out[1] = static_cast<Byte>(word >> 16);
+                    out[2] = static_cast<Byte>(word >> 8);
+                    out[3] = static_cast<Byte>(word);
+                    out += 4;
+                }
+            }
+            for (; pending >= 8; pending -= 8) *out++ = static_cast<Byte>(acc >> (pending - 8));
+            if (pending > 0) *out = static_cast<Byte>(acc << (8 - pending));
+            return encoded;
+        }
+
+        static ByteVector Encode(const std::string& data, size_t& bitLength) {
+            return Encode(data.data(), data.size(), bitLength);
+        }
+
+        // Decode bitLength bits; throws std::invalid_argument on a bit pattern that is not a code
+        // A code cut off by the end of the stream ends decoding, like the table-driven Decoder
+        static std::string Decode(const Byte* data, size_t size, size_t bitLength) {
+            bitLength = bitLength < size * 8 ? bitLength : size * 8;
+            std::string decoded;
+            decoded.reserve(bitLength / MinLength);
+
+            // Unread bits, most significant first, topped up a byte at a time to more than 56 bits
+            std::uint64_t window = 0;
+            unsigned available = 0;
+            size_t byte = 0;
+            size_t pos = 0;
+            while (pos < bitLength) {
+                for (; available <= 56; available += 8, ++byte) {
+                    window |= std::uint64_t(byte < size ? data[byte] : 0) << (56 - available);
+                }
+
+                std::uint64_t peek = window >> (64 - MaxLength);
+                const Detail::StaticEntry& entry = tables_.lookup[peek >> (MaxLength - TableBits)];
+                unsigned length = entry.length;
+                Byte symbol = entry.symbol;
+                if (TableBits < MaxLength && length == 0) {
+                    for (length = TableBits + 1; length <= MaxLength && peek >= tables_.limit[length]; ++length) {}
+                    if (length <= MaxLength) {
+                        symbol = tables_.symbols[tables_.offset[length] + ((peek >> (MaxLength - length)) - tables_.firstCode[length])];
+                    } else {
+                        length = 0;
+                    }
+                }
+                if (length == 0) throw std::invalid_argument("invalid code in a static stream");
+                if (pos + length > bitLength) break;
+
+                pos += length;
+                window <<= length;
+                available -= length;
+                decoded += static_cast<char>(symbol);
+            }
+            return decoded;
+        }
+
+        static std::string Decode(const ByteVector& compressed, size_t bitLength) {
+            return Decode(compressed.data(), compressed.size(), bitLength);
+        }
+
+    private:
+        static constexpr Tables tables_ = Detail::BuildStaticTables<MaxLength, TableBits>(Detail::CodeLengths<Table>(0));
+    };
+
+    template <typename Table, unsigned LookupBits>
+    constexpr unsigned StaticCodec<Table, LookupBits>::MaxLength;
+    template <typename Table, unsigned LookupBits>
+    constexpr unsigned StaticCodec<Table, LookupBits>::MinLength;
+    template <typename Table, unsigned LookupBits>
+    constexpr unsigned StaticCodec<Table, LookupBits>::TableBits;
+    template <typename Table, unsigned LookupBits>
+    constexpr typename StaticCodec<Table, LookupBits>::Tables StaticCodec<Table, LookupBits>::tables_;
+}
+
+#endif // HUFFMAN_STATIC_CODEC_H
@@ -1,25 +1,1226 @@
 #define HUFFPRESS_LIBRARY_BUILD
 
 #include "huffpress.h"
+#include "mapped_file.h"
 #include <fstream>
 #include <iostream>
 #include <cstring>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <cstdio>
 
 namespace Huffpress {
 
+    namespace {
+        // Payloads at least this large check both checksums on two threads at once
+        const size_t ConcurrentVerifyThreshold = 1 << 20;
+        // Major version of files with a transform list after the version
+        const uint8_t TransformedVersion = 1;
+        // Major version of files with a transform list, a coding and its tables after the version
+        const uint8_t CodedVersion = 2;
+
+        template <typename T>
+        bool ReadField(const Huffman::Byte* data, size_t size, size_t& offset, T& value) {
+            if (size - offset < sizeof(value)) return false;
+            std::memcpy(&value, data + offset, sizeof(value));
+            offset += sizeof(value);
+            return true;
+        }
+
+        // Whether a coding of a version 2 header goes with that many tables
+        bool KnownCoding(std::uint8_t coding, size_t tableCount) {
+            return (coding == static_cast<std::uint8_t>(Coding::Lz77) && tableCount == LzTableCount)
+                || (coding == static_cast<std::uint8_t>(Coding::ContextSplit) && tableCount < MaxContextTables);
+        }
+
+        bool ReadFreqMap(const Huffman::Byte* data, size_t size, size_t& offset, Huffman::FreqMap& freqMap, std::string& error) {
+            size_t freqMapSize = 0;
+            if (!ReadField(data, size, offset, freqMapSize)) {
+                error = "truncated header";
+                return false;
+            }
+            if (freqMapSize > 256) {
+                error = "frequency map too large";
+                return false;
+            }
+
+            freqMap.clear();
+            for (size_t i = 0; i < freqMapSize; ++i) {
+                char key;
+                int value;
+                if (!ReadField(data, size, offset, key) || !ReadField(data, size, offset, value)) {
+                    error = "truncated frequency map";
+                    return false;
+                }
+                freqMap[key] = value;
+            }
+            return true;
+        }
+
+        // Bounds-checked header parser for data that has not been validated yet
+        bool ReadHeader(const Huffman::Byte* data, size_t size, HuffpressFile::_HuffpressFileHeader& header, size_t& offset, std::string& error) {
+            offset = 0;
+            if (!ReadField(data, size, offset, header.magic) || !ReadField(data, size, offset, header.version)) {
+                error = "truncated header";
+                return false;
+            }
+            if (std::memcmp(header.magic, "HPF", sizeof(header.magic)) != 0) {
+                error = "bad magic";
+                return false;
+            }
+
+            header.transforms.clear();
+            header.coding = Coding::Huffman;
+            header.tables.clear();
+            if (header.version[0] == TransformedVersion || header.version[0] == CodedVersion) {
+                std::uint8_t count = 0;
+                if (!ReadField(data, size, offset, count)) {
+                    error = "truncated header";
+                    return false;
+                }
+                if ((count == 0 && header.version[0] == TransformedVersion) || count > MaxTransforms) {
+                    error = "bad transform count";
+                    return false;
+                }
+                for (std::uint8_t i = 0; i < count; ++i) {
+                    std::uint8_t transform = 0;
+                    if (!ReadField(data, size, offset, transform)) {
+                        error = "truncated transform list";
+                        return false;
+                    }
+                    if (!KnownTransform(transform)) {
+                        error = "unknown transform";
+                        return false;
+                    }
+                    header.transforms.push_back(static_cast<Transform>(transform));
+                }
+            }
+
+            if (header.version[0] == CodedVersion) {
+                std::uint8_t coding = 0, tableCount = 0;
+                if (!ReadField(data, size, offset, coding) || !ReadField(data, size, offset, tableCount)) {
+                    error = "truncated header";
+                    return false;
+                }
+                if (!KnownCoding(coding, tableCount)) {
+                    error = "unknown coding";
+                    return false;
+                }
+                header.coding = static_cast<Coding>(coding);
+                header.tables.resize(tableCount);
+                for (Huffman::FreqMap& table : header.tables) {
+                    if (!ReadFreqMap(data, size, offset, table, error)) return false;
+                }
+                if (header.coding == Coding::ContextSplit) {
+                    size_t mapSize = ContextMapSize(tableCount + 1);
+                    if (size - offset < mapSize) {
+                        error = "truncated context map";
+                        return false;
+                    }
+                    if (!UnpackContextMap(data + offset, tableCount + 1, header.contextMap)) {
+                        error = "context map refers to a missing table";
+                        return false;
+                    }
+                    offset += mapSize;
+                }
+            }
+
+            if (!ReadFreqMap(data, size, offset, header.freqMap, error)) return false;
+
+            if (!ReadField(data, size, offset, header.bitLength) || !ReadField(data, size, offset, header.size)
+                || !ReadField(data, size, offset, header.sourceChecksum) || !ReadField(data, size, offset, header.compressedChecksum)) {
+                error = "truncated header";
+                return false;
+            }
+            return true;
+        }
+
+        template <typename T>
+        void AppendField(Huffman::ByteVector& buffer, const T& value) {
+            const Huffman::Byte* bytes = reinterpret_cast<const Huffman::Byte*>(&value);
+            buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+        }
+
+        // Version a header is written with: the major version tells whether a transform list and a coding follow,
+        // whatever the header was parsed with
+        void WrittenVersion(const HuffpressFile::_HuffpressFileHeader& header, uint8_t (&version)[3]) {
+            std::memcpy(version, header.version, sizeof(version));
+            if (header.coding != Coding::Huffman) {
+                version[0] = CodedVersion;
+            } else if (!header.transforms.empty()) {
+                version[0] = TransformedVersion;
+            } else if (version[0] == TransformedVersion || version[0] == CodedVersion) {
+                version[0] = Version[0];
+            }
+        }
+
+        void AppendFreqMap(Huffman::ByteVector& buffer, const Huffman::FreqMap& freqMap) {
+            size_t freqMapSize = freqMap.size();
+            AppendField(buffer, freqMapSize);
+            for (const auto& pair : freqMap) {
+                AppendField(buffer, pair.first);
+                AppendField(buffer, pair.second);
+            }
+        }
+
+        // Append the header in the layout read by ReadHeader
+        void AppendHeader(const HuffpressFile::_HuffpressFileHeader& header, Huffman::ByteVector& buffer) {
+            uint8_t version[3];
+            WrittenVersion(header, version);
+            AppendField(buffer, header.magic);
+            AppendField(buffer, version);
+            if (version[0] == TransformedVersion || version[0] == CodedVersion) {
+                AppendField(buffer, static_cast<std::uint8_t>(header.transforms.size()));
+                for (Transform transform : header.transforms) AppendField(buffer, static_cast<std::uint8_t>(transform));
+            }
+            if (version[0] == CodedVersion) {
+                AppendField(buffer, static_cast<std::uint8_t>(header.coding));
+                AppendField(buffer, static_cast<std::uint8_t>(header.tables.size()));
+                for (const Huffman::FreqMap& table : header.tables) AppendFreqMap(buffer, table);
+                if (header.coding == Coding::ContextSplit) {
+                    size_t mapOffset = buffer.size();
+                    buffer.resize(mapOffset + ContextMapSize(header.tables.size() + 1));
+                    PackContextMap(header.contextMap, header.tables.size() + 1, buffer.data() + mapOffset);
+                }
+            }
+
+            AppendFreqMap(buffer, header.freqMap);
+
+            AppendField(buffer, header.bitLength);
+            AppendField(buffer, header.size);
+            AppendField(buffer, header.sourceChecksum);
+            AppendField(buffer, header.compressedChecksum);
+        }
+
+        // Size of a header written by AppendHeader with `entries` frequency map entries and `transforms` transforms
+        size_t HeaderSize(size_t entries, size_t transforms = 0) {
+            const HuffpressFile::_HuffpressFileHeader header;
+            return sizeof(header.magic) + sizeof(header.version) + (transforms ? 1 + transforms : 0)
+                + sizeof(size_t) + entries * (sizeof(Huffman::Char) + sizeof(Huffman::Int))
+                + sizeof(header.bitLength) + sizeof(header.size) + sizeof(header.sourceChecksum) + sizeof(header.compressedChecksum);
+        }
+
+        void ReadStreamFreqMap(std::istream& in, Huffman::FreqMap& freqMap) {
+            size_t freqMapSize = 0;
+            in.read(reinterpret_cast<char*>(&freqMapSize), sizeof(freqMapSize));
+
+            freqMap.clear();
+            for (size_t i = 0; in && i < freqMapSize; ++i) {
+                char key;
+                int value;
+                in.read(reinterpret_cast<char*>(&key), sizeof(key));
+                in.read(reinterpret_cast<char*>(&value), sizeof(value));
+                freqMap[key] = value;
+            }
+        }
+
+        // Read a whole file in the layout written by Serialize
+        void ReadStream(std::istream& in, HuffpressFile::_HuffpressFileHeader& header, Huffman::ByteVector& byteVec) {
+            in.read(header.magic, sizeof(header.magic));
+            in.read(reinterpret_cast<char*>(header.version), sizeof(header.version));
+
+            header.transforms.clear();
+            header.coding = Coding::Huffman;
+            header.tables.clear();
+            if (in && (header.version[0] == TransformedVersion || header.version[0] == CodedVersion)) {
+                std::uint8_t count = 0;
+                in.read(reinterpret_cast<char*>(&count), sizeof(count));
+                for (std::uint8_t i = 0; in && i < count && i < MaxTransforms; ++i) {
+                    std::uint8_t transform = 0;
+                    in.read(reinterpret_cast<char*>(&transform), sizeof(transform));
+                    header.transforms.push_back(static_cast<Transform>(transform));
+                }
+            }
+            if (in && header.version[0] == CodedVersion) {
+                std::uint8_t coding = 0, tableCount = 0;
+                in.read(reinterpret_cast<char*>(&coding), sizeof(coding));
+                in.read(reinterpret_cast<char*>(&tableCount), sizeof(tableCount));
+                header.coding = static_cast<Coding>(coding);
+                header.tables.resize(in ? tableCount : 0);
+                for (Huffman::FreqMap& table : header.tables) ReadStreamFreqMap(in, table);
+                if (in && header.coding == Coding::ContextSplit && header.tables.size() < MaxContextTables) {
+                    Huffman::Byte packed[MaxContextMapSize] = {};
+                    in.read(reinterpret_cast<char*>(packed), ContextMapSize(header.tables.size() + 1));
+                    // A map that refers to a missing table fails CheckHeader
+                    if (!UnpackContextMap(packed, header.tables.size() + 1, header.contextMap)) header.contextMap.fill(MaxContextTables);
+                }
+            }
+
+            ReadStreamFreqMap(in, header.freqMap);
+
+            in.read(reinterpret_cast<char*>(&header.bitLength), sizeof(header.bitLength));
+
+            in.read(reinterpret_cast<char*>(&header.size), sizeof(header.size));
+            in.read(reinterpret_cast<char*>(&header.sourceChecksum), sizeof(header.sourceChecksum));
+            in.read(reinterpret_cast<char*>(&header.compressedChecksum), sizeof(header.compressedChecksum));
+
+            byteVec.resize(header.size);
+            in.read(reinterpret_cast<char*>(byteVec.data()), header.size);
+        }
+
+        bool CheckHeader(const HuffpressFile::_HuffpressFileHeader& header, size_t payloadSize, std::string& error) {
+            if (std::memcmp(header.magic, "HPF", sizeof(header.magic)) != 0) {
+                error = "bad magic";
+            } else if (header.version[0] != Version[0] && header.version[0] != TransformedVersion && header.version[0] != CodedVersion) {
+                error = "unsupported version";
+            } else if (header.coding != Coding::Huffman && !KnownCoding(static_cast<std::uint8_t>(header.coding), header.tables.size())) {
+                error = "unknown coding";
+            } else if (header.coding == Coding::ContextSplit
+                       && std::any_of(header.contextMap.begin(), header.contextMap.end(), [&header](std::uint8_t table) { return table > header.tables.size(); })) {
+                error = "context map refers to a missing table";
+            } else if (std::any_of(header.transforms.begin(), header.transforms.end(), [](Transform transform) { return !KnownTransform(static_cast<std::uint8_t>(transform)); })) {
+                error = "unknown transform";
+            } else if (header.size != payloadSize) {
+                error = "payload size does not match the header";
+            } else if (header.bitLength > payloadSize * 8 || (payloadSize > 0 && header.bitLength <= (payloadSize - 1) * 8)) {
+                error = "bit length does not match the payload size";
+            } else if (payloadSize > 0 && header.freqMap.size() < 2) {
+                error = "frequency map cannot produce the payload";
+            } else if (std::any_of(header.freqMap.begin(), header.freqMap.end(), [](const std::pair<const Huffman::Char, Huffman::Int>& pair) { return pair.second < 0; })) {
+                error = "negative frequency";
+            } else {
+                return true;
+            }
+            return false;
+        }
+
+        // Decode a payload to the data the transforms produced, with the decoder of freqMap
+        std::string DecodePayload(const HuffpressFile::_HuffpressFileHeader& header, const Huffman::Decoder& decoder, const Huffman::Byte* payload, size_t size,
+                                  unsigned threads) {
+            if (header.coding == Coding::Lz77) {
+                return LzDecompress(payload, size, header.bitLength, decoder, header.tables);
+            }
+            if (header.coding == Coding::ContextSplit) {
+                return ContextDecompress(payload, size, header.bitLength, decoder, header.tables, header.contextMap);
+            }
+            return decoder.Decompress(payload, size, header.bitLength, threads);
+        }
+
+        // Decode a payload to its source data, handing it to onOutput in chunks as it is decoded: the transforms are
+        // reverted as the coding produces their data, so only a BWT block and the LZ77 window are held at once
+        void DecodeSource(const HuffpressFile::_HuffpressFileHeader& header, const Huffman::Decoder& decoder, const Huffman::Byte* payload, size_t size,
+                          const Huffman::ChunkVisitor& onOutput) {
+            if (header.Plain()) {
+                decoder.Decode(payload, size, header.bitLength, onOutput);
+                return;
+            }
+            TransformReverter reverter(header.transforms, onOutput);
+            auto onDecoded = [&reverter](const char* chunk, size_t chunkSize) { reverter.Write(chunk, chunkSize); };
+            if (header.coding == Coding::Lz77) {
+                LzDecode(payload, size, header.bitLength, decoder, header.tables, onDecoded);
+            } else if (header.coding == Coding::ContextSplit) {
+                ContextDecode(payload, size, header.bitLength, decoder, header.tables, header.contextMap, onDecoded);
+            } else {
+                decoder.Decode(payload, size, header.bitLength, onDecoded);
+            }
+            reverter.Finish();
+        }
+
+        // Decode a payload to its source data on up to `threads` threads
+        std::string DecompressSource(const HuffpressFile::_HuffpressFileHeader& header, const Huffman::Decoder& decoder, const Huffman::Byte* payload, size_t size,
+                                     unsigned threads) {
+            std::string data = DecodePayload(header, decoder, payload, size, threads);
+            RevertTransforms(header.transforms, data, threads);
+            return data;
+        }
+
+        // Bits a frequency map entry (symbol and count) takes in a record header
+        const double FreqMapEntryBits = 8 * (sizeof(Huffman::Char) + sizeof(Huffman::Int));
+        // Tables a batch shares at most, inputs that fit none of them get their own
+        const size_t MaxSharedTables = 8;
+        // Batches below this many input bytes per thread are not split further
+        const size_t MinBatchSliceSize = 64 * 1024;
+
+        using SymbolCounts = std::array<std::uint32_t, 256>;
+
+        // Split `count` items into at most `parts` contiguous ranges of about the same total size
+        template <typename SizeOf>
+        Huffman::ScratchVector<size_t> SplitBatch(size_t count, size_t parts, SizeOf sizeOf) {
+            size_t total = 0;
+            for (size_t i = 0; i < count; ++i) total += sizeOf(i);
+            parts = std::max<size_t>(1, std::min({parts, count, total / MinBatchSliceSize}));
+
+            Huffman::ScratchVector<size_t> bounds(1, 0);
+            size_t done = 0;
+            for (size_t i = 0; i < count && bounds.size() < parts; ++i) {
+                done += sizeOf(i);
+                if (done * parts >= total * bounds.size()) bounds.push_back(i + 1);
+            }
+            bounds.push_back(count);
+            return bounds;
+        }
+
+        // Run work(first, last, part) for every range on its own thread under the caller's allocator
+        // The first exception thrown by any range is rethrown once all threads are done
+        template <typename Work>
+        void RunBatch(const Huffman::ScratchVector<size_t>& bounds, Work work) {
+            Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+            std::vector<std::exception_ptr> errors(bounds.size() - 1);
+            auto run = [&allocator, &bounds, &work, &errors](size_t part) {
+                try {
+                    Huffman::AllocatorScope scope(allocator, false);
+                    work(bounds[part], bounds[part + 1], part);
+                } catch (...) {
+                    errors[part] = std::current_exception();
+                }
+            };
+
+            Huffman::ScratchVector<std::thread> pool;
+            for (size_t part = 1; part + 1 < bounds.size(); ++part) {
+                pool.emplace_back(run, part);
+            }
+            run(0);
+            for (std::thread& thread : pool) {
+                thread.join();
+            }
+
+            for (const std::exception_ptr& error : errors) {
+                if (error) std::rethrow_exception(error);
+            }
+        }
+
+        // Size in bits of a record with its own table, estimated from the entropy of the counts
+        double OwnCost(const SymbolCounts& counts) {
+            double total = 0, entries = 0, bits = 0;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                total += counts[symbol];
+                entries += counts[symbol] != 0;
+            }
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                if (counts[symbol]) bits -= counts[symbol] * std::log2(counts[symbol] / total);
+            }
+            return bits + entries * FreqMapEntryBits;
+        }
+
+        // Merged counts of the inputs grouped under one shared table
+        // The model used to price new inputs is only refreshed when the counts have doubled since the last refresh
+        struct SharedGroup {
+            SymbolCounts counts{};
+            std::array<double, 256> symbolBits{};
+            std::uint64_t total = 0, modelTotal = 0;
+            size_t symbols = 0;
+
+            void Add(const SymbolCounts& more) {
+                for (int symbol = 0; symbol < 256; ++symbol) {
+                    symbols += more[symbol] && !counts[symbol];
+                    counts[symbol] += more[symbol];
+                    total += more[symbol];
+                }
+                if (total < modelTotal * 2) return;
+
+                // Symbols the model has never seen are priced as if seen half a time
+                modelTotal = total;
+                for (int symbol = 0; symbol < 256; ++symbol) symbolBits[symbol] = -std::log2(std::max(0.5, double(counts[symbol])) / total);
+            }
+
+            // Size in bits of a record using this group's table
+            double Cost(const SymbolCounts& data) const {
+                double entries = static_cast<double>(symbols), bits = 0;
+                for (int symbol = 0; symbol < 256; ++symbol) {
+                    if (!data[symbol]) continue;
+                    bits += data[symbol] * symbolBits[symbol];
+                    entries += !counts[symbol];
+                }
+                return bits + entries * FreqMapEntryBits;
+            }
+        };
+
+        Huffman::FreqMap ToFreqMap(const SymbolCounts& counts) {
+            Huffman::FreqMap freqMap;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                if (counts[symbol]) freqMap[static_cast<Huffman::Char>(symbol)] = static_cast<Huffman::Int>(counts[symbol]);
+            }
+            return freqMap;
+        }
+
+        // Blocks that may wait between two stages of the file pipeline
+        const size_t PipelineDepth = 4;
+
+        // Blocking queue of at most `capacity` items; Close() wakes everybody up once either side gives up or is done
+        template <typename T>
+        class BoundedQueue {
+        public:
+            explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+            // Wait for room and queue the item (dropped once the queue is closed)
+            void Push(T item) {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->hasRoom_.wait(lock, [this]() { return this->closed_ || this->items_.size() < this->capacity_; });
+                if (this->closed_) return;
+                this->items_.push_back(std::move(item));
+                lock.unlock();
+                this->hasItem_.notify_one();
+            }
+
+            // Wait for an item; false once the queue is closed and drained
+            bool Pop(T& item) {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->hasItem_.wait(lock, [this]() { return this->closed_ || !this->items_.empty(); });
+                if (this->items_.empty()) return false;
+                item = std::move(this->items_.front());
+                this->items_.pop_front();
+                lock.unlock();
+                this->hasRoom_.notify_one();
+                return true;
+            }
+
+            void Close() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    this->closed_ = true;
+                }
+                this->hasItem_.notify_all();
+                this->hasRoom_.notify_all();
+            }
+
+        private:
+            std::mutex mutex_;
+            std::condition_variable hasItem_, hasRoom_;
+            std::deque<T> items_;
+            size_t capacity_;
+            bool closed_ = false;
+        };
+
+        // A source file split into blocks, with the counts of every block and the checksum of the whole file
+        struct SourceBlocks {
+            Huffman::ScratchVector<Huffman::ScratchString> blocks;
+            Huffman::ScratchVector<SymbolCounts> counts;
+            checksum_t checksum = CHECKSUM_INIT;
+
+            Huffman::FreqMap FreqMap() const {
+                std::array<std::uint64_t, 256> total{};
+                for (const SymbolCounts& blockCounts : this->counts) {
+                    for (int symbol = 0; symbol < 256; ++symbol) total[symbol] += blockCounts[symbol];
+                }
+
+                Huffman::FreqMap freqMap;
+                for (int symbol = 0; symbol < 256; ++symbol) {
+                    if (total[symbol]) freqMap[static_cast<Huffman::Char>(symbol)] = static_cast<Huffman::Int>(total[symbol]);
+                }
+                return freqMap;
+            }
+
+            // Bit offset of every block in the encoded stream, the last entry is the bit length of the stream
+            Huffman::ScratchVector<size_t> BitOffsets(const Huffman::Encoder& encoder) const {
+                Huffman::ScratchVector<size_t> offsets(this->blocks.size() + 1, 0);
+                for (size_t block = 0; block < this->blocks.size(); ++block) {
+                    size_t bits = 0;
+                    for (int symbol = 0; symbol < 256; ++symbol) bits += size_t(this->counts[block][symbol]) * encoder.Code(static_cast<Huffman::Byte>(symbol)).length;
+                    offsets[block + 1] = offsets[block] + bits;
+                }
+                return offsets;
+            }
+        };
+
+        // Read a file on a reader thread; every block is counted and hashed on the calling thread as soon as it arrives
+        SourceBlocks ReadSource(const std::string& filePath, size_t blockSize) {
+            std::ifstream in(filePath, std::ios::binary);
+            if (!in) {
+                throw Exceptions::FileOpenException(filePath);
+            }
+
+            BoundedQueue<Huffman::ScratchString> queue(PipelineDepth);
+            std::exception_ptr readError;
+            Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+            std::thread reader([&in, &queue, &readError, &allocator, &filePath, blockSize]() {
+                try {
+                    Huffman::AllocatorScope scope(allocator, false);
+                    while (in) {
+                        Huffman::ScratchString block(blockSize, '\0');
+                        in.read(&block[0], blockSize);
+                        block.resize(static_cast<size_t>(in.gcount()));
+                        if (!block.empty()) queue.Push(std::move(block));
+                    }
+                    if (in.bad()) throw std::ios_base::failure("failed to read " + filePath);
+                } catch (...) {
+                    readError = std::current_exception();
+                }
+                queue.Close();
+            });
+
+            SourceBlocks source;
+            try {
+                Huffman::ScratchString block;
+                while (queue.Pop(block)) {
+                    source.counts.emplace_back();
+                    source.counts.back().fill(0);
+                    for (char c : block) source.counts.back()[static_cast<Huffman::Byte>(c)]++;
+                    source.checksum = checksum_update(source.checksum, block.data(), block.size());
+                    source.blocks.push_back(std::move(block));
+                }
+            } catch (...) {
+                queue.Close();
+                reader.join();
+                throw;
+            }
+            reader.join();
+
+            if (readError) std::rethrow_exception(readError);
+            return source;
+        }
+
+        // Joins blocks encoded with Encoder::Encode(..., bitOffset % 8) into one stream
+        // Each complete byte goes to the sink once; the unfinished last byte of a block waits for the next block
+        struct BlockStitcher {
+            size_t bitOffset = 0;
+            Huffman::Byte carry = 0;
+
+            template <typename Sink>
+            void Add(Huffman::ByteVector& block, size_t bits, Sink& sink) {
+                if (bits == 0) return;
+                if (this->bitOffset % 8) block[0] |= this->carry;
+
+                this->bitOffset += bits;
+                bool unfinished = this->bitOffset % 8 != 0;
+                sink(block.data(), block.size() - unfinished);
+                if (unfinished) this->carry = block.back();
+            }
+
+            template <typename Sink>
+            void Finish(Sink& sink) {
+                if (this->bitOffset % 8) sink(&this->carry, 1);
+            }
+        };
+
+        // Encode the blocks on up to `threads` threads and hand the joined stream to sink(data, size) in order
+        // Encoders run at most PipelineDepth blocks ahead of the sink
+        template <typename Sink>
+        void EncodeBlocks(const SourceBlocks& source, const Huffman::Encoder& encoder, const Huffman::ScratchVector<size_t>& bitOffsets, unsigned threads, Sink sink) {
+            const size_t count = source.blocks.size();
+            Huffman::ScratchVector<Huffman::ByteVector> encoded(count);
+            Huffman::ScratchVector<char> ready(count, 0);
+            std::mutex mutex;
+            std::condition_variable changed;
+            size_t next = 0, consumed = 0;
+            std::exception_ptr error;
+
+            Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+            auto work = [&]() {
+                Huffman::AllocatorScope scope(allocator, false);
+                for (;;) {
+                    size_t block;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return error || next >= count || next < consumed + PipelineDepth; });
+                        if (error || next >= count) return;
+                        block = next++;
+                    }
+
+                    try {
+                        size_t bits = 0;
+                        Huffman::ByteVector bytes = encoder.Encode(source.blocks[block].data(), source.blocks[block].size(), bits, bitOffsets[block] % 8);
+                        std::lock_guard<std::mutex> lock(mutex);
+                        encoded[block] = std::move(bytes);
+                        ready[block] = 1;
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error) error = std::current_exception();
+                    }
+                    changed.notify_all();
+                }
+            };
+
+            Huffman::ScratchVector<std::thread> pool;
+            for (size_t i = 0; i < std::min<size_t>(std::max(1u, threads), count); ++i) {
+                pool.emplace_back(work);
+            }
+
+            BlockStitcher stitcher;
+            try {
+                for (size_t block = 0; block < count; ++block) {
+                    Huffman::ByteVector bytes;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return error || ready[block]; });
+                        if (error) break;
+                        bytes = std::move(encoded[block]);
+                        consumed = block + 1;
+                    }
+                    changed.notify_all();
+                    stitcher.Add(bytes, bitOffsets[block + 1] - bitOffsets[block], sink);
+                }
+                stitcher.Finish(sink);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+            }
+            changed.notify_all();
+
+            for (std::thread& thread : pool) {
+                thread.join();
+            }
+            if (error) std::rethrow_exception(error);
+        }
+
+        // Magic of a block stream, followed by the library version
+        const char StreamMagic[3] = {'H', 'P', 'S'};
+        // Magic of an adaptive stream, followed by the library version
+        const char AdaptiveMagic[3] = {'H', 'P', 'D'};
+
+        // Records are read in pieces of at most this size, so a damaged size field fails as truncation rather than allocation
+        const size_t StreamReadChunk = 16 << 20;
+
+        // Run transform(item) on `threads` worker threads over the items produced by read(item) until it returns false,
+        // handing the results to write(result) in input order on a writer thread
+        // At most 2 * threads items are in flight, so memory stays bounded however long the input is
+        template <typename In, typename Out, typename Read, typename Transform, typename Write>
+        void RunInOrder(unsigned threads, Read read, Transform transform, Write write) {
+            const size_t window = 2 * size_t(threads);
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::deque<std::pair<size_t, In>> jobs;
+            std::map<size_t, Out> results;
+            size_t produced = 0, written = 0;
+            bool finished = false;
+            std::exception_ptr error;
+
+            auto fail = [&mutex, &error]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+            };
+
+            Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+            auto work = [&]() {
+                Huffman::AllocatorScope scope(allocator, false);
+                for (;;) {
+                    std::pair<size_t, In> job;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return error || finished || !jobs.empty(); });
+                        if (error || jobs.empty()) return;
+                        job = std::move(jobs.front());
+                        jobs.pop_front();
+                    }
+
+                    try {
+                        Out result = transform(job.second);
+                        std::lock_guard<std::mutex> lock(mutex);
+                        results.emplace(job.first, std::move(result));
+                    } catch (...) {
+                        fail();
+                    }
+                    changed.notify_all();
+                }
+            };
+
+            auto drain = [&]() {
+                Huffman::AllocatorScope scope(allocator, false);
+                for (;;) {
+                    Out result;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return error || results.count(written) || (finished && written == produced); });
+                        if (error || !results.count(written)) return;
+                        result = std::move(results[written]);
+                        results.erase(written);
+                    }
+
+                    try {
+                        write(result);
+                    } catch (...) {
+                        fail();
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ++written;
+                    }
+                    changed.notify_all();
+                }
+            };
+
+            Huffman::ScratchVector<std::thread> pool;
+            for (unsigned i = 0; i < threads; ++i) {
+                pool.emplace_back(work);
+            }
+            std::thread writer(drain);
+
+            try {
+                for (;;) {
+                    In item;
+                    if (!read(item)) break;
+
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() { return error || produced - written < window; });
+                    if (error) break;
+                    jobs.emplace_back(produced++, std::move(item));
+                    lock.unlock();
+                    changed.notify_all();
+                }
+            } catch (...) {
+                fail();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+            }
+            changed.notify_all();
+
+            for (std::thread& thread : pool) {
+                thread.join();
+            }
+            writer.join();
+            if (error) std::rethrow_exception(error);
+        }
+
+        // Read exactly `size` bytes of a stream record; false if the stream ends first
+        bool ReadRecord(std::istream& in, Huffman::ByteVector& record, std::uint64_t size) {
+            record.clear();
+            while (record.size() < size) {
+                size_t offset = record.size();
+                size_t chunk = static_cast<size_t>(std::min<std::uint64_t>(size - offset, StreamReadChunk));
+                record.resize(offset + chunk);
+                in.read(reinterpret_cast<char*>(record.data() + offset), chunk);
+                if (static_cast<size_t>(in.gcount()) != chunk) return false;
+            }
+            return true;
+        }
+
+        // Decode one complete Huffpress file held in a buffer, checking both checksums
+        std::string DecodeRecord(const Huffman::ByteVector& record, const std::string& name) {
+            HuffpressFile::_HuffpressFileHeader header;
+            size_t offset = 0;
+            std::string error;
+            if (!ReadHeader(record.data(), record.size(), header, offset, error) || !CheckHeader(header, record.size() - offset, error)) {
+                throw Exceptions::DeserializationException(name + ": " + error);
+            }
+
+            const Huffman::Byte* payload = record.data() + offset;
+            if (checksum(reinterpret_cast<const char*>(payload), header.size) != header.compressedChecksum) {
+                throw Exceptions::ChecksumMismatchException("compressed data of " + name);
+            }
+
+            std::string result;
+            checksum_t sourceChecksum = CHECKSUM_INIT;
+            DecodeSource(header, Huffman::Decoder(header.freqMap), payload, header.size, [&result, &sourceChecksum](const char* chunk, size_t size) {
+                sourceChecksum = checksum_update(sourceChecksum, chunk, size);
+                result.append(chunk, size);
+            });
+            if (sourceChecksum != header.sourceChecksum) {
+                throw Exceptions::ChecksumMismatchException("source data of " + name);
+            }
+            return result;
+        }
+
+        void WriteOutput(std::ostream& out, const char* data, size_t size) {
+            if (!out.write(data, size)) {
+                throw Exceptions::SerializationException("failed to write the output stream");
+            }
+        }
+
+        Huffman::ByteVector StreamHeader() {
+            Huffman::ByteVector streamHeader;
+            AppendField(streamHeader, StreamMagic);
+            AppendField(streamHeader, Version);
+            return streamHeader;
+        }
+
+        // Per-context table settings of stream blocks, checked before anything is written
+        ContextOptions StreamContextOptions(int lzLevel, size_t contextTables) {
+            if (lzLevel && contextTables) {
+                throw std::invalid_argument("blocks are coded either as LZ77 or with per-context tables");
+            }
+            if (contextTables > MaxContextTables) {
+                throw std::invalid_argument("context-split tables must be between 1 and " + std::to_string(MaxContextTables));
+            }
+            ContextOptions options;
+            options.maxTables = contextTables;
+            return options;
+        }
+
+        // Compress `in` into size-prefixed records followed by the end marker, as LZ77 sequences with lz or with
+        // per-context tables with context
+        StreamStats WriteStreamBlocks(std::istream& in, std::ostream& out, unsigned threads, size_t blockSize, const Pipeline& pipeline, const LzOptions* lz,
+                                      const ContextOptions* context) {
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+            blockSize = std::max<size_t>(blockSize, 1);
+
+            StreamStats stats;
+            RunInOrder<std::string, Huffman::ByteVector>(threads,
+                [&in, &stats, blockSize](std::string& block) {
+                    block.resize(blockSize);
+                    in.read(&block[0], blockSize);
+                    block.resize(static_cast<size_t>(in.gcount()));
+                    if (in.bad()) throw Exceptions::DeserializationException("failed to read the input stream");
+                    stats.sourceBytes += block.size();
+                    return !block.empty();
+                },
+                [&pipeline, lz, context](const std::string& block) {
+                    // The record is a complete file behind its size, so it can also be cut out and opened on its own
+                    HuffpressFile file;
+                    if (lz) {
+                        file.Init(block, *lz, pipeline);
+                    } else if (context) {
+                        file.Init(block, *context, pipeline);
+                    } else {
+                        file.Init(block, pipeline);
+                    }
+                    Huffman::ByteVector record(sizeof(std::uint64_t));
+                    AppendHeader(file.header, record);
+                    record.insert(record.end(), file.byteVec.begin(), file.byteVec.end());
+                    std::uint64_t recordSize = record.size() - sizeof(std::uint64_t);
+                    std::memcpy(record.data(), &recordSize, sizeof(recordSize));
+                    return record;
+                },
+                [&out, &stats](const Huffman::ByteVector& record) {
+                    WriteOutput(out, reinterpret_cast<const char*>(record.data()), record.size());
+                    stats.blocks++;
+                    stats.compressedBytes += record.size() - sizeof(std::uint64_t);
+                });
+
+            const std::uint64_t endMarker = 0;
+            WriteOutput(out, reinterpret_cast<const char*>(&endMarker), sizeof(endMarker));
+            if (!out.flush()) {
+                throw Exceptions::SerializationException("failed to write the output stream");
+            }
+            return stats;
+        }
+
+        // Read the next frame of an adaptive stream (after its header) and append its data to out; false at the end marker
+        bool ReadAdaptiveFrame(std::istream& in, Huffman::AdaptiveDecoder& decoder, Huffman::ByteVector& frame, std::string& out,
+                               StreamStats& stats) {
+            std::uint64_t symbols = 0, size = 0;
+            checksum_t sourceChecksum = 0;
+            if (!in.read(reinterpret_cast<char*>(&symbols), sizeof(symbols))) {
+                throw Exceptions::DeserializationException("stream ends without an end marker");
+            }
+            if (symbols == 0) return false;
+            std::string name = "stream frame " + std::to_string(stats.blocks);
+            if (!in.read(reinterpret_cast<char*>(&size), sizeof(size)) || !in.read(reinterpret_cast<char*>(&sourceChecksum), sizeof(sourceChecksum))
+                || !ReadRecord(in, frame, size)) {
+                throw Exceptions::DeserializationException(name + " is truncated");
+            }
+            // Every symbol takes at least one bit
+            if (symbols > size * 8) {
+                throw Exceptions::DeserializationException(name + ": more symbols than bits");
+            }
+
+            size_t start = out.size();
+            try {
+                decoder.Decode(frame.data(), frame.size(), static_cast<size_t>(symbols), out);
+            } catch (const std::invalid_argument&) {
+                throw Exceptions::DeserializationException(name + " is truncated");
+            }
+            if (checksum(out.data() + start, out.size() - start) != sourceChecksum) {
+                throw Exceptions::ChecksumMismatchException("source data of " + name);
+            }
+            stats.blocks++;
+            stats.sourceBytes += out.size() - start;
+            stats.compressedBytes += size;
+            return true;
+        }
+
+        // Position of the end marker of a block stream, found by hopping over the record sizes without reading the records
+        std::uint64_t FindStreamEnd(std::istream& in, const std::string& streamPath) {
+            in.seekg(0, std::ios::end);
+            std::uint64_t fileSize = static_cast<std::uint64_t>(in.tellg());
+
+            char magic[sizeof(StreamMagic)] = {};
+            uint8_t version[sizeof(Version)] = {};
+            in.seekg(0);
+            in.read(magic, sizeof(magic));
+            in.read(reinterpret_cast<char*>(version), sizeof(version));
+            if (!in || std::memcmp(magic, StreamMagic, sizeof(magic)) != 0) {
+                throw Exceptions::DeserializationException(streamPath + " is not a block stream");
+            }
+            if (version[0] != Version[0]) {
+                throw Exceptions::DeserializationException("unsupported version");
+            }
+
+            std::uint64_t position = sizeof(magic) + sizeof(version);
+            for (;;) {
+                std::uint64_t recordSize = 0;
+                in.seekg(static_cast<std::streamoff>(position));
+                if (!in.read(reinterpret_cast<char*>(&recordSize), sizeof(recordSize))) {
+                    throw Exceptions::DeserializationException(streamPath + " ends without an end marker");
+                }
+                if (recordSize == 0) break;
+                if (recordSize > fileSize - position - sizeof(recordSize)) {
+                    throw Exceptions::DeserializationException(streamPath + " has a truncated block");
+                }
+                position += sizeof(recordSize) + recordSize;
+            }
+            if (position + sizeof(std::uint64_t) != fileSize) {
+                throw Exceptions::DeserializationException(streamPath + " has data after its end marker");
+            }
+            return position;
+        }
+
+        size_t FileSize(const std::string& filePath) {
+            std::ifstream in(filePath, std::ios::binary | std::ios::ate);
+            if (!in) {
+                throw Exceptions::FileOpenException(filePath);
+            }
+            return static_cast<size_t>(in.tellg());
+        }
+
+        // Run job(source, target, sourceSize, threads, result) for every pair of paths on a pool of workers, largest sources first
+        // When there are fewer files than threads, the spare threads are shared out among the files
+        template <typename Job>
+        std::vector<FileResult> RunFileJobs(const std::vector<std::string>& sourcePaths, const std::vector<std::string>& targetPaths, unsigned threads, Job job) {
+            if (sourcePaths.size() != targetPaths.size()) {
+                throw std::invalid_argument("source and target path counts differ");
+            }
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+            std::vector<FileResult> results(sourcePaths.size());
+            Huffman::ScratchVector<size_t> sizes(sourcePaths.size(), 0), order(sourcePaths.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+                try {
+                    sizes[i] = FileSize(sourcePaths[i]);
+                } catch (const std::exception& e) {
+                    results[i].error = e.what();
+                }
+            }
+            std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+            unsigned fileThreads = std::max<unsigned>(1, threads / std::max<size_t>(1, sourcePaths.size()));
+            std::atomic<size_t> next(0);
+            auto worker = [&]() {
+                // Tables and scratch buffers of one file are dropped in one go and their blocks reused by the next file
+                Huffman::ArenaAllocator arena;
+                for (size_t k = next++; k < order.size(); k = next++) {
+                    size_t i = order[k];
+                    if (!results[i].Ok()) continue;
+                    try {
+                        Huffman::AllocatorScope scope(arena);
+                        job(sourcePaths[i], targetPaths[i], sizes[i], fileThreads, results[i]);
+                    } catch (const std::exception& e) {
+                        // A half-written target must not pass for a result
+                        results[i].error = e.what();
+                        std::remove(targetPaths[i].c_str());
+                    }
+                }
+            };
+
+            Huffman::ScratchVector<std::thread> pool;
+            for (size_t i = 1; i < std::min<size_t>(threads, order.size()); ++i) {
+                pool.emplace_back(worker);
+            }
+            worker();
+            for (std::thread& thread : pool) {
+                thread.join();
+            }
+            return results;
+        }
+
+        void VerifyPayload(const HuffpressFile::_HuffpressFileHeader& header, const Huffman::Decoder& decoder, const Huffman::Byte* payload, size_t size, bool checkSource, bool concurrent, VerifyResult& result) {
+            checksum_t compressedChecksum = CHECKSUM_INIT;
+            // Set once the payload is known to be damaged, which makes decoding it pointless
+            std::atomic<bool> damaged(false);
+            auto hashPayload = [&compressedChecksum, &damaged, &header, payload, size]() {
+                compressedChecksum = checksum(reinterpret_cast<const char*>(payload), size);
+                if (compressedChecksum != header.compressedChecksum) damaged = true;
+            };
+
+            std::thread hasher;
+            if (checkSource && concurrent && size >= ConcurrentVerifyThreshold) {
+                hasher = std::thread(hashPayload);
+            } else {
+                hashPayload();
+            }
+
+            std::string decodeError;
+            if (checkSource && !damaged) {
+                checksum_t sourceChecksum = CHECKSUM_INIT;
+                result.sourceChecked = true;
+                try {
+                    DecodeSource(header, decoder, payload, size, [&sourceChecksum, &damaged](const char* chunk, size_t chunkSize) {
+                        // A concurrent hasher that finds damage stops the decoding at the next chunk
+                        if (damaged) throw Exceptions::CancelledException("decoding a damaged payload");
+                        sourceChecksum = checksum_update(sourceChecksum, chunk, chunkSize);
+                    });
+                    result.sourceChecksumValid = sourceChecksum == header.sourceChecksum;
+                } catch (const Exceptions::CancelledException&) {
+                    result.sourceChecked = false;
+                } catch (const std::exception& e) {
+                    // Damaged payloads may fail to decode in any way, including running out of memory
+                    result.sourceChecksumValid = false;
+                    decodeError = e.what();
+                }
+            }
+
+            if (hasher.joinable()) hasher.join();
+            result.compressedChecksumValid = compressedChecksum == header.compressedChecksum;
+
+            if (!result.compressedChecksumValid) {
+                result.error = "compressed checksum mismatch";
+            } else if (!decodeError.empty()) {
+                result.error = "payload does not decode: " + decodeError;
+            } else if (result.sourceChecked && !result.sourceChecksumValid) {
+                result.error = "source checksum mismatch";
+            }
+        }
+
+        VerifyResult VerifyMappedFile(const std::string& filePath, bool checkSource, bool concurrent) {
+            VerifyResult result;
+            try {
+                MappedFile mapped(filePath);
+
+                HuffpressFile::_HuffpressFileHeader header;
+                size_t offset = 0;
+                if (!ReadHeader(mapped.Data(), mapped.Size(), header, offset, result.error)) return result;
+
+                result.headerValid = CheckHeader(header, mapped.Size() - offset, result.error);
+                if (!result.headerValid) return result;
+
+                VerifyPayload(header, Huffman::Decoder(header.freqMap), mapped.Data() + offset, mapped.Size() - offset, checkSource, concurrent, result);
+            } catch (const std::exception& e) {
+                result.error = e.what();
+            }
+            return result;
+        }
+    }
+
     HUFFPRESS_API HuffpressFile::HuffpressFile(const std::string& data) {
         this->Init(data);
     }
 
-    HUFFPRESS_API void HuffpressFile::Init(const std::string& data) {
-        this->byteVec = Huffman::Compress(data, this->header.freqMap, this->header.bitLength);
+    namespace Detail {
+        HUFFPRESS_API void CompressInto(HuffpressFile& file, const std::string& data, unsigned threads, Huffman::TableMode mode,
+                                        const Huffman::ChunkVisitor& onSource, const Huffman::ChunkVisitor& onPacked) {
+            // The exact table is counted into the map, so the counts of an earlier Init must go first
+            file.header.freqMap.clear();
+            file.header.transforms.clear();
+            file.header.coding = Coding::Huffman;
+            file.header.tables.clear();
+            checksum_t sourceChecksum = CHECKSUM_INIT;
+            checksum_t compressedChecksum = CHECKSUM_INIT;
+
+            // Both checksums ride along with the counting and encoding passes of the compressor
+            file.byteVec = Huffman::Compress(data, file.header.freqMap, file.header.bitLength,
+                [&sourceChecksum, &onSource](const char* chunk, size_t size) {
+                    if (onSource) onSource(chunk, size);
+                    sourceChecksum = checksum_update(sourceChecksum, chunk, size);
+                },
+                [&compressedChecksum, &onPacked](const char* chunk, size_t size) {
+                    if (onPacked) onPacked(chunk, size);
+                    compressedChecksum = checksum_update(compressedChecksum, chunk, size);
+                },
+                threads, mode);
+
+            file.header.size = file.byteVec.size();
+            file.header.sourceChecksum = sourceChecksum;
+            file.header.compressedChecksum = compressedChecksum;
+            file.sourceChecksumPending_ = false;
+        }
+    }
+
+    HUFFPRESS_API void HuffpressFile::Init(const std::string& data, unsigned threads, Huffman::TableMode mode) {
+        Detail::CompressInto(*this, data, threads, mode, nullptr, nullptr);
+    }
+
+    HUFFPRESS_API void HuffpressFile::Init(const std::string& data, const Pipeline& pipeline, unsigned threads) {
+        if (pipeline.size() > MaxTransforms) {
+            throw std::invalid_argument("more than " + std::to_string(MaxTransforms) + " transforms");
+        }
+        if (pipeline.empty()) {
+            this->Init(data, threads);
+            return;
+        }
+
+        std::string transformed = data;
+        ApplyTransforms(pipeline, transformed, threads);
+        checksum_t compressedChecksum = CHECKSUM_INIT;
+        this->header.freqMap.clear();
+        this->byteVec = Huffman::Compress(transformed, this->header.freqMap, this->header.bitLength, nullptr,
+            [&compressedChecksum](const char* chunk, size_t size) { compressedChecksum = checksum_update(compressedChecksum, chunk, size); },
+            threads);
+
+        this->header.transforms = pipeline;
+        this->header.coding = Coding::Huffman;
+        this->header.tables.clear();
         this->header.size = this->byteVec.size();
-        this->header.sourceChecksum = checksum(data.c_str(), data.size());
-        this->header.compressedChecksum = checksum(reinterpret_cast<char*>(this->byteVec.data()), this->header.size);
+        this->header.sourceChecksum = checksum(data.data(), data.size());
+        this->header.compressedChecksum = compressedChecksum;
+        this->sourceChecksumPending_ = false;
+    }
+
+    HUFFPRESS_API void HuffpressFile::Init(const std::string& data, const LzOptions& options, const Pipeline& pipeline, unsigned threads) {
+        if (pipeline.size() > MaxTransforms) {
+            throw std::invalid_argument("more than " + std::to_string(MaxTransforms) + " transforms");
+        }
+
+        std::string transformed;
+        if (!pipeline.empty()) {
+            transformed = data;
+            ApplyTransforms(pipeline, transformed, threads);
+        }
+        const std::string& coded = pipeline.empty() ? data : transformed;
+        this->byteVec = LzCompress(coded.data(), coded.size(), options, this->header.freqMap, this->header.tables, this->header.bitLength);
+
+        this->header.transforms = pipeline;
+        this->header.coding = Coding::Lz77;
+        this->header.size = this->byteVec.size();
+        this->header.sourceChecksum = checksum(data.data(), data.size());
+        this->header.compressedChecksum = checksum(reinterpret_cast<const char*>(this->byteVec.data()), this->byteVec.size());
+        this->sourceChecksumPending_ = false;
+    }
+
+    HUFFPRESS_API void HuffpressFile::Init(const std::string& data, const ContextOptions& options, const Pipeline& pipeline, unsigned threads) {
+        if (pipeline.size() > MaxTransforms) {
+            throw std::invalid_argument("more than " + std::to_string(MaxTransforms) + " transforms");
+        }
+
+        std::string transformed;
+        if (!pipeline.empty()) {
+            transformed = data;
+            ApplyTransforms(pipeline, transformed, threads);
+        }
+        const std::string& coded = pipeline.empty() ? data : transformed;
+        this->byteVec = ContextCompress(coded.data(), coded.size(), options, this->header.freqMap, this->header.tables, this->header.contextMap,
+                                        this->header.bitLength);
+
+        this->header.transforms = pipeline;
+        this->header.coding = Coding::ContextSplit;
+        this->header.size = this->byteVec.size();
+        this->header.sourceChecksum = checksum(data.data(), data.size());
+        this->header.compressedChecksum = checksum(reinterpret_cast<const char*>(this->byteVec.data()), this->byteVec.size());
+        this->sourceChecksumPending_ = false;
+    }
+
+    HUFFPRESS_API std::uint64_t HuffpressFile::Load(const std::string& sourcePath, unsigned threads, size_t blockSize) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        SourceBlocks source = ReadSource(sourcePath, std::max<size_t>(blockSize, 1));
+
+        Huffman::FreqMap freqMap = source.FreqMap();
+        Huffman::Encoder encoder(freqMap);
+        Huffman::ScratchVector<size_t> bitOffsets = source.BitOffsets(encoder);
+
+        Huffman::ByteVector payload;
+        payload.reserve((bitOffsets.back() + 7) / 8);
+        checksum_t compressedChecksum = CHECKSUM_INIT;
+        EncodeBlocks(source, encoder, bitOffsets, threads, [&payload, &compressedChecksum](const Huffman::Byte* data, size_t size) {
+            payload.insert(payload.end(), data, data + size);
+            compressedChecksum = checksum_update(compressedChecksum, reinterpret_cast<const char*>(data), size);
+        });
+
+        this->byteVec = std::move(payload);
+        this->header.transforms.clear();
+        this->header.coding = Coding::Huffman;
+        this->header.tables.clear();
+        this->header.freqMap = std::move(freqMap);
+        this->header.bitLength = bitOffsets.back();
+        this->header.size = this->byteVec.size();
+        this->header.sourceChecksum = source.checksum;
+        this->header.compressedChecksum = compressedChecksum;
+        this->sourceChecksumPending_ = false;
+
+        std::uint64_t sourceSize = 0;
+        for (const Huffman::ScratchString& block : source.blocks) sourceSize += block.size();
+        return sourceSize;
     }
 
     HUFFPRESS_API void HuffpressFile::Serialize(const std::string& filePath) {
+        this->SourceChecksum();
+
         std::ofstream out(filePath, std::ios::binary);
         if (!out) {
             throw Exceptions::FileOpenException(filePath);
@@ -28,7 +1229,33 @@ namespace Huffpress {
         try {
             out.write(this->header.magic, sizeof(this->header.magic));
 
-            out.write(reinterpret_cast<const char*>(this->header.version), sizeof(this->header.version));
+            uint8_t version[3];
+            WrittenVersion(this->header, version);
+            out.write(reinterpret_cast<const char*>(version), sizeof(version));
+            if (version[0] == TransformedVersion || version[0] == CodedVersion) {
+                std::uint8_t count = static_cast<std::uint8_t>(this->header.transforms.size());
+                out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+                out.write(reinterpret_cast<const char*>(this->header.transforms.data()), count);
+            }
+            if (version[0] == CodedVersion) {
+                std::uint8_t coding = static_cast<std::uint8_t>(this->header.coding);
+                std::uint8_t tableCount = static_cast<std::uint8_t>(this->header.tables.size());
+                out.write(reinterpret_cast<const char*>(&coding), sizeof(coding));
+                out.write(reinterpret_cast<const char*>(&tableCount), sizeof(tableCount));
+                for (const Huffman::FreqMap& table : this->header.tables) {
+                    size_t tableSize = table.size();
+                    out.write(reinterpret_cast<const char*>(&tableSize), sizeof(tableSize));
+                    for (const auto& pair : table) {
+                        out.write(reinterpret_cast<const char*>(&pair.first), sizeof(pair.first));
+                        out.write(reinterpret_cast<const char*>(&pair.second), sizeof(pair.second));
+                    }
+                }
+                if (this->header.coding == Coding::ContextSplit) {
+                    Huffman::Byte packed[MaxContextMapSize];
+                    PackContextMap(this->header.contextMap, tableCount + 1, packed);
+                    out.write(reinterpret_cast<const char*>(packed), ContextMapSize(tableCount + 1));
+                }
+            }
             
             size_t freqMapSize = this->header.freqMap.size();
             out.write(reinterpret_cast<const char*>(&freqMapSize), sizeof(freqMapSize));
@@ -53,266 +1280,801 @@ namespace Huffpress {
     }
 
     HUFFPRESS_API void HuffpressFile::BufferedSerialize(const std::string& filePath, const size_t bufferSize) {
-        std::ofstream out(filePath, std::ios::binary);
+        this->SourceChecksum();
+
+        // The stream itself buffers in bufferSize pieces, so a payload of any size is written straight from byteVec
+        Huffman::ScratchVector<char> buffer(std::max<size_t>(bufferSize, 1));
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        out.open(filePath, std::ios::binary);
         if (!out) {
             throw Exceptions::FileOpenException(filePath);
         }
 
         try {
-            std::vector<char> buffer(bufferSize);
-            size_t bufferPos = 0;
+            Huffman::ByteVector head;
+            AppendHeader(this->header, head);
+            out.write(reinterpret_cast<const char*>(head.data()), head.size());
+            out.write(reinterpret_cast<const char*>(this->byteVec.data()), this->byteVec.size());
 
-            auto writeBuffer = [&out, &buffer, &bufferPos]() {
-                if (bufferPos > 0) {
-                    out.write(buffer.data(), bufferPos);
-                    bufferPos = 0;
-                }
-            };
+            out.close();
+            if (!out) {
+                throw std::ios_base::failure("failed to write " + filePath);
+            }
+        } catch (const std::exception& e) {
+            throw Exceptions::SerializationException(e.what());
+        }
+    }
 
-            std::memcpy(buffer.data(), this->header.magic, sizeof(this->header.magic));
-            bufferPos += sizeof(this->header.magic);
-            writeBuffer();
+    HUFFPRESS_API void HuffpressFile::SerializeToBuffer(Huffman::ByteVector& buffer) {
+        this->SourceChecksum();
 
-            std::memcpy(buffer.data(), this->header.version, sizeof(this->header.version));
-            bufferPos += sizeof(this->header.version);
-            writeBuffer();
+        try {
+            buffer.clear();
+            AppendHeader(this->header, buffer);
+            buffer.insert(buffer.end(), this->byteVec.begin(), this->byteVec.end());
+        } catch (const std::exception& e) {
+            throw Exceptions::SerializationException(e.what());
+        }
+    }
 
-            size_t freqMapSize = this->header.freqMap.size();
-            std::memcpy(buffer.data(), &freqMapSize, sizeof(freqMapSize));
-            bufferPos += sizeof(freqMapSize);
-            writeBuffer();
+    HUFFPRESS_API void HuffpressFile::Parse(const std::string& filePath) {
+        this->sourceChecksumPending_ = false;
 
-            for (const auto& pair : this->header.freqMap) {
-                std::memcpy(buffer.data(), &pair.first, sizeof(pair.first));
-                bufferPos += sizeof(pair.first);
-                std::memcpy(buffer.data() + bufferPos, &pair.second, sizeof(pair.second));
-                bufferPos += sizeof(pair.second);
-                writeBuffer();
-            }
+        std::ifstream in(filePath, std::ios::binary);
+        if (!in) {
+            throw Exceptions::FileOpenException(filePath);
+        }
+        try {
+            ReadStream(in, this->header, this->byteVec);
+        } catch (const std::exception& e) {
+            throw Exceptions::DeserializationException(e.what());
+        }
+    }
 
-            std::memcpy(buffer.data(), &this->header.bitLength, sizeof(this->header.bitLength));
-            bufferPos += sizeof(this->header.bitLength);
-            writeBuffer();
+    HUFFPRESS_API void HuffpressFile::BufferedParse(const std::string& filePath, const size_t bufferSize) {
+        this->sourceChecksumPending_ = false;
 
-            std::memcpy(buffer.data(), &this->header.size, sizeof(this->header.size));
-            bufferPos += sizeof(this->header.size);
-            writeBuffer();
+        // The stream itself buffers in bufferSize pieces, the payload is read straight into byteVec
+        Huffman::ScratchVector<char> buffer(std::max<size_t>(bufferSize, 1));
+        std::ifstream in;
+        in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        in.open(filePath, std::ios::binary);
+        if (!in) {
+            throw Exceptions::FileOpenException(filePath);
+        }
 
-            std::memcpy(buffer.data(), &this->header.sourceChecksum, sizeof(this->header.sourceChecksum));
-            bufferPos += sizeof(this->header.sourceChecksum);
-            writeBuffer();
+        try {
+            ReadStream(in, this->header, this->byteVec);
+        } catch (const std::exception& e) {
+            throw Exceptions::DeserializationException(e.what());
+        }
+    }
+        
+    HUFFPRESS_API void HuffpressFile::ParseFromBuffer(const Huffman::ByteVector& buffer) {
+        this->sourceChecksumPending_ = false;
 
-            std::memcpy(buffer.data(), &this->header.compressedChecksum, sizeof(this->header.compressedChecksum));
-            bufferPos += sizeof(this->header.compressedChecksum);
-            writeBuffer();
+        // Buffers come from anywhere (batches, archives, the network), so every field is bounds-checked
+        size_t offset = 0;
+        std::string error;
+        if (!ReadHeader(buffer.data(), buffer.size(), this->header, offset, error)) {
+            throw Exceptions::DeserializationException(error);
+        }
+        if (buffer.size() - offset < this->header.size) {
+            throw Exceptions::DeserializationException("truncated payload");
+        }
+        this->byteVec.assign(buffer.begin() + offset, buffer.begin() + offset + this->header.size);
+    }
 
-            std::memcpy(buffer.data(), this->byteVec.data(), this->header.size);
-            bufferPos += this->header.size;
-            writeBuffer();
+    HUFFPRESS_API void HuffpressFile::Modify(const std::string& data, unsigned threads) {
+        this->header.freqMap.clear();
+        this->Init(data, threads);
+    }
 
-            out.close();
-        } catch (const std::exception& e) {
-            throw Exceptions::SerializationException(e.what());
+    HUFFPRESS_API void HuffpressFile::Modify(const Huffman::ByteVector& newByteVec, const Huffman::FreqMap& newFreqMap, size_t bitLength) {
+        this->Modify(newByteVec, newFreqMap, bitLength, 0);
+        this->sourceChecksumPending_ = true;
+    }
+
+    HUFFPRESS_API void HuffpressFile::Modify(const Huffman::ByteVector& newByteVec, const Huffman::FreqMap& newFreqMap, size_t bitLength, checksum_t sourceChecksum) {
+        this->byteVec = newByteVec;
+        this->header.size = this->byteVec.size();
+        this->header.transforms.clear();
+        this->header.coding = Coding::Huffman;
+        this->header.tables.clear();
+        this->header.freqMap = newFreqMap;
+        this->header.bitLength = bitLength;
+        this->header.sourceChecksum = sourceChecksum;
+        this->header.compressedChecksum = checksum(reinterpret_cast<char*>(this->byteVec.data()), this->header.size);
+        this->sourceChecksumPending_ = false;
+    }
+
+    HUFFPRESS_API std::string HuffpressFile::Decompress(unsigned threads) const {
+        if (!this->header.Plain()) {
+            return DecompressSource(this->header, Huffman::Decoder(this->header.freqMap), this->byteVec.data(), this->byteVec.size(), threads);
         }
+        return Huffman::Decompress(this->byteVec, this->header.freqMap, this->header.bitLength, threads);
     }
 
-    HUFFPRESS_API void HuffpressFile::SerializeToBuffer(Huffman::ByteVector& buffer) {
-        try {
-            buffer.clear();
+    HUFFPRESS_API void HuffpressFile::Decode(const Huffman::ChunkVisitor& onOutput) const {
+        DecodeSource(this->header, Huffman::Decoder(this->header.freqMap), this->byteVec.data(), this->byteVec.size(), onOutput);
+    }
 
-            buffer.insert(buffer.end(), this->header.magic, this->header.magic + sizeof(this->header.magic));
-            buffer.insert(buffer.end(), reinterpret_cast<const char*>(this->header.version), reinterpret_cast<const char*>(this->header.version) + sizeof(this->header.version));
+    HUFFPRESS_API std::string HuffpressFile::DecompressAndVerify() {
+        if (checksum(reinterpret_cast<char*>(this->byteVec.data()), this->byteVec.size()) != this->header.compressedChecksum) {
+            throw Exceptions::ChecksumMismatchException("compressed data");
+        }
 
-            size_t freqMapSize = this->header.freqMap.size();
-            buffer.insert(buffer.end(), reinterpret_cast<const char*>(&freqMapSize), reinterpret_cast<const char*>(&freqMapSize) + sizeof(freqMapSize));
+        std::string result;
+        checksum_t sourceChecksum = CHECKSUM_INIT;
+        DecodeSource(this->header, Huffman::Decoder(this->header.freqMap), this->byteVec.data(), this->byteVec.size(),
+            [&result, &sourceChecksum](const char* chunk, size_t size) {
+                sourceChecksum = checksum_update(sourceChecksum, chunk, size);
+                result.append(chunk, size);
+            });
 
-            for (const auto& pair : this->header.freqMap) {
-                buffer.insert(buffer.end(), reinterpret_cast<const char*>(&pair.first), reinterpret_cast<const char*>(&pair.first) + sizeof(pair.first));
-                buffer.insert(buffer.end(), reinterpret_cast<const char*>(&pair.second), reinterpret_cast<const char*>(&pair.second) + sizeof(pair.second));
-            }
+        if (!this->sourceChecksumPending_ && sourceChecksum != this->header.sourceChecksum) {
+            throw Exceptions::ChecksumMismatchException("source data");
+        }
+        this->header.sourceChecksum = sourceChecksum;
+        this->sourceChecksumPending_ = false;
+        return result;
+    }
 
-            buffer.insert(buffer.end(), reinterpret_cast<const char*>(&this->header.bitLength), reinterpret_cast<const char*>(&this->header.bitLength) + sizeof(this->header.bitLength));
+    HUFFPRESS_API checksum_t HuffpressFile::SourceChecksum() {
+        if (this->sourceChecksumPending_) {
+            checksum_t sourceChecksum = CHECKSUM_INIT;
+            Huffman::Decode(this->byteVec.data(), this->byteVec.size(), this->header.freqMap, this->header.bitLength,
+                [&sourceChecksum](const char* chunk, size_t size) { sourceChecksum = checksum_update(sourceChecksum, chunk, size); });
+            this->header.sourceChecksum = sourceChecksum;
+            this->sourceChecksumPending_ = false;
+        }
+        return this->header.sourceChecksum;
+    }
 
-            buffer.insert(buffer.end(), reinterpret_cast<const char*>(&this->header.size), reinterpret_cast<const char*>(&this->header.size) + sizeof(this->header.size));
-            buffer.insert(buffer.end(), reinterpret_cast<const char*>(&this->header.sourceChecksum), reinterpret_cast<const char*>(&this->header.sourceChecksum) + sizeof(this->header.sourceChecksum));
-            buffer.insert(buffer.end(), reinterpret_cast<const char*>(&this->header.compressedChecksum), reinterpret_cast<const char*>(&this->header.compressedChecksum) + sizeof(this->header.compressedChecksum));
+    HUFFPRESS_API VerifyResult HuffpressFile::Verify(bool checkSource) {
+        VerifyResult result;
+        result.headerValid = CheckHeader(this->header, this->byteVec.size(), result.error);
+        if (!result.headerValid) return result;
 
-            buffer.insert(buffer.end(), this->byteVec.begin(), this->byteVec.end());
+        // A deferred source checksum has nothing to be checked against; without a source check no decoder is needed
+        bool decode = checkSource && !this->sourceChecksumPending_;
+        try {
+            VerifyPayload(this->header, Huffman::Decoder(decode ? this->header.freqMap : Huffman::FreqMap()), this->byteVec.data(), this->byteVec.size(), decode, true, result);
         } catch (const std::exception& e) {
-            throw Exceptions::SerializationException(e.what());
+            result.error = e.what();
         }
+        return result;
     }
 
-    HUFFPRESS_API void HuffpressFile::Parse(const std::string& filePath) {
-        std::ifstream in(filePath, std::ios::binary);
-        if (!in) {
-            throw Exceptions::FileOpenException(filePath);
-        }
+    HUFFPRESS_API VerifyResult HuffpressFile::VerifyFile(const std::string& filePath, bool checkSource) {
+        return VerifyMappedFile(filePath, checkSource, true);
+    }
+
+    HUFFPRESS_API HuffpressReader::HuffpressReader(HuffpressFile file)
+        : file_(std::move(file)), decoder_(file_.header.freqMap) {
+        this->file_.SourceChecksum();
+    }
+
+    HUFFPRESS_API HuffpressReader::HuffpressReader(const std::string& filePath)
+        : decoder_(Huffman::FreqMap()) {
+        this->file_.Parse(filePath);
+        this->decoder_ = Huffman::Decoder(this->file_.header.freqMap);
+    }
+
+    HUFFPRESS_API std::string HuffpressReader::Decompress(unsigned threads) const {
+        return DecompressSource(this->file_.header, this->decoder_, this->file_.byteVec.data(), this->file_.byteVec.size(), threads);
+    }
+
+    HUFFPRESS_API void HuffpressReader::Decode(const Huffman::ChunkVisitor& onOutput) const {
+        DecodeSource(this->file_.header, this->decoder_, this->file_.byteVec.data(), this->file_.byteVec.size(), onOutput);
+    }
+
+    HUFFPRESS_API VerifyResult HuffpressReader::Verify(bool checkSource) const {
+        VerifyResult result;
+        result.headerValid = CheckHeader(this->file_.header, this->file_.byteVec.size(), result.error);
+        if (!result.headerValid) return result;
+
         try {
-            in.read(this->header.magic, sizeof(this->header.magic));
-            in.read(reinterpret_cast<char*>(this->header.version), sizeof(this->header.version));
+            VerifyPayload(this->file_.header, this->decoder_, this->file_.byteVec.data(), this->file_.byteVec.size(), checkSource, true, result);
+        } catch (const std::exception& e) {
+            result.error = e.what();
+        }
+        return result;
+    }
 
-            size_t freqMapSize;
-            in.read(reinterpret_cast<char*>(&freqMapSize), sizeof(freqMapSize));
+    HUFFPRESS_API std::vector<VerifyResult> VerifyFiles(const std::vector<std::string>& filePaths, bool checkSource, unsigned threads) {
+        std::vector<VerifyResult> results(filePaths.size());
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
 
-            this->header.freqMap.clear();
-            for (size_t i = 0; i < freqMapSize; ++i) {
-                char key;
-                int value;
-                in.read(reinterpret_cast<char*>(&key), sizeof(key));
-                in.read(reinterpret_cast<char*>(&value), sizeof(value));
-                this->header.freqMap[key] = value;
+        // Spare threads go to the two passes of each file once there are fewer files than threads
+        bool concurrent = filePaths.size() < threads;
+
+        std::atomic<size_t> next(0);
+        Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+        auto worker = [&results, &filePaths, &next, &allocator, checkSource, concurrent]() {
+            Huffman::AllocatorScope scope(allocator, false);
+            for (size_t i = next++; i < filePaths.size(); i = next++) {
+                results[i] = VerifyMappedFile(filePaths[i], checkSource, concurrent);
             }
+        };
 
-            in.read(reinterpret_cast<char*>(&this->header.bitLength), sizeof(this->header.bitLength));
+        Huffman::ScratchVector<std::thread> pool;
+        for (size_t i = 1; i < std::min<size_t>(threads, filePaths.size()); ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
 
-            in.read(reinterpret_cast<char*>(&this->header.size), sizeof(this->header.size));
-            in.read(reinterpret_cast<char*>(&this->header.sourceChecksum), sizeof(this->header.sourceChecksum));
-            in.read(reinterpret_cast<char*>(&this->header.compressedChecksum), sizeof(this->header.compressedChecksum));
+        return results;
+    }
 
-            this->byteVec.resize(this->header.size);
-            in.read(reinterpret_cast<char*>(this->byteVec.data()), this->header.size);
+    HUFFPRESS_API size_t DecompressFile(const std::string& sourcePath, const std::string& targetPath) {
+        MappedFile mapped(sourcePath);
 
-            in.close();
-        } catch (const std::exception& e) {
-            throw Exceptions::DeserializationException(e.what());
+        HuffpressFile::_HuffpressFileHeader header;
+        size_t offset = 0;
+        std::string error;
+        if (!ReadHeader(mapped.Data(), mapped.Size(), header, offset, error) || !CheckHeader(header, mapped.Size() - offset, error)) {
+            throw Exceptions::DeserializationException(sourcePath + ": " + error);
+        }
+        const Huffman::Byte* payload = mapped.Data() + offset;
+        if (checksum(reinterpret_cast<const char*>(payload), header.size) != header.compressedChecksum) {
+            throw Exceptions::ChecksumMismatchException("compressed data of " + sourcePath);
         }
+
+        std::ofstream out(targetPath, std::ios::binary);
+        if (!out) {
+            throw Exceptions::FileOpenException(targetPath);
+        }
+
+        size_t decoded = 0;
+        checksum_t sourceChecksum = CHECKSUM_INIT;
+        DecodeSource(header, Huffman::Decoder(header.freqMap), payload, header.size, [&out, &decoded, &sourceChecksum](const char* chunk, size_t size) {
+            sourceChecksum = checksum_update(sourceChecksum, chunk, size);
+            out.write(chunk, size);
+            decoded += size;
+        });
+        out.close();
+        if (!out) {
+            throw Exceptions::SerializationException("failed to write " + targetPath);
+        }
+        if (sourceChecksum != header.sourceChecksum) {
+            throw Exceptions::ChecksumMismatchException("source data of " + sourcePath);
+        }
+        return decoded;
     }
 
-    HUFFPRESS_API void HuffpressFile::BufferedParse(const std::string& filePath, const size_t bufferSize) {
-        std::ifstream in(filePath, std::ios::binary);
-        if (!in) {
-            throw Exceptions::FileOpenException(filePath);
+    HUFFPRESS_API std::vector<FileResult> CompressFiles(const std::vector<std::string>& sourcePaths, const std::vector<std::string>& targetPaths, unsigned threads) {
+        return RunFileJobs(sourcePaths, targetPaths, threads, [](const std::string& source, const std::string& target, size_t sourceSize, unsigned fileThreads, FileResult& result) {
+            CompressFile(source, target, fileThreads);
+            result.sourceBytes = sourceSize;
+            result.compressedBytes = FileSize(target);
+        });
+    }
+
+    HUFFPRESS_API std::vector<FileResult> DecompressFiles(const std::vector<std::string>& sourcePaths, const std::vector<std::string>& targetPaths, unsigned threads) {
+        return RunFileJobs(sourcePaths, targetPaths, threads, [](const std::string& source, const std::string& target, size_t sourceSize, unsigned, FileResult& result) {
+            result.sourceBytes = DecompressFile(source, target);
+            result.compressedBytes = sourceSize;
+        });
+    }
+
+    HUFFPRESS_API HuffpressFile::_HuffpressFileHeader CompressFile(const std::string& sourcePath, const std::string& targetPath, unsigned threads, size_t blockSize) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        blockSize = std::max<size_t>(blockSize, 1);
+        SourceBlocks source = ReadSource(sourcePath, blockSize);
+
+        HuffpressFile::_HuffpressFileHeader header;
+        header.freqMap = source.FreqMap();
+        Huffman::Encoder encoder(header.freqMap);
+        Huffman::ScratchVector<size_t> bitOffsets = source.BitOffsets(encoder);
+        header.bitLength = bitOffsets.back();
+        header.size = (header.bitLength + 7) / 8;
+        header.sourceChecksum = source.checksum;
+
+        // The compressed checksum is only known at the end, it is written as a placeholder and patched afterwards
+        Huffman::ByteVector head;
+        AppendHeader(header, head);
+
+        std::ofstream out(targetPath, std::ios::binary);
+        if (!out) {
+            throw Exceptions::FileOpenException(targetPath);
         }
 
-        try {
-            std::vector<char> buffer(bufferSize);
-            size_t bufferPos = 0;
+        BoundedQueue<Huffman::ByteVector> queue(PipelineDepth);
+        std::exception_ptr writeError;
+        std::thread writer([&out, &queue, &writeError, &head, &targetPath]() {
+            try {
+                out.write(reinterpret_cast<const char*>(head.data()), head.size());
+                Huffman::ByteVector chunk;
+                while (queue.Pop(chunk) && out) {
+                    out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+                }
+                if (!out) throw std::ios_base::failure("failed to write " + targetPath);
+            } catch (...) {
+                writeError = std::current_exception();
+            }
+            queue.Close();
+        });
 
-            auto readBuffer = [&in, &buffer, &bufferPos, bufferSize]() {
-                if (bufferPos == 0 || bufferPos == bufferSize) {
-                    in.read(buffer.data(), bufferSize);
-                    bufferPos = 0;
+        checksum_t compressedChecksum = CHECKSUM_INIT;
+        try {
+            Huffman::ByteVector chunk;
+            EncodeBlocks(source, encoder, bitOffsets, threads, [&queue, &chunk, &compressedChecksum, blockSize](const Huffman::Byte* data, size_t size) {
+                compressedChecksum = checksum_update(compressedChecksum, reinterpret_cast<const char*>(data), size);
+                chunk.insert(chunk.end(), data, data + size);
+                if (chunk.size() >= blockSize) {
+                    queue.Push(std::move(chunk));
+                    chunk = Huffman::ByteVector();
                 }
-            };
+            });
+            if (!chunk.empty()) queue.Push(std::move(chunk));
+        } catch (...) {
+            queue.Close();
+            writer.join();
+            throw;
+        }
+        queue.Close();
+        writer.join();
+
+        if (writeError) {
+            try {
+                std::rethrow_exception(writeError);
+            } catch (const std::exception& e) {
+                throw Exceptions::SerializationException(e.what());
+            }
+        }
 
-            readBuffer();
-            std::memcpy(this->header.magic, buffer.data() + bufferPos, sizeof(this->header.magic));
-            bufferPos += sizeof(this->header.magic);
+        header.compressedChecksum = compressedChecksum;
+        out.seekp(static_cast<std::streamoff>(head.size() - sizeof(header.compressedChecksum)));
+        out.write(reinterpret_cast<const char*>(&header.compressedChecksum), sizeof(header.compressedChecksum));
+        out.close();
+        if (!out) {
+            throw Exceptions::SerializationException("failed to write " + targetPath);
+        }
+        return header;
+    }
 
-            readBuffer();
-            std::memcpy(this->header.version, buffer.data() + bufferPos, sizeof(this->header.version));
-            bufferPos += sizeof(this->header.version);
+    HUFFPRESS_API StreamStats CompressStream(std::istream& in, std::ostream& out, unsigned threads, size_t blockSize, const Pipeline& pipeline, int lzLevel,
+                                             size_t contextTables) {
+        LzOptions lz = lzLevel ? LzLevel(lzLevel) : LzOptions();
+        ContextOptions context = StreamContextOptions(lzLevel, contextTables);
+        Huffman::ByteVector streamHeader = StreamHeader();
+        WriteOutput(out, reinterpret_cast<const char*>(streamHeader.data()), streamHeader.size());
+        return WriteStreamBlocks(in, out, threads, blockSize, pipeline, lzLevel ? &lz : nullptr, contextTables ? &context : nullptr);
+    }
 
-            size_t freqMapSize;
-            readBuffer();
-            std::memcpy(&freqMapSize, buffer.data() + bufferPos, sizeof(freqMapSize));
-            bufferPos += sizeof(freqMapSize);
+    HUFFPRESS_API StreamStats AppendStream(const std::string& streamPath, std::istream& in, unsigned threads, size_t blockSize, const Pipeline& pipeline, int lzLevel,
+                                           size_t contextTables) {
+        LzOptions lz = lzLevel ? LzLevel(lzLevel) : LzOptions();
+        ContextOptions context = StreamContextOptions(lzLevel, contextTables);
+        std::fstream stream(streamPath, std::ios::binary | std::ios::in | std::ios::out);
+        if (!stream) {
+            // Opening for append never truncates, in case the file exists but could not be opened for reading
+            std::ofstream create(streamPath, std::ios::binary | std::ios::app);
+            if (!create || create.tellp() != 0) {
+                throw Exceptions::FileOpenException(streamPath);
+            }
+            Huffman::ByteVector streamHeader = StreamHeader();
+            const std::uint64_t endMarker = 0;
+            create.write(reinterpret_cast<const char*>(streamHeader.data()), streamHeader.size());
+            create.write(reinterpret_cast<const char*>(&endMarker), sizeof(endMarker));
+            create.close();
+            if (!create) {
+                throw Exceptions::FileOpenException(streamPath);
+            }
+            stream.open(streamPath, std::ios::binary | std::ios::in | std::ios::out);
+            if (!stream) {
+                throw Exceptions::FileOpenException(streamPath);
+            }
+        }
 
-            this->header.freqMap.clear();
-            for (size_t i = 0; i < freqMapSize; ++i) {
-                char key;
-                int value;
-                readBuffer();
-                std::memcpy(&key, buffer.data() + bufferPos, sizeof(key));
-                bufferPos += sizeof(key);
-                readBuffer();
-                std::memcpy(&value, buffer.data() + bufferPos, sizeof(value));
-                bufferPos += sizeof(value);
-                this->header.freqMap[key] = value;
+        // The new blocks and a new end marker go over the old end marker
+        const std::uint64_t end = FindStreamEnd(stream, streamPath);
+        stream.seekp(static_cast<std::streamoff>(end));
+        StreamStats stats;
+        try {
+            stats = WriteStreamBlocks(in, stream, threads, blockSize, pipeline, lzLevel ? &lz : nullptr, contextTables ? &context : nullptr);
+        } catch (...) {
+            // Put the old end marker back and cut off the partial records, so that the blocks appended before stay readable
+            const std::uint64_t endMarker = 0;
+            stream.clear();
+            stream.seekp(static_cast<std::streamoff>(end));
+            stream.write(reinterpret_cast<const char*>(&endMarker), sizeof(endMarker));
+            stream.close();
+            TruncateFile(streamPath, end + sizeof(endMarker));
+            throw;
+        }
+        stream.close();
+        if (!stream) {
+            throw Exceptions::SerializationException("failed to write " + streamPath);
+        }
+        return stats;
+    }
+
+    HUFFPRESS_API StreamStats DecompressStream(std::istream& in, std::ostream& out, unsigned threads) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+        char magic[sizeof(StreamMagic)];
+        uint8_t version[sizeof(Version)];
+        if (!in.read(magic, sizeof(magic))) {
+            throw Exceptions::DeserializationException("truncated stream header");
+        }
+
+        StreamStats stats;
+        if (std::memcmp(magic, "HPF", sizeof(magic)) == 0) {
+            // A single Huffpress file is a stream of one block without the framing
+            Huffman::ByteVector record(magic, magic + sizeof(magic));
+            char buffer[1 << 16];
+            while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+                record.insert(record.end(), buffer, buffer + in.gcount());
+            }
+            std::string data = DecodeRecord(record, "file");
+            WriteOutput(out, data.data(), data.size());
+            stats.blocks = 1;
+            stats.sourceBytes = data.size();
+            stats.compressedBytes = record.size();
+        } else {
+            bool adaptive = std::memcmp(magic, AdaptiveMagic, sizeof(magic)) == 0;
+            if (!adaptive && std::memcmp(magic, StreamMagic, sizeof(magic)) != 0) {
+                throw Exceptions::DeserializationException("bad magic");
+            }
+            if (!in.read(reinterpret_cast<char*>(version), sizeof(version))) {
+                throw Exceptions::DeserializationException("truncated stream header");
+            }
+            if (version[0] != Version[0]) {
+                throw Exceptions::DeserializationException("unsupported version");
             }
 
-            readBuffer();
-            std::memcpy(&this->header.bitLength, buffer.data() + bufferPos, sizeof(this->header.bitLength));
-            bufferPos += sizeof(this->header.bitLength);
+            if (adaptive) {
+                // Frames depend on the ones before them, so they are decoded in order; each is written out as it arrives
+                Huffman::AdaptiveDecoder decoder;
+                Huffman::ByteVector frame;
+                std::string data;
+                while (ReadAdaptiveFrame(in, decoder, frame, data, stats)) {
+                    WriteOutput(out, data.data(), data.size());
+                    if (!out.flush()) {
+                        throw Exceptions::SerializationException("failed to write the output stream");
+                    }
+                    data.clear();
+                }
+                return stats;
+            }
 
-            readBuffer();
-            std::memcpy(&this->header.size, buffer.data() + bufferPos, sizeof(this->header.size));
-            bufferPos += sizeof(this->header.size);
+            RunInOrder<std::pair<size_t, Huffman::ByteVector>, std::string>(threads,
+                [&in, &stats](std::pair<size_t, Huffman::ByteVector>& block) {
+                    std::uint64_t recordSize = 0;
+                    if (!in.read(reinterpret_cast<char*>(&recordSize), sizeof(recordSize))) {
+                        throw Exceptions::DeserializationException("stream ends without an end marker");
+                    }
+                    if (recordSize == 0) return false;
+                    block.first = stats.blocks++;
+                    if (!ReadRecord(in, block.second, recordSize)) {
+                        throw Exceptions::DeserializationException("stream block " + std::to_string(block.first) + " is truncated");
+                    }
+                    stats.compressedBytes += recordSize;
+                    return true;
+                },
+                [](const std::pair<size_t, Huffman::ByteVector>& block) {
+                    return DecodeRecord(block.second, "stream block " + std::to_string(block.first));
+                },
+                [&out, &stats](const std::string& data) {
+                    WriteOutput(out, data.data(), data.size());
+                    stats.sourceBytes += data.size();
+                });
+        }
 
-            readBuffer();
-            std::memcpy(&this->header.sourceChecksum, buffer.data() + bufferPos, sizeof(this->header.sourceChecksum));
-            bufferPos += sizeof(this->header.sourceChecksum);
+        if (!out.flush()) {
+            throw Exceptions::SerializationException("failed to write the output stream");
+        }
+        return stats;
+    }
 
-            readBuffer();
-            std::memcpy(&this->header.compressedChecksum, buffer.data() + bufferPos, sizeof(this->header.compressedChecksum));
-            bufferPos += sizeof(this->header.compressedChecksum);
+    HUFFPRESS_API AdaptiveStreamWriter::AdaptiveStreamWriter(std::ostream& out, size_t frameSize)
+        : out_(out), frameSize_(std::max<size_t>(frameSize, 1)) {
+        Huffman::ByteVector streamHeader;
+        AppendField(streamHeader, AdaptiveMagic);
+        AppendField(streamHeader, Version);
+        WriteOutput(this->out_, reinterpret_cast<const char*>(streamHeader.data()), streamHeader.size());
+    }
 
-            this->byteVec.resize(this->header.size);
-            readBuffer();
-            std::memcpy(this->byteVec.data(), buffer.data() + bufferPos, this->header.size);
-            bufferPos += this->header.size;
+    HUFFPRESS_API void AdaptiveStreamWriter::Write(const char* data, size_t size) {
+        if (this->closed_) throw Exceptions::SerializationException("write to a closed adaptive stream");
+        // Data is encoded in pieces, so a frame never grows far past frameSize
+        while (size > 0) {
+            size_t piece = std::min(size, this->frameSize_);
+            this->encoder_.Encode(data, piece, this->pending_);
+            this->symbols_ += piece;
+            this->checksum_ = checksum_update(this->checksum_, data, piece);
+            this->stats_.sourceBytes += piece;
+            if (this->pending_.size() >= this->frameSize_) this->WriteFrame();
+            data += piece;
+            size -= piece;
+        }
+    }
 
-            in.close();
-        } catch (const std::exception& e) {
-            throw Exceptions::DeserializationException(e.what());
+    HUFFPRESS_API void AdaptiveStreamWriter::Flush() {
+        if (this->closed_) throw Exceptions::SerializationException("flush of a closed adaptive stream");
+        this->WriteFrame();
+        if (!this->out_.flush()) {
+            throw Exceptions::SerializationException("failed to write the output stream");
         }
     }
-        
-    HUFFPRESS_API void HuffpressFile::ParseFromBuffer(const Huffman::ByteVector& buffer) {
-        try {
-            size_t offset = 0;
 
-            std::memcpy(this->header.magic, buffer.data() + offset, sizeof(this->header.magic));
-            offset += sizeof(this->header.magic);
+    HUFFPRESS_API void AdaptiveStreamWriter::Close() {
+        if (this->closed_) return;
+        this->Flush();
+        const std::uint64_t endMarker = 0;
+        WriteOutput(this->out_, reinterpret_cast<const char*>(&endMarker), sizeof(endMarker));
+        this->closed_ = true;
+        if (!this->out_.flush()) {
+            throw Exceptions::SerializationException("failed to write the output stream");
+        }
+    }
 
-            std::memcpy(this->header.version, buffer.data() + offset, sizeof(this->header.version));
-            offset += sizeof(this->header.version);
+    void AdaptiveStreamWriter::WriteFrame() {
+        if (this->symbols_ == 0) return;
+        this->encoder_.Flush(this->pending_);
+
+        Huffman::ByteVector frameHeader;
+        std::uint64_t size = this->pending_.size();
+        AppendField(frameHeader, this->symbols_);
+        AppendField(frameHeader, size);
+        AppendField(frameHeader, this->checksum_);
+        WriteOutput(this->out_, reinterpret_cast<const char*>(frameHeader.data()), frameHeader.size());
+        WriteOutput(this->out_, reinterpret_cast<const char*>(this->pending_.data()), this->pending_.size());
+
+        this->stats_.blocks++;
+        this->stats_.compressedBytes += this->pending_.size();
+        this->pending_.clear();
+        this->symbols_ = 0;
+        this->checksum_ = CHECKSUM_INIT;
+    }
 
-            size_t freqMapSize;
-            std::memcpy(&freqMapSize, buffer.data() + offset, sizeof(freqMapSize));
-            offset += sizeof(freqMapSize);
+    HUFFPRESS_API AdaptiveStreamReader::AdaptiveStreamReader(std::istream& in) : in_(in) {
+        char magic[sizeof(AdaptiveMagic)];
+        uint8_t version[sizeof(Version)];
+        if (!this->in_.read(magic, sizeof(magic)) || !this->in_.read(reinterpret_cast<char*>(version), sizeof(version))) {
+            throw Exceptions::DeserializationException("truncated stream header");
+        }
+        if (std::memcmp(magic, AdaptiveMagic, sizeof(magic)) != 0) {
+            throw Exceptions::DeserializationException("bad magic");
+        }
+        if (version[0] != Version[0]) {
+            throw Exceptions::DeserializationException("unsupported version");
+        }
+    }
 
-            this->header.freqMap.clear();
-            for (size_t i = 0; i < freqMapSize; ++i) {
-                char key;
-                int value;
-                std::memcpy(&key, buffer.data() + offset, sizeof(key));
-                offset += sizeof(key);
+    HUFFPRESS_API bool AdaptiveStreamReader::Read(std::string& out) {
+        if (this->done_) return false;
+        this->done_ = !ReadAdaptiveFrame(this->in_, this->decoder_, this->frame_, out, this->stats_);
+        return !this->done_;
+    }
 
-                std::memcpy(&value, buffer.data() + offset, sizeof(value));
-                offset += sizeof(value);
+    HUFFPRESS_API StreamStats CompressAdaptive(std::istream& in, std::ostream& out, bool lineFrames) {
+        AdaptiveStreamWriter writer(out);
+        if (lineFrames) {
+            std::string line;
+            while (std::getline(in, line)) {
+                // The last line may end without a newline
+                if (!in.eof()) line += '\n';
+                writer.Write(line);
+                writer.Flush();
+            }
+        } else {
+            char buffer[1 << 16];
+            while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+                writer.Write(buffer, static_cast<size_t>(in.gcount()));
+            }
+        }
+        if (in.bad()) throw Exceptions::DeserializationException("failed to read the input stream");
+        writer.Close();
+        return writer.Stats();
+    }
 
-                this->header.freqMap[key] = value;
+    HUFFPRESS_API CompressedBatch CompressBatch(const std::vector<Span>& inputs, unsigned threads, double shareTolerance) {
+        Huffman::ScratchVector<size_t> bounds = SplitBatch(inputs.size(), threads, [&inputs](size_t i) { return inputs[i].size; });
+
+        auto countSymbols = [](const Span& input, SymbolCounts& counts) {
+            counts.fill(0);
+            for (size_t pos = 0; pos < input.size; ++pos) counts[static_cast<Huffman::Byte>(input.data[pos])]++;
+        };
+
+        // Group inputs greedily by how well the merged counts of a group would code them
+        // Inputs are small, so they are counted again when encoded rather than keeping counts for the whole batch
+        const size_t Unshared = MaxSharedTables;
+        Huffman::ScratchVector<SharedGroup> groups;
+        Huffman::ScratchVector<size_t> groupOf(inputs.size(), Unshared);
+        Huffman::ScratchVector<double> ownCosts(inputs.size());
+        SymbolCounts counts;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i].size == 0) continue;
+            countSymbols(inputs[i], counts);
+            ownCosts[i] = OwnCost(counts);
+
+            for (size_t group = 0; group < groups.size() && groupOf[i] == Unshared; ++group) {
+                if (groups[group].Cost(counts) <= ownCosts[i] * (1 + shareTolerance)) groupOf[i] = group;
             }
+            if (groupOf[i] == Unshared && groups.size() < MaxSharedTables) {
+                groupOf[i] = groups.size();
+                groups.emplace_back();
+            }
+            if (groupOf[i] != Unshared) groups[groupOf[i]].Add(counts);
+        }
 
-            std::memcpy(&this->header.bitLength, buffer.data() + offset, sizeof(this->header.bitLength));
-            offset += sizeof(this->header.bitLength);
+        Huffman::ScratchVector<Huffman::FreqMap> sharedMaps;
+        Huffman::ScratchVector<Huffman::Encoder> sharedEncoders;
+        for (const SharedGroup& group : groups) {
+            sharedMaps.push_back(ToFreqMap(group.counts));
+            sharedEncoders.emplace_back(sharedMaps.back());
+        }
 
-            std::memcpy(&this->header.size, buffer.data() + offset, sizeof(this->header.size));
-            offset += sizeof(this->header.size);
+        // Every range writes its records into its own arena, the arenas are joined at the end
+        Huffman::ScratchVector<CompressedBatch> parts(bounds.size() - 1);
+        RunBatch(bounds, [&](size_t first, size_t last, size_t part) {
+            CompressedBatch& out = parts[part];
+            HuffpressFile::_HuffpressFileHeader header;
+            SymbolCounts counts;
+
+            for (size_t i = first; i < last; ++i) {
+                const Span& input = inputs[i];
+                size_t group = groupOf[i];
+                countSymbols(input, counts);
+
+                // The shared table has to cover every symbol and code with more than one symbol,
+                // a lone symbol is restored from its count which only fits the input it came from
+                bool shared = group != Unshared && sharedMaps[group].size() > 1;
+                if (shared) {
+                    double bits = static_cast<double>(sharedMaps[group].size()) * FreqMapEntryBits;
+                    for (int symbol = 0; symbol < 256 && shared; ++symbol) {
+                        if (!counts[symbol]) continue;
+                        shared = sharedEncoders[group].Knows(static_cast<Huffman::Byte>(symbol));
+                        bits += double(counts[symbol]) * sharedEncoders[group].Code(static_cast<Huffman::Byte>(symbol)).length;
+                    }
+                    shared = shared && bits <= ownCosts[i] * (1 + shareTolerance);
+                }
 
-            std::memcpy(&this->header.sourceChecksum, buffer.data() + offset, sizeof(this->header.sourceChecksum));
-            offset += sizeof(this->header.sourceChecksum);
+                Huffman::ByteVector payload;
+                if (shared) {
+                    header.freqMap = sharedMaps[group];
+                    payload = sharedEncoders[group].Encode(input.data, input.size, header.bitLength);
+                } else {
+                    header.freqMap = ToFreqMap(counts);
+                    payload = Huffman::Encoder(header.freqMap).Encode(input.data, input.size, header.bitLength);
+                }
 
-            std::memcpy(&this->header.compressedChecksum, buffer.data() + offset, sizeof(this->header.compressedChecksum));
-            offset += sizeof(this->header.compressedChecksum);
+                header.size = payload.size();
+                header.sourceChecksum = checksum(input.data, input.size);
+                header.compressedChecksum = checksum(reinterpret_cast<const char*>(payload.data()), payload.size());
 
-            this->byteVec.resize(this->header.size);
-            std::memcpy(this->byteVec.data(), buffer.data() + offset, this->header.size);
-        } catch (const std::exception& e) {
-            throw Exceptions::DeserializationException(e.what());
+                AppendHeader(header, out.data);
+                out.data.insert(out.data.end(), payload.begin(), payload.end());
+                out.offsets.push_back(out.data.size());
+            }
+        });
+
+        if (parts.size() == 1) return std::move(parts[0]);
+
+        CompressedBatch batch;
+        size_t total = 0;
+        for (const CompressedBatch& part : parts) total += part.data.size();
+        batch.data.reserve(total);
+        batch.offsets.reserve(inputs.size() + 1);
+        for (const CompressedBatch& part : parts) {
+            size_t base = batch.data.size();
+            batch.data.insert(batch.data.end(), part.data.begin(), part.data.end());
+            for (size_t i = 1; i < part.offsets.size(); ++i) batch.offsets.push_back(base + part.offsets[i]);
         }
+        return batch;
     }
 
-    HUFFPRESS_API void HuffpressFile::Modify(const std::string& data) {
-        this->header.freqMap.clear();
-        this->byteVec = Huffman::Compress(data, this->header.freqMap, this->header.bitLength);
-        this->header.size = this->byteVec.size();
-        this->header.sourceChecksum = checksum(data.c_str(), data.size());
-        this->header.compressedChecksum = checksum(reinterpret_cast<char*>(this->byteVec.data()), this->header.size);
+    HUFFPRESS_API DecompressedBatch DecompressBatch(const CompressedBatch& batch, unsigned threads) {
+        Huffman::ScratchVector<size_t> bounds = SplitBatch(batch.Count(), threads, [&batch](size_t i) { return batch.Size(i); });
+
+        Huffman::ScratchVector<DecompressedBatch> parts(bounds.size() - 1);
+        RunBatch(bounds, [&batch, &parts](size_t first, size_t last, size_t part) {
+            DecompressedBatch& out = parts[part];
+            HuffpressFile::_HuffpressFileHeader header;
+
+            // Records of a batch mostly repeat a few shared tables, so the last decoders are kept around
+            Huffman::ScratchVector<std::pair<Huffman::FreqMap, Huffman::Decoder>> decoders;
+            size_t replace = 0;
+
+            for (size_t i = first; i < last; ++i) {
+                size_t offset = 0;
+                std::string error;
+                if (!ReadHeader(batch.Item(i), batch.Size(i), header, offset, error) || !CheckHeader(header, batch.Size(i) - offset, error)) {
+                    throw Exceptions::DeserializationException("batch record " + std::to_string(i) + ": " + error);
+                }
+
+                auto decoder = std::find_if(decoders.begin(), decoders.end(), [&header](const std::pair<Huffman::FreqMap, Huffman::Decoder>& cached) {
+                    return cached.first == header.freqMap;
+                });
+                if (decoder == decoders.end()) {
+                    if (decoders.size() < MaxSharedTables) {
+                        decoders.emplace_back(header.freqMap, Huffman::Decoder(header.freqMap));
+                        decoder = decoders.end() - 1;
+                    } else {
+                        decoder = decoders.begin() + replace++ % MaxSharedTables;
+                        decoder->second = Huffman::Decoder(header.freqMap);
+                        decoder->first.swap(header.freqMap);
+                    }
+                }
+
+                const Huffman::Byte* payload = batch.Item(i) + offset;
+                if (checksum(reinterpret_cast<const char*>(payload), header.size) != header.compressedChecksum) {
+                    throw Exceptions::ChecksumMismatchException("compressed data of batch record " + std::to_string(i));
+                }
+                checksum_t sourceChecksum = CHECKSUM_INIT;
+                DecodeSource(header, decoder->second, payload, header.size, [&out, &sourceChecksum](const char* chunk, size_t size) {
+                    sourceChecksum = checksum_update(sourceChecksum, chunk, size);
+                    out.data.append(chunk, size);
+                });
+                if (sourceChecksum != header.sourceChecksum) {
+                    throw Exceptions::ChecksumMismatchException("source data of batch record " + std::to_string(i));
+                }
+                out.offsets.push_back(out.data.size());
+            }
+        });
+
+        if (parts.size() == 1) return std::move(parts[0]);
+
+        DecompressedBatch result;
+        size_t total = 0;
+        for (const DecompressedBatch& part : parts) total += part.data.size();
+        result.data.reserve(total);
+        result.offsets.reserve(batch.Count() + 1);
+        for (const DecompressedBatch& part : parts) {
+            size_t base = result.data.size();
+            result.data += part.data;
+            for (size_t i = 1; i < part.offsets.size(); ++i) result.offsets.push_back(base + part.offsets[i]);
+        }
+        return result;
     }
 
-    HUFFPRESS_API void HuffpressFile::Modify(const Huffman::ByteVector& newByteVec, const Huffman::FreqMap& newFreqMap, size_t bitLength) {
-        this->byteVec = newByteVec;
-        this->header.size = this->byteVec.size();
-        this->header.freqMap = newFreqMap;
-        std::string decompressed = Huffman::Decompress(this->byteVec, this->header.freqMap, bitLength);
-        this->header.sourceChecksum = checksum(decompressed.c_str(), decompressed.size());
-        this->header.compressedChecksum = checksum(reinterpret_cast<char*>(this->byteVec.data()), this->header.size);
+    HUFFPRESS_API SizeEstimate EstimateCompressedSize(const std::string& data, bool fromSample) {
+        Huffman::FreqMap freqMap;
+        SizeEstimate estimate;
+        estimate.sourceSize = data.size();
+        estimate.bitLength = Huffman::EncodedBitLength(data.data(), data.size(), freqMap, fromSample);
+        estimate.payloadSize = (estimate.bitLength + 7) / 8;
+        estimate.headerSize = HeaderSize(freqMap.size());
+        estimate.sampled = fromSample && data.size() >= Huffman::SampledTableMinSize;
+        return estimate;
     }
 
-    HUFFPRESS_API std::string HuffpressFile::Decompress() {
-        return Huffman::Decompress(this->byteVec, this->header.freqMap, this->header.bitLength);
+    HUFFPRESS_API checksum_t ParallelBlockChecksum(const char* data, size_t size, size_t blockSize, unsigned threads, std::vector<checksum_t>* blockChecksums) {
+        if (blockSize == 0) blockSize = size ? size : 1;
+        size_t blockCount = (size + blockSize - 1) / blockSize;
+
+        Huffman::ScratchVector<checksum_t> checksums(blockCount);
+        auto hashBlocks = [&checksums, data, size, blockSize, blockCount](size_t first, size_t step) {
+            for (size_t block = first; block < blockCount; block += step) {
+                size_t offset = block * blockSize;
+                checksums[block] = block_checksum(data + offset, std::min(blockSize, size - offset));
+            }
+        };
+
+        size_t workers = std::max<size_t>(1, std::min<size_t>(threads, blockCount));
+        Huffman::ScratchVector<std::thread> pool;
+        for (size_t i = 1; i < workers; ++i) {
+            pool.emplace_back(hashBlocks, i, workers);
+        }
+        hashBlocks(0, workers);
+        for (std::thread& worker : pool) {
+            worker.join();
+        }
+
+        checksum_t combined = 0;
+        for (size_t block = 0; block < blockCount; ++block) {
+            size_t offset = block * blockSize;
+            combined = block_checksum_combine(combined, checksums[block], std::min(blockSize, size - offset));
+        }
+
+        if (blockChecksums) blockChecksums->assign(checksums.begin(), checksums.end());
+        return combined;
     }
 } // Huffpress
\ No newline at end of file
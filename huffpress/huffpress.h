@@ -7,19 +7,74 @@
 #include "huffman/huffman.h"
 
 #include "exceptions.h"
+#include "transform.h"
+#include "lz77.h"
+#include "context.h"
+
+#include <vector>
+#include <iosfwd>
 
 namespace Huffpress {
 
     const uint8_t Version[3] = {0, 1, 2};
 
+    // Outcome of an integrity check of a Huffpress file
+    struct VerifyResult {
+        // Magic, version, frequency map and sizes are consistent with the payload
+        bool headerValid = false;
+        // The payload matches compressedChecksum
+        bool compressedChecksumValid = false;
+        // The payload was decoded and checked against sourceChecksum
+        bool sourceChecked = false;
+        // The decoded payload matches sourceChecksum (meaningful when sourceChecked)
+        bool sourceChecksumValid = false;
+        // Description of the first failed check
+        std::string error;
+
+        bool Ok() const { return headerValid && compressedChecksumValid && (!sourceChecked || sourceChecksumValid); }
+    };
+
+    // How the payload of a file is coded, after the transforms
+    enum class Coding : std::uint8_t {
+        // Every byte with the one Huffman table of freqMap
+        Huffman = 0,
+        // LZ77 sequences (see lz77.h): freqMap is the literal table and the header holds the LzTableCount others
+        Lz77 = 1,
+        // Every byte with the table its previous byte is mapped to (see context.h): freqMap is table 0, the header
+        // holds up to MaxContextTables - 1 others and the context map
+        ContextSplit = 2,
+    };
+
+    class HuffpressFile;
+
+    namespace Detail {
+        // The compression of HuffpressFile::Init, also handing the source and the packed chunks to onSource and
+        // onPacked (either may be empty) as the coder passes over them; CompressAsync checks for cancellation there
+        HUFFPRESS_API void CompressInto(HuffpressFile& file, const std::string& data, unsigned threads, Huffman::TableMode mode,
+                                        const Huffman::ChunkVisitor& onSource, const Huffman::ChunkVisitor& onPacked);
+    }
+
     class HUFFPRESS_API HuffpressFile
     {
     public:
         HuffpressFile() = default;
         HUFFPRESS_API HuffpressFile(const std::string& data);
 
-        // Initialize the structure by data
-        HUFFPRESS_API void Init(const std::string& data);
+        // Initialize the structure by data (compressing on up to `threads` threads, same output for any count)
+        // TableMode::Sampled builds the code table of large inputs from a sample, reading the data once at a small ratio cost
+        HUFFPRESS_API void Init(const std::string& data, unsigned threads = 1, Huffman::TableMode mode = Huffman::TableMode::Exact);
+        // Initialize the structure by data run through a transform pipeline before it is coded (see transform.h)
+        // The pipeline is recorded in the header and reverted by every decoding path; the source checksum stays that of data
+        HUFFPRESS_API void Init(const std::string& data, const Pipeline& pipeline, unsigned threads = 1);
+        // Initialize the structure by data coded as LZ77 matches and literals, after an optional transform pipeline
+        // Match finding is sequential, `threads` only applies to the transforms
+        HUFFPRESS_API void Init(const std::string& data, const LzOptions& options, const Pipeline& pipeline = Pipeline(), unsigned threads = 1);
+        // Initialize the structure by data coded with per-context tables, after an optional transform pipeline
+        // The tables are chosen for this data alone; `threads` only applies to the transforms
+        HUFFPRESS_API void Init(const std::string& data, const ContextOptions& options, const Pipeline& pipeline = Pipeline(), unsigned threads = 1);
+        // Initialize the structure by the contents of a file on disk (on up to `threads` threads, all hardware threads for 0)
+        // A reader thread reads blockSize blocks while they are counted, then the blocks are encoded in parallel
+        HUFFPRESS_API std::uint64_t Load(const std::string& sourcePath, unsigned threads = 0, size_t blockSize = 1 << 20);
         // Serialize to a file
         HUFFPRESS_API void Serialize(const std::string& filePath);
         // Serialize to a file (buffered writing, default buffer size 64 KB)
@@ -32,12 +87,25 @@ namespace Huffpress {
         HUFFPRESS_API void BufferedParse(const std::string& filePath, const size_t bufferSize = 64 * 1024);
         // Deserialize from a buffer
         HUFFPRESS_API void ParseFromBuffer(const Huffman::ByteVector& buffer);
-        // Modify the file's data by compressing the new string data
-        HUFFPRESS_API void Modify(const std::string& data);
+        // Modify the file's data by compressing the new string data (on up to `threads` threads)
+        HUFFPRESS_API void Modify(const std::string& data, unsigned threads = 1);
         // Modify the file's data by directly setting the new byte vector and frequency map
+        // The source checksum is deferred until it is first needed (SourceChecksum or serialization)
         HUFFPRESS_API void Modify(const Huffman::ByteVector& newByteVec, const Huffman::FreqMap& newFreqMap, size_t bitLength);
-        // Get decompressed buffer
-        HUFFPRESS_API std::string Decompress();
+        // Modify the file's data by directly setting the new byte vector, frequency map and the known source checksum
+        HUFFPRESS_API void Modify(const Huffman::ByteVector& newByteVec, const Huffman::FreqMap& newFreqMap, size_t bitLength, checksum_t sourceChecksum);
+        // Get decompressed buffer (decoding on up to `threads` threads)
+        HUFFPRESS_API std::string Decompress(unsigned threads = 1) const;
+        // Decode without materializing the result, handing decoded chunks to onOutput
+        HUFFPRESS_API void Decode(const Huffman::ChunkVisitor& onOutput) const;
+        // Get decompressed buffer, checking both checksums on the way (throws ChecksumMismatchException)
+        HUFFPRESS_API std::string DecompressAndVerify();
+        // Get the source checksum, computing it first if it was deferred by Modify
+        HUFFPRESS_API checksum_t SourceChecksum();
+        // Check the header and compressed checksum, and the source checksum by decoding into a small rolling buffer
+        HUFFPRESS_API VerifyResult Verify(bool checkSource = true);
+        // Verify a file on disk through a memory mapping, without loading the payload into a HuffpressFile
+        HUFFPRESS_API static VerifyResult VerifyFile(const std::string& filePath, bool checkSource = true);
 
     public:
         struct _HuffpressFileHeader {
@@ -49,6 +117,21 @@ namespace Huffpress {
             // Helps in managing backward compatibility for future versions of the format
             uint8_t version[3] = {Huffpress::Version[0], Huffpress::Version[1], Huffpress::Version[2]};
 
+            // Transforms the data went through before it was coded, in the order they were applied
+            // Written only when there are any: such files carry major version 1 and the transform list after the version
+            // Only readers with header checks reject a major version they do not know, and only where they check the
+            // header (Verify, DecompressFile, streams and batches); earlier readers check neither the magic nor the
+            // version and misread such files as plain Huffman data
+            Pipeline transforms;
+
+            // Coding of the payload and the tables it needs besides freqMap
+            // Written only for codings other than Huffman: such files carry major version 2, followed by the
+            // transform list (which may be empty), the coding and its tables
+            Coding coding = Coding::Huffman;
+            std::vector<Huffman::FreqMap> tables;
+            // Table of every context of ContextSplit, written packed after the tables (see ContextMapSize)
+            ContextMap contextMap{};
+
             // Frequency map used for compression
             // Stores the frequency of each character in the original data for Huffman encoding
             Huffman::FreqMap freqMap;
@@ -68,6 +151,9 @@ namespace Huffpress {
             // Checksum of the compressed (byte) data
             // Used for verifying the integrity of the compressed data
             checksum_t compressedChecksum = 0;
+
+            // Whether the payload decodes to the source data with freqMap alone
+            bool Plain() const { return this->transforms.empty() && this->coding == Coding::Huffman; }
         };
 
         // File header
@@ -76,6 +162,201 @@ namespace Huffpress {
         // The compressed byte vector
         // Stores the actual compressed data in bytes
         Huffman::ByteVector byteVec;
-    };    
+
+    private:
+        friend void Detail::CompressInto(HuffpressFile& file, const std::string& data, unsigned threads, Huffman::TableMode mode,
+                                         const Huffman::ChunkVisitor& onSource, const Huffman::ChunkVisitor& onPacked);
+
+        // Set while header.sourceChecksum is stale after a raw Modify
+        bool sourceChecksumPending_ = false;
+    };
+
+    // Immutable view of a Huffpress file for concurrent readers
+    // Thread safety: the decode tables are built once when the reader is created and nothing is modified
+    // afterwards, so all members may be called from any number of threads at once without locking
+    class HUFFPRESS_API HuffpressReader
+    {
+    public:
+        // Take over a parsed or freshly compressed file
+        HUFFPRESS_API explicit HuffpressReader(HuffpressFile file);
+        // Parse a file from disk
+        HUFFPRESS_API explicit HuffpressReader(const std::string& filePath);
+
+        // Get decompressed buffer (decoding on up to `threads` threads)
+        HUFFPRESS_API std::string Decompress(unsigned threads = 1) const;
+        // Decode without materializing the result, handing decoded chunks to onOutput
+        HUFFPRESS_API void Decode(const Huffman::ChunkVisitor& onOutput) const;
+        // Same checks as HuffpressFile::Verify
+        HUFFPRESS_API VerifyResult Verify(bool checkSource = true) const;
+
+        const HuffpressFile::_HuffpressFileHeader& Header() const { return file_.header; }
+        const Huffman::ByteVector& Payload() const { return file_.byteVec; }
+
+    private:
+        HuffpressFile file_;
+        Huffman::Decoder decoder_;
+    };
+
+    // Compress a file on disk into a Huffpress file on disk (on up to `threads` threads, all hardware threads for 0)
+    // A reader thread feeds the counting pass, then encoder threads feed a writer thread through bounded queues of
+    // blockSize blocks, so the disk is kept busy while the blocks are encoded; returns the header that was written
+    HUFFPRESS_API HuffpressFile::_HuffpressFileHeader CompressFile(const std::string& sourcePath, const std::string& targetPath, unsigned threads = 0, size_t blockSize = 1 << 20);
+
+    // Totals of a block stream written by CompressStream or read by DecompressStream
+    struct StreamStats {
+        size_t blocks = 0;
+        size_t sourceBytes = 0;
+        size_t compressedBytes = 0;
+    };
+
+    // Compress everything readable from `in` into a block stream on `out`: a stream header, then one complete Huffpress
+    // file per blockSize block of input, each prefixed by its size, and an end marker
+    // Blocks are read on the calling thread, compressed on up to `threads` threads (all hardware threads for 0) and
+    // written in order by a writer thread, with at most 2 * threads blocks in flight
+    // Every block goes through `pipeline` before it is coded, recorded in the block's header; with an lzLevel (see
+    // LzLevel) blocks are coded as LZ77 sequences, with contextTables (up to MaxContextTables) each block gets its own
+    // per-context tables; 0 for both codes them with one Huffman table, and only one of them may be set
+    HUFFPRESS_API StreamStats CompressStream(std::istream& in, std::ostream& out, unsigned threads = 0, size_t blockSize = 4 << 20, const Pipeline& pipeline = Pipeline(), int lzLevel = 0,
+                                             size_t contextTables = 0);
+    // Append everything readable from `in` to the block stream at streamPath (created if missing) as new blocks
+    // Only the new data is compressed and written: the blocks replace the end marker, which is written again after them
+    HUFFPRESS_API StreamStats AppendStream(const std::string& streamPath, std::istream& in, unsigned threads = 0, size_t blockSize = 4 << 20, const Pipeline& pipeline = Pipeline(), int lzLevel = 0,
+                                           size_t contextTables = 0);
+    // Decompress a block stream (or a single Huffpress file) from `in` to `out`, checking both checksums of every block
+    HUFFPRESS_API StreamStats DecompressStream(std::istream& in, std::ostream& out, unsigned threads = 0);
+
+    // Writes an adaptive stream: data is encoded in a single pass as it is written (see Huffman::AdaptiveEncoder), so
+    // nothing has to be buffered to count it first. The stream is a header like that of a block stream, then frames of
+    // [uint64 symbols][uint64 bytes][source checksum][bytes], and a frame of zero symbols as the end marker
+    // A frame goes out once frameSize compressed bytes are pending or on Flush, which makes everything written so far
+    // decodable at the other end of a pipe or socket
+    class HUFFPRESS_API AdaptiveStreamWriter {
+    public:
+        HUFFPRESS_API explicit AdaptiveStreamWriter(std::ostream& out, size_t frameSize = 64 << 10);
+
+        HUFFPRESS_API void Write(const char* data, size_t size);
+        void Write(const std::string& data) { this->Write(data.data(), data.size()); }
+        // Write the pending data as a frame (if there is any) and flush the output stream
+        HUFFPRESS_API void Flush();
+        // Flush and write the end marker; nothing can be written afterwards
+        HUFFPRESS_API void Close();
+
+        // Frames are counted as blocks
+        const StreamStats& Stats() const { return this->stats_; }
+
+    private:
+        std::ostream& out_;
+        size_t frameSize_;
+        Huffman::AdaptiveEncoder encoder_;
+        Huffman::ByteVector pending_;
+        std::uint64_t symbols_ = 0;
+        checksum_t checksum_ = CHECKSUM_INIT;
+        StreamStats stats_;
+        bool closed_ = false;
+
+        void WriteFrame();
+    };
+
+    // Reads an adaptive stream frame by frame, checking the checksum of each
+    class HUFFPRESS_API AdaptiveStreamReader {
+    public:
+        // Reads and checks the stream header
+        HUFFPRESS_API explicit AdaptiveStreamReader(std::istream& in);
+
+        // Append the data of the next frame to out; false at the end marker
+        HUFFPRESS_API bool Read(std::string& out);
+
+        const StreamStats& Stats() const { return this->stats_; }
+
+    private:
+        std::istream& in_;
+        Huffman::AdaptiveDecoder decoder_;
+        Huffman::ByteVector frame_;
+        StreamStats stats_;
+        bool done_ = false;
+    };
+
+    // Compress everything readable from `in` into an adaptive stream on `out`; with lineFrames every line is written
+    // as soon as it is complete, for producers that write a line at a time
+    HUFFPRESS_API StreamStats CompressAdaptive(std::istream& in, std::ostream& out, bool lineFrames = false);
+
+    // Read-only view of one input buffer
+    struct Span {
+        const char* data = nullptr;
+        size_t size = 0;
+
+        Span() = default;
+        Span(const char* data, size_t size) : data(data), size(size) {}
+        Span(const std::string& text) : data(text.data()), size(text.size()) {}
+    };
+
+    // Items of a batch laid out back to back in one buffer, item i spans [offsets[i], offsets[i + 1])
+    template <typename Buffer>
+    struct BatchArena {
+        Buffer data;
+        std::vector<size_t> offsets = std::vector<size_t>(1, 0);
+
+        size_t Count() const { return offsets.size() - 1; }
+        size_t Size(size_t i) const { return offsets[i + 1] - offsets[i]; }
+        const typename Buffer::value_type* Item(size_t i) const { return data.data() + offsets[i]; }
+    };
+
+    // Every item is a complete Huffpress record, the bytes SerializeToBuffer would produce for it
+    using CompressedBatch = BatchArena<Huffman::ByteVector>;
+    using DecompressedBatch = BatchArena<std::string>;
+
+    // Compress each input into its own record on up to `threads` threads
+    // Inputs with similar distributions share a code table built once for the batch; an input keeps the shared
+    // table only while its record stays within shareTolerance of the size it would have with its own table
+    HUFFPRESS_API CompressedBatch CompressBatch(const std::vector<Span>& inputs, unsigned threads = 1, double shareTolerance = 0.03);
+    // Decompress every record of a batch on up to `threads` threads (throws DeserializationException on a malformed record)
+    HUFFPRESS_API DecompressedBatch DecompressBatch(const CompressedBatch& batch, unsigned threads = 1);
+
+    // Verify many files on up to `threads` threads, results are in the order of filePaths
+    HUFFPRESS_API std::vector<VerifyResult> VerifyFiles(const std::vector<std::string>& filePaths, bool checkSource = true, unsigned threads = 0);
+
+    // Outcome of one file of CompressFiles or DecompressFiles
+    struct FileResult {
+        size_t sourceBytes = 0;
+        size_t compressedBytes = 0;
+        // Description of the failure, empty on success
+        std::string error;
+
+        bool Ok() const { return error.empty(); }
+    };
+
+    // Decompress a Huffpress file on disk into a file on disk, decoding straight from a memory mapping
+    // Both checksums are checked (throws DeserializationException or ChecksumMismatchException); returns the decoded size
+    HUFFPRESS_API size_t DecompressFile(const std::string& sourcePath, const std::string& targetPath);
+    // Compress sourcePaths[i] into targetPaths[i] on a pool of `threads` workers (all hardware threads for 0)
+    // Files are scheduled largest first and every worker keeps one arena for the tables and buffers of all its files
+    // Failures are reported per file; results are in the order of sourcePaths
+    HUFFPRESS_API std::vector<FileResult> CompressFiles(const std::vector<std::string>& sourcePaths, const std::vector<std::string>& targetPaths, unsigned threads = 0);
+    // Decompress sourcePaths[i] into targetPaths[i] the same way
+    HUFFPRESS_API std::vector<FileResult> DecompressFiles(const std::vector<std::string>& sourcePaths, const std::vector<std::string>& targetPaths, unsigned threads = 0);
+
+    // Predicted result of compressing data into a record, see EstimateCompressedSize
+    struct SizeEstimate {
+        std::uint64_t sourceSize = 0;
+        // Bytes of the record header, which grows with the frequency map
+        std::uint64_t headerSize = 0;
+        std::uint64_t payloadSize = 0;
+        std::uint64_t bitLength = 0;
+        // Estimated from a sample, otherwise exact
+        bool sampled = false;
+
+        std::uint64_t RecordSize() const { return headerSize + payloadSize; }
+        // Record bytes per source byte, above 1 when compressing does not pay off
+        double Ratio() const { return sourceSize ? static_cast<double>(RecordSize()) / sourceSize : 0; }
+    };
+
+    // Size of the record HuffpressFile::Init (with TableMode::Exact) and SerializeToBuffer would produce for data, computed
+    // from the symbol counts and code lengths without encoding; exact unless fromSample, which counts only the strided
+    // sample of sampled tables
+    HUFFPRESS_API SizeEstimate EstimateCompressedSize(const std::string& data, bool fromSample = false);
+
+    // Combinable checksum (block_checksum) of data hashed as blockSize blocks on up to `threads` threads
+    // The per-block values are stored to blockChecksums when it is not null
+    HUFFPRESS_API checksum_t ParallelBlockChecksum(const char* data, size_t size, size_t blockSize, unsigned threads, std::vector<checksum_t>* blockChecksums = nullptr);
 } // Huffpress
 #endif // HUFFPRESS_H
\ No newline at end of file
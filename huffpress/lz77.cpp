@@ -0,0 +1,563 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "lz77.h"
+#include "exceptions.h"
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Huffpress {
+
+    namespace {
+        using Huffman::Byte;
+        using Position = std::uint32_t;
+        using Counts = std::array<std::uint64_t, 256>;
+
+        // Shortest match worth coding, also the number of bytes hashed per position
+        const size_t MinMatch = 4;
+        // Longest match in one sequence; longer runs continue in the next sequence at the same distance
+        const size_t MaxMatch = 1 << 24;
+        // The match finder restarts every SegmentSize bytes, so positions fit 32 bits; literal runs carry over
+        const size_t SegmentSize = size_t(1) << 30;
+        const size_t LargestWindow = SegmentSize;
+        const unsigned MaxHashBits = 17;
+        // Values below this are their own code; see ValueCode
+        const unsigned DirectCodes = 16;
+        // Values a code stands for have fewer bits than this (literal runs are not bounded by the segments)
+        const unsigned MaxValueBits = 48;
+        // Literals are decoded in batches of at most this many, so that a sink can hand out a bounded buffer for them
+        const size_t LiteralBatch = 4096;
+
+        // Match finder settings of levels 1 to 9
+        const LzOptions Levels[] = {
+            {1 << 16, 1, 16, false},
+            {1 << 18, 2, 24, false},
+            {1 << 20, 4, 32, false},
+            {1 << 20, 8, 32, true},
+            {1 << 20, 16, 64, true},
+            {1 << 20, 32, 128, true},
+            {1 << 22, 64, 128, true},
+            {1 << 22, 128, 258, true},
+            {1 << 22, 256, 258, true},
+        };
+
+        std::uint32_t Load32(const Byte* data) {
+            std::uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint64_t Load64(const Byte* data) {
+            std::uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        // Code of a length or distance: values below DirectCodes are their own code, larger ones are coded by the
+        // position of their highest bit and the two bits below it, and followed by the remaining bits as they are
+        Byte ValueCode(std::uint64_t value, unsigned& extraBits) {
+            if (value < DirectCodes) {
+                extraBits = 0;
+                return static_cast<Byte>(value);
+            }
+            unsigned high = 0;
+            while (value >> (high + 1)) ++high;
+            extraBits = high - 2;
+            return static_cast<Byte>(DirectCodes + (high - 4) * 4 + ((value >> extraBits) & 3));
+        }
+
+        // Hash chains over the positions of one segment: head holds the latest position of every hash, prev the
+        // position before each one with the same hash, both one past the position so that zero is no position
+        class MatchFinder {
+        public:
+            MatchFinder(const Byte* data, size_t size, const LzOptions& options) : data_(data), size_(size), options_(options) {
+                size_t ring = 1;
+                while (ring < std::min(options.window, size)) ring <<= 1;
+                this->prev_.resize(ring);
+                this->mask_ = ring - 1;
+                while (this->hashBits_ < MaxHashBits && (size_t(1) << this->hashBits_) < size) ++this->hashBits_;
+                this->head_.resize(size_t(1) << this->hashBits_);
+            }
+
+            // Forget every position, matches start over at base
+            void Reset(size_t base) {
+                std::fill(this->head_.begin(), this->head_.end(), 0);
+                this->base_ = base;
+            }
+
+            size_t Base() const { return this->base_; }
+
+            void Insert(size_t pos) {
+                if (pos + MinMatch > this->size_) return;
+                Position& head = this->head_[this->Hash(pos)];
+                this->prev_[(pos - this->base_) & this->mask_] = head;
+                head = static_cast<Position>(pos - this->base_ + 1);
+            }
+
+            // Longest match for pos among the inserted positions, below MinMatch if there is none
+            size_t Find(size_t pos, size_t& distance) const {
+                if (pos + MinMatch > this->size_) return 0;
+                const size_t limit = std::min(this->size_ - pos, MaxMatch);
+                const Byte* current = this->data_ + pos;
+                size_t best = MinMatch - 1;
+
+                Position link = this->head_[this->Hash(pos)];
+                for (unsigned depth = 0; link != 0 && depth < this->options_.depth; ++depth) {
+                    size_t candidate = this->base_ + link - 1;
+                    if (candidate >= pos || pos - candidate > this->options_.window) break;
+
+                    // The byte that would make the match longer than the best one rules out most candidates
+                    const Byte* earlier = this->data_ + candidate;
+                    if (earlier[best] == current[best] && Load32(earlier) == Load32(current)) {
+                        size_t length = MatchLength(earlier, current, limit);
+                        if (length > best) {
+                            best = length;
+                            distance = pos - candidate;
+                            if (length >= this->options_.niceLength || length == limit) break;
+                        }
+                    }
+
+                    // Entries older than the ring may have been overwritten by later positions, which end the chain
+                    Position next = this->prev_[(candidate - this->base_) & this->mask_];
+                    if (next >= link) break;
+                    link = next;
+                }
+                return best;
+            }
+
+        private:
+            const Byte* data_;
+            size_t size_;
+            LzOptions options_;
+            size_t base_ = 0;
+            size_t mask_;
+            unsigned hashBits_ = 10;
+            Huffman::ScratchVector<Position> head_;
+            Huffman::ScratchVector<Position> prev_;
+
+            size_t Hash(size_t pos) const {
+                return (Load32(this->data_ + pos) * 2654435761u) >> (32 - this->hashBits_);
+            }
+
+            static size_t MatchLength(const Byte* earlier, const Byte* current, size_t limit) {
+                size_t length = MinMatch;
+                while (length + 8 <= limit && Load64(earlier + length) == Load64(current + length)) length += 8;
+                while (length < limit && earlier[length] == current[length]) ++length;
+                return length;
+            }
+        };
+
+        // A run of literals followed by a match; the last sequence of a payload may have no match
+        struct Sequence {
+            size_t literals;
+            Position length;
+            Position distance;
+        };
+
+        // Frequency map of counts; a lone symbol gets a partner so that it has a one-bit code, since the bit stream
+        // has no symbol counts to restore it from
+        Huffman::FreqMap TableFromCounts(const Counts& counts) {
+            Huffman::FreqMap freqMap;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                if (counts[symbol]) freqMap[static_cast<Huffman::Char>(symbol)] = static_cast<Huffman::Int>(std::min<std::uint64_t>(counts[symbol], std::numeric_limits<Huffman::Int>::max()));
+            }
+            if (freqMap.size() == 1) freqMap[static_cast<Huffman::Char>(static_cast<Byte>(freqMap.begin()->first) ^ 1)] = 1;
+            return freqMap;
+        }
+
+        // Bit reader of LzDecompress, throwing on anything the encoder cannot have written
+        class TokenReader {
+        public:
+            TokenReader(const Byte* payload, size_t size, size_t bitLength) : reader_(payload, size, bitLength) {}
+
+            std::uint64_t Bits(unsigned count) {
+                if (count == 0) return 0;
+                this->reader_.Refill();
+                if (this->reader_.Position() + count > this->reader_.BitLength()) {
+                    throw Exceptions::DeserializationException("LZ77 payload ends inside a token");
+                }
+                std::uint64_t value = this->reader_.Peek() >> (64 - count);
+                this->reader_.Skip(count);
+                return value;
+            }
+
+            char Symbol(const Huffman::Decoder& decoder) {
+                char symbol;
+                if (!decoder.DecodeSymbol(this->reader_, symbol)) {
+                    throw Exceptions::DeserializationException("LZ77 payload ends inside a token");
+                }
+                return symbol;
+            }
+
+            std::uint64_t Value(const Huffman::Decoder& decoder) {
+                Byte code = static_cast<Byte>(this->Symbol(decoder));
+                if (code < DirectCodes) return code;
+                unsigned high = (code - DirectCodes) / 4 + 4;
+                if (high >= MaxValueBits) {
+                    throw Exceptions::DeserializationException("LZ77 value out of range");
+                }
+                std::uint64_t top = 4 | ((code - DirectCodes) & 3);
+                return (top << (high - 2)) | this->Bits(high - 2);
+            }
+
+            bool Done() const { return this->reader_.Position() == this->reader_.BitLength(); }
+            std::uint64_t Remaining() const { return this->reader_.BitLength() - this->reader_.Position(); }
+
+        private:
+            Huffman::BitReader reader_;
+        };
+
+        // Decoders of a table that the token stream can use: neither empty nor a lone symbol without a code
+        void CheckTable(const Huffman::Decoder& decoder) {
+            if (decoder.Empty() || decoder.Lone()) {
+                throw Exceptions::DeserializationException("LZ77 payload uses a table without codes");
+            }
+        }
+
+        // Output of LzDecompress, grown as the sequences are decoded: a source size read from a damaged payload
+        // costs nothing until the sequences actually produce that much
+        class StringSink {
+        public:
+            explicit StringSink(size_t reserve) { this->out_.reserve(reserve); }
+
+            size_t Produced() const { return this->out_.size(); }
+
+            // Room for count literals at the end of the output
+            char* Literals(size_t count) {
+                size_t start = this->out_.size();
+                this->out_.resize(start + count);
+                return &this->out_[start];
+            }
+
+            void Match(size_t distance, size_t length) {
+                size_t start = this->out_.size();
+                this->out_.resize(start + length);
+                char* output = &this->out_[start];
+                // Overlapping matches repeat the bytes they are still writing, byte by byte
+                const char* from = output - distance;
+                if (distance >= length) {
+                    std::memcpy(output, from, length);
+                } else {
+                    for (size_t i = 0; i < length; ++i) output[i] = from[i];
+                }
+            }
+
+            std::string& Output() { return this->out_; }
+
+        private:
+            std::string out_;
+        };
+
+        // History LzDecode keeps at first: the window of the highest level, so that only payloads of a wider
+        // custom window cost it a second pass
+        const size_t StreamWindow = 1 << 22;
+        // Output LzDecode collects beyond its history before handing it on
+        const size_t MinStreamFlush = 1 << 20;
+
+        // Thrown by WindowSink on a match that reaches back past the history it keeps
+        struct WindowMiss {};
+
+        // Output of LzDecode: hands the output on as it grows and keeps only the last `keep` bytes of it for
+        // matches to copy from; the first `skip` bytes are not handed on, they were on an earlier attempt
+        class WindowSink {
+        public:
+            WindowSink(size_t keep, std::uint64_t skip, const Huffman::ChunkVisitor& onOutput)
+                : keep_(keep), flush_(std::max(keep, MinStreamFlush)), skip_(skip), onOutput_(onOutput) {}
+
+            std::uint64_t Produced() const { return this->base_ + this->buffer_.size(); }
+            std::uint64_t Emitted() const { return std::max(this->emitted_, this->skip_); }
+
+            char* Literals(size_t count) {
+                this->Drain();
+                size_t start = this->buffer_.size();
+                this->buffer_.resize(start + count);
+                return &this->buffer_[start];
+            }
+
+            void Match(size_t distance, size_t length) {
+                if (distance > this->keep_) throw WindowMiss();
+                // Long matches are copied in pieces so that the history is trimmed in between
+                while (length > 0) {
+                    this->Drain();
+                    size_t piece = std::min(length, this->flush_);
+                    size_t start = this->buffer_.size();
+                    this->buffer_.resize(start + piece);
+                    char* output = &this->buffer_[start];
+                    const char* from = output - distance;
+                    if (distance >= piece) {
+                        std::memcpy(output, from, piece);
+                    } else {
+                        for (size_t i = 0; i < piece; ++i) output[i] = from[i];
+                    }
+                    length -= piece;
+                }
+            }
+
+            // Hand on the rest of the output
+            void Finish() { this->Emit(); }
+
+        private:
+            size_t keep_;
+            size_t flush_;
+            std::uint64_t skip_;
+            const Huffman::ChunkVisitor& onOutput_;
+            Huffman::ScratchString buffer_;
+            // Output bytes before the buffer, and before the first byte not handed on yet
+            std::uint64_t base_ = 0;
+            std::uint64_t emitted_ = 0;
+
+            void Emit() {
+                std::uint64_t start = std::max(this->emitted_, this->skip_);
+                if (start < this->Produced()) {
+                    this->onOutput_(this->buffer_.data() + (start - this->base_), static_cast<size_t>(this->Produced() - start));
+                }
+                this->emitted_ = std::max(this->emitted_, this->Produced());
+            }
+
+            // Once flush_ bytes past the history have piled up, hand them on and drop all but the history
+            void Drain() {
+                if (this->buffer_.size() < this->keep_ + this->flush_) return;
+                this->Emit();
+                size_t drop = this->buffer_.size() - this->keep_;
+                this->buffer_.erase(0, drop);
+                this->base_ += drop;
+            }
+        };
+
+        // Output of the first pass of LzDecode when WindowSink missed: checks the payload and finds how far back
+        // its matches reach, without keeping any output
+        class ScanSink {
+        public:
+            std::uint64_t Produced() const { return this->produced_; }
+            size_t FarthestMatch() const { return this->farthest_; }
+
+            char* Literals(size_t count) {
+                this->produced_ += count;
+                this->literals_.resize(std::max(this->literals_.size(), count));
+                return this->literals_.data();
+            }
+
+            void Match(size_t distance, size_t length) {
+                this->produced_ += length;
+                this->farthest_ = std::max(this->farthest_, distance);
+            }
+
+        private:
+            std::uint64_t produced_ = 0;
+            size_t farthest_ = 0;
+            Huffman::ScratchVector<char> literals_;
+        };
+
+        // Decode the sequences of a payload into sink until it holds `total` bytes, checking every field against
+        // the output so far and the bits left before the sink is asked to grow
+        template <typename Sink>
+        void DecodeSequences(TokenReader& reader, std::uint64_t total, const Huffman::Decoder& literals, const std::vector<Huffman::Decoder>& decoders,
+                             Sink& sink) {
+            const Huffman::Decoder& lengthDecoder = decoders[LzLiteralLengths];
+            const Huffman::Decoder& matchDecoder = decoders[LzMatchLengths];
+            const Huffman::Decoder& distanceDecoder = decoders[LzDistances];
+            while (sink.Produced() < total) {
+                CheckTable(lengthDecoder);
+                std::uint64_t literalCount = reader.Value(lengthDecoder);
+                // Every literal takes at least one bit
+                if (literalCount > total - sink.Produced() || literalCount > reader.Remaining()) {
+                    throw Exceptions::DeserializationException("LZ77 literals run past the source size");
+                }
+                if (literalCount) CheckTable(literals);
+                for (size_t left = static_cast<size_t>(literalCount); left > 0;) {
+                    size_t batch = std::min(left, LiteralBatch);
+                    char* output = sink.Literals(batch);
+                    for (size_t i = 0; i < batch; ++i) output[i] = reader.Symbol(literals);
+                    left -= batch;
+                }
+                if (sink.Produced() == total) break;
+
+                CheckTable(matchDecoder);
+                CheckTable(distanceDecoder);
+                std::uint64_t length = reader.Value(matchDecoder) + MinMatch;
+                std::uint64_t distance = reader.Value(distanceDecoder) + 1;
+                if (length > MaxMatch || length > total - sink.Produced() || distance > sink.Produced()) {
+                    throw Exceptions::DeserializationException("LZ77 match out of range");
+                }
+                sink.Match(static_cast<size_t>(distance), static_cast<size_t>(length));
+            }
+            if (!reader.Done()) {
+                throw Exceptions::DeserializationException("LZ77 payload has bits past its last token");
+            }
+        }
+
+        // Source size at the start of a payload, checked against what its bits can code: every sequence codes at
+        // least one bit, and a match copies at most MaxMatch bytes
+        std::uint64_t ReadSourceSize(TokenReader& reader, size_t bitLength) {
+            std::uint64_t total = reader.Bits(32) << 32;
+            total |= reader.Bits(32);
+            if (total > (bitLength + 1) * MaxMatch) {
+                throw Exceptions::DeserializationException("LZ77 source size does not match the payload");
+            }
+            return total;
+        }
+
+        std::vector<Huffman::Decoder> SequenceDecoders(const std::vector<Huffman::FreqMap>& tables) {
+            if (tables.size() != LzTableCount) {
+                throw Exceptions::DeserializationException("LZ77 payload needs " + std::to_string(LzTableCount) + " tables");
+            }
+            std::vector<Huffman::Decoder> decoders;
+            decoders.reserve(LzTableCount);
+            for (const Huffman::FreqMap& table : tables) decoders.emplace_back(table);
+            return decoders;
+        }
+    }
+
+    HUFFPRESS_API LzOptions LzLevel(int level) {
+        if (level < MinLzLevel || level > MaxLzLevel) {
+            throw std::invalid_argument("LZ77 level " + std::to_string(level) + " is not between " + std::to_string(MinLzLevel) + " and " + std::to_string(MaxLzLevel));
+        }
+        return Levels[level - MinLzLevel];
+    }
+
+    HUFFPRESS_API Huffman::ByteVector LzCompress(const char* data, size_t size, const LzOptions& options, Huffman::FreqMap& literals,
+                                                 std::vector<Huffman::FreqMap>& tables, size_t& bitLength) {
+        if (options.window == 0 || options.window > LargestWindow || options.depth == 0 || options.niceLength < MinMatch) {
+            throw std::invalid_argument("bad LZ77 options");
+        }
+        const Byte* bytes = reinterpret_cast<const Byte*>(data);
+
+        // Parse into sequences, greedily or looking one position ahead before every match
+        Huffman::ScratchVector<Sequence> sequences;
+        {
+            MatchFinder finder(bytes, size, options);
+            size_t pos = 0, anchor = 0;
+            while (pos + MinMatch <= size) {
+                if (pos - finder.Base() >= SegmentSize) finder.Reset(pos);
+                size_t distance = 0;
+                size_t length = finder.Find(pos, distance);
+                finder.Insert(pos);
+                if (length < MinMatch) {
+                    ++pos;
+                    continue;
+                }
+
+                while (options.lazy && length < options.niceLength) {
+                    size_t nextDistance = 0;
+                    size_t next = finder.Find(pos + 1, nextDistance);
+                    if (next <= length) break;
+                    finder.Insert(++pos);
+                    length = next;
+                    distance = nextDistance;
+                }
+
+                sequences.push_back({pos - anchor, static_cast<Position>(length), static_cast<Position>(distance)});
+                for (size_t end = pos + length; ++pos < end;) finder.Insert(pos);
+                anchor = pos;
+            }
+            if (anchor < size || sequences.empty()) {
+                sequences.push_back({size - anchor, 0, 0});
+            }
+        }
+
+        // Count the symbols of every table, then code them
+        Counts literalCounts{}, counts[LzTableCount] = {};
+        size_t pos = 0;
+        for (const Sequence& sequence : sequences) {
+            unsigned extraBits;
+            counts[LzLiteralLengths][ValueCode(sequence.literals, extraBits)]++;
+            for (size_t end = pos + sequence.literals; pos < end; ++pos) literalCounts[bytes[pos]]++;
+            if (sequence.length) {
+                counts[LzMatchLengths][ValueCode(sequence.length - MinMatch, extraBits)]++;
+                counts[LzDistances][ValueCode(sequence.distance - 1, extraBits)]++;
+                pos += sequence.length;
+            }
+        }
+        literals = TableFromCounts(literalCounts);
+        tables.assign(LzTableCount, Huffman::FreqMap());
+        for (size_t table = 0; table < LzTableCount; ++table) tables[table] = TableFromCounts(counts[table]);
+
+        if (size == 0) {
+            bitLength = 0;
+            return Huffman::ByteVector();
+        }
+        const Huffman::Encoder literalEncoder(literals);
+        const Huffman::Encoder lengthEncoder(tables[LzLiteralLengths]), matchEncoder(tables[LzMatchLengths]), distanceEncoder(tables[LzDistances]);
+
+        // The stream starts with the 64-bit source size; the exact bit length sizes the output
+        bitLength = 64;
+        for (int symbol = 0; symbol < 256; ++symbol) bitLength += literalCounts[symbol] * literalEncoder.Code(static_cast<Byte>(symbol)).length;
+        for (const Sequence& sequence : sequences) {
+            unsigned extraBits;
+            bitLength += lengthEncoder.Code(ValueCode(sequence.literals, extraBits)).length + extraBits;
+            if (sequence.length) {
+                bitLength += matchEncoder.Code(ValueCode(sequence.length - MinMatch, extraBits)).length + extraBits;
+                bitLength += distanceEncoder.Code(ValueCode(sequence.distance - 1, extraBits)).length + extraBits;
+            }
+        }
+
+        Huffman::ByteVector payload((bitLength + 7) / 8);
+        Huffman::BitWriter writer(payload.data());
+        auto putValue = [&writer](const Huffman::Encoder& encoder, std::uint64_t value) {
+            unsigned extraBits;
+            const Huffman::HuffmanCodeword& code = encoder.Code(ValueCode(value, extraBits));
+            writer.Put(code.bits, code.length);
+            if (extraBits) writer.Put(value & ((std::uint64_t(1) << extraBits) - 1), extraBits);
+        };
+
+        writer.Put(static_cast<std::uint64_t>(size), 64);
+        pos = 0;
+        for (const Sequence& sequence : sequences) {
+            putValue(lengthEncoder, sequence.literals);
+            for (size_t end = pos + sequence.literals; pos < end; ++pos) {
+                const Huffman::HuffmanCodeword& code = literalEncoder.Code(bytes[pos]);
+                writer.Put(code.bits, code.length);
+            }
+            if (sequence.length) {
+                putValue(matchEncoder, sequence.length - MinMatch);
+                putValue(distanceEncoder, sequence.distance - 1);
+                pos += sequence.length;
+            }
+        }
+        writer.Flush();
+        return payload;
+    }
+
+    HUFFPRESS_API std::string LzDecompress(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& literals,
+                                           const std::vector<Huffman::FreqMap>& tables) {
+        std::vector<Huffman::Decoder> decoders = SequenceDecoders(tables);
+        if (bitLength == 0) return std::string();
+
+        TokenReader reader(payload, size, bitLength);
+        std::uint64_t total = ReadSourceSize(reader, std::min(bitLength, size * 8));
+        // The reservation is only a guess bounded by the payload; the output grows past it as it is decoded
+        StringSink sink(static_cast<size_t>(std::min<std::uint64_t>(total, static_cast<std::uint64_t>(size) * 8)));
+        DecodeSequences(reader, total, literals, decoders, sink);
+        return std::move(sink.Output());
+    }
+
+    HUFFPRESS_API void LzDecode(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& literals,
+                                const std::vector<Huffman::FreqMap>& tables, const Huffman::ChunkVisitor& onOutput) {
+        std::vector<Huffman::Decoder> decoders = SequenceDecoders(tables);
+        if (bitLength == 0) return;
+
+        auto decode = [&](auto& sink) {
+            TokenReader reader(payload, size, bitLength);
+            std::uint64_t total = ReadSourceSize(reader, std::min(bitLength, size * 8));
+            DecodeSequences(reader, total, literals, decoders, sink);
+        };
+        WindowSink sink(StreamWindow, 0, onOutput);
+        try {
+            decode(sink);
+            sink.Finish();
+            return;
+        } catch (const WindowMiss&) {
+        }
+
+        // A match reached back farther than the history kept: find how far the farthest one goes and decode
+        // again with that much, handing on only what the first attempt did not
+        ScanSink scan;
+        decode(scan);
+        WindowSink rest(scan.FarthestMatch(), sink.Emitted(), onOutput);
+        decode(rest);
+        rest.Finish();
+    }
+} // Huffpress
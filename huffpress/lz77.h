@@ -0,0 +1,57 @@
+#ifndef HUFFPRESS_LZ77_H
+#define HUFFPRESS_LZ77_H
+
+#include "export.h"
+#include "huffman/huffman.h"
+
+#include <string>
+#include <vector>
+
+namespace Huffpress {
+
+    // Match finder settings of the LZ77 coding
+    // The decoder needs none of them: any window and depth produce payloads every reader decodes
+    struct LzOptions {
+        // Farthest back a match may reach, in bytes (up to 1 GB)
+        size_t window = 1 << 20;
+        // Earlier positions with the same hash examined per position; more find longer matches, slower
+        unsigned depth = 32;
+        // A match at least this long is taken without looking at more candidates
+        size_t niceLength = 128;
+        // Before taking a match, check whether the next position starts a longer one (lazy matching)
+        bool lazy = true;
+    };
+
+    // Levels trade speed for ratio from 1 (greedy, one candidate, 64 KB window) to 9 (lazy, 256 candidates, 4 MB window)
+    const int MinLzLevel = 1;
+    const int MaxLzLevel = 9;
+    const int DefaultLzLevel = 6;
+
+    // Match finder settings of a level; throws std::invalid_argument outside [MinLzLevel, MaxLzLevel]
+    HUFFPRESS_API LzOptions LzLevel(int level);
+
+    // Tables of an LZ77 payload besides the literal table, in the order they are stored in the header
+    const size_t LzTableCount = 3;
+    enum LzTable : size_t {
+        LzLiteralLengths = 0,
+        LzMatchLengths = 1,
+        LzDistances = 2,
+    };
+
+    // Code data as LZ77 sequences: a run of literals, then a match (length and distance) copying earlier output
+    // Each sequence is coded into one bit stream as the literal length, the literals, the match length and the distance,
+    // every field with its own Huffman table; lengths and distances are coded by magnitude followed by raw low bits
+    // literals receives the literal table and tables the LzTableCount others
+    HUFFPRESS_API Huffman::ByteVector LzCompress(const char* data, size_t size, const LzOptions& options, Huffman::FreqMap& literals,
+                                                 std::vector<Huffman::FreqMap>& tables, size_t& bitLength);
+    // Decode an LzCompress payload with a decoder of its literal table and its other tables
+    // Throws DeserializationException on a payload LzCompress cannot have produced
+    HUFFPRESS_API std::string LzDecompress(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& literals,
+                                           const std::vector<Huffman::FreqMap>& tables);
+    // Decode an LzCompress payload the same way, handing the source to onOutput in chunks as it is decoded
+    // Only as much output is kept as the matches reach back: the window of the compressor, 4 MB at the highest level
+    HUFFPRESS_API void LzDecode(const Huffman::Byte* payload, size_t size, size_t bitLength, const Huffman::Decoder& literals,
+                                const std::vector<Huffman::FreqMap>& tables, const Huffman::ChunkVisitor& onOutput);
+} // Huffpress
+
+#endif // HUFFPRESS_LZ77_H
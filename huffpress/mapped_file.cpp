@@ -0,0 +1,99 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "mapped_file.h"
+#include "exceptions.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace Huffpress {
+
+#if defined(_WIN32) || defined(_WIN64)
+    HUFFPRESS_API MappedFile::MappedFile(const std::string& filePath) {
+        HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw Exceptions::FileOpenException(filePath);
+        }
+        this->fileHandle_ = file;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            throw Exceptions::FileOpenException(filePath);
+        }
+        this->size_ = static_cast<size_t>(size.QuadPart);
+        if (this->size_ == 0) return;
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!view) {
+            if (mapping) CloseHandle(mapping);
+            CloseHandle(file);
+            throw Exceptions::FileOpenException(filePath);
+        }
+        this->mappingHandle_ = mapping;
+        this->data_ = static_cast<const Huffman::Byte*>(view);
+    }
+
+    HUFFPRESS_API MappedFile::~MappedFile() {
+        if (this->data_) UnmapViewOfFile(this->data_);
+        if (this->mappingHandle_) CloseHandle(this->mappingHandle_);
+        if (this->fileHandle_) CloseHandle(this->fileHandle_);
+    }
+
+    HUFFPRESS_API void TruncateFile(const std::string& filePath, std::uint64_t size) {
+        HANDLE file = CreateFileA(filePath.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw Exceptions::SerializationException("failed to truncate " + filePath);
+        }
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(size);
+        bool done = SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+        CloseHandle(file);
+        if (!done) {
+            throw Exceptions::SerializationException("failed to truncate " + filePath);
+        }
+    }
+#else
+    HUFFPRESS_API MappedFile::MappedFile(const std::string& filePath) {
+        this->fd_ = open(filePath.c_str(), O_RDONLY);
+        if (this->fd_ < 0) {
+            throw Exceptions::FileOpenException(filePath);
+        }
+
+        struct stat st;
+        if (fstat(this->fd_, &st) != 0) {
+            close(this->fd_);
+            throw Exceptions::FileOpenException(filePath);
+        }
+        this->size_ = static_cast<size_t>(st.st_size);
+        if (this->size_ == 0) return;
+
+        void* view = mmap(nullptr, this->size_, PROT_READ, MAP_PRIVATE, this->fd_, 0);
+        if (view == MAP_FAILED) {
+            close(this->fd_);
+            throw Exceptions::FileOpenException(filePath);
+        }
+        // The payload is walked front to back exactly once
+        madvise(view, this->size_, MADV_SEQUENTIAL);
+        this->data_ = static_cast<const Huffman::Byte*>(view);
+    }
+
+    HUFFPRESS_API MappedFile::~MappedFile() {
+        if (this->data_) munmap(const_cast<Huffman::Byte*>(this->data_), this->size_);
+        if (this->fd_ >= 0) close(this->fd_);
+    }
+
+    HUFFPRESS_API void TruncateFile(const std::string& filePath, std::uint64_t size) {
+        if (truncate(filePath.c_str(), static_cast<off_t>(size)) != 0) {
+            throw Exceptions::SerializationException("failed to truncate " + filePath);
+        }
+    }
+#endif
+} // Huffpress
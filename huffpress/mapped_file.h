@@ -0,0 +1,44 @@
+#ifndef HUFFPRESS_MAPPED_FILE_H
+#define HUFFPRESS_MAPPED_FILE_H
+
+#include "export.h"
+
+#include "huffman/huffman.h"
+
+#include <string>
+#include <cstdint>
+
+namespace Huffpress {
+
+    // Read-only view of a whole file mapped into memory
+    class HUFFPRESS_API MappedFile
+    {
+    public:
+        // Map the file (throws FileOpenException)
+        HUFFPRESS_API explicit MappedFile(const std::string& filePath);
+        HUFFPRESS_API ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // First byte of the mapping (nullptr for an empty file)
+        const Huffman::Byte* Data() const { return data_; }
+        // Size of the file in bytes
+        size_t Size() const { return size_; }
+
+    private:
+        const Huffman::Byte* data_ = nullptr;
+        size_t size_ = 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+        void* fileHandle_ = nullptr;
+        void* mappingHandle_ = nullptr;
+#else
+        int fd_ = -1;
+#endif
+    };
+
+    // Cut a file down to its first `size` bytes (throws SerializationException)
+    HUFFPRESS_API void TruncateFile(const std::string& filePath, std::uint64_t size);
+} // Huffpress
+#endif // HUFFPRESS_MAPPED_FILE_H
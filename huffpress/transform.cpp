@@ -0,0 +1,512 @@
+#define HUFFPRESS_LIBRARY_BUILD
+
+#include "transform.h"
+#include "huffpress.h"
+
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace Huffpress {
+
+    namespace {
+        using Index = std::int32_t;
+
+        // Suffix array of s[0, n) over the alphabet [0, upper] by induced sorting (SA-IS), in linear time
+        // Suffixes compare as if s ended in a sentinel below every symbol, so a suffix sorts before the longer ones
+        // it is a prefix of; the sentinel's own suffix is not in the result
+        template <typename Symbol>
+        Huffman::ScratchVector<Index> SuffixArray(const Symbol* s, Index n, Index upper) {
+            Huffman::ScratchVector<Index> sa(n);
+            if (n == 0) return sa;
+            if (n == 1) {
+                sa[0] = 0;
+                return sa;
+            }
+            if (n == 2) {
+                sa[0] = s[0] < s[1] ? 0 : 1;
+                sa[1] = 1 - sa[0];
+                return sa;
+            }
+
+            // S-type suffixes sort before the L-type ones starting with the same symbol
+            Huffman::ScratchVector<bool> sType(n, false);
+            for (Index i = n - 2; i >= 0; --i) {
+                sType[i] = s[i] == s[i + 1] ? sType[i + 1] : s[i] < s[i + 1];
+            }
+
+            // Bucket starts of the L-type and S-type suffixes of every symbol
+            Huffman::ScratchVector<Index> startL(upper + 1, 0), startS(upper + 1, 0);
+            for (Index i = 0; i < n; ++i) {
+                if (!sType[i]) {
+                    startS[s[i]]++;
+                } else {
+                    startL[s[i] + 1]++;
+                }
+            }
+            for (Index c = 0; c <= upper; ++c) {
+                startS[c] += startL[c];
+                if (c < upper) startL[c + 1] += startS[c];
+            }
+
+            // Place the LMS suffixes in their buckets and induce the order of all others from them
+            Huffman::ScratchVector<Index> buckets(upper + 1);
+            auto induce = [&](const Huffman::ScratchVector<Index>& lms) {
+                std::fill(sa.begin(), sa.end(), -1);
+                std::copy(startS.begin(), startS.end(), buckets.begin());
+                for (Index d : lms) {
+                    if (d != n) sa[buckets[s[d]]++] = d;
+                }
+                std::copy(startL.begin(), startL.end(), buckets.begin());
+                sa[buckets[s[n - 1]]++] = n - 1;
+                for (Index i = 0; i < n; ++i) {
+                    Index v = sa[i];
+                    if (v >= 1 && !sType[v - 1]) sa[buckets[s[v - 1]]++] = v - 1;
+                }
+                std::copy(startL.begin(), startL.end(), buckets.begin());
+                for (Index i = n - 1; i >= 0; --i) {
+                    Index v = sa[i];
+                    if (v >= 1 && sType[v - 1]) sa[--buckets[s[v - 1] + 1]] = v - 1;
+                }
+            };
+
+            Huffman::ScratchVector<Index> lmsIndex(n + 1, -1);
+            Huffman::ScratchVector<Index> lms;
+            for (Index i = 1; i < n; ++i) {
+                if (!sType[i - 1] && sType[i]) {
+                    lmsIndex[i] = static_cast<Index>(lms.size());
+                    lms.push_back(i);
+                }
+            }
+            Index m = static_cast<Index>(lms.size());
+            induce(lms);
+            if (m == 0) return sa;
+
+            // Name the LMS substrings by their sorted order, equal substrings get equal names
+            Huffman::ScratchVector<Index> sortedLms;
+            sortedLms.reserve(m);
+            for (Index v : sa) {
+                if (lmsIndex[v] != -1) sortedLms.push_back(v);
+            }
+            Huffman::ScratchVector<Index> reduced(m);
+            Index names = 0;
+            reduced[lmsIndex[sortedLms[0]]] = 0;
+            for (Index i = 1; i < m; ++i) {
+                Index left = sortedLms[i - 1], right = sortedLms[i];
+                Index endLeft = lmsIndex[left] + 1 < m ? lms[lmsIndex[left] + 1] : n;
+                Index endRight = lmsIndex[right] + 1 < m ? lms[lmsIndex[right] + 1] : n;
+                bool same = endLeft - left == endRight - right;
+                if (same) {
+                    for (; left < endLeft && s[left] == s[right]; ++left, ++right) {}
+                    same = left != n && s[left] == s[right];
+                }
+                if (!same) ++names;
+                reduced[lmsIndex[sortedLms[i]]] = names;
+            }
+
+            // The order of the reduced string is the order of the LMS suffixes, which induces everything else
+            Huffman::ScratchVector<Index> reducedSa = SuffixArray(reduced.data(), m, names);
+            for (Index i = 0; i < m; ++i) sortedLms[i] = lms[reducedSa[i]];
+            induce(sortedLms);
+            return sa;
+        }
+
+        void StoreIndex(char* out, std::uint32_t value) {
+            for (int i = 0; i < 4; ++i) out[i] = static_cast<char>(value >> (8 * i));
+        }
+
+        std::uint32_t LoadIndex(const char* in) {
+            std::uint32_t value = 0;
+            for (int i = 0; i < 4; ++i) value |= std::uint32_t(static_cast<std::uint8_t>(in[i])) << (8 * i);
+            return value;
+        }
+
+        // BWT of one block into out: the primary row, then the last column without the sentinel's row
+        // Row 0 is the sentinel's own suffix and the primary row the one that starts with the whole block
+        void BwtBlock(const char* data, size_t size, char* out) {
+            const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(data);
+            Huffman::ScratchVector<Index> sa = SuffixArray(bytes, static_cast<Index>(size), 255);
+
+            char* column = out + 4;
+            *column++ = data[size - 1];
+            std::uint32_t primary = 0;
+            for (size_t i = 0; i < size; ++i) {
+                if (sa[i] == 0) {
+                    primary = static_cast<std::uint32_t>(i + 1);
+                } else {
+                    *column++ = data[sa[i] - 1];
+                }
+            }
+            StoreIndex(out, primary);
+        }
+
+        // Inverse BWT of one block, walking the last-to-first mapping from the sentinel's row backwards through the block
+        void UnbwtBlock(const char* in, size_t size, char* out) {
+            std::uint32_t primary = LoadIndex(in);
+            if (primary == 0 || primary > size) {
+                throw Exceptions::DeserializationException("BWT block has a bad primary index");
+            }
+            const std::uint8_t* column = reinterpret_cast<const std::uint8_t*>(in + 4);
+
+            // Next row of every row in the walk, in the same array as the row's symbol
+            std::uint32_t starts[256] = {};
+            for (size_t i = 0; i < size; ++i) starts[column[i]]++;
+            std::uint32_t sum = 1;
+            for (int c = 0; c < 256; ++c) {
+                std::uint32_t count = starts[c];
+                starts[c] = sum;
+                sum += count;
+            }
+
+            Huffman::ScratchVector<std::uint32_t> next(size + 1, 0);
+            for (size_t row = 0; row <= size; ++row) {
+                if (row == primary) continue;
+                std::uint8_t symbol = column[row < primary ? row : row - 1];
+                next[row] = (starts[symbol]++ << 8) | symbol;
+            }
+
+            // Blocks hold at most BwtBlockSize bytes, so a row fits the 24 bits above the symbol
+            std::uint32_t row = 0;
+            for (size_t k = size; k > 0; --k) {
+                if (row == primary) {
+                    throw Exceptions::DeserializationException("BWT block does not invert");
+                }
+                out[k - 1] = static_cast<char>(next[row] & 0xff);
+                row = next[row] >> 8;
+            }
+        }
+
+        // Run job(block) for blocks [0, count) on up to `threads` threads under the caller's allocator
+        template <typename Job>
+        void RunBlocks(size_t count, unsigned threads, Job job) {
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+            threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+            Huffman::Allocator& allocator = Huffman::CurrentAllocator();
+            std::atomic<size_t> nextBlock(0);
+            std::exception_ptr error;
+            std::atomic<bool> failed(false);
+            auto worker = [&]() {
+                Huffman::AllocatorScope scope(allocator, false);
+                for (size_t block = nextBlock++; block < count && !failed; block = nextBlock++) {
+                    try {
+                        job(block);
+                    } catch (...) {
+                        if (!failed.exchange(true)) error = std::current_exception();
+                    }
+                }
+            };
+
+            Huffman::ScratchVector<std::thread> pool;
+            for (unsigned i = 1; i < threads; ++i) {
+                pool.emplace_back(worker);
+            }
+            worker();
+            for (std::thread& thread : pool) {
+                thread.join();
+            }
+            if (error) std::rethrow_exception(error);
+        }
+
+        void ApplyBwt(std::string& data, unsigned threads) {
+            size_t blocks = (data.size() + BwtBlockSize - 1) / BwtBlockSize;
+            std::string out(data.size() + 4 * blocks, '\0');
+            RunBlocks(blocks, threads, [&data, &out](size_t block) {
+                size_t offset = block * BwtBlockSize;
+                BwtBlock(data.data() + offset, std::min(BwtBlockSize, data.size() - offset), &out[offset + 4 * block]);
+            });
+            data.swap(out);
+        }
+
+        void RevertBwt(std::string& data, unsigned threads) {
+            if (data.empty()) return;
+            // Every block is its primary index and BwtBlockSize bytes, only the last one may be shorter (but not empty)
+            size_t blocks = (data.size() + BwtBlockSize + 3) / (BwtBlockSize + 4);
+            if (data.size() <= 4 * blocks + (blocks - 1) * BwtBlockSize) {
+                throw Exceptions::DeserializationException("BWT data has a truncated block");
+            }
+            size_t size = data.size() - 4 * blocks;
+            std::string out(size, '\0');
+            RunBlocks(blocks, threads, [&data, &out, size](size_t block) {
+                size_t offset = block * BwtBlockSize;
+                UnbwtBlock(data.data() + offset + 4 * block, std::min(BwtBlockSize, size - offset), &out[offset]);
+            });
+            data.swap(out);
+        }
+
+        // Differences of little-endian words of `width` bytes, modulo 2^(8 * width)
+        template <typename Word>
+        void DeltaEncode(std::string& data) {
+            size_t words = data.size() / sizeof(Word);
+            Word previous = 0;
+            for (size_t i = 0; i < words; ++i) {
+                Word word;
+                std::memcpy(&word, &data[i * sizeof(Word)], sizeof(Word));
+                Word delta = static_cast<Word>(word - previous);
+                previous = word;
+                std::memcpy(&data[i * sizeof(Word)], &delta, sizeof(Word));
+            }
+        }
+
+        template <typename Word>
+        void DeltaDecode(std::string& data) {
+            size_t words = data.size() / sizeof(Word);
+            Word previous = 0;
+            for (size_t i = 0; i < words; ++i) {
+                Word delta;
+                std::memcpy(&delta, &data[i * sizeof(Word)], sizeof(Word));
+                previous = static_cast<Word>(previous + delta);
+                std::memcpy(&data[i * sizeof(Word)], &previous, sizeof(Word));
+            }
+        }
+
+        void MoveToFrontEncode(std::string& data) {
+            std::uint8_t order[256];
+            for (int i = 0; i < 256; ++i) order[i] = static_cast<std::uint8_t>(i);
+            for (char& c : data) {
+                std::uint8_t symbol = static_cast<std::uint8_t>(c);
+                std::uint8_t position = 0;
+                while (order[position] != symbol) ++position;
+                std::memmove(order + 1, order, position);
+                order[0] = symbol;
+                c = static_cast<char>(position);
+            }
+        }
+
+        void MoveToFrontDecode(std::string& data) {
+            std::uint8_t order[256];
+            for (int i = 0; i < 256; ++i) order[i] = static_cast<std::uint8_t>(i);
+            for (char& c : data) {
+                std::uint8_t position = static_cast<std::uint8_t>(c);
+                std::uint8_t symbol = order[position];
+                std::memmove(order + 1, order, position);
+                order[0] = symbol;
+                c = static_cast<char>(symbol);
+            }
+        }
+
+        // Chunks the stages of a TransformReverter hand on at most, besides whole BWT blocks
+        const size_t RevertChunkSize = 64 * 1024;
+    }
+
+    struct TransformReverter::Stage {
+        virtual ~Stage() = default;
+        // Revert the next size bytes, handing what is done to next
+        virtual void Write(const char* data, size_t size, const Huffman::ChunkVisitor& next) = 0;
+        virtual void Finish(const Huffman::ChunkVisitor&) {}
+    };
+
+    namespace {
+        // DeltaDecode across writes: a word split between two writes is carried over to the next one
+        template <typename Word>
+        class DeltaStage : public TransformReverter::Stage {
+        public:
+            DeltaStage() : out_(RevertChunkSize) {}
+
+            void Write(const char* data, size_t size, const Huffman::ChunkVisitor& next) override {
+                while (size > 0) {
+                    size_t take = std::min(size, this->out_.size() - this->carried_);
+                    std::memcpy(this->out_.data(), this->carry_, this->carried_);
+                    std::memcpy(this->out_.data() + this->carried_, data, take);
+                    size_t filled = this->carried_ + take;
+                    size_t words = filled / sizeof(Word);
+                    for (size_t i = 0; i < words; ++i) {
+                        Word delta;
+                        std::memcpy(&delta, &this->out_[i * sizeof(Word)], sizeof(Word));
+                        this->previous_ = static_cast<Word>(this->previous_ + delta);
+                        std::memcpy(&this->out_[i * sizeof(Word)], &this->previous_, sizeof(Word));
+                    }
+                    this->carried_ = filled - words * sizeof(Word);
+                    std::memcpy(this->carry_, this->out_.data() + words * sizeof(Word), this->carried_);
+                    if (words) next(this->out_.data(), words * sizeof(Word));
+                    data += take;
+                    size -= take;
+                }
+            }
+
+            // Bytes after the last whole word are kept as they are
+            void Finish(const Huffman::ChunkVisitor& next) override {
+                if (this->carried_) next(this->carry_, this->carried_);
+                this->carried_ = 0;
+            }
+
+        private:
+            Huffman::ScratchVector<char> out_;
+            char carry_[sizeof(Word)];
+            size_t carried_ = 0;
+            Word previous_ = 0;
+        };
+
+        class MoveToFrontStage : public TransformReverter::Stage {
+        public:
+            MoveToFrontStage() : out_(RevertChunkSize) {
+                for (int i = 0; i < 256; ++i) this->order_[i] = static_cast<std::uint8_t>(i);
+            }
+
+            void Write(const char* data, size_t size, const Huffman::ChunkVisitor& next) override {
+                while (size > 0) {
+                    size_t take = std::min(size, this->out_.size());
+                    for (size_t i = 0; i < take; ++i) {
+                        std::uint8_t position = static_cast<std::uint8_t>(data[i]);
+                        std::uint8_t symbol = this->order_[position];
+                        std::memmove(this->order_ + 1, this->order_, position);
+                        this->order_[0] = symbol;
+                        this->out_[i] = static_cast<char>(symbol);
+                    }
+                    next(this->out_.data(), take);
+                    data += take;
+                    size -= take;
+                }
+            }
+
+        private:
+            Huffman::ScratchVector<char> out_;
+            std::uint8_t order_[256];
+        };
+
+        // RevertBwt one block at a time: a block is inverted once its primary index and BwtBlockSize bytes are in
+        class BwtStage : public TransformReverter::Stage {
+        public:
+            void Write(const char* data, size_t size, const Huffman::ChunkVisitor& next) override {
+                while (size > 0) {
+                    size_t take = std::min(size, BwtBlockSize + 4 - this->block_.size());
+                    this->block_.insert(this->block_.end(), data, data + take);
+                    if (this->block_.size() == BwtBlockSize + 4) this->Invert(next);
+                    data += take;
+                    size -= take;
+                }
+            }
+
+            // Only the last block may be shorter, but not empty
+            void Finish(const Huffman::ChunkVisitor& next) override {
+                if (!this->block_.empty()) this->Invert(next);
+            }
+
+        private:
+            Huffman::ScratchVector<char> block_;
+            Huffman::ScratchVector<char> out_;
+
+            void Invert(const Huffman::ChunkVisitor& next) {
+                if (this->block_.size() <= 4) {
+                    throw Exceptions::DeserializationException("BWT data has a truncated block");
+                }
+                this->out_.resize(this->block_.size() - 4);
+                UnbwtBlock(this->block_.data(), this->out_.size(), this->out_.data());
+                this->block_.clear();
+                next(this->out_.data(), this->out_.size());
+            }
+        };
+
+        const struct {
+            Transform transform;
+            const char* name;
+        } TransformNames[] = {
+            {Transform::Delta8, "delta8"},
+            {Transform::Delta16, "delta16"},
+            {Transform::Delta32, "delta32"},
+            {Transform::MoveToFront, "mtf"},
+            {Transform::Bwt, "bwt"},
+        };
+    }
+
+    HUFFPRESS_API bool KnownTransform(std::uint8_t value) {
+        return value >= static_cast<std::uint8_t>(Transform::Delta8) && value <= static_cast<std::uint8_t>(Transform::Bwt);
+    }
+
+    HUFFPRESS_API void ApplyTransforms(const Pipeline& pipeline, std::string& data, unsigned threads) {
+        for (Transform transform : pipeline) {
+            switch (transform) {
+            case Transform::Delta8: DeltaEncode<std::uint8_t>(data); break;
+            case Transform::Delta16: DeltaEncode<std::uint16_t>(data); break;
+            case Transform::Delta32: DeltaEncode<std::uint32_t>(data); break;
+            case Transform::MoveToFront: MoveToFrontEncode(data); break;
+            case Transform::Bwt: ApplyBwt(data, threads); break;
+            default: throw std::invalid_argument("unknown transform");
+            }
+        }
+    }
+
+    HUFFPRESS_API void RevertTransforms(const Pipeline& pipeline, std::string& data, unsigned threads) {
+        for (auto it = pipeline.rbegin(); it != pipeline.rend(); ++it) {
+            switch (*it) {
+            case Transform::Delta8: DeltaDecode<std::uint8_t>(data); break;
+            case Transform::Delta16: DeltaDecode<std::uint16_t>(data); break;
+            case Transform::Delta32: DeltaDecode<std::uint32_t>(data); break;
+            case Transform::MoveToFront: MoveToFrontDecode(data); break;
+            case Transform::Bwt: RevertBwt(data, threads); break;
+            default: throw Exceptions::DeserializationException("unknown transform");
+            }
+        }
+    }
+
+    HUFFPRESS_API TransformReverter::TransformReverter(const Pipeline& pipeline, const Huffman::ChunkVisitor& onOutput) {
+        for (auto it = pipeline.rbegin(); it != pipeline.rend(); ++it) {
+            switch (*it) {
+            case Transform::Delta8: this->stages_.emplace_back(new DeltaStage<std::uint8_t>()); break;
+            case Transform::Delta16: this->stages_.emplace_back(new DeltaStage<std::uint16_t>()); break;
+            case Transform::Delta32: this->stages_.emplace_back(new DeltaStage<std::uint32_t>()); break;
+            case Transform::MoveToFront: this->stages_.emplace_back(new MoveToFrontStage()); break;
+            case Transform::Bwt: this->stages_.emplace_back(new BwtStage()); break;
+            default: throw Exceptions::DeserializationException("unknown transform");
+            }
+        }
+        for (size_t i = 1; i < this->stages_.size(); ++i) {
+            this->outputs_.push_back([this, i](const char* data, size_t size) { this->stages_[i]->Write(data, size, this->outputs_[i]); });
+        }
+        this->outputs_.push_back(onOutput);
+    }
+
+    HUFFPRESS_API TransformReverter::~TransformReverter() {}
+
+    HUFFPRESS_API void TransformReverter::Write(const char* data, size_t size) {
+        if (this->stages_.empty()) {
+            if (size) this->outputs_[0](data, size);
+            return;
+        }
+        this->stages_[0]->Write(data, size, this->outputs_[0]);
+    }
+
+    HUFFPRESS_API void TransformReverter::Finish() {
+        for (size_t i = 0; i < this->stages_.size(); ++i) {
+            this->stages_[i]->Finish(this->outputs_[i]);
+        }
+    }
+
+    HUFFPRESS_API Pipeline ParsePipeline(const std::string& text) {
+        Pipeline pipeline;
+        if (text.empty() || text == "none") return pipeline;
+
+        size_t start = 0;
+        for (;;) {
+            size_t end = std::min(text.find(',', start), text.size());
+            std::string name = text.substr(start, end - start);
+            auto found = std::find_if(std::begin(TransformNames), std::end(TransformNames),
+                [&name](const decltype(TransformNames[0])& entry) { return name == entry.name; });
+            if (found == std::end(TransformNames)) {
+                throw std::invalid_argument("unknown transform " + name);
+            }
+            pipeline.push_back(found->transform);
+            if (end == text.size()) break;
+            start = end + 1;
+        }
+        if (pipeline.size() > MaxTransforms) {
+            throw std::invalid_argument("more than " + std::to_string(MaxTransforms) + " transforms");
+        }
+        return pipeline;
+    }
+
+    HUFFPRESS_API std::string PipelineName(const Pipeline& pipeline) {
+        if (pipeline.empty()) return "none";
+        std::string name;
+        for (Transform transform : pipeline) {
+            if (!name.empty()) name += ',';
+            for (const auto& entry : TransformNames) {
+                if (entry.transform == transform) name += entry.name;
+            }
+        }
+        return name;
+    }
+} // Huffpress
@@ -0,0 +1,79 @@
+#ifndef HUFFPRESS_TRANSFORM_H
+#define HUFFPRESS_TRANSFORM_H
+
+#include "export.h"
+#include "huffman/huffman.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Huffpress {
+
+    // Reversible transforms applied to the data ahead of the Huffman coder, recorded in the file header
+    // None of them compresses by itself: each reshapes the data so that an order-0 code gets more out of it
+    enum class Transform : std::uint8_t {
+        // Every byte replaced by its difference to the byte before it, for slowly changing byte samples
+        Delta8 = 1,
+        // The same on little-endian 16-bit and 32-bit words (numeric telemetry); bytes after the last whole word are kept
+        Delta16 = 2,
+        Delta32 = 3,
+        // Every byte replaced by its position in a list of the most recently seen byte values, so that repeats
+        // become zeros and small values; usually follows Bwt
+        MoveToFront = 4,
+        // Burrows-Wheeler transform of BwtBlockSize blocks, which groups bytes by the context that follows them
+        // Every block is preceded by the 32-bit position of its primary row
+        Bwt = 5,
+    };
+
+    // Transforms in the order they are applied to the data
+    using Pipeline = std::vector<Transform>;
+
+    // Blocks of the BWT: its suffix array takes about 4 bytes of memory per byte of block while it is built
+    const size_t BwtBlockSize = 1 << 20;
+    // Transforms a header holds at most
+    const size_t MaxTransforms = 8;
+
+    // Whether the value is one of the transforms above
+    HUFFPRESS_API bool KnownTransform(std::uint8_t value);
+
+    // Apply the pipeline to data in place, with BWT blocks sorted on up to `threads` threads (all hardware threads for 0)
+    HUFFPRESS_API void ApplyTransforms(const Pipeline& pipeline, std::string& data, unsigned threads = 1);
+    // Undo ApplyTransforms in place; throws DeserializationException on data the pipeline cannot have produced
+    HUFFPRESS_API void RevertTransforms(const Pipeline& pipeline, std::string& data, unsigned threads = 1);
+
+    // Undoes a pipeline on data handed over piece by piece as it is decoded, passing the result on to onOutput
+    // BWT blocks are inverted one at a time, so at most one block (BwtBlockSize bytes) is held besides small chunks
+    // Throws DeserializationException on data the pipeline cannot have produced, by the latest in Finish
+    class HUFFPRESS_API TransformReverter
+    {
+    public:
+        HUFFPRESS_API TransformReverter(const Pipeline& pipeline, const Huffman::ChunkVisitor& onOutput);
+        HUFFPRESS_API ~TransformReverter();
+
+        TransformReverter(const TransformReverter&) = delete;
+        TransformReverter& operator=(const TransformReverter&) = delete;
+
+        // Revert the next size bytes of the transformed data
+        HUFFPRESS_API void Write(const char* data, size_t size);
+        // Hand on what the transforms still hold back: the last BWT block and bytes after the last whole delta word
+        HUFFPRESS_API void Finish();
+
+        // One transform being reverted, defined with the transforms
+        struct Stage;
+
+    private:
+        // Stages in the order they revert the pipeline; outputs_[i] feeds the output of stage i to the next one
+        std::vector<std::unique_ptr<Stage>> stages_;
+        std::vector<Huffman::ChunkVisitor> outputs_;
+    };
+
+    // Parse a comma-separated pipeline of delta8, delta16, delta32, mtf and bwt ("" and "none" are empty pipelines)
+    // Throws std::invalid_argument on an unknown name or more than MaxTransforms transforms
+    HUFFPRESS_API Pipeline ParsePipeline(const std::string& text);
+    // The pipeline in the form ParsePipeline reads, "none" for an empty one
+    HUFFPRESS_API std::string PipelineName(const Pipeline& pipeline);
+} // Huffpress
+
+#endif // HUFFPRESS_TRANSFORM_H
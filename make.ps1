@@ -8,7 +8,7 @@ $EXAMPLESDIR = "examples"
 # Set the compiler and flags
 # $CC = "clang"
 $CXX = "clang++"
-$CXXFLAGS = "-std=c++11"
+$CXXFLAGS = "-std=c++14"
 $CXXWARNINGS = "-Wall"
 $CXXPIC = "-fPIC" 
 $CXXTARGET = "--target=x86_64-w64-mingw32"
@@ -39,7 +39,12 @@ function Build-Libraries {
         Write-Host "Failed to build huffman.obj"
         exit $LASTEXITCODE
     }
-    & $CXX $CXXTARGET -shared "$OBJDIR\huffman.obj" -o "$BINDIR\libhuffman$LIBEXT"
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -c "./huffpress/huffman/allocator.cpp" -o "$OBJDIR\allocator.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build allocator.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET -shared "$OBJDIR\huffman.obj" "$OBJDIR\allocator.obj" -o "$BINDIR\libhuffman$LIBEXT"
     if ($LASTEXITCODE -ne 0) {
         Write-Host "Failed to build libhuffman$LIBEXT"
         exit $LASTEXITCODE
@@ -63,7 +68,47 @@ function Build-Libraries {
         Write-Host "Failed to build huffpress.obj"
         exit $LASTEXITCODE
     }
-    & $CXX $CXXTARGET -shared "$OBJDIR\huffpress.obj" -o "$BINDIR\libhuffpress$LIBEXT" $LDFLAGS -lhuffman -lhuffchecksum
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/mapped_file.cpp" -o "$OBJDIR\mapped_file.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build mapped_file.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/async.cpp" -o "$OBJDIR\async.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build async.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/archive.cpp" -o "$OBJDIR\archive.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build archive.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/blockfile.cpp" -o "$OBJDIR\blockfile.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build blockfile.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/cache.cpp" -o "$OBJDIR\cache.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build cache.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/transform.cpp" -o "$OBJDIR\transform.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build transform.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/lz77.cpp" -o "$OBJDIR\lz77.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build lz77.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET $CXXFLAGS $CXXWARNINGS $CXXPIC -I"./huffpress/huffman" -I"./huffpress/checksum" -c "./huffpress/context.cpp" -o "$OBJDIR\context.obj"
+    if ($LASTEXITCODE -ne 0) {
+        Write-Host "Failed to build context.obj"
+        exit $LASTEXITCODE
+    }
+    & $CXX $CXXTARGET -shared "$OBJDIR\huffpress.obj" "$OBJDIR\mapped_file.obj" "$OBJDIR\async.obj" "$OBJDIR\archive.obj" "$OBJDIR\blockfile.obj" "$OBJDIR\cache.obj" "$OBJDIR\transform.obj" "$OBJDIR\lz77.obj" "$OBJDIR\context.obj" -o "$BINDIR\libhuffpress$LIBEXT" $LDFLAGS -lhuffman -lhuffchecksum
     if ($LASTEXITCODE -ne 0) {
         Write-Host "Failed to build libhuffpress$LIBEXT"
         exit $LASTEXITCODE
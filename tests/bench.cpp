@@ -0,0 +1,253 @@
+#include "huffpress.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+// Throughput benchmark over generated corpora, also the training run of the profile-guided build
+
+namespace {
+    struct Corpus {
+        const char* name;
+        std::string data;
+    };
+
+    struct Random {
+        std::uint64_t state;
+
+        std::uint64_t Next() {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return state >> 16;
+        }
+    };
+
+    // Words picked with a roughly Zipfian skew, in sentences
+    std::string TextCorpus(size_t size) {
+        static const char* words[] = {
+            "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on",
+            "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they",
+            "compression", "symbol", "frequency", "encoder", "decoder", "table", "block", "stream", "archive",
+        };
+        const size_t count = sizeof(words) / sizeof(words[0]);
+        Random random{1};
+        std::string text;
+        text.reserve(size + 32);
+        while (text.size() < size) {
+            size_t pick = static_cast<size_t>(random.Next() % count);
+            pick = pick * pick / count;
+            text += words[pick];
+            text += random.Next() % 11 == 0 ? ". " : " ";
+        }
+        text.resize(size);
+        return text;
+    }
+
+    // Structured log lines with timestamps and counters
+    std::string LogCorpus(size_t size) {
+        static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        Random random{2};
+        std::string log;
+        log.reserve(size + 128);
+        for (std::uint64_t line = 0; log.size() < size; ++line) {
+            log += "2024-05-" + std::to_string(10 + line / 100000 % 20) + "T" + std::to_string(line / 3600 % 24) + ":"
+                + std::to_string(line / 60 % 60) + ":" + std::to_string(line % 60) + " ";
+            log += levels[random.Next() % 6];
+            log += " worker=" + std::to_string(random.Next() % 16) + " request=" + std::to_string(random.Next() % 100000)
+                + " latency_us=" + std::to_string(random.Next() % 5000) + "\n";
+        }
+        log.resize(size);
+        return log;
+    }
+
+    // Geometrically distributed bytes, a few symbols dominate
+    std::string SkewedCorpus(size_t size) {
+        Random random{3};
+        std::string data(size, '\0');
+        for (char& c : data) {
+            std::uint64_t bits = random.Next();
+            unsigned symbol = 0;
+            while (symbol < 40 && (bits & 1)) {
+                ++symbol;
+                bits >>= 1;
+            }
+            c = static_cast<char>('A' + symbol);
+        }
+        return data;
+    }
+
+    // Uniform bytes, nothing to gain
+    std::string BinaryCorpus(size_t size) {
+        Random random{4};
+        std::string data(size, '\0');
+        for (char& c : data) c = static_cast<char>(random.Next());
+        return data;
+    }
+
+    template <typename Job>
+    double BestSeconds(unsigned repeats, Job job) {
+        double best = 0;
+        for (unsigned i = 0; i < repeats; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            job();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = i == 0 ? seconds : std::min(best, seconds);
+        }
+        return best;
+    }
+
+    double Throughput(size_t size, double seconds) {
+        return seconds > 0 ? size / seconds / (1 << 20) : 0;
+    }
+
+    void Usage() {
+        std::cerr << "Usage: bench [-s size in MB] [-r repeats] [-t threads] [--train]" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = 8 << 20;
+    unsigned repeats = 5;
+    unsigned threads = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 < argc && std::strcmp(argv[i], "-s") == 0) {
+            size = static_cast<size_t>(std::strtod(argv[++i], nullptr) * (1 << 20));
+        } else if (i + 1 < argc && std::strcmp(argv[i], "-r") == 0) {
+            repeats = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        } else if (i + 1 < argc && std::strcmp(argv[i], "-t") == 0) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--train") == 0) {
+            // Enough work to profile every hot path, on one thread so the counters stay exact
+            size = 2 << 20;
+            repeats = 2;
+            threads = 1;
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    std::vector<Corpus> corpora = {
+        {"text", TextCorpus(size)},
+        {"log", LogCorpus(size)},
+        {"skewed", SkewedCorpus(size)},
+        {"binary", BinaryCorpus(size)},
+    };
+
+    std::cout << std::left << std::setw(8) << "corpus" << std::setw(9) << "table" << std::right << std::setw(10) << "size"
+              << std::setw(8) << "ratio" << std::setw(8) << "loss" << std::setw(16) << "compress MB/s" << std::setw(18) << "decompress MB/s"
+              << std::setw(14) << "verify MB/s" << std::setw(16) << "estimate MB/s" << std::endl;
+    bool failed = false;
+    for (const Corpus& corpus : corpora) {
+        // The sampled table's ratio is reported against the exact one
+        double exactRatio = 0;
+        for (Huffman::TableMode mode : {Huffman::TableMode::Exact, Huffman::TableMode::Sampled}) {
+            Huffman::ByteVector record;
+            double compress = BestSeconds(repeats, [&]() {
+                Huffpress::HuffpressFile file;
+                file.Init(corpus.data, threads, mode);
+                record.clear();
+                file.SerializeToBuffer(record);
+            });
+
+            Huffpress::HuffpressFile parsed;
+            parsed.ParseFromBuffer(record);
+            std::string restored;
+            double decompress = BestSeconds(repeats, [&]() { restored = parsed.Decompress(threads); });
+            bool ok = true;
+            double verify = BestSeconds(repeats, [&]() { ok = ok && parsed.Verify(true).Ok(); });
+
+            bool exact = mode == Huffman::TableMode::Exact;
+            // The exact estimate predicts the exact record, the sampled one estimates it from the sample
+            Huffpress::SizeEstimate estimate;
+            double estimateSeconds = BestSeconds(repeats, [&]() { estimate = Huffpress::EstimateCompressedSize(corpus.data, !exact); });
+            if (exact && estimate.RecordSize() != record.size()) {
+                std::cerr << corpus.name << ": estimated " << estimate.RecordSize() << " bytes, compressed to " << record.size() << std::endl;
+                failed = true;
+            }
+            if (!ok || restored != corpus.data) {
+                std::cerr << corpus.name << (exact ? " (exact)" : " (sampled)") << ": round trip failed" << std::endl;
+                failed = true;
+            }
+            double ratio = double(record.size()) / corpus.data.size();
+            if (exact) exactRatio = ratio;
+            std::cout << std::left << std::setw(8) << corpus.name << std::setw(9) << (exact ? "exact" : "sampled") << std::right
+                      << std::setw(10) << corpus.data.size() << std::setw(8) << std::fixed << std::setprecision(3) << ratio
+                      << std::setw(7) << std::setprecision(2) << (ratio / exactRatio - 1) * 100 << "%"
+                      << std::setw(16) << std::setprecision(1) << Throughput(corpus.data.size(), compress)
+                      << std::setw(18) << Throughput(corpus.data.size(), decompress)
+                      << std::setw(14) << Throughput(corpus.data.size(), verify)
+                      << std::setw(16) << Throughput(corpus.data.size(), estimateSeconds) << std::endl;
+        }
+
+        // One pass with running counts, the ratio is again reported against the exact table
+        std::string stream;
+        double adaptive = BestSeconds(repeats, [&]() {
+            std::ostringstream out;
+            Huffpress::AdaptiveStreamWriter writer(out);
+            writer.Write(corpus.data);
+            writer.Close();
+            stream = out.str();
+        });
+        std::string restored;
+        double adaptiveDecompress = BestSeconds(repeats, [&]() {
+            std::istringstream in(stream);
+            std::ostringstream out;
+            Huffpress::DecompressStream(in, out);
+            restored = out.str();
+        });
+        if (restored != corpus.data) {
+            std::cerr << corpus.name << " (adaptive): round trip failed" << std::endl;
+            failed = true;
+        }
+        double ratio = double(stream.size()) / corpus.data.size();
+        std::cout << std::left << std::setw(8) << corpus.name << std::setw(9) << "adaptive" << std::right
+                  << std::setw(10) << corpus.data.size() << std::setw(8) << std::setprecision(3) << ratio
+                  << std::setw(7) << std::setprecision(2) << (ratio / exactRatio - 1) * 100 << "%"
+                  << std::setw(16) << std::setprecision(1) << Throughput(corpus.data.size(), adaptive)
+                  << std::setw(18) << Throughput(corpus.data.size(), adaptiveDecompress)
+                  << std::setw(14) << "-" << std::setw(16) << "-" << std::endl;
+
+        // Transform pipelines, LZ77 levels and per-context tables, against the same exact table
+        for (const char* name : {"delta8", "bwt,mtf", "lz77:1", "lz77:6", "lz77:9", "ctx:4", "ctx:16"}) {
+            int level = std::strncmp(name, "lz77:", 5) == 0 ? std::atoi(name + 5) : 0;
+            size_t contextTables = std::strncmp(name, "ctx:", 4) == 0 ? static_cast<size_t>(std::atoi(name + 4)) : 0;
+            Huffpress::Pipeline pipeline = level || contextTables ? Huffpress::Pipeline() : Huffpress::ParsePipeline(name);
+            Huffman::ByteVector record;
+            double compress = BestSeconds(repeats, [&]() {
+                Huffpress::HuffpressFile file;
+                if (level) {
+                    file.Init(corpus.data, Huffpress::LzLevel(level), pipeline, threads);
+                } else if (contextTables) {
+                    Huffpress::ContextOptions options;
+                    options.maxTables = contextTables;
+                    file.Init(corpus.data, options, pipeline, threads);
+                } else {
+                    file.Init(corpus.data, pipeline, threads);
+                }
+                record.clear();
+                file.SerializeToBuffer(record);
+            });
+            Huffpress::HuffpressFile parsed;
+            parsed.ParseFromBuffer(record);
+            double decompress = BestSeconds(repeats, [&]() { restored = parsed.Decompress(threads); });
+            if (restored != corpus.data) {
+                std::cerr << corpus.name << " (" << name << "): round trip failed" << std::endl;
+                failed = true;
+            }
+            ratio = double(record.size()) / corpus.data.size();
+            std::cout << std::left << std::setw(8) << corpus.name << std::setw(9) << name << std::right
+                      << std::setw(10) << corpus.data.size() << std::setw(8) << std::setprecision(3) << ratio
+                      << std::setw(7) << std::setprecision(2) << (ratio / exactRatio - 1) * 100 << "%"
+                      << std::setw(16) << std::setprecision(1) << Throughput(corpus.data.size(), compress)
+                      << std::setw(18) << Throughput(corpus.data.size(), decompress)
+                      << std::setw(14) << "-" << std::setw(16) << "-" << std::endl;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -1,9 +1,25 @@
 #include "framework/tinytest.h"
 #include "../huffpress/huffpress.h"
+#include "../huffpress/async.h"
+#include "../huffpress/archive.h"
+#include "../huffpress/blockfile.h"
+#include "../huffpress/cache.h"
+#include "../huffpress/huffman/static_codec.h"
+#ifndef _WIN32
+#include "../huffpress/daemon/daemon.h"
+#include <cstdio>
+#endif
 #include <string>
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
 
 // Test 1 (00): File initialization with data
 ttret_t test_initialize_file(void) {
@@ -103,13 +119,1436 @@ ttret_t test_check_sums(void) {
     tinytestdone();
 }
 
+// Test 6 (05): Checksums computed while compressing and decompressing
+ttret_t test_fused_checksums(void) {
+    std::string testData(200000, 'a');
+    for (size_t i = 0; i < testData.size(); i += 7) testData[i] = static_cast<char>('b' + i % 13);
+    Huffpress::HuffpressFile file(testData);
+
+    ttcheck(file.header.sourceChecksum == checksum(testData.c_str(), testData.size()));
+    ttcheck(file.header.compressedChecksum == checksum(reinterpret_cast<const char*>(file.byteVec.data()), file.byteVec.size()));
+    ttcheck(file.DecompressAndVerify() == testData);
+
+    Huffpress::HuffpressFile single(std::string(1000, 'z')); // A lone symbol is restored from its count
+    ttcheck(single.DecompressAndVerify() == std::string(1000, 'z'));
+
+    // Compressing again into a used file starts from an empty table
+    Huffpress::HuffpressFile reused;
+    reused.Init(std::string(5, 'a'));
+    reused.Init(std::string(5, 'a'));
+    ttcheck(reused.Decompress() == std::string(5, 'a'));
+    reused.Init("xyz");
+    ttcheck(reused.header.freqMap.size() == 3 && reused.DecompressAndVerify() == "xyz");
+
+    file.byteVec[file.byteVec.size() / 2] ^= 0x10;
+    bool thrown = false;
+    try { file.DecompressAndVerify(); } catch (const Huffpress::Exceptions::ChecksumMismatchException&) { thrown = true; }
+    ttcheck(thrown);
+
+    tinytestdone();
+}
+
+// Test 7 (06): Raw modification with deferred and supplied source checksums
+ttret_t test_raw_modify_checksum(void) {
+    std::string testData = "Raw payload, raw payload";
+    Huffpress::HuffpressFile source(testData);
+
+    Huffpress::HuffpressFile deferred;
+    deferred.Modify(source.byteVec, source.header.freqMap, source.header.bitLength);
+    ttcheck(deferred.header.bitLength == source.header.bitLength);
+    ttcheck(deferred.SourceChecksum() == source.header.sourceChecksum);
+
+    Huffpress::HuffpressFile supplied;
+    supplied.Modify(source.byteVec, source.header.freqMap, source.header.bitLength, source.header.sourceChecksum);
+    Huffman::ByteVector a, b;
+    supplied.SerializeToBuffer(a);
+    source.SerializeToBuffer(b);
+    ttcheck(a == b);
+
+    tinytestdone();
+}
+
+// Test 8 (07): Per-block checksums combined into a whole-buffer value
+ttret_t test_block_checksums(void) {
+    std::string testData;
+    for (int i = 0; i < 100000; ++i) testData += static_cast<char>(i * 31 % 251);
+
+    std::vector<checksum_t> blocks;
+    checksum_t whole = block_checksum(testData.data(), testData.size());
+    ttcheck(Huffpress::ParallelBlockChecksum(testData.data(), testData.size(), 4096, 4, &blocks) == whole);
+    ttcheck(blocks.size() == (testData.size() + 4095) / 4096);
+    ttcheck(blocks[0] == block_checksum(testData.data(), 4096));
+    ttcheck(Huffpress::ParallelBlockChecksum(testData.data(), testData.size(), 333, 1) == whole);
+    ttcheck(block_checksum("\0", 1) != block_checksum("\0\0", 2));
+
+    tinytestdone();
+}
+
+// Test 9 (08): Integrity verification of files on disk
+ttret_t test_verify(void) {
+    std::string testData;
+    for (int i = 0; i < 50000; ++i) testData += static_cast<char>('a' + i * i % 17);
+    Huffpress::HuffpressFile file(testData);
+    ttcheck(file.Verify().Ok());
+
+    const std::string goodPath = "testverify_good.hpf";
+    const std::string badPath = "testverify_bad.hpf";
+    file.Serialize(goodPath);
+    file.byteVec[100] ^= 0x01;
+    file.Serialize(badPath);
+
+    std::vector<Huffpress::VerifyResult> results = Huffpress::VerifyFiles({goodPath, badPath, "testverify_missing.hpf"}, true, 2);
+    ttcheck(results.size() == 3);
+    ttcheck(results[0].Ok() && results[0].sourceChecked);
+    ttcheck(!results[1].Ok() && results[1].headerValid && !results[1].compressedChecksumValid);
+    // A payload that fails its checksum is not decoded
+    ttcheck(!results[1].sourceChecked && results[1].error == "compressed checksum mismatch");
+    Huffpress::VerifyResult damaged = file.Verify(true);
+    ttcheck(!damaged.Ok() && !damaged.compressedChecksumValid && !damaged.sourceChecked);
+    ttcheck(!results[2].Ok() && !results[2].headerValid);
+    ttcheck(Huffpress::HuffpressFile::VerifyFile(goodPath, false).Ok());
+
+    ttcheck(std::remove(goodPath.c_str()) == 0);
+    ttcheck(std::remove(badPath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Test 10 (09): Multi-threaded compression matches the serial output
+ttret_t test_parallel_compress(void) {
+    std::string testData;
+    for (int i = 0; i < 3000000; ++i) testData += static_cast<char>((i * 7919 % 61) * (i % 5 == 0) + 'A');
+
+    Huffpress::HuffpressFile serial(testData);
+    for (unsigned threads : {2u, 3u, 8u}) {
+        Huffpress::HuffpressFile parallel;
+        parallel.Init(testData, threads);
+        ttcheck(parallel.byteVec == serial.byteVec);
+        ttcheck(parallel.header.bitLength == serial.header.bitLength);
+        ttcheck(parallel.header.freqMap == serial.header.freqMap);
+        ttcheck(parallel.header.sourceChecksum == serial.header.sourceChecksum);
+        ttcheck(parallel.header.compressedChecksum == serial.header.compressedChecksum);
+    }
+    ttcheck(serial.Decompress() == testData);
+
+    tinytestdone();
+}
+
+// Test 11 (10): Multi-threaded decompression of a single stream
+ttret_t test_parallel_decompress(void) {
+    std::string testData;
+    for (int i = 0; i < 4000000; ++i) testData += static_cast<char>('a' + (i * 2654435761u >> 13) % 23 * (i % 3 != 0));
+
+    Huffpress::HuffpressFile file(testData);
+    ttcheck(file.Decompress(4) == testData);
+    ttcheck(file.Decompress(3) == file.Decompress());
+
+    // Without a table there is nothing to decode, however many threads are asked for
+    ttcheck(Huffman::Decompress(file.byteVec, Huffman::FreqMap(), file.header.bitLength, 4).empty());
+
+    tinytestdone();
+}
+
+// Test 12 (11): Internal allocations routed through an arena
+ttret_t test_arena_allocator(void) {
+    std::string testData;
+    for (int i = 0; i < 1500000; ++i) testData += static_cast<char>('0' + i % 10 + (i % 7 == 0));
+
+    Huffman::ArenaAllocator arena(64 * 1024);
+    std::string restored;
+    {
+        Huffman::AllocatorScope scope(arena);
+        ttcheck(&Huffman::CurrentAllocator() == &arena);
+        Huffpress::HuffpressFile file;
+        file.Init(testData, 4);
+        restored = file.Decompress(4);
+
+        Huffman::HuffmanNode* root = Huffman::Methods::BuildHuffmanTree(file.header.freqMap);
+        Huffman::Methods::FreeTree(root);
+    }
+    ttcheck(restored == testData);
+    ttcheck(&Huffman::CurrentAllocator() != &arena);
+    ttcheck(arena.PeakUsage() > 0);
+    ttcheck(arena.Usage() == 0); // Reset when the scope ended
+    ttcheck(arena.Reserved() >= arena.PeakUsage());
+
+    Huffman::ArenaAllocator bounded(4096, 1024);
+    bool thrown = false;
+    try {
+        Huffman::AllocatorScope scope(bounded);
+        Huffpress::HuffpressFile file(testData);
+    } catch (const std::bad_alloc&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+
+    tinytestdone();
+}
+
+// Test 13 (12): Shared read-only reader under contention
+ttret_t test_concurrent_reader(void) {
+    std::string testData;
+    for (int i = 0; i < 2500000; ++i) testData += static_cast<char>(' ' + (i * i + i / 3) % 90 * (i % 4 != 0));
+
+    const std::string filePath = "testreader.hpf";
+    Huffpress::HuffpressFile(testData).Serialize(filePath);
+    const Huffpress::HuffpressReader reader(filePath);
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 8; ++t) {
+        threads.emplace_back([&reader, &testData, &failures, t]() {
+            for (int round = 0; round < 4; ++round) {
+                if (reader.Decompress(1 + (t + round) % 3) != testData) failures++;
+                checksum_t running = CHECKSUM_INIT;
+                reader.Decode([&running](const char* chunk, size_t size) { running = checksum_update(running, chunk, size); });
+                if (running != reader.Header().sourceChecksum) failures++;
+                if (!reader.Verify(round % 2 == 0).Ok()) failures++;
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    ttcheck(failures == 0);
+
+    ttcheck(std::remove(filePath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Test 14 (13): Batch compression of many small buffers
+ttret_t test_batch(void) {
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 3000; ++i) {
+        std::string item;
+        for (int j = 0; j < 100 + i % 200; ++j) item += "status=ok latency=12ms user=alice "[(i * 7 + j * 13) % 34];
+        inputs.push_back(item);
+    }
+    inputs.push_back("");
+    inputs.push_back(std::string(77, 'z'));
+    std::string binary;
+    for (int i = 0; i < 512; ++i) binary += static_cast<char>(i * 131);
+    inputs.push_back(binary);
+
+    std::vector<Huffpress::Span> spans(inputs.begin(), inputs.end());
+    for (unsigned threads = 1; threads <= 3; threads += 2) {
+        Huffpress::CompressedBatch batch = Huffpress::CompressBatch(spans, threads);
+        ttcheck(batch.Count() == inputs.size());
+        ttcheck(batch.offsets.back() == batch.data.size());
+
+        Huffpress::DecompressedBatch restored = Huffpress::DecompressBatch(batch, threads);
+        ttcheck(restored.Count() == inputs.size());
+        bool same = true;
+        for (size_t i = 0; i < inputs.size(); ++i) same = same && std::string(restored.Item(i), restored.Size(i)) == inputs[i];
+        ttcheck(same);
+
+        // Every record is a complete file, and similar inputs share a table
+        Huffpress::HuffpressFile first, second;
+        first.ParseFromBuffer(Huffman::ByteVector(batch.Item(0), batch.Item(0) + batch.Size(0)));
+        second.ParseFromBuffer(Huffman::ByteVector(batch.Item(1), batch.Item(1) + batch.Size(1)));
+        ttcheck(first.Verify().Ok() && first.Decompress() == inputs[0]);
+        ttcheck(first.header.freqMap == second.header.freqMap);
+    }
+
+    Huffpress::CompressedBatch damaged = Huffpress::CompressBatch(spans);
+    damaged.data[damaged.offsets[inputs.size() - 5]] = 'X';
+    bool thrown = false;
+    try {
+        Huffpress::DecompressBatch(damaged, 3);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+
+    // A flipped payload byte still decodes, but not to data with the record's checksums
+    Huffpress::CompressedBatch flipped = Huffpress::CompressBatch(spans);
+    flipped.data[flipped.offsets[2] - 1] ^= 0x10;
+    thrown = false;
+    try {
+        Huffpress::DecompressBatch(flipped, 3);
+    } catch (const Huffpress::Exceptions::ChecksumMismatchException&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+
+    tinytestdone();
+}
+
+// Test 15 (14): Asynchronous jobs, callbacks, cancellation and back-pressure
+ttret_t test_async(void) {
+    std::string testData;
+    for (int i = 0; i < 300000; ++i) testData += static_cast<char>('a' + i % 13 + (i % 5 == 0));
+
+    Huffpress::AsyncExecutor executor(2, 4);
+    Huffpress::AsyncTask<Huffpress::HuffpressFile> compressed = Huffpress::CompressAsync(testData, 1, executor);
+    Huffpress::HuffpressFile file = compressed.Get();
+    ttcheck(file.Verify().Ok());
+    Huffman::ByteVector asyncRecord, syncRecord;
+    file.SerializeToBuffer(asyncRecord);
+    Huffpress::HuffpressFile(testData).SerializeToBuffer(syncRecord);
+    ttcheck(asyncRecord == syncRecord);
+
+    std::atomic<bool> called(false);
+    Huffpress::AsyncTask<std::string> restored = Huffpress::DecompressAsync(file, 1, executor);
+    restored.OnComplete([&called, &testData](Huffpress::AsyncTask<std::string>& done) { called = done.Get() == testData; });
+    restored.Wait();
+    while (!called) std::this_thread::yield(); // The callback runs right after the task becomes ready
+    ttcheck(called);
+
+    const std::string filePath = "testasync.hpf";
+    Huffpress::SerializeAsync(file, filePath, executor).Get();
+    ttcheck(Huffpress::HuffpressReader(filePath).Decompress() == testData);
+    ttcheck(std::remove(filePath.c_str()) == 0);
+
+    // A job cancelled while it waits in the queue never runs
+    Huffpress::AsyncExecutor single(1, 1, Huffpress::AsyncExecutor::Overflow::Throw);
+    std::mutex gate;
+    gate.lock();
+    single.Post([&gate]() { std::lock_guard<std::mutex> wait(gate); });
+    while (single.Pending() > 0) std::this_thread::yield();
+
+    Huffpress::AsyncTask<std::string> cancelled = Huffpress::DecompressAsync(file, 1, single);
+    cancelled.Cancel();
+    bool full = false;
+    try {
+        single.Post([]() {});
+    } catch (const Huffpress::Exceptions::QueueFullException&) {
+        full = true;
+    }
+    ttcheck(full);
+    ttcheck(!single.TryPost([]() {}));
+    gate.unlock();
+
+    bool thrown = false;
+    try {
+        cancelled.Get();
+    } catch (const Huffpress::Exceptions::CancelledException&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+
+    tinytestdone();
+}
+
+// Test 16 (15): Pipelined compression straight from a file on disk
+ttret_t test_file_pipeline(void) {
+    std::string testData;
+    for (int i = 0; i < 200000; ++i) testData += static_cast<char>('a' + (i * i) % 23 + (i % 7 == 0) * 40);
+    const std::string sourcePath = "testpipeline.txt", targetPath = "testpipeline.hpf", expectedPath = "testexpected.hpf";
+    std::ofstream(sourcePath, std::ios::binary) << testData;
+
+    Huffpress::HuffpressFile expected(testData);
+    expected.Serialize(expectedPath);
+    auto readAll = [](const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+
+    // Blocks that end in the middle of a byte are stitched into the single-threaded stream
+    for (size_t blockSize : { size_t(1) << 20, size_t(4097), size_t(1000) }) {
+        Huffpress::HuffpressFile loaded;
+        ttcheck(loaded.Load(sourcePath, 3, blockSize) == testData.size());
+        ttcheck(loaded.byteVec == expected.byteVec);
+        ttcheck(loaded.header.freqMap == expected.header.freqMap && loaded.header.bitLength == expected.header.bitLength);
+        ttcheck(loaded.header.compressedChecksum == expected.header.compressedChecksum && loaded.Verify().Ok());
+
+        Huffpress::CompressFile(sourcePath, targetPath, 2, blockSize);
+        ttcheck(readAll(targetPath) == readAll(expectedPath));
+    }
+
+    std::ofstream(sourcePath, std::ios::binary) << std::string(5000, 'q');
+    Huffpress::CompressFile(sourcePath, targetPath, 2, 100);
+    ttcheck(Huffpress::HuffpressReader(targetPath).Decompress() == std::string(5000, 'q'));
+
+    ttcheck(std::remove(sourcePath.c_str()) == 0);
+    ttcheck(std::remove(targetPath.c_str()) == 0);
+    ttcheck(std::remove(expectedPath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Test 17 (16): Block streams of unknown length, in parallel and in order
+ttret_t test_stream(void) {
+    std::string testData;
+    for (int i = 0; i < 100000; ++i) testData += static_cast<char>('0' + (i * 31) % 17 + (i % 11 == 0) * 20);
+
+    for (unsigned threads = 1; threads <= 3; threads += 2) {
+        std::istringstream in(testData);
+        std::stringstream compressed;
+        Huffpress::StreamStats stats = Huffpress::CompressStream(in, compressed, threads, 7000);
+        ttcheck(stats.blocks == (testData.size() + 6999) / 7000 && stats.sourceBytes == testData.size());
+        ttcheck(stats.compressedBytes < testData.size());
+
+        std::ostringstream restored;
+        Huffpress::DecompressStream(compressed, restored, threads);
+        ttcheck(restored.str() == testData);
+    }
+
+    std::istringstream empty("");
+    std::stringstream compressedEmpty;
+    ttcheck(Huffpress::CompressStream(empty, compressedEmpty, 2).blocks == 0);
+    std::ostringstream restoredEmpty;
+    Huffpress::DecompressStream(compressedEmpty, restoredEmpty, 2);
+    ttcheck(restoredEmpty.str().empty());
+
+    // A single Huffpress file decompresses like a stream of one block
+    Huffman::ByteVector single;
+    Huffpress::HuffpressFile(testData).SerializeToBuffer(single);
+    std::istringstream singleIn(std::string(single.begin(), single.end()));
+    std::ostringstream singleOut;
+    Huffpress::DecompressStream(singleIn, singleOut);
+    ttcheck(singleOut.str() == testData);
+
+    // Damaged and truncated streams are rejected
+    std::istringstream in(testData);
+    std::stringstream compressed;
+    Huffpress::CompressStream(in, compressed, 2, 20000);
+    std::string stream = compressed.str();
+    std::string damaged = stream;
+    damaged[damaged.size() / 2] ^= 0x5a;
+    bool damagedThrown = false, truncatedThrown = false;
+    try {
+        std::istringstream damagedIn(damaged);
+        std::ostringstream out;
+        Huffpress::DecompressStream(damagedIn, out, 2);
+    } catch (const Huffpress::Exceptions::HuffpressException&) {
+        damagedThrown = true;
+    }
+    try {
+        std::istringstream truncatedIn(stream.substr(0, stream.size() - 8));
+        std::ostringstream out;
+        Huffpress::DecompressStream(truncatedIn, out, 2);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        truncatedThrown = true;
+    }
+    ttcheck(damagedThrown && truncatedThrown);
+
+    tinytestdone();
+}
+
+// Test 18 (17): Many files on a worker pool, largest first
+ttret_t test_file_pool(void) {
+    std::vector<std::string> sources, targets, restored, contents;
+    for (int i = 0; i < 5; ++i) {
+        std::string data;
+        for (int j = 0; j < 20000 * i; ++j) data += static_cast<char>('a' + (i + j * j) % 19);
+        contents.push_back(data);
+        sources.push_back("testpool" + std::to_string(i) + ".txt");
+        targets.push_back(sources.back() + ".hpf");
+        restored.push_back(sources.back() + ".out");
+        std::ofstream(sources.back(), std::ios::binary) << data;
+    }
+    sources.push_back("testpool-missing.txt");
+    targets.push_back("testpool-missing.txt.hpf");
+    restored.push_back("testpool-missing.txt.out");
+
+    std::vector<Huffpress::FileResult> compressed = Huffpress::CompressFiles(sources, targets, 3);
+    std::vector<Huffpress::FileResult> decompressed = Huffpress::DecompressFiles(targets, restored, 3);
+    ttcheck(compressed.size() == sources.size() && decompressed.size() == sources.size());
+    ttcheck(!compressed.back().Ok() && !decompressed.back().Ok());
+
+    bool same = true;
+    for (size_t i = 0; i < contents.size(); ++i) {
+        std::ifstream in(restored[i], std::ios::binary);
+        same = same && compressed[i].Ok() && decompressed[i].Ok() && compressed[i].sourceBytes == contents[i].size()
+            && decompressed[i].sourceBytes == contents[i].size() && decompressed[i].compressedBytes == compressed[i].compressedBytes
+            && std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()) == contents[i];
+        in.close();
+        std::remove(sources[i].c_str());
+        std::remove(targets[i].c_str());
+        std::remove(restored[i].c_str());
+    }
+    ttcheck(same);
+
+    tinytestdone();
+}
+
+// Test 19 (18): Multi-entry archives with a central directory
+ttret_t test_archive(void) {
+    const std::string archivePath = "testarchive.hpa";
+    std::vector<std::string> names, contents;
+    for (int i = 0; i < 40; ++i) {
+        names.push_back("logs/" + std::to_string(i) + ".txt");
+        std::string data;
+        for (int j = 0; j < 100 * i; ++j) data += "level=info msg=ok "[(i + j * 5) % 18];
+        contents.push_back(data);
+    }
+
+    {
+        Huffpress::ArchiveWriter writer(archivePath);
+        for (int i = 0; i < 30; ++i) writer.Add(names[i], contents[i]);
+        bool duplicate = false;
+        try {
+            writer.Add(names[0], "again");
+        } catch (const std::invalid_argument&) {
+            duplicate = true;
+        }
+        ttcheck(duplicate);
+    }
+    {
+        // Appended entries keep the earlier ones readable
+        Huffpress::ArchiveWriter writer(archivePath, true);
+        for (int i = 30; i < 40; ++i) writer.Add(names[i], contents[i]);
+        writer.Finish();
+    }
+    {
+        // Entries from disk record the size of the file they were read from
+        const std::string sourcePath = "testarchive.txt";
+        std::ofstream(sourcePath, std::ios::binary) << contents[39];
+        Huffpress::ArchiveWriter writer(archivePath, true);
+        writer.AddFile("logs/disk.txt", sourcePath, 2);
+        writer.Finish();
+        std::remove(sourcePath.c_str());
+    }
+
+    Huffpress::ArchiveReader reader(archivePath);
+    ttcheck(reader.Entries().size() == names.size() + 1);
+    ttcheck(reader.Find("logs/disk.txt")->size == contents[39].size() && reader.Extract("logs/disk.txt") == contents[39]);
+    ttcheck(reader.Find("logs/7.txt") && reader.Find("logs/7.txt")->size == contents[7].size());
+    ttcheck(!reader.Find("missing"));
+    ttcheck(reader.Extract("logs/33.txt") == contents[33] && reader.Extract("logs/0.txt").empty());
+    std::vector<std::string> all = contents;
+    all.push_back(contents[39]);
+    ttcheck(reader.ExtractAll(3) == all);
+
+    bool missing = false;
+    try {
+        reader.Extract("missing");
+    } catch (const Huffpress::Exceptions::EntryNotFoundException&) {
+        missing = true;
+    }
+    ttcheck(missing);
+
+    // Damage inside an entry is caught when it is extracted, damage to the directory when the archive is opened
+    std::fstream file(archivePath, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(static_cast<std::streamoff>(reader.Find("logs/20.txt")->offset + reader.Find("logs/20.txt")->compressedSize - 1));
+    file.put('\x7f');
+    file.seekg(-40, std::ios::end);
+    char byte = static_cast<char>(file.peek());
+    file.seekp(-40, std::ios::end);
+    file.put(static_cast<char>(byte ^ 1));
+    file.close();
+
+    bool damaged = false, directoryDamaged = false;
+    try {
+        reader.Extract("logs/20.txt");
+    } catch (const Huffpress::Exceptions::ChecksumMismatchException&) {
+        damaged = true;
+    }
+    try {
+        Huffpress::ArchiveReader damagedReader(archivePath);
+    } catch (const Huffpress::Exceptions::ChecksumMismatchException&) {
+        directoryDamaged = true;
+    }
+    ttcheck(damaged && directoryDamaged);
+
+    ttcheck(std::remove(archivePath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Test 20 (19): Appending blocks to a block stream in place
+// Input that serves its data, then fails like a broken device
+struct FailingInput : std::streambuf {
+    std::string data;
+    bool served = false;
+
+    explicit FailingInput(std::string data) : data(std::move(data)) {}
+
+    int_type underflow() override {
+        if (served) throw std::runtime_error("device error");
+        served = true;
+        setg(&data[0], &data[0], &data[0] + data.size());
+        return traits_type::to_int_type(data[0]);
+    }
+};
+
+ttret_t test_append_stream(void) {
+    const std::string streamPath = "testappend.hps";
+    std::remove(streamPath.c_str());
+
+    std::string expected;
+    size_t previousSize = 0;
+    for (int i = 0; i < 4; ++i) {
+        std::string delta;
+        for (int j = 0; j < 3000 + 1000 * i; ++j) delta += "GET /index.html 200\n"[(i + j) % 20];
+        std::istringstream in(delta);
+        Huffpress::StreamStats stats = Huffpress::AppendStream(streamPath, in, 2, 2048);
+        ttcheck(stats.sourceBytes == delta.size() && stats.blocks == (delta.size() + 2047) / 2048);
+        expected += delta;
+
+        // The file grows by the new blocks only
+        std::ifstream file(streamPath, std::ios::binary | std::ios::ate);
+        size_t size = static_cast<size_t>(file.tellg());
+        ttcheck(i == 0 || size == previousSize + stats.compressedBytes + 8 * stats.blocks);
+        previousSize = size;
+    }
+
+    // A failed append leaves the stream as it was, and it takes more blocks afterwards
+    FailingInput failing(std::string(100 << 10, 'x'));
+    std::istream broken(&failing);
+    bool thrown = false;
+    try {
+        Huffpress::AppendStream(streamPath, broken, 2, 2048);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+    {
+        std::ifstream file(streamPath, std::ios::binary | std::ios::ate);
+        ttcheck(static_cast<size_t>(file.tellg()) == previousSize);
+        file.seekg(0);
+        std::ostringstream restored;
+        Huffpress::DecompressStream(file, restored, 2);
+        ttcheck(restored.str() == expected);
+    }
+    std::istringstream more("GET /more.html 200\n");
+    Huffpress::AppendStream(streamPath, more, 2, 2048);
+    expected += "GET /more.html 200\n";
+    previousSize = static_cast<size_t>(std::ifstream(streamPath, std::ios::binary | std::ios::ate).tellg());
+
+    std::ifstream in(streamPath, std::ios::binary);
+    std::ostringstream out;
+    Huffpress::DecompressStream(in, out, 2);
+    ttcheck(out.str() == expected);
+    in.close();
+
+    // Something that is not a block stream is left alone
+    const std::string plainPath = "testappend.hpf";
+    Huffpress::HuffpressFile("plain file").Serialize(plainPath);
+    thrown = false;
+    try {
+        std::istringstream delta("more");
+        Huffpress::AppendStream(plainPath, delta);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+
+    // Nor is a block stream of another major version
+    {
+        std::fstream stream(streamPath, std::ios::binary | std::ios::in | std::ios::out);
+        stream.seekp(3);
+        stream.put(static_cast<char>(Huffpress::Version[0] + 3));
+    }
+    thrown = false;
+    try {
+        std::istringstream delta("more");
+        Huffpress::AppendStream(streamPath, delta);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+    std::ifstream appended(streamPath, std::ios::binary | std::ios::ate);
+    ttcheck(static_cast<size_t>(appended.tellg()) == previousSize);
+    appended.close();
+
+    ttcheck(std::remove(streamPath.c_str()) == 0);
+    ttcheck(std::remove(plainPath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Test 21 (20): In-place writes to a block file, rewriting only the dirty blocks
+ttret_t test_block_file(void) {
+    const std::string filePath = "testblocks.hpb";
+    std::string model;
+    for (int i = 0; i < 100000; ++i) model += "0123456789abcdef"[(i * 7 + i / 100) % 16];
+    Huffpress::BlockFile::Create(filePath, model, 4096, 3);
+
+    std::uint64_t createdSize = 0;
+    {
+        Huffpress::BlockFile file(filePath);
+        ttcheck(file.Size() == model.size() && file.BlockCount() == 25 && file.FreeBytes() == 0);
+        ttcheck(file.Read(5000, 300) == model.substr(5000, 300));
+        ttcheck(file.Read(99990, 100) == model.substr(99990));
+
+        // A write across a block boundary dirties just the two blocks
+        file.Write(8190, "ZZZZ");
+        model.replace(8190, 4, "ZZZZ");
+        ttcheck(file.DirtyBlocks() == 2 && file.Read(8180, 20) == model.substr(8180, 20));
+        file.Flush();
+        ttcheck(file.DirtyBlocks() == 0);
+
+        // Repeated rewrites of one block keep reusing the space it frees
+        std::ifstream before(filePath, std::ios::binary | std::ios::ate);
+        createdSize = static_cast<std::uint64_t>(before.tellg());
+        for (int round = 0; round < 20; ++round) {
+            std::string patch(50, static_cast<char>('A' + round));
+            file.Write(40000 + round, patch);
+            model.replace(40000 + round, 50, patch);
+            file.Flush();
+        }
+        std::ifstream after(filePath, std::ios::binary | std::ios::ate);
+        ttcheck(static_cast<std::uint64_t>(after.tellg()) < createdSize + 3 * 4096);
+
+        // Writing past the end grows the last block and adds new ones
+        std::string tail(5000, 'T');
+        file.Write(file.Size() - 10, tail);
+        model.replace(model.size() - 10, 10, tail);
+        ttcheck(file.Size() == model.size());
+        bool thrown = false;
+        try {
+            file.Write(file.Size() + 1, "x");
+        } catch (const std::out_of_range&) {
+            thrown = true;
+        }
+        ttcheck(thrown);
+    }
+
+    {
+        Huffpress::BlockFile reopened(filePath);
+        ttcheck(reopened.Size() == model.size() && reopened.Read(0, model.size()) == model);
+        reopened.Compact();
+        ttcheck(reopened.FreeBytes() == 0 && reopened.Read(0, model.size()) == model);
+    }
+
+    ttcheck(std::remove(filePath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Test 22 (21): Decoded blocks are served from a shared cache until they change
+ttret_t test_block_cache(void) {
+    Huffpress::BlockCache small(1000, 2);
+    ttcheck(small.Find(1, 0, 7) == nullptr);
+    small.Insert(1, 0, 7, std::string(300, 'a'));
+    ttcheck(small.Find(1, 0, 7) && *small.Find(1, 0, 7) == std::string(300, 'a'));
+    ttcheck(small.Find(1, 0, 8) == nullptr && small.Find(2, 0, 7) == nullptr);
+    // Blocks larger than a shard are returned but not kept, full shards evict their oldest blocks
+    ttcheck(small.Insert(1, 1, 7, std::string(600, 'b'))->size() == 600 && small.Stats().entries == 1);
+    for (std::uint64_t block = 2; block < 20; ++block) small.Insert(1, block, 7, std::string(200, 'c'));
+    Huffpress::BlockCacheStats stats = small.Stats();
+    ttcheck(stats.bytes <= 1000 && stats.evictions > 0 && stats.hits == 2 && stats.misses == 3);
+
+    const std::string filePath = "testcache.hpb";
+    std::string model;
+    for (int i = 0; i < 40000; ++i) model += "abcdefgh"[(i * 5 + i / 64) % 8];
+    Huffpress::BlockFile::Create(filePath, model, 4096);
+
+    Huffpress::BlockCache cache;
+    {
+        Huffpress::BlockFile file(filePath, &cache);
+        ttcheck(file.Read(100, 5000) == model.substr(100, 5000) && cache.Stats().misses == 2);
+        ttcheck(file.Read(200, 4000) == model.substr(200, 4000) && cache.Stats().hits == 2);
+
+        // Flushed blocks replace their old versions in the cache
+        file.Write(4000, "XYZ");
+        model.replace(4000, 3, "XYZ");
+        file.Flush();
+        Huffpress::BlockCacheStats before = cache.Stats();
+        ttcheck(file.Read(3990, 20) == model.substr(3990, 20) && cache.Stats().hits == before.hits + 1);
+    }
+
+    // Another reader of the same file shares the cached blocks, from any number of threads
+    {
+        Huffpress::BlockFile other(filePath, &cache);
+        std::atomic<bool> same(true);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&cache, &filePath, &model, &same, t]() {
+                Huffpress::BlockFile file(filePath, &cache);
+                for (int i = 0; i < 20; ++i) {
+                    size_t offset = static_cast<size_t>((t * 7919 + i * 1543) % 39000);
+                    if (file.Read(offset, 1000) != model.substr(offset, 1000)) same = false;
+                }
+            });
+        }
+        for (std::thread& reader : readers) reader.join();
+        ttcheck(same && other.Read(0, model.size()) == model);
+    }
+    ttcheck(std::remove(filePath.c_str()) == 0);
+
+    const std::string archivePath = "testcache.hpa";
+    {
+        Huffpress::ArchiveWriter writer(archivePath);
+        writer.Add("one", model.substr(0, 10000));
+        writer.Add("two", model.substr(10000));
+    }
+    {
+        cache.Clear();
+        Huffpress::ArchiveReader reader(archivePath, &cache);
+        ttcheck(reader.Extract("two") == model.substr(10000));
+        Huffpress::BlockCacheStats before = cache.Stats();
+        std::vector<std::string> all = reader.ExtractAll(2);
+        ttcheck(all.size() == 2 && all[0] == model.substr(0, 10000) && all[1] == model.substr(10000));
+        ttcheck(cache.Stats().hits == before.hits + 1 && cache.Stats().entries == 2);
+    }
+    ttcheck(std::remove(archivePath.c_str()) == 0);
+    tinytestdone();
+}
+
+// Fixed distributions for the static codec: comma-separated digits, and explicit code lengths with long codes
+struct TelemetryTable {
+    struct Counts {
+        constexpr std::uint32_t operator[](unsigned symbol) const {
+            return symbol >= '0' && symbol <= '9' ? 40 + 3 * (symbol - '0') : symbol == ',' ? 90 : symbol == '\n' ? 12 : 0;
+        }
+    };
+    static constexpr Counts Frequencies{};
+};
+
+struct SkewedTable {
+    struct Lengths_ {
+        // 'a' gets 1 bit, 'b' 2 bits and so on up to 14 bits, the last two symbols share the longest length
+        constexpr unsigned operator[](unsigned symbol) const {
+            return symbol >= 'a' && symbol <= 'n' ? symbol - 'a' + 1 : symbol == 'o' ? 14 : 0;
+        }
+    };
+    static constexpr Lengths_ Lengths{};
+};
+
+// Test 23 (22): Static codecs with tables computed at compile time round-trip their data
+ttret_t test_static_codec(void) {
+    using Telemetry = Huffman::StaticCodec<TelemetryTable>;
+    static_assert(Telemetry::Code(',').length > 0 && !Telemetry::Knows('x'), "tables are computed at compile time");
+    static_assert(Telemetry::MaxLength <= Telemetry::TableBits, "every telemetry code decodes with a single lookup");
+
+    std::string telemetry;
+    for (int i = 0; i < 5000; ++i) telemetry += std::to_string(i * 7919 % 100003) + (i % 10 == 9 ? "\n" : ",");
+    size_t bitLength = 0;
+    Huffman::ByteVector encoded = Telemetry::Encode(telemetry, bitLength);
+    ttcheck(bitLength > 0 && encoded.size() == (bitLength + 7) / 8 && encoded.size() < telemetry.size() / 2);
+    ttcheck(Telemetry::Decode(encoded, bitLength) == telemetry);
+    // A code cut off by the end of the stream ends decoding
+    ttcheck(Telemetry::Decode(encoded, bitLength - 1).size() == telemetry.size() - 1);
+
+    bool thrown = false;
+    try {
+        Telemetry::Encode(std::string("12x"), bitLength);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    ttcheck(thrown);
+
+    // Codes longer than the lookup table go through the canonical fallback
+    using Skewed = Huffman::StaticCodec<SkewedTable, 4>;
+    static_assert(Skewed::MaxLength == 14 && Skewed::TableBits == 4 && Skewed::Code('a').length == 1, "lengths are taken as given");
+    std::string skewed;
+    for (int i = 0; i < 20000; ++i) skewed += static_cast<char>('a' + (i * 31 % 97 % 15));
+    encoded = Skewed::Encode(skewed, bitLength);
+    ttcheck(Skewed::Decode(encoded, bitLength) == skewed);
+    tinytestdone();
+}
+
+// Test 24 (23): Bit writer and reader agree on codes of every length at any bit offset
+ttret_t test_bit_io(void) {
+    std::vector<std::pair<std::uint64_t, unsigned>> codes;
+    std::uint64_t state = 12345;
+    size_t totalBits = 0;
+    for (int i = 0; i < 5000; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned length = static_cast<unsigned>(state >> 58) + 1;
+        std::uint64_t bits = length == 64 ? state : state & ((std::uint64_t(1) << length) - 1);
+        codes.push_back(std::make_pair(bits, length));
+        totalBits += length;
+    }
+
+    for (unsigned leading = 0; leading < 8; leading += 3) {
+        Huffman::ByteVector buffer((leading + totalBits + 7) / 8);
+        Huffman::BitWriter writer(buffer.data(), leading);
+        for (const auto& code : codes) writer.Put(code.first, code.second);
+        writer.Flush();
+        ttcheck(writer.Position() == buffer.data() + buffer.size());
+
+        Huffman::BitReader reader(buffer.data(), buffer.size(), leading + totalBits, leading);
+        bool same = true;
+        for (const auto& code : codes) {
+            std::uint64_t bits = 0;
+            for (unsigned left = code.second; left > 0;) {
+                reader.Refill();
+                unsigned take = std::min(left, 32u);
+                bits = (bits << take) | (reader.Peek() >> (64 - take));
+                reader.Skip(take);
+                left -= take;
+            }
+            same = same && bits == code.first;
+        }
+        ttcheck(same && reader.Done() && reader.Position() == leading + totalBits);
+    }
+
+    std::string bitString;
+    for (int i = 0; i < 1003; ++i) bitString += (i * i % 7 < 3) ? '1' : '0';
+    size_t bitLength = 0;
+    Huffman::ByteVector packed = Huffman::Methods::PackBitsToBytes(bitString, bitLength);
+    ttcheck(bitLength == 1003 && packed.size() == 126);
+    ttcheck(Huffman::Methods::UnpackBytesToBits(packed, bitLength) == bitString);
+    tinytestdone();
+}
+
+#ifndef _WIN32
+// Test 25 (24): Daemon answers compress, decompress and verify requests from concurrent clients
+ttret_t test_daemon(void) {
+    const std::string socketPath = "testdaemon.sock";
+    std::string data;
+    for (int i = 0; i < 20000; ++i) data += static_cast<char>('a' + (i * 7919LL) % 23);
+
+    Huffpress::DaemonOptions options;
+    options.threads = 4;
+    std::unique_ptr<Huffpress::DaemonServer> server(new Huffpress::DaemonServer(socketPath, options));
+    std::thread serving([&server]() { server->Serve(); });
+
+    {
+        Huffpress::DaemonClient client(socketPath);
+        client.Ping();
+
+        Huffman::ByteVector record = client.Compress(data);
+        Huffpress::HuffpressFile local(data);
+        Huffman::ByteVector expected;
+        local.SerializeToBuffer(expected);
+        ttcheck(record == expected);
+
+        ttcheck(client.Decompress(record) == data);
+        ttcheck(client.Decompress(record) == data);
+        ttcheck(client.Verify(record).Ok());
+        Huffpress::VerifyResult header = client.Verify(record, false);
+        ttcheck(header.Ok() && !header.sourceChecked);
+
+        // A corrupted payload fails verification and decompression, and the connection keeps working
+        Huffman::ByteVector corrupted = record;
+        corrupted.back() ^= 0x5a;
+        ttcheck(!client.Verify(corrupted).Ok());
+        bool threw = false;
+        try {
+            client.Decompress(corrupted);
+        } catch (const Huffpress::Exceptions::DaemonException&) {
+            threw = true;
+        }
+        ttcheck(threw);
+        client.Ping();
+    }
+
+    std::atomic<int> good(0);
+    std::vector<std::thread> clients;
+    for (int t = 0; t < 6; ++t) {
+        clients.emplace_back([&socketPath, &good, t]() {
+            Huffpress::DaemonClient client(socketPath);
+            std::string part(static_cast<size_t>(1000 + t * 500), static_cast<char>('k' + t));
+            part += "mixed in " + std::to_string(t);
+            for (int round = 0; round < 5; ++round) {
+                if (client.Decompress(client.Compress(part)) == part) good++;
+            }
+        });
+    }
+    for (std::thread& client : clients) client.join();
+    ttcheck(good == 30);
+
+    Huffpress::DaemonStats stats = server->Stats();
+    ttcheck(stats.connections == 7);
+    ttcheck(stats.errors == 1);
+    ttcheck(stats.tableHits >= 2 && stats.tableMisses >= 7);
+
+    // Stop with a client still connected: Serve closes it and returns
+    Huffpress::DaemonClient idle(socketPath);
+    idle.Ping();
+    server->Stop();
+    serving.join();
+    server.reset();
+    ttcheck(std::fopen(socketPath.c_str(), "r") == nullptr);
+    tinytestdone();
+}
+#endif
+
+// Test 26 (25): Sampled tables code every byte value and stay close to the exact ratio
+ttret_t test_sampled_table(void) {
+    std::string data;
+    for (long long i = 0; data.size() < (3u << 20); ++i) data += "word" + std::to_string(i * 7919LL % 1000) + (i % 9 ? " " : ". ");
+    // Bytes that no sampled run sees (runs are the first 4 KB of every 64 KB)
+    data[5000] = '\x01';
+    data[70000] = '\xff';
+    data[data.size() - 1] = '@';
+
+    Huffpress::HuffpressFile exact;
+    exact.Init(data);
+    Huffpress::HuffpressFile sampled;
+    sampled.Init(data, 1, Huffman::TableMode::Sampled);
+    ttcheck(sampled.header.freqMap.size() == 256);
+    ttcheck(sampled.Decompress() == data);
+    ttcheck(sampled.Verify().Ok());
+    ttcheck(sampled.byteVec.size() < exact.byteVec.size() * 1.02);
+    ttcheck(sampled.header.sourceChecksum == exact.header.sourceChecksum);
+
+    // Slices encoded in parallel are stitched into the same stream
+    Huffpress::HuffpressFile parallel;
+    parallel.Init(data, 4, Huffman::TableMode::Sampled);
+    ttcheck(parallel.byteVec == sampled.byteVec && parallel.header.bitLength == sampled.header.bitLength);
+    ttcheck(parallel.header.compressedChecksum == sampled.header.compressedChecksum);
+
+    Huffman::ByteVector record;
+    parallel.SerializeToBuffer(record);
+    Huffpress::HuffpressFile parsed;
+    parsed.ParseFromBuffer(record);
+    ttcheck(parsed.Decompress(4) == data);
+
+    // Small inputs are counted exactly
+    Huffpress::HuffpressFile small;
+    small.Init("sampling needs large inputs", 1, Huffman::TableMode::Sampled);
+    ttcheck(small.header.freqMap == Huffpress::HuffpressFile("sampling needs large inputs").header.freqMap);
+    tinytestdone();
+}
+
+// Test 27 (26): Size estimates match the records compression produces
+ttret_t test_size_estimate(void) {
+    const std::string inputs[] = {"", "aaaa", "Hello, World!", std::string(5000, 'x') + "yz", std::string(300, '\0') + "binary\xff\x80"};
+    for (const std::string& input : inputs) {
+        Huffpress::HuffpressFile file(input);
+        Huffman::ByteVector record;
+        file.SerializeToBuffer(record);
+        Huffpress::SizeEstimate estimate = Huffpress::EstimateCompressedSize(input);
+        ttcheck(!estimate.sampled && estimate.sourceSize == input.size());
+        ttcheck(estimate.bitLength == file.header.bitLength && estimate.payloadSize == file.byteVec.size());
+        ttcheck(estimate.RecordSize() == record.size());
+    }
+
+    std::string data;
+    for (long long i = 0; data.size() < (2u << 20); ++i) data += "entry " + std::to_string(i * 7919LL % 977) + ";";
+    Huffpress::HuffpressFile file(data);
+    Huffman::ByteVector record;
+    file.SerializeToBuffer(record);
+    ttcheck(Huffpress::EstimateCompressedSize(data).RecordSize() == record.size());
+
+    Huffpress::SizeEstimate sampled = Huffpress::EstimateCompressedSize(data, true);
+    ttcheck(sampled.sampled);
+    ttcheck(sampled.Ratio() > 0 && std::abs(static_cast<double>(sampled.RecordSize()) / record.size() - 1) < 0.02);
+
+    // Random bytes are not worth compressing
+    std::string noise(1 << 16, '\0');
+    std::uint64_t state = 7;
+    for (char& c : noise) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        c = static_cast<char>(state >> 56);
+    }
+    ttcheck(Huffpress::EstimateCompressedSize(noise).Ratio() > 1);
+    tinytestdone();
+}
+
+// Test 28 (27): Adaptive streams decode frame by frame as they are written, and in one go
+ttret_t test_adaptive_stream(void) {
+    // Enough lines for the table to be rebuilt many times, with the mix changing halfway
+    std::string data;
+    for (int i = 0; i < 20000; ++i) {
+        data += i < 10000 ? "level=info request=" + std::to_string(i * 7919 % 1000) + "\n" : "ERROR 0x" + std::to_string(i) + " ####\n";
+    }
+
+    // Every flushed frame can be decoded before the writer goes on
+    std::stringstream stream;
+    Huffpress::AdaptiveStreamWriter writer(stream, 4096);
+    writer.Write(data.data(), 100);
+    writer.Flush();
+    Huffpress::AdaptiveStreamReader reader(stream);
+    std::string restored;
+    ttcheck(reader.Read(restored) && restored == data.substr(0, 100));
+
+    writer.Write(data.data() + 100, data.size() - 100);
+    writer.Close();
+    while (reader.Read(restored)) {}
+    ttcheck(restored == data);
+    // The table follows the change of mix, which one table for all the data cannot
+    ttcheck(writer.Stats().blocks > 2 && writer.Stats().compressedBytes < Huffpress::HuffpressFile(data).byteVec.size());
+    ttcheck(reader.Stats().sourceBytes == data.size());
+
+    // DecompressStream recognizes adaptive streams, also those written a line at a time
+    std::istringstream lines(data);
+    std::stringstream lineStream;
+    ttcheck(Huffpress::CompressAdaptive(lines, lineStream, true).blocks == 20000);
+    std::ostringstream output;
+    ttcheck(Huffpress::DecompressStream(lineStream, output).sourceBytes == data.size());
+    ttcheck(output.str() == data);
+
+    // An empty stream has no frames, a damaged one fails its checksum or is cut short
+    std::istringstream none;
+    std::stringstream empty;
+    ttcheck(Huffpress::CompressAdaptive(none, empty).blocks == 0);
+    std::ostringstream nothing;
+    ttcheck(Huffpress::DecompressStream(empty, nothing).sourceBytes == 0 && nothing.str().empty());
+
+    std::string damaged = stream.str();
+    damaged[damaged.size() / 2] ^= 0x10;
+    std::istringstream damagedIn(damaged);
+    std::ostringstream damagedOut;
+    bool rejected = false;
+    try {
+        Huffpress::DecompressStream(damagedIn, damagedOut);
+    } catch (const Huffpress::Exceptions::HuffpressException&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+    tinytestdone();
+}
+
+// Test 29 (28): Transforms invert exactly, alone and in files and streams, and help the data they are made for
+ttret_t test_transforms(void) {
+    using Huffpress::Transform;
+
+    // The BWT of banana sorts its rotations; the sentinel row is dropped and its position goes first
+    std::string bwt = "banana";
+    Huffpress::ApplyTransforms({Transform::Bwt}, bwt);
+    ttcheck(bwt == std::string("\x04\0\0\0annbaa", 10));
+    std::string mtf = "aaab";
+    Huffpress::ApplyTransforms({Transform::MoveToFront}, mtf);
+    ttcheck(mtf == std::string("a\0\0b", 4));
+    std::string delta = "\x01\x02\x03\x05";
+    Huffpress::ApplyTransforms({Transform::Delta8}, delta);
+    ttcheck(delta == "\x01\x01\x01\x02");
+
+    // Edge cases and more than one BWT block round-trip through every transform
+    std::string large;
+    unsigned seed = 1;
+    for (size_t i = 0; i < Huffpress::BwtBlockSize + 12345; ++i) {
+        seed = seed * 1103515245 + 12345;
+        large += i % 3 ? "the quick brown fox "[i % 20] : static_cast<char>(seed >> 16);
+    }
+    const std::string inputs[] = {"", "x", std::string(1000, 'z'), "abracadabra\xff\0\x80", "abcde", large};
+    const Huffpress::Pipeline pipelines[] = {
+        {Transform::Delta8}, {Transform::Delta16}, {Transform::Delta32}, {Transform::MoveToFront}, {Transform::Bwt},
+        {Transform::Bwt, Transform::MoveToFront}, {Transform::Delta16, Transform::Bwt, Transform::MoveToFront},
+    };
+    for (const std::string& input : inputs) {
+        for (const Huffpress::Pipeline& pipeline : pipelines) {
+            std::string data = input;
+            Huffpress::ApplyTransforms(pipeline, data, 4);
+
+            // Reverting the data as it arrives in pieces of any size gives the same result
+            std::string streamed;
+            Huffpress::TransformReverter reverter(pipeline, [&streamed](const char* chunk, size_t size) { streamed.append(chunk, size); });
+            for (size_t offset = 0, piece = 1; offset < data.size(); offset += piece, piece = piece * 7 % 70001 + 1) {
+                reverter.Write(data.data() + offset, std::min(piece, data.size() - offset));
+            }
+            reverter.Finish();
+            ttcheck(streamed == input);
+
+            Huffpress::RevertTransforms(pipeline, data, 4);
+            ttcheck(data == input);
+        }
+    }
+
+    // A BWT block whose primary row is out of range cannot come from ApplyTransforms
+    std::string bad = std::string("\x09\0\0\0", 4) + "abc";
+    bool rejected = false;
+    try {
+        Huffpress::RevertTransforms({Transform::Bwt}, bad);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+    rejected = false;
+    try {
+        Huffpress::TransformReverter reverter({Transform::Bwt}, [](const char*, size_t) {});
+        reverter.Write("\x01\0\0", 3);
+        reverter.Finish();
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    // Pipelines read back the way they are printed
+    Huffpress::Pipeline parsed = Huffpress::ParsePipeline("bwt,mtf");
+    ttcheck(parsed.size() == 2 && Huffpress::PipelineName(parsed) == "bwt,mtf");
+    ttcheck(Huffpress::ParsePipeline("none").empty() && Huffpress::PipelineName({}) == "none");
+    rejected = false;
+    try {
+        Huffpress::ParsePipeline("bwt,zip");
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    // Slowly rising 16-bit samples shrink with delta16, and the file keeps the checksum of the original data
+    std::string samples;
+    for (int i = 0; i < 50000; ++i) {
+        std::uint16_t sample = static_cast<std::uint16_t>(20000 + i * 3 + i % 7);
+        samples.push_back(static_cast<char>(sample & 0xff));
+        samples.push_back(static_cast<char>(sample >> 8));
+    }
+    Huffpress::HuffpressFile plain(samples), transformed;
+    transformed.Init(samples, {Transform::Delta16});
+    ttcheck(transformed.byteVec.size() < plain.byteVec.size() / 2);
+    ttcheck(transformed.header.sourceChecksum == plain.header.sourceChecksum);
+
+    Huffman::ByteVector buffer;
+    transformed.SerializeToBuffer(buffer);
+    Huffpress::HuffpressFile parsedFile;
+    parsedFile.ParseFromBuffer(buffer);
+    ttcheck(parsedFile.header.version[0] == 1 && parsedFile.header.transforms == Huffpress::Pipeline{Transform::Delta16});
+    ttcheck(parsedFile.Verify(true).Ok());
+    ttcheck(parsedFile.DecompressAndVerify() == samples && parsedFile.Decompress(4) == samples);
+
+    // Files without transforms keep the version they always had
+    Huffman::ByteVector plainBuffer;
+    plain.SerializeToBuffer(plainBuffer);
+    Huffpress::HuffpressFile plainParsed;
+    plainParsed.ParseFromBuffer(plainBuffer);
+    ttcheck(plainParsed.header.version[0] == Huffpress::HuffpressFile().header.version[0] && plainParsed.header.transforms.empty());
+
+    // Every block of a stream goes through the pipeline
+    std::istringstream in(large);
+    std::stringstream stream;
+    Huffpress::CompressStream(in, stream, 2, 256 << 10, {Transform::Bwt, Transform::MoveToFront});
+    std::ostringstream out;
+    ttcheck(Huffpress::DecompressStream(stream, out, 2).sourceBytes == large.size());
+    ttcheck(out.str() == large);
+    tinytestdone();
+}
+
+// Test 30 (29): LZ77 coding round-trips at every level, beats one table on repetitive data and rejects damage
+ttret_t test_lz77(void) {
+    std::string logs;
+    for (int i = 0; i < 20000; ++i) {
+        logs += "2026-10-19 12:00:" + std::to_string(i % 60) + " INFO request id=" + std::to_string(i * 7919 % 10007) + " path=/api/items/" + std::to_string(i % 37) + " status=200\n";
+    }
+
+    // Runs longer than the longest match, matches overlapping their own output, and data without any match
+    std::string random;
+    unsigned seed = 7;
+    for (int i = 0; i < 5000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        random += static_cast<char>(seed >> 16);
+    }
+    const std::string inputs[] = {"", "a", "abc", "abcd", std::string(20 << 20, 'z'), "abcabcabcabcabcabcabcabcabcabcx", random, random + random, logs};
+    for (const std::string& input : inputs) {
+        Huffpress::HuffpressFile file;
+        file.Init(input, Huffpress::LzLevel(Huffpress::DefaultLzLevel));
+        ttcheck(file.header.coding == Huffpress::Coding::Lz77 && file.Decompress() == input);
+        ttcheck(file.Verify(true).Ok());
+    }
+
+    // Every level decodes the same way; higher levels are at least as small on repetitive data
+    Huffpress::HuffpressFile plain(logs);
+    size_t fastest = 0, smallest = 0;
+    for (int level = Huffpress::MinLzLevel; level <= Huffpress::MaxLzLevel; ++level) {
+        Huffpress::HuffpressFile file;
+        file.Init(logs, Huffpress::LzLevel(level));
+        ttcheck(file.Decompress() == logs);
+        if (level == Huffpress::MinLzLevel) fastest = file.byteVec.size();
+        if (level == Huffpress::MaxLzLevel) smallest = file.byteVec.size();
+    }
+    ttcheck(smallest <= fastest && fastest < plain.byteVec.size() / 2);
+
+    bool rejected = false;
+    try {
+        Huffpress::LzLevel(Huffpress::MaxLzLevel + 1);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    // The header carries the coding and its tables, with transforms ahead of the coding
+    Huffpress::HuffpressFile file;
+    file.Init(logs, Huffpress::LzLevel(1), {Huffpress::Transform::Delta8});
+    Huffman::ByteVector buffer;
+    file.SerializeToBuffer(buffer);
+    Huffpress::HuffpressFile parsed;
+    parsed.ParseFromBuffer(buffer);
+    ttcheck(parsed.header.version[0] == 2 && parsed.header.coding == Huffpress::Coding::Lz77);
+    ttcheck(parsed.header.tables.size() == Huffpress::LzTableCount && parsed.header.transforms.size() == 1);
+    ttcheck(parsed.DecompressAndVerify() == logs && Huffpress::HuffpressReader(parsed).Decompress() == logs);
+
+    const std::string path = "lz77_test.hpf";
+    file.Serialize(path);
+    Huffpress::HuffpressFile fromDisk;
+    fromDisk.Parse(path);
+    ttcheck(fromDisk.Decompress() == logs && Huffpress::HuffpressFile::VerifyFile(path).Ok());
+    std::remove(path.c_str());
+
+    // A damaged payload fails verification instead of decoding to garbage
+    Huffpress::HuffpressFile damaged = parsed;
+    damaged.byteVec[damaged.byteVec.size() / 2] ^= 0x20;
+    ttcheck(!damaged.Verify(true).Ok());
+    rejected = false;
+    try {
+        damaged.DecompressAndVerify();
+    } catch (const Huffpress::Exceptions::HuffpressException&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    // A source size far beyond what the sequences produce is rejected without allocating it first
+    Huffman::ByteVector oversized = parsed.byteVec;
+    const Huffman::Byte size[8] = {0, 0, 0, 2, 0, 0, 0, 0};
+    std::copy(size, size + 8, oversized.begin());
+    rejected = false;
+    try {
+        Huffpress::LzDecompress(oversized.data(), oversized.size(), parsed.header.bitLength, Huffman::Decoder(parsed.header.freqMap), parsed.header.tables);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    // Decoding in chunks keeps only the window; matches beyond the usual window take a second pass, but decode the same
+    const std::string far = random + std::string(9 << 20, 'z') + random;
+    Huffpress::LzOptions wide = Huffpress::LzLevel(1);
+    wide.window = 16 << 20;
+    const std::string run(40 << 20, 'z');
+    for (const std::string* input : {&run, &far}) {
+        Huffpress::HuffpressFile chunked;
+        chunked.Init(*input, input == &far ? wide : Huffpress::LzLevel(Huffpress::DefaultLzLevel));
+        std::string decoded;
+        size_t largest = 0;
+        Huffpress::LzDecode(chunked.byteVec.data(), chunked.byteVec.size(), chunked.header.bitLength, Huffman::Decoder(chunked.header.freqMap),
+                            chunked.header.tables, [&decoded, &largest](const char* chunk, size_t size) {
+                                decoded.append(chunk, size);
+                                largest = std::max(largest, size);
+                            });
+        ttcheck(decoded == *input && chunked.Verify(true).Ok());
+        ttcheck(input == &far ? chunked.byteVec.size() < random.size() * 3 / 2 : largest < run.size() / 2);
+    }
+
+    // Streams code every block as LZ77 at the given level
+    std::istringstream in(logs);
+    std::stringstream stream;
+    Huffpress::StreamStats stats = Huffpress::CompressStream(in, stream, 2, 256 << 10, {}, 4);
+    ttcheck(stats.compressedBytes < plain.byteVec.size() / 2);
+    std::ostringstream out;
+    ttcheck(Huffpress::DecompressStream(stream, out, 2).sourceBytes == logs.size());
+    ttcheck(out.str() == logs);
+    tinytestdone();
+}
+
+// Test 31 (30): Per-context tables round-trip, beat one table on text, and keep the context map in the header
+ttret_t test_context_split(void) {
+    const char* words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "while", "queen", "quietly", "explains", "zebra", "xylophone", "rhythm"};
+    std::string text;
+    unsigned seed = 11;
+    for (int i = 0; i < 40000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        text += words[(seed >> 16) % 15];
+        text += (seed >> 8) % 11 == 0 ? ".\n" : " ";
+    }
+    std::string random;
+    for (int i = 0; i < 5000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        random += static_cast<char>(seed >> 16);
+    }
+
+    const std::string inputs[] = {"", "a", "ab", std::string(100000, 'z'), random, text};
+    for (const std::string& input : inputs) {
+        for (size_t maxTables : {size_t(1), size_t(4), Huffpress::MaxContextTables}) {
+            Huffpress::ContextOptions options;
+            options.maxTables = maxTables;
+            Huffpress::HuffpressFile file;
+            file.Init(input, options);
+            ttcheck(file.header.coding == Huffpress::Coding::ContextSplit && file.header.tables.size() < maxTables);
+            ttcheck(file.Decompress() == input && file.Verify(true).Ok());
+        }
+    }
+
+    // The previous byte tells a lot about text, so several tables beat one
+    Huffman::ByteVector plainRecord, splitRecord;
+    Huffpress::HuffpressFile(text).SerializeToBuffer(plainRecord);
+    Huffpress::HuffpressFile file;
+    file.Init(text, Huffpress::ContextOptions());
+    file.SerializeToBuffer(splitRecord);
+    ttcheck(file.header.tables.size() > 1 && splitRecord.size() < plainRecord.size() * 9 / 10);
+
+    Huffpress::HuffpressFile parsed;
+    parsed.ParseFromBuffer(splitRecord);
+    ttcheck(parsed.header.version[0] == 2 && parsed.header.coding == Huffpress::Coding::ContextSplit);
+    ttcheck(parsed.header.tables == file.header.tables && parsed.header.contextMap == file.header.contextMap);
+    ttcheck(parsed.DecompressAndVerify() == text && Huffpress::HuffpressReader(parsed).Decompress() == text);
+    std::string decoded;
+    Huffpress::ContextDecode(parsed.byteVec.data(), parsed.byteVec.size(), parsed.header.bitLength, Huffman::Decoder(parsed.header.freqMap),
+                             parsed.header.tables, parsed.header.contextMap, [&decoded](const char* chunk, size_t size) { decoded.append(chunk, size); });
+    ttcheck(decoded == text);
+
+    const std::string path = "context_test.hpf";
+    file.Init(text, Huffpress::ContextOptions(), {Huffpress::Transform::MoveToFront});
+    file.Serialize(path);
+    Huffpress::HuffpressFile fromDisk;
+    fromDisk.Parse(path);
+    ttcheck(fromDisk.Decompress() == text && Huffpress::HuffpressFile::VerifyFile(path).Ok());
+    std::remove(path.c_str());
+
+    // The map takes as many bits per context as the table count needs
+    ttcheck(Huffpress::ContextMapSize(1) == 0 && Huffpress::ContextMapSize(2) == 32 && Huffpress::ContextMapSize(5) == 96);
+    ttcheck(Huffpress::ContextMapSize(Huffpress::MaxContextTables) == Huffpress::MaxContextMapSize);
+    Huffpress::ContextMap map, unpacked;
+    for (int context = 0; context < 256; ++context) map[context] = static_cast<std::uint8_t>(context * 7 % 5);
+    Huffman::Byte packed[Huffpress::MaxContextMapSize];
+    Huffpress::PackContextMap(map, 5, packed);
+    ttcheck(Huffpress::UnpackContextMap(packed, 5, unpacked) && unpacked == map);
+    map.fill(3);
+    Huffpress::PackContextMap(map, 4, packed);
+    ttcheck(!Huffpress::UnpackContextMap(packed, 3, unpacked));
+
+    // A map pointing at a missing table and a damaged payload fail verification
+    Huffpress::HuffpressFile badMap = parsed;
+    badMap.header.contextMap['e'] = static_cast<std::uint8_t>(badMap.header.tables.size() + 1);
+    ttcheck(!badMap.Verify(false).Ok());
+    Huffpress::HuffpressFile damaged = parsed;
+    damaged.byteVec[damaged.byteVec.size() / 2] ^= 0x20;
+    ttcheck(!damaged.Verify(true).Ok());
+
+    // A source size beyond one byte per payload bit is rejected before anything is allocated for it
+    Huffman::ByteVector oversized = parsed.byteVec;
+    const Huffman::Byte size[8] = {0, 0, 0, 2, 0, 0, 0, 0};
+    std::copy(size, size + 8, oversized.begin());
+    bool rejected = false;
+    try {
+        Huffpress::ContextDecompress(oversized.data(), oversized.size(), parsed.header.bitLength, Huffman::Decoder(parsed.header.freqMap),
+                                     parsed.header.tables, parsed.header.contextMap);
+    } catch (const Huffpress::Exceptions::DeserializationException&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    rejected = false;
+    try {
+        Huffpress::ContextOptions options;
+        options.maxTables = Huffpress::MaxContextTables + 1;
+        file.Init(text, options);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+
+    // Streams pick the tables of every block on its own
+    std::istringstream in(text);
+    std::stringstream stream;
+    Huffpress::StreamStats stats = Huffpress::CompressStream(in, stream, 2, 64 << 10, {}, 0, 8);
+    ttcheck(stats.blocks > 1 && stats.compressedBytes < plainRecord.size());
+    std::ostringstream out;
+    ttcheck(Huffpress::DecompressStream(stream, out, 2).sourceBytes == text.size() && out.str() == text);
+
+    rejected = false;
+    try {
+        std::istringstream again(text);
+        std::ostringstream discard;
+        Huffpress::CompressStream(again, discard, 1, 64 << 10, {}, 1, 8);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    ttcheck(rejected);
+    tinytestdone();
+}
+
 // Array of test functions
 ttest_t tests[] = {
     { test_initialize_file, "Test initialization"                           },
     { test_modify_file, "Test modification"                                 },
     { test_serialize_and_deserialize, "Test serialization"                  },
     { test_buffered_serialize_and_deserialize, "Test buff. serialization"   },
-    { test_check_sums, "Test checksum validation"                           }
+    { test_check_sums, "Test checksum validation"                           },
+    { test_fused_checksums, "Test fused checksums"                          },
+    { test_raw_modify_checksum, "Test raw modify checksum"                  },
+    { test_block_checksums, "Test block checksums"                          },
+    { test_verify, "Test verification"                                      },
+    { test_parallel_compress, "Test parallel compression"                   },
+    { test_parallel_decompress, "Test parallel decompress"                  },
+    { test_arena_allocator, "Test arena allocator"                          },
+    { test_concurrent_reader, "Test concurrent reader"                      },
+    { test_batch, "Test batch"                                              },
+    { test_async, "Test async"                                              },
+    { test_file_pipeline, "Test file pipeline"                              },
+    { test_stream, "Test block streams"                                     },
+    { test_file_pool, "Test file pool"                                      },
+    { test_archive, "Test archive"                                          },
+    { test_append_stream, "Test append stream"                              },
+    { test_block_file, "Test block file"                                    },
+    { test_block_cache, "Test block cache"                                  },
+    { test_static_codec, "Test static codec"                                },
+    { test_bit_io, "Test bit I/O"                                           },
+#ifndef _WIN32
+    { test_daemon, "Test daemon"                                            },
+#endif
+    { test_sampled_table, "Test sampled table"                              },
+    { test_size_estimate, "Test size estimate"                              },
+    { test_adaptive_stream, "Test adaptive stream"                          },
+    { test_transforms, "Test transforms"                                    },
+    { test_lz77, "Test LZ77"                                                },
+    { test_context_split, "Test context split"                              },
 };
 
 // Main function to run the tests